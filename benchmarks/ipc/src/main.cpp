@@ -0,0 +1,757 @@
+// Microbenchmarks of the hel IPC primitives.
+// Local benchmarks drive both ends of a stream from a single thread; they measure the
+// kernel paths without any cross-CPU wakeups. Remote benchmarks run the server side on a
+// second thread (created by helCreateThread()) that the scheduler places on another CPU
+// if one is idle; hel does not allow user space to pin threads.
+// Latencies are reported as p50/p99/p999 in the format of benchmarks/system.
+// Finally, we count the heap allocations of a steady-state helix request/response loop.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <initializer_list>
+#include <new>
+#include <vector>
+
+#include <async/result.hpp>
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/ipc.hpp>
+#include <helix/pool.hpp>
+
+#include "common.hpp"
+
+// Counts all heap allocations of the program.
+size_t numHeapAllocations = 0;
+
+void *operator new(size_t size) {
+	__atomic_fetch_add(&numHeapAllocations, 1, __ATOMIC_RELAXED);
+	if(auto pointer = malloc(size))
+		return pointer;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void *pointer) noexcept {
+	free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+	free(pointer);
+}
+
+extern "C" void benchIpcWorkerEntry();
+extern "C" [[noreturn]] void benchIpcWorkerMain(void *worker);
+
+// Threads created by helCreateThread() start with the stack pointer that we pass in.
+asm (
+	".text\n"
+	".global benchIpcWorkerEntry\n"
+	"benchIpcWorkerEntry:\n"
+	"\tmov (%rsp), %rdi\n"
+	"\tcall benchIpcWorkerMain\n"
+	"\tud2\n"
+);
+
+namespace {
+
+// --------------------------------------------------------
+// Completion infrastructure
+// --------------------------------------------------------
+
+// A helSubmitAsync() (or similar) request whose results are parsed into helix operations.
+struct Submission final : helix::Context {
+	template<typename... Ops>
+	explicit Submission(Ops *...ops)
+	: _ops{ops...}, _count{sizeof...(Ops)} { }
+
+	uintptr_t context() {
+		return reinterpret_cast<uintptr_t>(static_cast<helix::Context *>(this));
+	}
+
+	void reset() {
+		done = false;
+		_element = helix::ElementHandle{};
+	}
+
+	void complete(helix::ElementHandle element) override {
+		_element = std::move(element);
+		auto ptr = _element.data();
+		for(size_t i = 0; i < _count; i++)
+			_ops[i]->parse(ptr);
+		done = true;
+	}
+
+	bool done = false;
+
+private:
+	helix::Operation *_ops[4];
+	size_t _count;
+	helix::ElementHandle _element;
+};
+
+struct SimpleResult : helix::Operation {
+	void parse(void *&ptr) override {
+		error = reinterpret_cast<HelSimpleResult *>(ptr)->error;
+		ptr = reinterpret_cast<char *>(ptr) + sizeof(HelSimpleResult);
+	}
+
+	HelError error;
+};
+
+// Minimal consumer of a hel queue. Unlike helix::Dispatcher, it never allocates
+// after construction. Hence, it can also be used by threads that are created by
+// helCreateThread() and that do not have a libc thread context.
+// Element payloads stay valid until the kernel reuses their chunk, i.e., at least
+// until another chunk worth of elements has been dispatched.
+struct RawQueue {
+	static constexpr int sizeShift = 1;
+	static constexpr int numChunks = 1 << sizeShift;
+	static constexpr size_t chunkSize = 4096;
+
+	RawQueue() {
+		_queue = reinterpret_cast<HelQueue *>(operator new(sizeof(HelQueue)
+				+ numChunks * sizeof(int)));
+		_queue->headFutex = 0;
+		HEL_CHECK(helCreateQueue2(_queue, 0, sizeShift, 128, chunkSize, &_handle));
+
+		for(int cn = 0; cn < numChunks; cn++) {
+			_chunks[cn] = reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk)
+					+ chunkSize));
+			HEL_CHECK(helSetupChunk(_handle, cn, _chunks[cn], 0));
+			_requeue(cn);
+		}
+	}
+
+	RawQueue(const RawQueue &) = delete;
+
+	// All submissions must be complete at this point.
+	~RawQueue() {
+		HEL_CHECK(helCloseDescriptor(_handle));
+		for(int cn = 0; cn < numChunks; cn++)
+			operator delete(_chunks[cn]);
+		operator delete(_queue);
+	}
+
+	RawQueue &operator= (const RawQueue &) = delete;
+
+	HelHandle handle() {
+		return _handle;
+	}
+
+	// Blocks until one element is available and completes its submission.
+	void dispatch() {
+		while(true) {
+			auto cn = _queue->indexQueue[_retrieveIndex & (numChunks - 1)];
+			auto chunk = _chunks[cn];
+			auto futex = __atomic_load_n(&chunk->progressFutex, __ATOMIC_ACQUIRE);
+			if(_progress != (futex & kHelProgressMask)) {
+				auto element = reinterpret_cast<HelElement *>(reinterpret_cast<char *>(chunk)
+						+ sizeof(HelChunk) + _progress);
+				_progress += sizeof(HelElement) + element->length;
+				auto context = reinterpret_cast<helix::Context *>(element->context);
+				context->complete(helix::ElementHandle{nullptr, -1, element + 1});
+				return;
+			}else if(futex & kHelProgressDone) {
+				_requeue(cn);
+				_progress = 0;
+				_retrieveIndex = (_retrieveIndex + 1) & kHelHeadMask;
+				continue;
+			}
+
+			if(!__atomic_compare_exchange_n(&chunk->progressFutex, &futex,
+					_progress | kHelProgressWaiters,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+				continue;
+			HEL_CHECK(helFutexWait(&chunk->progressFutex, _progress | kHelProgressWaiters));
+		}
+	}
+
+private:
+	void _requeue(int cn) {
+		_chunks[cn]->progressFutex = 0;
+		_queue->indexQueue[_nextIndex & (numChunks - 1)] = cn;
+		_nextIndex = (_nextIndex + 1) & kHelHeadMask;
+
+		auto futex = __atomic_exchange_n(&_queue->headFutex, _nextIndex, __ATOMIC_RELEASE);
+		if(futex & kHelHeadWaiters)
+			HEL_CHECK(helFutexWake(&_queue->headFutex));
+	}
+
+	HelHandle _handle;
+	HelQueue *_queue;
+	HelChunk *_chunks[numChunks];
+	int _retrieveIndex = 0;
+	int _nextIndex = 0;
+	int _progress = 0;
+};
+
+// Adapts helix::Dispatcher to the interface of RawQueue.
+struct HelixQueue {
+	HelHandle handle() {
+		return dispatcher.acquire();
+	}
+
+	void dispatch() {
+		dispatcher.wait();
+	}
+
+	helix::Dispatcher dispatcher;
+};
+
+template<typename Q>
+void submit(HelHandle lane, Q &queue, Submission &submission,
+		std::initializer_list<HelAction> actions) {
+	submission.reset();
+	HEL_CHECK(helSubmitAsync(lane, actions.begin(), actions.size(), queue.handle(),
+			submission.context(), 0));
+}
+
+template<typename Q>
+void waitFor(Q &queue, Submission &submission) {
+	while(!submission.done)
+		queue.dispatch();
+}
+
+// --------------------------------------------------------
+// Remote threads
+// --------------------------------------------------------
+
+// A thread that is created by helCreateThread(). It shares the address space but it
+// has no libc thread context; in particular, it must not allocate memory.
+struct Worker {
+	static constexpr size_t stackSize = 0x10000;
+
+	explicit Worker(void (*run)(Worker *))
+	: _run{run} {
+		_stack = operator new(stackSize);
+		auto sp = (reinterpret_cast<uintptr_t>(_stack) + stackSize) & ~uintptr_t(15);
+
+		// benchIpcWorkerEntry expects the argument on top of the stack.
+		sp -= 16;
+		reinterpret_cast<Worker **>(sp)[0] = this;
+		HEL_CHECK(helCreateThread(kHelNullHandle, kHelNullHandle, kHelAbiSystemV,
+				reinterpret_cast<void *>(&benchIpcWorkerEntry), reinterpret_cast<void *>(sp),
+				kHelThreadStopped, &_thread));
+	}
+
+	Worker(const Worker &) = delete;
+
+	~Worker() {
+		// Wait until the thread parks itself. Afterwards, it does not touch *this anymore.
+		while(true) {
+			auto parked = __atomic_load_n(&_parked, __ATOMIC_ACQUIRE);
+			if(parked)
+				break;
+			HEL_CHECK(helFutexWait(&_parked, 0));
+		}
+		HEL_CHECK(helKillThread(_thread));
+		HEL_CHECK(helCloseDescriptor(_thread));
+		// We do not know when the thread is actually gone; leak its stack.
+	}
+
+	Worker &operator= (const Worker &) = delete;
+
+	// Call this after the parameters below are set up.
+	void start() {
+		HEL_CHECK(helResume(_thread));
+	}
+
+	RawQueue queue;
+	HelHandle lane = kHelNullHandle;
+	int *futex = nullptr;
+	int iterations = 0;
+
+	[[noreturn]] static void main(Worker *self) {
+		self->_run(self);
+
+		__atomic_store_n(&self->_parked, 1, __ATOMIC_RELEASE);
+		HEL_CHECK(helFutexWake(&self->_parked));
+		int forever = 0;
+		while(true)
+			helFutexWait(&forever, 0);
+	}
+
+private:
+	void (*_run)(Worker *);
+	void *_stack;
+	HelHandle _thread;
+	int _parked = 0;
+};
+
+// --------------------------------------------------------
+// Statistics
+// --------------------------------------------------------
+
+void reportPercentiles(const char *name, std::vector<uint64_t> &samples) {
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&] (size_t permille) {
+		return double(samples[std::min(samples.size() * permille / 1000, samples.size() - 1)]);
+	};
+
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "%s-p50", name);
+	report(buffer, percentile(500), "ns");
+	snprintf(buffer, sizeof(buffer), "%s-p99", name);
+	report(buffer, percentile(990), "ns");
+	// For 100'000 samples, this is the 100th largest sample.
+	snprintf(buffer, sizeof(buffer), "%s-p999", name);
+	report(buffer, percentile(999), "ns");
+}
+
+constexpr int numSamples = 100'000;
+constexpr int numWarmup = 1'000;
+
+// Runs fn() numWarmup + numSamples times and reports the latency percentiles.
+template<typename F>
+void measure(const char *name, F fn) {
+	std::vector<uint64_t> samples;
+	samples.reserve(numSamples);
+	for(int i = 0; i < numWarmup + numSamples; i++) {
+		auto start = currentNanos();
+		fn();
+		auto elapsed = currentNanos() - start;
+		if(i >= numWarmup)
+			samples.push_back(elapsed);
+	}
+	reportPercentiles(name, samples);
+}
+
+// --------------------------------------------------------
+// Offer/accept/send/recv round trips
+// --------------------------------------------------------
+
+const char requestMessage[16] = "ping";
+const char replyMessage[16] = "pong";
+
+struct Client {
+	template<typename Q>
+	void submitTo(HelHandle lane, Q &queue) {
+		::submit(lane, queue, submission, {
+			helix::action(&offer, kHelItemAncillary).action,
+			helix::action(&send, requestMessage, sizeof(requestMessage), kHelItemChain).action,
+			helix::action(&recv).action
+		});
+	}
+
+	void check() {
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send.error());
+		HEL_CHECK(recv.error());
+	}
+
+	helix::Offer offer;
+	helix::SendBuffer send;
+	helix::RecvInline recv;
+	Submission submission{&offer, &send, &recv};
+};
+
+// Accepts a conversation, receives the request and replies.
+struct Server {
+	template<typename Q>
+	void submitAccept(HelHandle lane, Q &queue) {
+		::submit(lane, queue, acceptSubmission, {
+			helix::action(&accept, kHelItemAncillary).action,
+			helix::action(&recv).action
+		});
+	}
+
+	template<typename Q>
+	void submitReply(Q &queue) {
+		HEL_CHECK(accept.error());
+		HEL_CHECK(recv.error());
+		conversation = accept.descriptor();
+		::submit(conversation.getHandle(), queue, replySubmission, {
+			helix::action(&send, replyMessage, sizeof(replyMessage)).action
+		});
+	}
+
+	void finish() {
+		HEL_CHECK(send.error());
+		conversation = helix::UniqueDescriptor{};
+	}
+
+	helix::Accept accept;
+	helix::RecvInline recv;
+	helix::SendBuffer send;
+	helix::UniqueDescriptor conversation;
+	Submission acceptSubmission{&accept, &recv};
+	Submission replySubmission{&send};
+};
+
+template<typename Q>
+void roundTripLocal(const char *name) {
+	HelHandle lanes[2];
+	HEL_CHECK(helCreateStream(&lanes[0], &lanes[1]));
+	Q queue;
+	Client client;
+	Server server;
+
+	measure(name, [&] {
+		client.submitTo(lanes[0], queue);
+		server.submitAccept(lanes[1], queue);
+		waitFor(queue, server.acceptSubmission);
+		server.submitReply(queue);
+		waitFor(queue, server.replySubmission);
+		server.finish();
+		waitFor(queue, client.submission);
+		client.check();
+	});
+
+	HEL_CHECK(helCloseDescriptor(lanes[0]));
+	HEL_CHECK(helCloseDescriptor(lanes[1]));
+}
+
+void echoServer(Worker *worker) {
+	Server server;
+	for(int i = 0; i < worker->iterations; i++) {
+		server.submitAccept(worker->lane, worker->queue);
+		waitFor(worker->queue, server.acceptSubmission);
+		server.submitReply(worker->queue);
+		waitFor(worker->queue, server.replySubmission);
+		server.finish();
+	}
+}
+
+void roundTripRemote() {
+	HelHandle lanes[2];
+	HEL_CHECK(helCreateStream(&lanes[0], &lanes[1]));
+	RawQueue queue;
+	Client client;
+
+	{
+		Worker worker{echoServer};
+		worker.lane = lanes[1];
+		worker.iterations = numWarmup + numSamples;
+		worker.start();
+
+		measure("ipc-roundtrip-remote", [&] {
+			client.submitTo(lanes[0], queue);
+			waitFor(queue, client.submission);
+			client.check();
+		});
+	}
+
+	HEL_CHECK(helCloseDescriptor(lanes[0]));
+	HEL_CHECK(helCloseDescriptor(lanes[1]));
+}
+
+// --------------------------------------------------------
+// Descriptor push/pull
+// --------------------------------------------------------
+
+struct DescriptorClient {
+	template<typename Q>
+	void submitTo(HelHandle lane, HelHandle descriptor, Q &queue) {
+		::submit(lane, queue, submission, {
+			helix::action(&offer, kHelItemAncillary).action,
+			helix::action(&push, helix::BorrowedDescriptor{descriptor}, kHelItemChain).action,
+			helix::action(&recv).action
+		});
+	}
+
+	void check() {
+		HEL_CHECK(offer.error());
+		HEL_CHECK(push.error());
+		HEL_CHECK(recv.error());
+	}
+
+	helix::Offer offer;
+	helix::PushDescriptor push;
+	helix::RecvInline recv;
+	Submission submission{&offer, &push, &recv};
+};
+
+struct DescriptorServer {
+	template<typename Q>
+	void submitAccept(HelHandle lane, Q &queue) {
+		::submit(lane, queue, acceptSubmission, {
+			helix::action(&accept, kHelItemAncillary).action,
+			helix::action(&pull).action
+		});
+	}
+
+	template<typename Q>
+	void submitReply(Q &queue) {
+		HEL_CHECK(accept.error());
+		HEL_CHECK(pull.error());
+		conversation = accept.descriptor();
+		// Closing the pulled descriptor is part of the measured path.
+		pull.descriptor();
+		::submit(conversation.getHandle(), queue, replySubmission, {
+			helix::action(&send, replyMessage, sizeof(replyMessage)).action
+		});
+	}
+
+	void finish() {
+		HEL_CHECK(send.error());
+		conversation = helix::UniqueDescriptor{};
+	}
+
+	helix::Accept accept;
+	helix::PullDescriptor pull;
+	helix::SendBuffer send;
+	helix::UniqueDescriptor conversation;
+	Submission acceptSubmission{&accept, &pull};
+	Submission replySubmission{&send};
+};
+
+void descriptorLocal() {
+	HelHandle lanes[2];
+	HEL_CHECK(helCreateStream(&lanes[0], &lanes[1]));
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, &memory));
+	RawQueue queue;
+	DescriptorClient client;
+	DescriptorServer server;
+
+	measure("ipc-descriptor-local", [&] {
+		client.submitTo(lanes[0], memory, queue);
+		server.submitAccept(lanes[1], queue);
+		waitFor(queue, server.acceptSubmission);
+		server.submitReply(queue);
+		waitFor(queue, server.replySubmission);
+		server.finish();
+		waitFor(queue, client.submission);
+		client.check();
+	});
+
+	HEL_CHECK(helCloseDescriptor(memory));
+	HEL_CHECK(helCloseDescriptor(lanes[0]));
+	HEL_CHECK(helCloseDescriptor(lanes[1]));
+}
+
+void descriptorServer(Worker *worker) {
+	DescriptorServer server;
+	for(int i = 0; i < worker->iterations; i++) {
+		server.submitAccept(worker->lane, worker->queue);
+		waitFor(worker->queue, server.acceptSubmission);
+		server.submitReply(worker->queue);
+		waitFor(worker->queue, server.replySubmission);
+		server.finish();
+	}
+}
+
+void descriptorRemote() {
+	HelHandle lanes[2];
+	HEL_CHECK(helCreateStream(&lanes[0], &lanes[1]));
+	HelHandle memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, &memory));
+	RawQueue queue;
+	DescriptorClient client;
+
+	{
+		Worker worker{descriptorServer};
+		worker.lane = lanes[1];
+		worker.iterations = numWarmup + numSamples;
+		worker.start();
+
+		measure("ipc-descriptor-remote", [&] {
+			client.submitTo(lanes[0], memory, queue);
+			waitFor(queue, client.submission);
+			client.check();
+		});
+	}
+
+	HEL_CHECK(helCloseDescriptor(memory));
+	HEL_CHECK(helCloseDescriptor(lanes[0]));
+	HEL_CHECK(helCloseDescriptor(lanes[1]));
+}
+
+// --------------------------------------------------------
+// SendFromBuffer/RecvToBuffer throughput
+// --------------------------------------------------------
+
+void transferThroughput() {
+	HelHandle lanes[2];
+	HEL_CHECK(helCreateStream(&lanes[0], &lanes[1]));
+	RawQueue queue;
+
+	constexpr size_t maxSize = size_t(1) << 20;
+	auto source = static_cast<char *>(operator new(maxSize));
+	auto dest = static_cast<char *>(operator new(maxSize));
+	memset(source, 0x5A, maxSize);
+	memset(dest, 0, maxSize);
+
+	for(size_t size : {size_t(64), size_t(1024), size_t(16384),
+			size_t(262144), size_t(1) << 20}) {
+		helix::SendBuffer send;
+		helix::RecvBuffer recv;
+		Submission send_submission{&send};
+		Submission recv_submission{&recv};
+
+		// Transfer 256 MiB in total (but at least 10'000 messages).
+		auto n = std::max((size_t(256) << 20) / size, size_t(10'000));
+		auto start = currentNanos();
+		for(size_t i = 0; i < n; i++) {
+			submit(lanes[0], queue, send_submission, {
+				helix::action(&send, source, size).action
+			});
+			submit(lanes[1], queue, recv_submission, {
+				helix::action(&recv, dest, size).action
+			});
+			waitFor(queue, send_submission);
+			waitFor(queue, recv_submission);
+			HEL_CHECK(send.error());
+			HEL_CHECK(recv.error());
+			assert(recv.actualLength() == size);
+		}
+		auto elapsed = currentNanos() - start;
+
+		char name[64];
+		snprintf(name, sizeof(name), "ipc-transfer-%zu", size);
+		report(name, (n * size / double(1 << 20)) * 1e9 / elapsed, "MiB/s");
+	}
+
+	operator delete(source);
+	operator delete(dest);
+	HEL_CHECK(helCloseDescriptor(lanes[0]));
+	HEL_CHECK(helCloseDescriptor(lanes[1]));
+}
+
+// --------------------------------------------------------
+// Futex ping-pong
+// --------------------------------------------------------
+
+// Blocks until *futex == value.
+void futexAwait(int *futex, int value) {
+	while(true) {
+		auto current = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+		if(current == value)
+			return;
+		HEL_CHECK(helFutexWait(futex, current));
+	}
+}
+
+void futexSet(int *futex, int value) {
+	__atomic_store_n(futex, value, __ATOMIC_RELEASE);
+	HEL_CHECK(helFutexWake(futex));
+}
+
+void futexPong(Worker *worker) {
+	for(int i = 0; i < worker->iterations; i++) {
+		futexAwait(worker->futex, 1);
+		futexSet(worker->futex, 2);
+	}
+}
+
+void futexPingPong() {
+	int futex = 0;
+	Worker worker{futexPong};
+	worker.futex = &futex;
+	worker.iterations = numWarmup + numSamples;
+	worker.start();
+
+	measure("futex-ping-pong", [&] {
+		futexSet(&futex, 1);
+		futexAwait(&futex, 2);
+	});
+}
+
+// --------------------------------------------------------
+// helSubmitAwaitClock() jitter
+// --------------------------------------------------------
+
+void clockJitter() {
+	constexpr uint64_t delay = 1'000'000;
+	constexpr int n = 2'000;
+	RawQueue queue;
+	SimpleResult result;
+	Submission submission{&result};
+
+	// Reports how late the completion arrives compared to the requested deadline.
+	std::vector<uint64_t> samples;
+	for(int i = 0; i < n; i++) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		uint64_t async_id;
+		submission.reset();
+		HEL_CHECK(helSubmitAwaitClock(now + delay, queue.handle(),
+				submission.context(), &async_id));
+		waitFor(queue, submission);
+		HEL_CHECK(result.error);
+
+		uint64_t after;
+		HEL_CHECK(helGetClock(&after));
+		assert(after >= now + delay);
+		samples.push_back(after - (now + delay));
+	}
+	reportPercentiles("clock-jitter-1ms", samples);
+}
+
+// --------------------------------------------------------
+// Heap allocations of helix round trips
+// --------------------------------------------------------
+
+async::result<void> pooledRoundTrip(helix::PooledFrame, helix::BorrowedDescriptor lane) {
+	helix::Offer offer;
+	helix::SendBuffer send;
+	helix::RecvInline recv;
+	auto &&transmit = helix::submitAsync(lane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send, requestMessage, sizeof(requestMessage), kHelItemChain),
+			helix::action(&recv));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send.error());
+	HEL_CHECK(recv.error());
+}
+
+// Performs round trips against a remote server through helix::Dispatcher::global().
+// Once the pools are warmed up, this is expected not to allocate from the heap
+// (unverified so far). Protobuf messages are not involved.
+// Terminates the program when it is done.
+async::detached countHeapAllocations() {
+	constexpr int n = 10'000;
+	HelHandle lanes[2];
+	HEL_CHECK(helCreateStream(&lanes[0], &lanes[1]));
+
+	size_t allocations;
+	{
+		Worker worker{echoServer};
+		worker.lane = lanes[1];
+		worker.iterations = numWarmup + n;
+		worker.start();
+
+		for(int i = 0; i < numWarmup; i++)
+			co_await pooledRoundTrip(helix::pooledFrame, helix::BorrowedDescriptor{lanes[0]});
+
+		auto before = __atomic_load_n(&numHeapAllocations, __ATOMIC_RELAXED);
+		for(int i = 0; i < n; i++)
+			co_await pooledRoundTrip(helix::pooledFrame, helix::BorrowedDescriptor{lanes[0]});
+		allocations = __atomic_load_n(&numHeapAllocations, __ATOMIC_RELAXED) - before;
+		report("helix-heap-allocations", double(allocations) / n, "allocs/op");
+		if(allocations)
+			fprintf(stderr, "bench-ipc: %zu heap allocations in the steady state\n",
+					allocations);
+	}
+
+	HEL_CHECK(helCloseDescriptor(lanes[0]));
+	HEL_CHECK(helCloseDescriptor(lanes[1]));
+	// A nonzero exit status makes the runner report the benchmark as failed.
+	exit(allocations ? 1 : 0);
+}
+
+} // anonymous namespace
+
+void benchIpcWorkerMain(void *worker) {
+	Worker::main(static_cast<Worker *>(worker));
+}
+
+int main() {
+	roundTripLocal<RawQueue>("ipc-roundtrip-local");
+	roundTripLocal<HelixQueue>("ipc-roundtrip-local-helix");
+	roundTripRemote();
+	descriptorLocal();
+	descriptorRemote();
+	transferThroughput();
+	futexPingPong();
+	clockJitter();
+
+	{
+		async::queue_scope scope{helix::globalQueue()};
+		countHeapAllocations();
+	}
+
+	helix::globalQueue()->run();
+}
@@ -0,0 +1,88 @@
+// Host-side microbenchmark that compares frigg::TicketLock and frigg::McsLock
+// under contention. Each thread repeatedly acquires the lock, performs a short
+// critical section and releases it.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <frigg/atomic.hpp>
+
+namespace {
+
+constexpr uint64_t iterationsPerThread = 1'000'000;
+
+uint64_t currentNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+}
+
+void pinToCpu(unsigned int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+}
+
+// Returns the throughput in acquisitions per microsecond.
+template<typename Lock>
+double run(unsigned int num_threads) {
+	Lock lock;
+	std::atomic<unsigned int> ready{0};
+	std::atomic<bool> go{false};
+	volatile uint64_t counter = 0;
+
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < num_threads; i++) {
+		threads.emplace_back([&, i] {
+			pinToCpu(i);
+			ready.fetch_add(1);
+			while(!go.load(std::memory_order_acquire))
+				;
+			for(uint64_t k = 0; k < iterationsPerThread; k++) {
+				auto guard = frigg::guard(&lock);
+				counter = counter + 1;
+			}
+		});
+	}
+
+	while(ready.load() != num_threads)
+		;
+	auto start = currentNanos();
+	go.store(true, std::memory_order_release);
+	for(auto &thread : threads)
+		thread.join();
+	auto elapsed = currentNanos() - start;
+
+	if(counter != num_threads * iterationsPerThread) {
+		std::cerr << "Lock does not provide mutual exclusion!" << std::endl;
+		abort();
+	}
+	return (num_threads * iterationsPerThread) * 1000.0 / elapsed;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	unsigned int max_threads = std::thread::hardware_concurrency();
+	if(argc > 1)
+		max_threads = strtoul(argv[1], nullptr, 10);
+
+	std::cout << std::setw(8) << "threads"
+			<< std::setw(16) << "ticket (ops/us)"
+			<< std::setw(16) << "mcs (ops/us)" << std::endl;
+	for(unsigned int n = 1; n <= max_threads; n *= 2) {
+		auto ticket = run<frigg::TicketLock>(n);
+		auto mcs = run<frigg::McsLock>(n);
+		std::cout << std::setw(8) << n
+				<< std::setw(16) << std::fixed << std::setprecision(2) << ticket
+				<< std::setw(16) << std::fixed << std::setprecision(2) << mcs << std::endl;
+	}
+}
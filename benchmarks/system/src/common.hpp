@@ -0,0 +1,53 @@
+#ifndef BENCHMARKS_SYSTEM_COMMON_HPP
+#define BENCHMARKS_SYSTEM_COMMON_HPP
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Shared helpers of the system benchmarks. All programs print their results to stdout
+// which bench-runner redirects to the kernel log (and thus to the debugcon).
+// tools/run-benchmarks parses lines of the form "bench: <name> <value> <unit>".
+
+inline uint64_t currentNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+}
+
+// Units that end in "/s" are rates (higher is better); all other units are times.
+inline void report(const char *name, double value, const char *unit) {
+	printf("bench: %s %.3f %s\n", name, value, unit);
+	fflush(stdout);
+}
+
+inline void check(bool success, const char *what) {
+	if(success)
+		return;
+	fprintf(stderr, "bench: %s failed: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+// Number of times that each measurement is repeated. We report the best round
+// as it is least affected by noise from other VMs on the host.
+constexpr int numRounds = 5;
+
+// Calls fn() n times per round. Returns the best time per call in nanoseconds.
+template<typename F>
+double bestNanosPerOp(int n, F fn) {
+	double best = 0;
+	for(int r = 0; r < numRounds; r++) {
+		auto start = currentNanos();
+		for(int i = 0; i < n; i++)
+			fn();
+		double elapsed = double(currentNanos() - start) / n;
+		if(!r || elapsed < best)
+			best = elapsed;
+	}
+	return best;
+}
+
+#endif // BENCHMARKS_SYSTEM_COMMON_HPP
@@ -0,0 +1,43 @@
+// Measures how epoll_wait() scales with the number of watched file descriptors.
+// Only one of the descriptors is ready.
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <initializer_list>
+#include <vector>
+
+#include "common.hpp"
+
+int main() {
+	for(int n : {1, 16, 128, 512}) {
+		int epfd = epoll_create1(0);
+		check(epfd >= 0, "epoll_create1()");
+
+		std::vector<int> pipes;
+		for(int i = 0; i < n; i++) {
+			int fds[2];
+			check(!pipe(fds), "pipe()");
+			struct epoll_event event;
+			event.events = EPOLLIN;
+			event.data.fd = fds[0];
+			check(!epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), "epoll_ctl()");
+			pipes.push_back(fds[0]);
+			pipes.push_back(fds[1]);
+		}
+
+		// The byte is never consumed; the pipe stays ready.
+		char c = 0;
+		check(write(pipes.back(), &c, 1) == 1, "write()");
+
+		char name[64];
+		snprintf(name, sizeof(name), "epoll-wait-%d", n);
+		report(name, bestNanosPerOp(10'000, [&] {
+			struct epoll_event events[16];
+			check(epoll_wait(epfd, events, 16, 0) == 1, "epoll_wait()");
+		}), "ns");
+
+		for(auto fd : pipes)
+			close(fd);
+		close(epfd);
+	}
+}
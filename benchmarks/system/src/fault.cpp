@@ -0,0 +1,51 @@
+// Measures the rate of page faults on anonymous memory and the cost of MAP_POPULATE.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+namespace {
+
+constexpr size_t pageSize = 4096;
+constexpr size_t regionSize = size_t(64) << 20;
+
+} // anonymous namespace
+
+int main() {
+	constexpr size_t num_pages = regionSize / pageSize;
+
+	// Each round uses a fresh mapping so that every access faults.
+	double best = 0;
+	for(int r = 0; r < numRounds; r++) {
+		auto p = static_cast<volatile char *>(mmap(nullptr, regionSize,
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		check(p != MAP_FAILED, "mmap()");
+
+		auto start = currentNanos();
+		for(size_t i = 0; i < num_pages; i++)
+			p[i * pageSize] = 1;
+		auto elapsed = currentNanos() - start;
+
+		check(!munmap(const_cast<char *>(p), regionSize), "munmap()");
+		auto rate = num_pages * 1e9 / elapsed;
+		if(rate > best)
+			best = rate;
+	}
+	report("page-fault-anon-write", best, "faults/s");
+
+	best = 0;
+	for(int r = 0; r < numRounds; r++) {
+		auto start = currentNanos();
+		auto p = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		check(p != MAP_FAILED, "mmap()");
+		auto elapsed = currentNanos() - start;
+
+		check(!munmap(p, regionSize), "munmap()");
+		auto rate = num_pages * 1e9 / elapsed;
+		if(rate > best)
+			best = rate;
+	}
+	report("page-populate-anon", best, "pages/s");
+}
@@ -0,0 +1,43 @@
+// Measures the time to fork() a process and to fork() + execve() a (tiny) program.
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+namespace {
+
+void waitFor(pid_t child) {
+	int status;
+	check(waitpid(child, &status, 0) == child, "waitpid()");
+	if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "bench: Child did not exit successfully\n");
+		exit(1);
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	// We re-execute ourselves; this is the child side.
+	if(argc > 1 && !strcmp(argv[1], "--exit"))
+		return 0;
+
+	report("fork-exit-wait", bestNanosPerOp(200, [] {
+		auto child = fork();
+		check(child >= 0, "fork()");
+		if(!child)
+			_exit(0);
+		waitFor(child);
+	}) / 1000, "us");
+
+	report("fork-exec-wait", bestNanosPerOp(100, [&] {
+		auto child = fork();
+		check(child >= 0, "fork()");
+		if(!child) {
+			execl(argv[0], argv[0], "--exit", nullptr);
+			_exit(1);
+		}
+		waitFor(child);
+	}) / 1000, "us");
+}
@@ -0,0 +1,84 @@
+// Measures the throughput of pipes and unix sockets between two processes.
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <initializer_list>
+
+#include "common.hpp"
+
+namespace {
+
+constexpr size_t transferSize = size_t(64) << 20;
+
+// Forks a writer that sends transferSize bytes in chunks of the given size.
+// Returns the throughput in MiB/s as observed by the reader.
+double transfer(int rfd, int wfd, size_t chunk_size) {
+	auto buffer = static_cast<char *>(malloc(chunk_size));
+	memset(buffer, 0x5A, chunk_size);
+
+	auto start = currentNanos();
+	auto child = fork();
+	check(child >= 0, "fork()");
+	if(!child) {
+		close(rfd);
+		for(size_t progress = 0; progress < transferSize; ) {
+			auto chunk = write(wfd, buffer, chunk_size);
+			check(chunk > 0, "write()");
+			progress += chunk;
+		}
+		_exit(0);
+	}
+
+	size_t progress = 0;
+	while(progress < transferSize) {
+		auto chunk = read(rfd, buffer, chunk_size);
+		check(chunk > 0, "read()");
+		progress += chunk;
+	}
+	auto elapsed = currentNanos() - start;
+
+	int status;
+	check(waitpid(child, &status, 0) == child, "waitpid()");
+	free(buffer);
+	return (progress / double(1 << 20)) * 1e9 / elapsed;
+}
+
+template<typename F>
+double bestThroughput(F fn) {
+	double best = 0;
+	for(int r = 0; r < numRounds; r++) {
+		auto throughput = fn();
+		if(throughput > best)
+			best = throughput;
+	}
+	return best;
+}
+
+} // anonymous namespace
+
+int main() {
+	for(size_t chunk_size : {size_t(4096), size_t(65536)}) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "pipe-throughput-%zuk", chunk_size / 1024);
+		report(name, bestThroughput([&] {
+			int fds[2];
+			check(!pipe(fds), "pipe()");
+			auto throughput = transfer(fds[0], fds[1], chunk_size);
+			close(fds[0]);
+			close(fds[1]);
+			return throughput;
+		}), "MiB/s");
+
+		snprintf(name, sizeof(name), "unix-stream-throughput-%zuk", chunk_size / 1024);
+		report(name, bestThroughput([&] {
+			int fds[2];
+			check(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair()");
+			auto throughput = transfer(fds[0], fds[1], chunk_size);
+			close(fds[0]);
+			close(fds[1]);
+			return throughput;
+		}), "MiB/s");
+	}
+}
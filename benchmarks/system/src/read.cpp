@@ -0,0 +1,51 @@
+// Measures the throughput of read() on tmpfs and ext2.
+// The file is written before it is read, i.e., the ext2 numbers measure reads
+// from the page cache, not from the disk.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+namespace {
+
+constexpr size_t fileSize = size_t(32) << 20;
+constexpr size_t chunkSize = 65536;
+
+void benchFile(const char *name, const char *path) {
+	auto buffer = static_cast<char *>(malloc(chunkSize));
+	memset(buffer, 0x5A, chunkSize);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	check(fd >= 0, "open()");
+	for(size_t progress = 0; progress < fileSize; progress += chunkSize)
+		check(write(fd, buffer, chunkSize) == ssize_t(chunkSize), "write()");
+
+	double best = 0;
+	for(int r = 0; r < numRounds; r++) {
+		check(lseek(fd, 0, SEEK_SET) == 0, "lseek()");
+		auto start = currentNanos();
+		size_t progress = 0;
+		while(progress < fileSize) {
+			auto chunk = read(fd, buffer, chunkSize);
+			check(chunk > 0, "read()");
+			progress += chunk;
+		}
+		auto throughput = (progress / double(1 << 20)) * 1e9 / (currentNanos() - start);
+		if(throughput > best)
+			best = throughput;
+	}
+	report(name, best, "MiB/s");
+
+	close(fd);
+	unlink(path);
+	free(buffer);
+}
+
+} // anonymous namespace
+
+int main() {
+	// /tmp is a tmpfs while /var/tmp lives on the ext2 root file system.
+	benchFile("read-throughput-tmpfs", "/tmp/bench-read");
+	benchFile("read-throughput-ext2", "/var/tmp/bench-read");
+}
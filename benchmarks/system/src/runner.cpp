@@ -0,0 +1,60 @@
+// Runs all system benchmarks and reports the results on the kernel log.
+// init-stage2 launches this program if the kernel command line contains init.launch=bench.
+// See tools/run-benchmarks for the host side.
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+
+#include "common.hpp"
+
+namespace {
+
+const char *benchmarks[] = {
+	"bench-syscall",
+	"bench-pipe",
+	"bench-fork",
+	"bench-fault",
+	"bench-read",
+	"bench-epoll",
+	"bench-ipc",
+};
+
+} // anonymous namespace
+
+int main() {
+	// Make sure that the results end up on the debugcon, regardless of how we were started.
+	int fd = open("/dev/helout", O_WRONLY);
+	check(fd >= 0, "open()");
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+
+	printf("bench-begin\n");
+
+	// posix-init records the time at which it was started.
+	if(auto init_nanos = getenv("MANAGARM_INIT_NANOS"); init_nanos)
+		report("boot-to-init", strtoull(init_nanos, nullptr, 10) / 1e6, "ms");
+	report("boot-to-stage2-ready", currentNanos() / 1e6, "ms");
+
+	for(auto name : benchmarks) {
+		auto path = std::string{BENCH_DIR} + "/" + name;
+		auto child = fork();
+		check(child >= 0, "fork()");
+		if(!child) {
+			execl(path.c_str(), path.c_str(), nullptr);
+			fprintf(stderr, "bench: Could not execute %s\n", path.c_str());
+			_exit(1);
+		}
+
+		int status;
+		check(waitpid(child, &status, 0) == child, "waitpid()");
+		if(!WIFEXITED(status) || WEXITSTATUS(status))
+			printf("bench-failed: %s\n", name);
+		fflush(stdout);
+	}
+
+	printf("bench-done\n");
+	fflush(stdout);
+}
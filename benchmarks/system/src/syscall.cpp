@@ -0,0 +1,35 @@
+// Measures the round-trip latency of simple POSIX requests.
+// On managarm, each of them is an IPC round trip to the POSIX subsystem.
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+int main() {
+	report("syscall-getppid", bestNanosPerOp(100'000, [] {
+		getppid();
+	}), "ns");
+
+	int fd = open("/dev/null", O_RDWR);
+	check(fd >= 0, "open()");
+
+	report("syscall-fstat", bestNanosPerOp(100'000, [&] {
+		struct stat st;
+		check(!fstat(fd, &st), "fstat()");
+	}), "ns");
+
+	report("syscall-write-devnull", bestNanosPerOp(100'000, [&] {
+		char c = 0;
+		check(write(fd, &c, 1) == 1, "write()");
+	}), "ns");
+
+	report("syscall-open-close", bestNanosPerOp(10'000, [] {
+		int tmp = open("/dev/null", O_RDONLY);
+		check(tmp >= 0, "open()");
+		close(tmp);
+	}), "ns");
+
+	close(fd);
+}
@@ -329,7 +329,8 @@ public:
 
 	// Processes interrupts for this virtq.
 	// Calls retrieveDescriptor() to complete individual requests.
-	void processInterrupt();
+	// Returns the number of requests that were completed.
+	size_t processInterrupt();
 
 protected:
 	virtual void notifyTransport() = 0;
@@ -1,10 +1,12 @@
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <optional>
 
 #include <core/virtio/core.hpp>
 #include <fafnir/dsl.hpp>
+#include <helix/clock.hpp>
 #include <protocols/kernlet/compiler.hpp>
 
 namespace virtio_core {
@@ -214,6 +216,18 @@ void LegacyPciTransport::runDevice() {
 	_processIrqs();
 }
 
+// Parameters of the adaptive IRQ policy (all times in nanoseconds).
+// Usually, every IRQ is delivered immediately. If IRQs arrive back-to-back, we keep
+// the IRQ masked and poll the queues until they become idle (similar to NAPI).
+// The kernel cannot coalesce the IRQs of this transport: they are level-triggered and
+// only reading the ISR deasserts them. Polling is only possible if the IRQ is not shared.
+namespace {
+	constexpr uint64_t idleInterval = 200'000;
+	constexpr uint64_t pollThreshold = 30'000;
+	constexpr uint64_t pollInterval = 20'000;
+	constexpr int pollIdleLimit = 8;
+}
+
 async::detached LegacyPciTransport::_processIrqs() {
 	co_await _hwDevice.enableBusIrq();
 
@@ -221,6 +235,9 @@ async::detached LegacyPciTransport::_processIrqs() {
 	HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckKick, 0));
 
 	uint64_t sequence = 0;
+	uint64_t last_irq = helix::currentClock();
+	uint64_t avg_interval = idleInterval; // Moving average of the time between IRQs.
+	bool can_poll = true;
 	while(true) {
 		helix::AwaitEvent await;
 		auto &&submit = helix::submitAwaitEvent(_irq, &await, sequence,
@@ -236,7 +253,27 @@ async::detached LegacyPciTransport::_processIrqs() {
 			continue;
 		}
 
-		HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
+		// Update the IRQ rate estimate.
+		auto now = helix::currentClock();
+		auto interval = (now - last_irq) / std::max(await.count(), uint64_t{1});
+		last_irq = now;
+		avg_interval = (7 * avg_interval + interval) / 8;
+
+		// Only enter polling mode if there is no configuration change to handle.
+		bool poll = can_poll && (isr == 1) && avg_interval < pollThreshold;
+		if(poll) {
+			// The kernel refuses to mask IRQs that are shared with other devices.
+			auto error = helAcknowledgeIrq(_irq.getHandle(),
+					kHelAckAcknowledge | kHelAckPoll, sequence);
+			if(error == kHelErrIllegalArgs) {
+				can_poll = false;
+				poll = false;
+			}else{
+				HEL_CHECK(error);
+			}
+		}
+		if(!poll)
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckAcknowledge, sequence));
 
 		if(isr & 2) {
 			std::cout << "core-virtio: Configuration change" << std::endl;
@@ -246,6 +283,35 @@ async::detached LegacyPciTransport::_processIrqs() {
 		if(isr & 1)
 			for(auto &queue : _queues)
 				queue->processInterrupt();
+
+		if(poll) {
+			// The IRQ stays masked while we poll. We do not read the ISR here:
+			// if the device completes requests after our last poll, the (level-triggered)
+			// IRQ fires as soon as we unmask it.
+			int idle = 0;
+			while(idle < pollIdleLimit) {
+				helix::AwaitClock await_clock;
+				auto &&submit = helix::submitAwaitClock(&await_clock,
+						helix::currentClock() + pollInterval, helix::Dispatcher::global());
+				co_await submit.async_wait();
+				HEL_CHECK(await_clock.error());
+
+				size_t progress = 0;
+				for(auto &queue : _queues)
+					progress += queue->processInterrupt();
+				if(progress) {
+					idle = 0;
+				}else{
+					idle++;
+				}
+			}
+
+			HEL_CHECK(helAcknowledgeIrq(_irq.getHandle(), kHelAckUnmask, 0));
+
+			// Restart the rate estimation; we are idle now.
+			last_irq = helix::currentClock();
+			avg_interval = idleInterval;
+		}
 	}
 }
 
@@ -758,7 +824,8 @@ void Queue::notify() {
 		notifyTransport();
 }
 
-void Queue::processInterrupt() {
+size_t Queue::processInterrupt() {
+	size_t progress = 0;
 	while(true) {
 		auto used_head = _usedRing->headIndex.load();
 		// TODO: I think this assertion is incorrect once we issue more than 2^16 requests.
@@ -791,7 +858,9 @@ void Queue::processInterrupt() {
 		request->complete(request);
 
 		_progressHead++;
+		progress++;
 	}
+	return progress;
 }
 
 } // namespace virtio_core
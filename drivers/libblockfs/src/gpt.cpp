@@ -72,6 +72,10 @@ Guid Partition::type() {
 	return _type;
 }
 
+uint64_t Partition::numSectors() {
+	return _numSectors;
+}
+
 async::result<void> Partition::readSectors(uint64_t sector, void *buffer, size_t count) {
 	assert(sector + count <= _numSectors);
 	return _table.getDevice()->readSectors(_startLba + sector,
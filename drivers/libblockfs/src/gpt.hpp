@@ -30,6 +30,8 @@ namespace type_guids {
 	static constexpr Guid null{0, 0, 0, {0, 0}, {0, 0, 0, 0, 0, 0}};
 	static constexpr Guid windowsData{0xEBD0A0A2, 0xB9E5, 0x4433, {0x87, 0xC0},
 			{0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7}};
+	static constexpr Guid linuxSwap{0x0657FD6D, 0xA4AB, 0x43C4, {0x84, 0xE5},
+			{0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F}};
 };
 
 // --------------------------------------------------------
@@ -106,6 +108,8 @@ struct Partition : public BlockDevice {
 
 	Guid type();
 
+	uint64_t numSectors();
+
 private:
 	Table &_table;
 	Guid _id;
@@ -11,6 +11,7 @@
 #include <blockfs.hpp>
 #include "gpt.hpp"
 #include "ext2fs.hpp"
+#include "swap.hpp"
 #include "fs.pb.h"
 
 namespace blockfs {
@@ -316,6 +317,13 @@ async::detached runDevice(BlockDevice *device) {
 				i, type.a, type.b, type.c, type.d[0], type.d[1],
 				type.e[0], type.e[1], type.e[2], type.e[3], type.e[4], type.e[5]);
 
+		if(type == gpt::type_guids::linuxSwap) {
+			printf("It's a swap partition!\n");
+			auto partition = &table->getPartition(i);
+			swap::runSwap(partition, partition->numSectors());
+			continue;
+		}
+
 		if(type != gpt::type_guids::windowsData)
 			continue;
 		printf("It's a Windows data partition!\n");
@@ -0,0 +1,157 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <helix/ipc.hpp>
+#include <helix/await.hpp>
+#include <helix/memory.hpp>
+
+#include "swap.hpp"
+
+namespace blockfs {
+namespace swap {
+
+namespace {
+	constexpr bool logRequests = false;
+
+	constexpr int pageShift = 12;
+	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	// Layout of the header that mkswap writes to the first page.
+	struct SwapHeader {
+		char bootbits[1024];
+		uint32_t version;
+		uint32_t lastPage;
+		uint32_t numBadPages;
+		uint8_t uuid[16];
+		char volumeName[16];
+	};
+
+	// The signature occupies the last bytes of the first page.
+	constexpr size_t signatureLength = 10;
+
+	// Signatures that hibernation tools write over SWAPSPACE2. The partition then holds
+	// a hibernation image that we must not overwrite.
+	const char *hibernationSignatures[] = {
+		"S1SUSPEND",
+		"S2SUSPEND",
+		"ULSUSPEND",
+		"LINHIB0001"
+	};
+
+	// Number of requests that we handle concurrently.
+	// The kernel fuses writebacks of adjacent slots; hence, requests can be large.
+	constexpr int numWorkers = 4;
+
+	async::detached serveRequests(BlockDevice *device, helix::BorrowedDescriptor memory) {
+		auto sectors_per_page = pageSize / device->sectorSize;
+
+		while(true) {
+			helix::ManageMemory manage;
+			auto &&submit_manage = helix::submitManageMemory(memory,
+					&manage, helix::Dispatcher::global());
+			co_await submit_manage.async_wait();
+			HEL_CHECK(manage.error());
+			if(logRequests)
+				printf("swap: %s of %lu bytes at slot %lu\n",
+						manage.type() == kHelManageInitialize ? "Read" : "Write",
+						manage.length(), manage.offset() >> pageShift);
+
+			// Slot n is stored in page n + 1 of the device.
+			auto sector = ((manage.offset() >> pageShift) + 1) * sectors_per_page;
+			auto num_sectors = (manage.length() >> pageShift) * sectors_per_page;
+
+			if(manage.type() == kHelManageInitialize) {
+				helix::Mapping slot_map{memory,
+						static_cast<ptrdiff_t>(manage.offset()), manage.length(),
+						kHelMapProtWrite};
+				co_await device->readSectors(sector, slot_map.get(), num_sectors);
+				HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
+						manage.offset(), manage.length()));
+			}else{
+				assert(manage.type() == kHelManageWriteback);
+
+				helix::Mapping slot_map{memory,
+						static_cast<ptrdiff_t>(manage.offset()), manage.length(),
+						kHelMapProtRead};
+				co_await device->writeSectors(sector, slot_map.get(), num_sectors);
+				HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
+						manage.offset(), manage.length()));
+			}
+		}
+	}
+}
+
+async::detached runSwap(BlockDevice *device, uint64_t num_sectors) {
+	assert(!(pageSize % device->sectorSize));
+	auto num_pages = num_sectors / (pageSize / device->sectorSize);
+	if(num_pages < 2) {
+		printf("swap: Device is too small\n");
+		co_return;
+	}
+
+	// Only use partitions that were explicitly prepared by mkswap.
+	auto header_page = static_cast<char *>(malloc(pageSize));
+	assert(header_page);
+	co_await device->readSectors(0, header_page, pageSize / device->sectorSize);
+	auto signature = header_page + pageSize - signatureLength;
+
+	for(auto hibernation_signature : hibernationSignatures) {
+		if(!memcmp(signature, hibernation_signature, strlen(hibernation_signature))) {
+			printf("swap: Partition contains a hibernation image, ignoring it\n");
+			free(header_page);
+			co_return;
+		}
+	}
+	if(memcmp(signature, "SWAPSPACE2", signatureLength)) {
+		printf("swap: Partition does not have a swap signature, ignoring it\n");
+		free(header_page);
+		co_return;
+	}
+
+	SwapHeader header;
+	memcpy(&header, header_page, sizeof(SwapHeader));
+	free(header_page);
+	if(header.version != 1 || header.numBadPages) {
+		printf("swap: Unsupported swap header (version %u, %u bad pages)\n",
+				header.version, header.numBadPages);
+		co_return;
+	}
+
+	// Pages 1 to lastPage are usable.
+	if(header.lastPage + 1 < num_pages)
+		num_pages = header.lastPage + 1;
+	if(num_pages < 2) {
+		printf("swap: Swap area is too small\n");
+		co_return;
+	}
+
+	HelHandle backing;
+	HelHandle frontal;
+	HEL_CHECK(helCreateManagedMemory((num_pages - 1) << pageShift,
+			kHelAllocBacked, &backing, &frontal));
+	// The kernel accesses the swap space directly; we do not need the frontal memory.
+	HEL_CHECK(helCloseDescriptor(frontal));
+
+	auto error = helSetSwapMemory(backing);
+	if(error == kHelErrIllegalState) {
+		printf("swap: A swap space is already in use\n");
+		HEL_CHECK(helCloseDescriptor(backing));
+		co_return;
+	}else if(error == kHelErrIllegalArgs) {
+		printf("swap: This server is not allowed to provide swap space\n");
+		HEL_CHECK(helCloseDescriptor(backing));
+		co_return;
+	}
+	HEL_CHECK(error);
+	printf("swap: Using %lu KiB of swap space\n", ((num_pages - 1) << pageShift) / 1024);
+
+	// The backing memory is never closed; the kernel keeps using the swap space.
+	for(int i = 0; i < numWorkers; i++)
+		serveRequests(device, helix::BorrowedDescriptor{backing});
+}
+
+} } // namespace blockfs::swap
+
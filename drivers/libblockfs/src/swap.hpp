@@ -0,0 +1,13 @@
+
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace swap {
+
+// Installs a swap space that stores evicted pages on the device.
+// The device needs to be initialized by mkswap (and must not contain a hibernation image).
+// The first page of the device is skipped; it holds the mkswap header.
+async::detached runSwap(BlockDevice *device, uint64_t num_sectors);
+
+} } // namespace blockfs::swap
+
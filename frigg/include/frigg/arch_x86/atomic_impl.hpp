@@ -96,6 +96,12 @@ public:
 			pause();
 		}
 	}
+
+	bool tryLock() {
+		auto ticket = __atomic_load_n(&_servingTicket, __ATOMIC_RELAXED);
+		return __atomic_compare_exchange_n(&_nextTicket, &ticket, ticket + 1, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	}
 	
 	void unlock() {
 		auto current = __atomic_load_n(&_servingTicket, __ATOMIC_RELAXED);
@@ -107,6 +113,88 @@ private:
 	uint32_t _servingTicket;
 };
 
+// Queued spinlock (the K42 variant of the MCS lock).
+// Waiters enqueue a node on their own stack and spin on a flag inside that node,
+// so contended acquisitions do not bounce a shared cache line between CPUs.
+// Once a waiter owns the lock, its successor is tracked inside the lock itself;
+// hence lock() and unlock() do not take a node and the lock can be used with guard().
+class McsLock {
+	struct Node {
+		Node *next;
+		bool waiting;
+	};
+
+public:
+	McsLock()
+	: _head{nullptr, false}, _tail{nullptr} { }
+
+	McsLock(const McsLock &) = delete;
+
+	McsLock &operator= (const McsLock &) = delete;
+
+	void lock() {
+		while(true) {
+			auto prev = __atomic_load_n(&_tail, __ATOMIC_RELAXED);
+			if(!prev) {
+				// The lock is free. _head acts as the queue node of the owner.
+				if(__atomic_compare_exchange_n(&_tail, &prev, &_head, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+					return;
+				continue;
+			}
+
+			Node node{nullptr, true};
+			if(!__atomic_compare_exchange_n(&_tail, &prev, &node, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+				continue;
+			__atomic_store_n(&prev->next, &node, __ATOMIC_RELEASE);
+
+			while(__atomic_load_n(&node.waiting, __ATOMIC_ACQUIRE))
+				pause();
+
+			// We own the lock. node goes out of scope, so move our successor into _head.
+			auto successor = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE);
+			if(!successor) {
+				__atomic_store_n(&_head.next, nullptr, __ATOMIC_RELAXED);
+				Node *expected = &node;
+				if(__atomic_compare_exchange_n(&_tail, &expected, &_head, false,
+						__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+					return;
+
+				// Another waiter already swapped the tail; wait until it links itself.
+				while(!(successor = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE)))
+					pause();
+			}
+			__atomic_store_n(&_head.next, successor, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	bool tryLock() {
+		Node *expected = nullptr;
+		return __atomic_compare_exchange_n(&_tail, &expected, &_head, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	}
+
+	void unlock() {
+		auto successor = __atomic_load_n(&_head.next, __ATOMIC_ACQUIRE);
+		if(!successor) {
+			Node *expected = &_head;
+			if(__atomic_compare_exchange_n(&_tail, &expected, nullptr, false,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+				return;
+
+			while(!(successor = __atomic_load_n(&_head.next, __ATOMIC_ACQUIRE)))
+				pause();
+		}
+		__atomic_store_n(&successor->waiting, false, __ATOMIC_RELEASE);
+	}
+
+private:
+	Node _head;
+	Node *_tail;
+};
+
 } // namespace frigg
 
 #endif // FRIGG_ARCH_X86_ATOMIC_IMPL_HPP
@@ -34,6 +34,7 @@ inline Array<uint32_t, 4> cpuid(uint32_t eax, uint32_t ecx = 0) {
 
 enum {
 	kMsrLocalApicBase = 0x0000001B,
+	kMsrXss = 0x00000DA0,
 	kMsrEfer = 0xC0000080,
 	kMsrStar = 0xC0000081,
 	kMsrLstar = 0xC0000082,
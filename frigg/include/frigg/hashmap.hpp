@@ -63,6 +63,7 @@ public:
 
 		Hashmap &map;
 		Item *item;
+		// Next bucket to visit once the chain of item is exhausted.
 		size_t bucket;
 	};
 
@@ -82,7 +83,7 @@ public:
 
 		for(size_t bucket = 0; bucket < p_capacity; bucket++) {
 			if(p_table[bucket])
-				return Iterator(*this, bucket, p_table[bucket]);
+				return Iterator(*this, bucket + 1, p_table[bucket]);
 		}
 		
 		assert(!"Hashmap corrupted");
@@ -271,14 +271,15 @@ struct buddy_tools {
 	using address_type = size_t;
 
 private:
-	// Determines the largest free chunk in the given range.
-	static int scan_free(int8_t *slice, address_type base, address_type limit) {
-		int free_order = -1;
-		for(address_type i = 0; i < limit; i++) {
-			if(slice[base + i] >= free_order)
-				free_order = slice[base + i];
-		}
-		return free_order;
+	// Determines the largest free chunk below an element from its two children,
+	// which are at the given order. If both children are completely free,
+	// they are merged into a chunk of the next higher order.
+	static int scan_free(int8_t *slice, address_type index, int order) {
+		auto left = slice[2 * index];
+		auto right = slice[2 * index + 1];
+		if(left == order && right == order)
+			return order + 1;
+		return left > right ? left : right;
 	}
 
 	static address_type find_target(int8_t *slice, address_type base, address_type limit,
@@ -302,8 +303,10 @@ public:
 
 	// Determines the size required for the buddy allocator in bytes.
 	static size_t determine_size(address_type num_roots, int table_order) {
+		// Level table_order - order has num_roots << (table_order - order) entries.
+		// This includes the roots themselves (order == table_order).
 		size_t size = 0;
-		for(int order = 0; order < table_order; order++)
+		for(int order = 0; order <= table_order; order++)
 			size += size_t(num_roots) << (table_order - order);
 		return size;
 	}
@@ -321,14 +324,35 @@ public:
 
 	static address_type allocate(int8_t *pointer, address_type num_roots, int table_order,
 			int target) {
+		auto address = allocate_in_roots(pointer, num_roots, table_order, target,
+				0, num_roots);
+		assert(address != address_type(-1) && "No item available at target order");
+		return address;
+	}
+
+	// Like allocate() but only considers roots in [root_begin, root_end).
+	// Returns address_type(-1) if no element of the target order is available.
+	// Allocations in disjoint ranges of roots touch disjoint parts of the table.
+	static address_type allocate_in_roots(int8_t *pointer, address_type num_roots,
+			int table_order, int target, address_type root_begin, address_type root_end) {
 		assert(target >= 0 && target <= table_order);
+		assert(root_begin <= root_end && root_end <= num_roots);
 
 		int order = table_order;
 		int8_t *slice = pointer;
 
 		// First phase: Descent to the target order.
 		// In this phase find a free element.
-		address_type alloc_index = find_target(slice, 0,  num_roots, target);
+		address_type alloc_index = address_type(-1);
+		for(address_type i = root_begin; i < root_end; i++) {
+			if(slice[i] >= target) {
+				alloc_index = i;
+				break;
+			}
+		}
+		if(alloc_index == address_type(-1))
+			return address_type(-1);
+
 		while(order > target) {
 			slice += size_t(num_roots) << (table_order - order);
 			order--;
@@ -344,7 +368,7 @@ public:
 		address_type update_index = alloc_index;
 		while(order < table_order) {
 			update_index /= 2;
-			auto free_order = scan_free(slice, 2 * update_index, 2);
+			auto free_order = scan_free(slice, update_index, order);
 			order++;
 			slice -= size_t(num_roots) << (table_order - order);		
 			slice[update_index] = free_order;
@@ -376,7 +400,7 @@ public:
 		// Update all superior elements.
 		while(order < table_order) {
 			update_index /= 2;
-			auto free_order = scan_free(slice, 2 * update_index, 2);
+			auto free_order = scan_free(slice, update_index, order);
 			order++;
 			slice -= size_t(num_roots) << (table_order - order);		
 			slice[update_index] = free_order;
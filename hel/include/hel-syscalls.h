@@ -55,6 +55,16 @@ extern inline __attribute__ (( always_inline )) HelError helCreateQueue(HelQueue
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helCreateQueue2(HelQueue *head,
+		uint32_t flags, unsigned int size_shift, size_t element_limit, size_t chunk_size,
+		HelHandle *handle) {
+	HelWord hel_handle;
+	HelError error = helSyscall5_1(kHelCallCreateQueue2, (HelWord)head, (HelWord)flags,
+			(HelWord)size_shift, (HelWord)element_limit, (HelWord)chunk_size, &hel_handle);
+	*handle = (HelHandle)hel_handle;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSetupChunk(HelHandle queue,
 		int index, HelChunk *chunk, uint32_t flags) {
 	return helSyscall4(kHelCallSetupChunk, (HelWord)queue, (HelWord)index,
@@ -138,6 +148,12 @@ extern inline __attribute__ (( always_inline )) HelError helUnmapMemory(HelHandl
 	return helSyscall3(kHelCallUnmapMemory, (HelWord)space, (HelWord)pointer, (HelWord)size);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helAdviseMemory(HelHandle space,
+		void *pointer, size_t size, uint32_t advice) {
+	return helSyscall4(kHelCallAdviseMemory, (HelWord)space, (HelWord)pointer, (HelWord)size,
+			(HelWord)advice);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helPointerPhysical(void *pointer, 
 		uintptr_t *physical) {
 	HelWord handle_word;
@@ -188,6 +204,20 @@ extern inline __attribute__ (( always_inline )) HelError helLoadahead(HelHandle
 	return helSyscall3(kHelCallLoadahead, (HelWord)handle, (HelWord)offset, (HelWord)length);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetSwapMemory(HelHandle handle) {
+	return helSyscall1(kHelCallSetSwapMemory, (HelWord)handle);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryCompressedPoolStats(
+		HelCompressedPoolStats *stats) {
+	return helSyscall1(kHelCallQueryCompressedPoolStats, (HelWord)stats);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryPageMergeStats(
+		HelPageMergeStats *stats) {
+	return helSyscall1(kHelCallQueryPageMergeStats, (HelWord)stats);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateThread(HelHandle universe,
 		HelHandle address_space, HelAbi abi, void *ip, void *sp, uint32_t flags,
 		HelHandle *handle) {
@@ -203,6 +233,11 @@ extern inline __attribute__ (( always_inline )) HelError helQueryThreadStats(Hel
 	return helSyscall2(kHelCallQueryThreadStats, (HelWord)handle, (HelWord)stats);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helQueryCpuStats(int cpu,
+		HelCpuStats *stats) {
+	return helSyscall2(kHelCallQueryCpuStats, (HelWord)cpu, (HelWord)stats);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helYield() {
 	return helSyscall0(kHelCallYield);
 };
@@ -212,6 +247,12 @@ extern inline __attribute__ (( always_inline )) HelError helSetPriority(HelHandl
 	return helSyscall2(kHelCallSetPriority, (HelWord)handle, (HelWord)priority);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetSchedulingPolicy(HelHandle handle,
+		int policy, int priority) {
+	return helSyscall3(kHelCallSetSchedulingPolicy, (HelWord)handle,
+			(HelWord)policy, (HelWord)priority);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitObserve(HelHandle handle,
 		uint64_t in_seq, HelHandle queue, uintptr_t context) {
 	return helSyscall4(kHelCallSubmitObserve, (HelWord)handle, (HelWord)in_seq,
@@ -240,6 +281,23 @@ extern inline __attribute__ (( always_inline )) HelError helStoreRegisters(HelHa
 	return helSyscall3(kHelCallStoreRegisters, (HelWord)handle, (HelWord)set, (HelWord)image);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helStartProfiling(uint64_t interval) {
+	return helSyscall1(kHelCallStartProfiling, (HelWord)interval);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helStopProfiling() {
+	return helSyscall0(kHelCallStopProfiling);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helReadProfile(unsigned int cpu,
+		struct HelProfileSample *samples, size_t max_samples, size_t *num_samples) {
+	HelWord count;
+	HelError error = helSyscall3_1(kHelCallReadProfile, (HelWord)cpu, (HelWord)samples,
+			(HelWord)max_samples, &count);
+	*num_samples = count;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helWriteFsBase(void *pointer) {
 	return helSyscall1(kHelCallWriteFsBase, (HelWord)pointer);
 };
@@ -251,6 +309,13 @@ extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *c
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helMapClockPage(void **pointer) {
+	HelWord pointer_word;
+	HelError error = helSyscall0_1(kHelCallMapClockPage, &pointer_word);
+	*pointer = (void *)pointer_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *async_id) {
 	HelWord async_word;
@@ -334,6 +399,12 @@ extern inline __attribute__ (( always_inline )) HelError helAutomateIrq(HelHandl
 			(HelWord)kernlet);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetIrqCoalescing(HelHandle handle,
+		uint64_t window, uint64_t burst) {
+	return helSyscall3(kHelCallSetIrqCoalescing, (HelWord)handle, (HelWord)window,
+			(HelWord)burst);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helAccessIo(uintptr_t *port_array,
 		size_t num_ports, HelHandle *handle) {
 	HelWord out_handle;
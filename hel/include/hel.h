@@ -15,7 +15,7 @@
 
 enum {
 	// largest system call number plus 1
-	kHelNumCalls = 99,
+	kHelNumCalls = 111,
 
 	kHelCallLog = 1,
 	kHelCallPanic = 10,
@@ -27,6 +27,7 @@ enum {
 	kHelCallCloseDescriptor = 20,
 
 	kHelCallCreateQueue = 89,
+	kHelCallCreateQueue2 = 110,
 	kHelCallSetupChunk = 90,
 	kHelCallCancelAsync = 92,
 
@@ -39,6 +40,7 @@ enum {
 	kHelCallForkSpace = 33,
 	kHelCallMapMemory = 44,
 	kHelCallUnmapMemory = 36,
+	kHelCallAdviseMemory = 109,
 	kHelCallPointerPhysical = 43,
 	kHelCallLoadForeign = 77,
 	kHelCallStoreForeign = 78,
@@ -47,10 +49,15 @@ enum {
 	kHelCallUpdateMemory = 47,
 	kHelCallSubmitLockMemoryView = 48,
 	kHelCallLoadahead = 49,
+	kHelCallSetSwapMemory = 106,
+	kHelCallQueryCompressedPoolStats = 107,
+	kHelCallQueryPageMergeStats = 108,
 	
 	kHelCallCreateThread = 67,
 	kHelCallQueryThreadStats = 95,
+	kHelCallQueryCpuStats = 104,
 	kHelCallSetPriority = 85,
+	kHelCallSetSchedulingPolicy = 103,
 	kHelCallYield = 34,
 	kHelCallSubmitObserve = 74,
 	kHelCallKillThread = 87,
@@ -58,9 +65,14 @@ enum {
 	kHelCallResume = 61,
 	kHelCallLoadRegisters = 75,
 	kHelCallStoreRegisters = 76,
+
+	kHelCallStartProfiling = 100,
+	kHelCallStopProfiling = 101,
+	kHelCallReadProfile = 102,
 	kHelCallWriteFsBase = 41,
 	kHelCallGetClock = 42,
 	kHelCallSubmitAwaitClock = 80,
+	kHelCallMapClockPage = 105,
 	
 	kHelCallCreateStream = 68,
 	kHelCallSubmitAsync = 79,
@@ -76,6 +88,7 @@ enum {
 	kHelCallAcknowledgeIrq = 81,
 	kHelCallSubmitAwaitEvent = 82,
 	kHelCallAutomateIrq = 94,
+	kHelCallSetIrqCoalescing = 99,
 
 	kHelCallAccessIo = 11,
 	kHelCallEnableIo = 12,
@@ -177,7 +190,16 @@ struct HelDescriptorInfo {
 enum HelAllocFlags {
 	kHelAllocContinuous = 4,
 	kHelAllocOnDemand = 1,
-	kHelAllocBacked = 2
+	kHelAllocBacked = 2,
+	// Pages may be evicted to the swap space (see helSetSwapMemory()).
+	// Do not use this for memory whose physical address is handed to devices.
+	kHelAllocSwappable = 8,
+	// Private copies (see kHelMapCopyOnWrite) of this memory are scanned for
+	// identical pages; those are merged into a single read-only page.
+	kHelAllocMergeable = 16,
+	// The memory is only accessed through private copies (see kHelMapCopyOnWrite)
+	// and never written directly. Private copies that are discarded read as zeros.
+	kHelAllocAnonymous = 32
 };
 
 enum HelManageRequests {
@@ -196,11 +218,33 @@ enum HelMapFlags {
 	kHelMapProtExecute = 1024,
 	kHelMapDropAtFork = 32,
 	kHelMapCopyOnWriteAtFork = 64,
-	kHelMapDontRequireBacking = 128
+	kHelMapDontRequireBacking = 128,
+	// Fault in the whole range before helMapMemory() returns.
+	kHelMapPopulate = 2048
+};
+
+enum HelAdvice {
+	// Start to load the range in the background.
+	kHelAdviseWillNeed = 1,
+	// Drop the pages of the range. Shared mappings fault in the underlying memory again.
+	// Copy-on-write mappings drop their private copies and read the underlying memory
+	// again (or zeros if it was allocated with kHelAllocAnonymous).
+	kHelAdviseDontNeed = 2,
+	// Tune the readahead on page faults.
+	kHelAdviseNormal = 3,
+	kHelAdviseSequential = 4,
+	kHelAdviseRandom = 5
 };
 
 enum HelThreadFlags {
-	kHelThreadStopped = 1
+	kHelThreadStopped = 1,
+	//! Threads inherit the permission to use real-time scheduling policies
+	//! from their creator. This flag drops that permission for the new thread
+	//! (and all threads that it creates).
+	kHelThreadNoRealtime = 2,
+	//! Like kHelThreadNoRealtime but for the permission to use privileged
+	//! system calls (e.g., helSetSwapMemory()).
+	kHelThreadUnprivileged = 4
 };
 
 enum HelObservation {
@@ -274,6 +318,10 @@ static const int kHelProgressWaiters = (1 << 24);
 //! Set by the kernel once it retires the chunk.
 static const int kHelProgressDone = (1 << 25);
 
+//! Size of the buffer of each chunk that helCreateQueue() uses.
+//! helCreateQueue2() also uses it if it is passed a chunk_size of zero.
+static const size_t kHelQueueDefaultChunkSize = 4096;
+
 struct HelChunk {
 	//! Futex for kernel/user-space progress synchronization.
 	int progressFutex;
@@ -347,6 +395,9 @@ struct HelEventResult {
 	HelError error;
 	uint32_t bitset;
 	uint64_t sequence;
+	//! Number of IRQs that are reported by this completion.
+	//! Always zero for events.
+	uint64_t count;
 };
 
 enum HelIrqFlags {
@@ -357,15 +408,133 @@ enum HelIrqFlags {
 enum HelAckFlags {
 	kHelAckAcknowledge = 2,
 	kHelAckNack = 3,
-	kHelAckKick = 1
+	kHelAckKick = 1,
+	//! Re-enables an IRQ that was acknowledged with kHelAckPoll.
+	kHelAckUnmask = 4,
+
+	//! Can be combined with kHelAckAcknowledge to keep the IRQ masked.
+	//! Drivers poll the device until it becomes idle and then use kHelAckUnmask.
+	//! Fails with kHelErrIllegalArgs if other IRQ objects share the IRQ line.
+	kHelAckPoll = 0x100
 };
 
 union HelKernletData {
 	HelHandle handle;
 };
 
+enum {
+	// Bucket 0 counts latencies below 1 us, bucket k > 0 counts latencies
+	// in [2^(k - 1), 2^k) us. The last bucket also counts all larger latencies.
+	kHelNumLatencyBuckets = 16
+};
+
 struct HelThreadStats {
 	uint64_t userTime;
+	// Total time (in ns) that the thread was runnable but not running.
+	uint64_t waitTime;
+	// Switches away from the thread because it blocked or was preempted.
+	uint64_t numVoluntarySwitches;
+	uint64_t numInvoluntarySwitches;
+	uint64_t numMigrations;
+	// Time from wakeup until the thread runs.
+	uint64_t wakeupLatency[kHelNumLatencyBuckets];
+	// Time spent in the run queue, including after preemption.
+	uint64_t runQueueWait[kHelNumLatencyBuckets];
+};
+
+struct HelCpuStats {
+	uint64_t waitTime;
+	uint64_t numVoluntarySwitches;
+	uint64_t numInvoluntarySwitches;
+	uint64_t numMigrations;
+	uint64_t wakeupLatency[kHelNumLatencyBuckets];
+	uint64_t runQueueWait[kHelNumLatencyBuckets];
+};
+
+struct HelCompressedPoolStats {
+	// Pages (and their compressed size in bytes) that are currently stored.
+	uint64_t storedPages;
+	uint64_t compressedBytes;
+	// Physical pages that are used to hold compressed data.
+	uint64_t poolPages;
+	// Pages that were compressed and decompressed again.
+	uint64_t numStores;
+	uint64_t numHits;
+	// Pages that did not compress well enough (or did not fit into the pool).
+	uint64_t numRejects;
+};
+
+struct HelPageMergeStats {
+	// Distinct pages that back merged memory.
+	uint64_t sharedPages;
+	// Additional mappings of those pages, i.e., the number of pages that are saved.
+	uint64_t sharingPages;
+	// Pages that were checksummed by the scanner.
+	uint64_t numScanned;
+	// Pages that were merged into an identical page.
+	uint64_t numMerged;
+	// Writes that broke sharing of a merged page.
+	uint64_t numBroken;
+};
+
+enum {
+	// The TSC is invariant (i.e., it runs at a constant rate in all power states).
+	// The kernel does not check that the TSCs of different CPUs are synchronized;
+	// like thor's own clock, this relies on the firmware to synchronize them.
+	kHelClockPageTscStable = 1
+};
+
+//! Page that allows user space to compute the value of helGetClock() without a syscall.
+//! The clock is given by ((rdtsc() * tscMult) >> tscShift) + nanosOffset
+//! (with a 128-bit intermediate product). This is only valid if kHelClockPageTscStable is set.
+//! The page is protected by a seqlock; readers must retry if seqlock is odd or changes.
+struct HelClockPage {
+	uint32_t seqlock;
+	uint32_t flags;
+	uint64_t tscMult;
+	uint32_t tscShift;
+	uint32_t padding;
+	int64_t nanosOffset;
+};
+
+enum {
+	// Default time-sharing policy. Threads are ordered by their priority
+	// and receive fair shares of CPU time within the same priority.
+	kHelSchedFair = 0,
+	// Real-time policies. Real-time threads always preempt fair threads.
+	// Within the same real-time priority, FIFO threads run until they block
+	// while round-robin threads are preempted after a fixed time slice.
+	kHelSchedFifo = 1,
+	kHelSchedRoundRobin = 2
+};
+
+enum {
+	kHelMinRtPriority = 1,
+	kHelMaxRtPriority = 99
+};
+
+enum {
+	kHelProfileMaxFrames = 8
+};
+
+enum {
+	// The sample was taken while the CPU executed kernel code.
+	kHelProfileKernel = 1,
+	// The sample was taken while the CPU was idle.
+	kHelProfileIdle = 2
+};
+
+struct HelProfileSample {
+	uint64_t timestamp;
+	// Opaque identifiers of the interrupted thread and its address space.
+	// Both are zero for idle and kernel fiber samples.
+	uint64_t thread;
+	uint64_t space;
+	uint64_t ip;
+	uint32_t flags;
+	uint32_t numFrames;
+	// Return addresses obtained by walking the frame pointer chain.
+	uint64_t frames[kHelProfileMaxFrames];
 };
 
 HEL_C_LINKAGE HelError helLog(const char *string, size_t length);
@@ -383,8 +552,18 @@ HEL_C_LINKAGE HelError helCloseDescriptor(HelHandle handle);
 //! size_shift:    Size of the indexQueue array.
 //! element_limit: Maximum size of a single element in bytes.
 //!                Does not include the per-element HelElement header.
+//!                Not validated by helCreateQueue(); operations whose elements do not
+//!                fit into a chunk fail with kHelErrQueueTooSmall.
 HEL_C_LINKAGE HelError helCreateQueue(HelQueue *head, uint32_t flags,
 		unsigned int size_shift, size_t element_limit, HelHandle *handle);
+//! Like helCreateQueue() but allows to choose the size of the chunks.
+//! chunk_size:    Size of the buffer of each HelChunk in bytes (or zero for
+//!                kHelQueueDefaultChunkSize). Must be a multiple of 8 and
+//!                large enough for a HelElement plus element_limit bytes
+//!                (otherwise, kHelErrIllegalArgs is returned).
+HEL_C_LINKAGE HelError helCreateQueue2(HelQueue *head, uint32_t flags,
+		unsigned int size_shift, size_t element_limit, size_t chunk_size,
+		HelHandle *handle);
 HEL_C_LINKAGE HelError helSetupChunk(HelHandle queue, int index, HelChunk *chunk, uint32_t flags);
 HEL_C_LINKAGE HelError helCancelAsync(HelHandle queue, uint64_t async_id);
 
@@ -401,6 +580,10 @@ HEL_C_LINKAGE HelError helForkSpace(HelHandle handle, HelHandle *forked);
 HEL_C_LINKAGE HelError helMapMemory(HelHandle handle, HelHandle space,
 		void *pointer, uintptr_t offset, size_t size, uint32_t flags, void **actual_pointer);
 HEL_C_LINKAGE HelError helUnmapMemory(HelHandle space, void *pointer, size_t size);
+//! Gives the kernel a hint (see HelAdvice) about the future use of a range of memory.
+//! The range must be page-aligned and covered by mappings.
+HEL_C_LINKAGE HelError helAdviseMemory(HelHandle space, void *pointer, size_t size,
+		uint32_t advice);
 HEL_C_LINKAGE HelError helPointerPhysical(void *pointer, uintptr_t *physical);
 HEL_C_LINKAGE HelError helLoadForeign(HelHandle handle, uintptr_t address,
 		size_t length, void *buffer);
@@ -414,11 +597,28 @@ HEL_C_LINKAGE HelError helUpdateMemory(HelHandle handle, int type, uintptr_t off
 HEL_C_LINKAGE HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size,
 		HelHandle queue, uintptr_t context);
 HEL_C_LINKAGE HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length);
+//! Makes the memory a swap space. handle must refer to the backing memory of a
+//! managed memory object (see helCreateManagedMemory()).
+//! Each page of that object is a swap slot; the kernel requests writeback of
+//! evicted anonymous pages and initialization of pages that are swapped in.
+//! Returns kHelErrIllegalState if a swap space is already set.
+//! Returns kHelErrIllegalArgs if the calling thread is not privileged
+//! (see kHelThreadUnprivileged).
+HEL_C_LINKAGE HelError helSetSwapMemory(HelHandle handle);
+//! Queries statistics of the pool that stores compressed anonymous pages.
+//! The compression ratio is given by storedPages / poolPages.
+HEL_C_LINKAGE HelError helQueryCompressedPoolStats(HelCompressedPoolStats *stats);
+//! Queries statistics of the merging of identical pages (see kHelAllocMergeable).
+HEL_C_LINKAGE HelError helQueryPageMergeStats(HelPageMergeStats *stats);
 
 HEL_C_LINKAGE HelError helCreateThread(HelHandle universe, HelHandle address_space,
 		HelAbi abi, void *ip, void *sp, uint32_t flags, HelHandle *handle);
 HEL_C_LINKAGE HelError helQueryThreadStats(HelHandle handle, HelThreadStats *stats);
+HEL_C_LINKAGE HelError helQueryCpuStats(int cpu, HelCpuStats *stats);
 HEL_C_LINKAGE HelError helSetPriority(HelHandle handle, int priority);
+//! Returns kHelErrIllegalArgs if a real-time policy is requested but the calling thread
+//! was created with kHelThreadNoRealtime (or by such a thread).
+HEL_C_LINKAGE HelError helSetSchedulingPolicy(HelHandle handle, int policy, int priority);
 HEL_C_LINKAGE HelError helYield();
 HEL_C_LINKAGE HelError helSubmitObserve(HelHandle handle, uint64_t in_seq,
 		HelHandle queue, uintptr_t context);
@@ -427,10 +627,23 @@ HEL_C_LINKAGE HelError helInterruptThread(HelHandle handle);
 HEL_C_LINKAGE HelError helResume(HelHandle handle);
 HEL_C_LINKAGE HelError helLoadRegisters(HelHandle handle, int set, void *image); 
 HEL_C_LINKAGE HelError helStoreRegisters(HelHandle handle, int set, const void *image);
+
+//! The profiling calls return kHelErrIllegalArgs if the calling thread is not
+//! privileged (see kHelThreadUnprivileged).
+//! interval: Time (in nanoseconds) between two samples on the same CPU.
+HEL_C_LINKAGE HelError helStartProfiling(uint64_t interval);
+HEL_C_LINKAGE HelError helStopProfiling();
+//! Moves up to max_samples samples of the given CPU into the samples array.
+//! Returns kHelErrIllegalArgs if cpu does not exist.
+HEL_C_LINKAGE HelError helReadProfile(unsigned int cpu, struct HelProfileSample *samples,
+		size_t max_samples, size_t *num_samples);
 HEL_C_LINKAGE HelError helWriteFsBase(void *pointer);
 HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
 HEL_C_LINKAGE HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *async_id);
+//! Maps the read-only clock page (see HelClockPage) into the current address space.
+//! The mapping is shared with forked address spaces.
+HEL_C_LINKAGE HelError helMapClockPage(void **pointer);
 
 HEL_C_LINKAGE HelError helCreateStream(HelHandle *lane1, HelHandle *lane2);
 HEL_C_LINKAGE HelError helSubmitAsync(HelHandle handle, const HelAction *actions,
@@ -448,6 +661,11 @@ HEL_C_LINKAGE HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint6
 HEL_C_LINKAGE HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 		HelHandle queue, uintptr_t context);
 HEL_C_LINKAGE HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet);
+//! window: Maximal delay (in nanoseconds) of IRQ completions. Zero disables coalescing.
+//! burst:  Number of IRQs after which a completion is delivered early. Zero means unlimited.
+//! While a completion is delayed, the kernel acknowledges the IRQ itself. Hence, coalescing
+//! fails with kHelErrIllegalArgs for level-triggered IRQs that are not automated by a kernlet.
+HEL_C_LINKAGE HelError helSetIrqCoalescing(HelHandle handle, uint64_t window, uint64_t burst);
 
 HEL_C_LINKAGE HelError helAccessIo(uintptr_t *port_array, size_t num_ports,
 		HelHandle *handle);
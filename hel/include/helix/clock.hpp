@@ -0,0 +1,18 @@
+#ifndef HELIX_CLOCK_HPP
+#define HELIX_CLOCK_HPP
+
+#include <stdint.h>
+
+namespace helix {
+
+// Returns the same value as helGetClock() (i.e., CLOCK_MONOTONIC in nanoseconds).
+// If the kernel reports a stable TSC, this reads the TSC and does not enter the kernel.
+// Otherwise, it falls back to helGetClock().
+uint64_t currentClock();
+
+// Returns true if currentClock() can avoid the syscall.
+bool haveFastClock();
+
+} // namespace helix
+
+#endif // HELIX_CLOCK_HPP
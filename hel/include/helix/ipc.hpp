@@ -3,6 +3,7 @@
 #define HELIX_HPP
 
 #include <assert.h>
+#include <algorithm>
 #include <atomic>
 #include <initializer_list>
 #include <list>
@@ -11,6 +12,7 @@
 #include <async/result.hpp>
 #include <hel.h>
 #include <hel-syscalls.h>
+#include <helix/pool.hpp>
 
 namespace helix {
 
@@ -181,7 +183,7 @@ private:
 	void *_data;
 };
 
-struct OperationBase {
+struct OperationBase : PoolAllocated {
 	friend struct Dispatcher;
 
 	OperationBase()
@@ -219,12 +221,18 @@ private:
 	uint64_t _asyncId;
 };
 
-struct Context {
+struct Context : PoolAllocated {
 	virtual ~Context() = default;
 
 	virtual void complete(ElementHandle element) = 0;
 };
 
+// Consumes the completions of a HelQueue.
+// By default, the dispatcher must only be used by a single thread.
+// In concurrent mode, any number of threads may call wait() and dispatchAvailable()
+// at the same time. Retrieving elements from the queue is serialized but the elements
+// of a batch are completed outside of the lock, i.e., Context::complete() (and
+// everything that it resumes) runs in parallel on all threads that wait().
 struct Dispatcher : async::io_service {
 	friend struct ElementHandle;
 
@@ -242,109 +250,170 @@ private:
 		size_t progress;
 	};
 
+	// Locks a FutexLock if the dispatcher is in concurrent mode.
+	struct Guard {
+		Guard(Dispatcher *dispatcher, FutexLock &lock)
+		: _lock{dispatcher->_concurrent ? &lock : nullptr} {
+			if(_lock)
+				_lock->lock();
+		}
+
+		Guard(const Guard &) = delete;
+
+		~Guard() {
+			if(_lock)
+				_lock->unlock();
+		}
+
+		Guard &operator= (const Guard &) = delete;
+
+	private:
+		FutexLock *_lock;
+	};
+
+	// An element that was retrieved from the queue but that is not completed yet.
+	struct Retrieved {
+		Context *context;
+		int cn;
+		void *data;
+	};
+
 public:
 	static constexpr int sizeShift = 9;
 
+	// Larger chunks let the kernel emit more elements before user space has to requeue.
+	static constexpr size_t defaultChunkSize = 16384;
+
+	// Maximal number of elements that wait() dispatches at once.
+	static constexpr size_t maxBatchSize = 64;
+
 	static Dispatcher &global();
 
-	Dispatcher()
-	: _handle{kHelNullHandle}, _queue{nullptr},
-			_activeChunks{0}, _retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} { }
+	explicit Dispatcher(size_t chunk_size = defaultChunkSize, bool concurrent = false)
+	: _handle{kHelNullHandle}, _queue{nullptr}, _chunkSize{chunk_size},
+			_concurrent{concurrent}, _activeChunks{0}, _hadWaiters{false},
+			_retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} { }
 
 	Dispatcher(const Dispatcher &) = delete;
+
+	// All submissions to the queue must be complete and all ElementHandles
+	// must be released. The chunks are recycled by other dispatchers.
+	~Dispatcher() {
+		if(!_handle)
+			return;
+		HEL_CHECK(helCloseDescriptor(_handle));
+		for(int cn = 0; cn < _activeChunks; cn++)
+			chunkPool().deallocate(_chunks[cn], _chunkSize);
+		operator delete(_queue);
+	}
 	
 	Dispatcher &operator= (const Dispatcher &) = delete;
 
+	bool concurrent() {
+		return _concurrent;
+	}
+
 	HelHandle acquire() {
+		auto handle = __atomic_load_n(&_handle, __ATOMIC_ACQUIRE);
+		if(handle)
+			return handle;
+
+		Guard lock{this, _requeueMutex};
 		if(!_handle) {
 			_queue = reinterpret_cast<HelQueue *>(operator new(sizeof(HelQueue)
 					+ (1 << sizeShift) * sizeof(int)));
 			_queue->headFutex = 0;
-			HEL_CHECK(helCreateQueue(_queue, 0, sizeShift, 128, &_handle));
+			HEL_CHECK(helCreateQueue2(_queue, 0, sizeShift, 128, _chunkSize, &handle));
+			__atomic_store_n(&_handle, handle, __ATOMIC_RELEASE);
 		}
-
 		return _handle;
 	}
 
 	void wait() override {
+		Retrieved batch[maxBatchSize];
+		size_t n;
 		while(true) {
-			if(_retrieveIndex == _nextIndex) {
-				assert(_activeChunks < (1 << sizeShift));
-				if(_activeChunks >= 16)
-					std::cerr << "\e[35mhelix: Queue is forced to grow to " << _activeChunks
-							<< " chunks (memory leak?)\e[39m" << std::endl;
-
-				auto chunk = reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk) + 4096));
-				_chunks[_activeChunks] = chunk;
-				HEL_CHECK(helSetupChunk(_handle, _activeChunks, chunk, 0));
-				
-				// Reset and enqueue the new chunk.
-				chunk->progressFutex = 0;
-
-				_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
-				_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-				_wakeHeadFutex();
-				
-				_refCounts[_activeChunks] = 1;
-				_activeChunks++;
-				continue;
-			}else if (_hadWaiters && _activeChunks < (1 << sizeShift)) {
-//				std::cerr << "\e[35mhelix: Growing queue to " << _activeChunks
-//						<< " chunks to improve throughput\e[39m" << std::endl;
-
-				auto chunk = reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk) + 4096));
-				_chunks[_activeChunks] = chunk;
-				HEL_CHECK(helSetupChunk(_handle, _activeChunks, chunk, 0));
-				
-				// Reset and enqueue the new chunk.
-				chunk->progressFutex = 0;
-
-				_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = _activeChunks;
-				_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-				_wakeHeadFutex();
-				
-				_refCounts[_activeChunks] = 1;
-				_activeChunks++;
-				_hadWaiters = false;
-			}
+			int *futex;
+			int expected;
+			{
+				Guard lock{this, _retrieveMutex};
+				if(_retrieveIndex == _nextIndex.load(std::memory_order_acquire)) {
+					assert(_activeChunks < (1 << sizeShift));
+					if(_activeChunks >= 16)
+						std::cerr << "\e[35mhelix: Queue is forced to grow to " << _activeChunks
+								<< " chunks (memory leak?)\e[39m" << std::endl;
+
+					_enqueueNewChunk();
+					continue;
+				}else if (_hadWaiters.load(std::memory_order_relaxed)
+						&& _activeChunks < (1 << sizeShift)) {
+//					std::cerr << "\e[35mhelix: Growing queue to " << _activeChunks
+//							<< " chunks to improve throughput\e[39m" << std::endl;
+
+					_enqueueNewChunk();
+					_hadWaiters.store(false, std::memory_order_relaxed);
+				}
 
-			bool done;
-			_waitProgressFutex(&done);
-			if(done) {
-				_surrender(_numberOf(_retrieveIndex));
+				bool done;
+				if(_armProgressFutex(&done, &expected)) {
+					if(done) {
+						_retireChunk();
+						continue;
+					}
 
-				_lastProgress = 0;
-				_retrieveIndex = ((_retrieveIndex + 1) & kHelHeadMask);
-				continue;
+					// Dispatch all elements that the kernel published together.
+					n = _retrieveAvailable(batch, maxBatchSize);
+					break;
+				}
+
+				// Chunks are only freed by ~Dispatcher(), so the futex stays valid
+				// after we drop the lock. If other threads retrieve from (or requeue)
+				// the chunk in the meantime, the futex changes and the wait returns.
+				futex = &_retrieveChunk()->progressFutex;
 			}
 
-			// Dequeue the next element.
-			auto ptr = (char *)_retrieveChunk() + sizeof(HelChunk) + _lastProgress;
-			auto element = reinterpret_cast<HelElement *>(ptr);
-			_lastProgress += sizeof(HelElement) + element->length;
-			
-			auto context = reinterpret_cast<Context *>(element->context);
-			_refCounts[_numberOf(_retrieveIndex)]++;
-			context->complete(ElementHandle{this, _numberOf(_retrieveIndex),
-					ptr + sizeof(HelElement)});
-			return;
+			// Sleep without holding _retrieveMutex so that dispatchAvailable()
+			// (and other waiters) are not blocked until the kernel makes progress.
+			HEL_CHECK(helFutexWait(futex, expected));
+		}
+
+		_completeBatch(batch, n);
+	}
+
+	// Dispatches up to limit elements without blocking.
+	// Returns the number of elements that were dispatched.
+	size_t dispatchAvailable(size_t limit) {
+		size_t total = 0;
+		while(total < limit) {
+			Retrieved batch[maxBatchSize];
+			size_t n;
+			{
+				Guard lock{this, _retrieveMutex};
+				n = _retrieveAvailable(batch, std::min(limit - total, maxBatchSize));
+			}
+			if(!n)
+				break;
+			_completeBatch(batch, n);
+			total += n;
 		}
+		return total;
 	}
 
 private:
+	// Can be called from any thread (in concurrent mode).
 	void _surrender(int cn) {
-		assert(_refCounts[cn] > 0);
-		if(_refCounts[cn]-- > 1)
+		auto count = _refCounts[cn].fetch_sub(1, std::memory_order_acq_rel);
+		assert(count > 0);
+		if(count > 1)
 			return;
 
-		// Reset and requeue the chunk.
+		// Reset and requeue the chunk. As soon as the chunk is requeued,
+		// other threads may retrieve elements from it.
+		_refCounts[cn].store(1, std::memory_order_relaxed);
 		_chunks[cn]->progressFutex = 0;
 
-		_queue->indexQueue[_nextIndex & ((1 << sizeShift) - 1)] = cn;
-		_nextIndex = ((_nextIndex + 1) & kHelHeadMask);
-		_wakeHeadFutex();
-
-		_refCounts[cn] = 1;
+		Guard lock{this, _requeueMutex};
+		_requeue(cn);
 	}
 
 private:
@@ -357,53 +426,147 @@ private:
 		return _chunks[cn];
 	}
 
-	void _wakeHeadFutex() {
-		auto futex = __atomic_exchange_n(&_queue->headFutex, _nextIndex, __ATOMIC_RELEASE);
+	// Must be called with _retrieveMutex held.
+	void _enqueueNewChunk() {
+		auto chunk = chunkPool().allocate(_chunkSize);
+		_chunks[_activeChunks] = chunk;
+		HEL_CHECK(helSetupChunk(_handle, _activeChunks, chunk, 0));
+
+		// Reset and enqueue the new chunk.
+		chunk->progressFutex = 0;
+		_refCounts[_activeChunks].store(1, std::memory_order_relaxed);
+
+		{
+			Guard lock{this, _requeueMutex};
+			_requeue(_activeChunks);
+		}
+		_activeChunks++;
+	}
+
+	// Must be called with _requeueMutex held.
+	void _requeue(int cn) {
+		auto index = _nextIndex.load(std::memory_order_relaxed);
+		_queue->indexQueue[index & ((1 << sizeShift) - 1)] = cn;
+		index = ((index + 1) & kHelHeadMask);
+		_nextIndex.store(index, std::memory_order_release);
+		_wakeHeadFutex(index);
+	}
+
+	// Must be called with _retrieveMutex held.
+	void _retireChunk() {
+		_surrender(_numberOf(_retrieveIndex));
+
+		_lastProgress = 0;
+		_retrieveIndex = ((_retrieveIndex + 1) & kHelHeadMask);
+	}
+
+	// Retrieves up to limit elements without blocking. Must be called with _retrieveMutex held.
+	// Each retrieved element holds a reference to its chunk.
+	size_t _retrieveAvailable(Retrieved *batch, size_t limit) {
+		size_t n = 0;
+		while(n < limit && _retrieveIndex != _nextIndex.load(std::memory_order_acquire)) {
+			bool done;
+			if(!_checkProgress(&done))
+				break;
+			if(done) {
+				_retireChunk();
+				continue;
+			}
+
+			auto cn = _numberOf(_retrieveIndex);
+			auto ptr = (char *)_chunks[cn] + sizeof(HelChunk) + _lastProgress;
+			auto element = reinterpret_cast<HelElement *>(ptr);
+			_lastProgress += sizeof(HelElement) + element->length;
+
+			_refCounts[cn].fetch_add(1, std::memory_order_relaxed);
+			batch[n++] = {reinterpret_cast<Context *>(element->context), cn,
+					ptr + sizeof(HelElement)};
+		}
+		return n;
+	}
+
+	void _completeBatch(Retrieved *batch, size_t n) {
+		for(size_t i = 0; i < n; i++)
+			batch[i].context->complete(ElementHandle{this, batch[i].cn, batch[i].data});
+	}
+
+	void _wakeHeadFutex(int index) {
+		auto futex = __atomic_exchange_n(&_queue->headFutex, index, __ATOMIC_RELEASE);
 		if(futex & kHelHeadWaiters) {
 			HEL_CHECK(helFutexWake(&_queue->headFutex));
-			_hadWaiters = true;
+			_hadWaiters.store(true, std::memory_order_relaxed);
 		}
 	}
 
-	void _waitProgressFutex(bool *done) {
-		while(true) {
-			auto futex = __atomic_load_n(&_retrieveChunk()->progressFutex, __ATOMIC_ACQUIRE);
-			do {
-				if(_lastProgress != (futex & kHelProgressMask)) {
-					*done = false;
-					return;
-				}else if(futex & kHelProgressDone) {
-					*done = true;
-					return;
-				}
-
-				assert(futex == _lastProgress);
-			} while(!__atomic_compare_exchange_n(&_retrieveChunk()->progressFutex, &futex,
-						_lastProgress | kHelProgressWaiters,
-						false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
-			
-			HEL_CHECK(helFutexWait(&_retrieveChunk()->progressFutex,
-					_lastProgress | kHelProgressWaiters));
+	// Returns true if there is a new element or if the current chunk was retired.
+	bool _checkProgress(bool *done) {
+		auto futex = __atomic_load_n(&_retrieveChunk()->progressFutex, __ATOMIC_ACQUIRE);
+		if(_lastProgress != (futex & kHelProgressMask)) {
+			*done = false;
+			return true;
+		}else if(futex & kHelProgressDone) {
+			*done = true;
+			return true;
 		}
+		return false;
+	}
+
+	// Returns true if there is a new element or if the current chunk was retired.
+	// Otherwise, sets the waiters bit of the progress futex and stores the value
+	// that must be passed to helFutexWait() in *expected.
+	// Must be called with _retrieveMutex held.
+	bool _armProgressFutex(bool *done, int *expected) {
+		auto futex = __atomic_load_n(&_retrieveChunk()->progressFutex, __ATOMIC_ACQUIRE);
+		do {
+			if(_lastProgress != (futex & kHelProgressMask)) {
+				*done = false;
+				return true;
+			}else if(futex & kHelProgressDone) {
+				*done = true;
+				return true;
+			}
+
+			// Another thread might have already set the waiters bit.
+			assert((futex & ~kHelProgressWaiters) == _lastProgress);
+			if(futex & kHelProgressWaiters)
+				break;
+		} while(!__atomic_compare_exchange_n(&_retrieveChunk()->progressFutex, &futex,
+					_lastProgress | kHelProgressWaiters,
+					false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+		*expected = _lastProgress | kHelProgressWaiters;
+		return false;
 	}
 
 private:
 	HelHandle _handle;
 	HelQueue *_queue;
+	size_t _chunkSize;
 	HelChunk *_chunks[1 << sizeShift];
+
+	bool _concurrent;
+
+	// In concurrent mode, _retrieveMutex protects the retrieval state (i.e., the progress
+	// into the queue and chunk allocation) while _requeueMutex protects the insertion of
+	// chunks. Threads can requeue chunks while another thread blocks in wait().
+	// Lock order: _retrieveMutex before _requeueMutex.
+	FutexLock _retrieveMutex;
+	FutexLock _requeueMutex;
 	
 	int _activeChunks;
-	bool _hadWaiters;
+	std::atomic<bool> _hadWaiters;
 
 	// Index of the chunk that we are currently retrieving/inserting next.
 	int _retrieveIndex;
-	int _nextIndex;
+	std::atomic<int> _nextIndex;
 
 	// Progress into the current chunk.
 	int _lastProgress;
 
 	// Per-chunk reference counts.
-	int _refCounts[1 << sizeShift];
+	// Each element that is not surrendered yet holds a reference; the chunk that
+	// is currently retrieved holds an additional reference.
+	std::atomic<int> _refCounts[1 << sizeShift];
 };
 
 inline ElementHandle::~ElementHandle() {
@@ -658,6 +821,7 @@ struct AwaitEvent : Operation {
 
 	uint64_t sequence() { return result()->sequence; }
 	uint32_t bitset() { return result()->bitset; }
+	uint64_t count() { return result()->count; }
 
 private:
 	HelEventResult *result() {
@@ -689,6 +853,10 @@ private:
 // ----------------------------------------------------------------------------
 
 struct Submission : private Context {
+	// Allocate from the SmallObjectPool (like all contexts).
+	using Context::operator new;
+	using Context::operator delete;
+
 	Submission(AwaitClock *operation,
 			uint64_t counter, Dispatcher &dispatcher)
 	: _result(operation) {
@@ -837,6 +1005,10 @@ inline Item<PullDescriptor> action(PullDescriptor *operation, uint32_t flags = 0
 
 template<typename... I>
 struct Transmission : private Context {
+	// Allocate from the SmallObjectPool (like all contexts).
+	using Context::operator new;
+	using Context::operator delete;
+
 	Transmission(BorrowedDescriptor descriptor, std::array<HelAction, sizeof...(I)> actions,
 			std::array<Operation *, sizeof...(I)> results, Dispatcher &dispatcher)
 	: _results(results) {
@@ -0,0 +1,158 @@
+#ifndef HELIX_POOL_HPP
+#define HELIX_POOL_HPP
+
+#include <stddef.h>
+#include <new>
+#include <experimental/coroutine>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+namespace helix {
+
+// Mutex that only relies on hel futexes. It does not need a libc thread context.
+struct FutexLock {
+	constexpr FutexLock()
+	: _state{0} { }
+
+	FutexLock(const FutexLock &) = delete;
+
+	FutexLock &operator= (const FutexLock &) = delete;
+
+	void lock() {
+		// States: 0 = unlocked, 1 = locked, 2 = locked with (potential) waiters.
+		int state = 0;
+		if(__atomic_compare_exchange_n(&_state, &state, 1,
+				false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+
+		if(state != 2)
+			state = __atomic_exchange_n(&_state, 2, __ATOMIC_ACQUIRE);
+		while(state) {
+			HEL_CHECK(helFutexWait(&_state, 2));
+			state = __atomic_exchange_n(&_state, 2, __ATOMIC_ACQUIRE);
+		}
+	}
+
+	void unlock() {
+		if(__atomic_exchange_n(&_state, 0, __ATOMIC_RELEASE) == 2)
+			HEL_CHECK(helFutexWake(&_state));
+	}
+
+private:
+	int _state;
+};
+
+// Allocator for small objects (operations, contexts and coroutine frames).
+// Blocks are carved out of larger slabs and recycled through per-size-class free lists;
+// memory is never returned to the heap. Once the pool is warmed up, allocate() and
+// deallocate() thus do not touch the heap. Larger objects are forwarded to operator new.
+// The pool is thread-safe.
+// Note that this does not make IPC allocation-free: protobuf parsing still allocates and
+// no server uses PooledFrame yet. bench-ipc checks a pooled round trip, but that has
+// not been run on a live system so far.
+struct SmallObjectPool {
+	static constexpr int minShift = 5;
+	static constexpr int maxShift = 12;
+	static constexpr size_t slabSize = size_t(64) << 10;
+
+	constexpr SmallObjectPool()
+	: _freeLists{}, _heapAllocations{0} { }
+
+	SmallObjectPool(const SmallObjectPool &) = delete;
+
+	SmallObjectPool &operator= (const SmallObjectPool &) = delete;
+
+	void *allocate(size_t size);
+
+	// size must be the same size that was passed to allocate().
+	void deallocate(void *pointer, size_t size);
+
+	// Number of times that the pool requested memory from the heap.
+	size_t heapAllocations();
+
+private:
+	struct FreeBlock {
+		FreeBlock *next;
+	};
+
+	FutexLock _mutex;
+	FreeBlock *_freeLists[maxShift - minShift + 1];
+	size_t _heapAllocations;
+};
+
+SmallObjectPool &smallObjectPool();
+
+// Recycles the chunks of helix::Dispatcher (which are too large for SmallObjectPool).
+// Only chunks of the default size are recycled; other sizes use operator new.
+struct ChunkPool {
+	constexpr ChunkPool()
+	: _freeList{nullptr} { }
+
+	ChunkPool(const ChunkPool &) = delete;
+
+	ChunkPool &operator= (const ChunkPool &) = delete;
+
+	HelChunk *allocate(size_t chunk_size);
+
+	void deallocate(HelChunk *chunk, size_t chunk_size);
+
+private:
+	struct FreeChunk {
+		FreeChunk *next;
+	};
+
+	FutexLock _mutex;
+	FreeChunk *_freeList;
+};
+
+ChunkPool &chunkPool();
+
+// Classes that derive from this are allocated from the SmallObjectPool if they are
+// allocated by new. Derived classes with virtual destructors are freed correctly.
+struct PoolAllocated {
+	static void *operator new(size_t size) {
+		return smallObjectPool().allocate(size);
+	}
+
+	static void operator delete(void *pointer, size_t size) {
+		smallObjectPool().deallocate(pointer, size);
+	}
+};
+
+// Tag for coroutines: if a coroutine takes a PooledFrame as its first parameter
+// (after the implicit object parameter of member functions and lambdas), its frame
+// is allocated from the SmallObjectPool instead of the heap.
+// Example: async::result<void> serve(helix::PooledFrame, helix::UniqueLane lane);
+struct PooledFrame { };
+
+constexpr PooledFrame pooledFrame;
+
+namespace detail {
+	template<typename P>
+	struct PooledPromise : P {
+		static void *operator new(size_t size) {
+			return smallObjectPool().allocate(size);
+		}
+
+		static void operator delete(void *pointer, size_t size) {
+			smallObjectPool().deallocate(pointer, size);
+		}
+	};
+}
+
+} // namespace helix
+
+namespace std::experimental {
+	template<typename R, typename... Args>
+	struct coroutine_traits<R, helix::PooledFrame, Args...> {
+		using promise_type = helix::detail::PooledPromise<typename R::promise_type>;
+	};
+
+	template<typename R, typename C, typename... Args>
+	struct coroutine_traits<R, C &, helix::PooledFrame, Args...> {
+		using promise_type = helix::detail::PooledPromise<typename R::promise_type>;
+	};
+}
+
+#endif // HELIX_POOL_HPP
@@ -0,0 +1,69 @@
+
+#include <string.h>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <helix/clock.hpp>
+
+namespace helix {
+
+namespace {
+	HelClockPage *accessClockPage() {
+		// The page is mapped once per address space; it survives fork().
+		static HelClockPage *page = [] {
+			void *pointer;
+			HEL_CHECK(helMapClockPage(&pointer));
+			return static_cast<HelClockPage *>(pointer);
+		}();
+		return page;
+	}
+
+	uint64_t rdtsc() {
+		uint32_t lsw, msw;
+		asm volatile ("rdtsc" : "=a"(lsw), "=d"(msw));
+		return (static_cast<uint64_t>(msw) << 32) | lsw;
+	}
+}
+
+bool haveFastClock() {
+	auto page = accessClockPage();
+	return __atomic_load_n(&page->flags, __ATOMIC_RELAXED) & kHelClockPageTscStable;
+}
+
+uint64_t currentClock() {
+	auto page = accessClockPage();
+
+	uint64_t tsc;
+	uint64_t mult;
+	uint32_t shift;
+	int64_t offset;
+	while(true) {
+		// Start the seqlock read.
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue;
+
+		// Perform the actual loads.
+		auto flags = __atomic_load_n(&page->flags, __ATOMIC_RELAXED);
+		mult = __atomic_load_n(&page->tscMult, __ATOMIC_RELAXED);
+		shift = __atomic_load_n(&page->tscShift, __ATOMIC_RELAXED);
+		offset = __atomic_load_n(&page->nanosOffset, __ATOMIC_RELAXED);
+		tsc = rdtsc();
+
+		// Finish the seqlock read.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) != seqlock)
+			continue;
+
+		if(!(flags & kHelClockPageTscStable)) {
+			uint64_t now;
+			HEL_CHECK(helGetClock(&now));
+			return now;
+		}
+		break;
+	}
+
+	return ((static_cast<unsigned __int128>(tsc) * mult) >> shift) + offset;
+}
+
+} // namespace helix
@@ -2,14 +2,19 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <new>
+#include <type_traits>
 
 #include <helix/ipc.hpp>
 
 namespace helix {
 
 Dispatcher &Dispatcher::global() {
-	static Dispatcher dispatcher;
-	return dispatcher;
+	// The global dispatcher is never destructed: at exit, other threads may still
+	// use it (and ~Dispatcher() would close the queue underneath them).
+	static std::aligned_storage_t<sizeof(Dispatcher), alignof(Dispatcher)> storage;
+	static Dispatcher *dispatcher = new (&storage) Dispatcher;
+	return *dispatcher;
 }
 
 async::run_queue *globalQueue() {
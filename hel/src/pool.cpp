@@ -0,0 +1,105 @@
+#include <string.h>
+#include <new>
+
+#include <helix/ipc.hpp>
+#include <helix/pool.hpp>
+
+namespace helix {
+
+namespace {
+	// Both pools are constant-initialized and trivially destructible;
+	// they can be used by static destructors.
+	SmallObjectPool globalSmallObjectPool;
+	ChunkPool globalChunkPool;
+
+	int sizeClassOf(size_t size) {
+		int shift = SmallObjectPool::minShift;
+		while((size_t(1) << shift) < size)
+			shift++;
+		return shift;
+	}
+}
+
+void *SmallObjectPool::allocate(size_t size) {
+	auto shift = sizeClassOf(size);
+	if(shift > maxShift)
+		return operator new(size);
+
+	_mutex.lock();
+	auto &list = _freeLists[shift - minShift];
+	if(!list) {
+		// Carve a new slab into blocks of this size class.
+		auto slab = static_cast<char *>(operator new(slabSize));
+		// heapAllocations() reads this without taking _mutex.
+		__atomic_fetch_add(&_heapAllocations, 1, __ATOMIC_RELAXED);
+		for(size_t offset = 0; offset < slabSize; offset += size_t(1) << shift) {
+			auto block = reinterpret_cast<FreeBlock *>(slab + offset);
+			block->next = list;
+			list = block;
+		}
+	}
+
+	auto block = list;
+	list = block->next;
+	_mutex.unlock();
+	return block;
+}
+
+void SmallObjectPool::deallocate(void *pointer, size_t size) {
+	if(!pointer)
+		return;
+
+	auto shift = sizeClassOf(size);
+	if(shift > maxShift) {
+		operator delete(pointer);
+		return;
+	}
+
+	auto block = static_cast<FreeBlock *>(pointer);
+	_mutex.lock();
+	auto &list = _freeLists[shift - minShift];
+	block->next = list;
+	list = block;
+	_mutex.unlock();
+}
+
+size_t SmallObjectPool::heapAllocations() {
+	return __atomic_load_n(&_heapAllocations, __ATOMIC_RELAXED);
+}
+
+SmallObjectPool &smallObjectPool() {
+	return globalSmallObjectPool;
+}
+
+HelChunk *ChunkPool::allocate(size_t chunk_size) {
+	if(chunk_size == Dispatcher::defaultChunkSize) {
+		_mutex.lock();
+		auto chunk = _freeList;
+		if(chunk)
+			_freeList = chunk->next;
+		_mutex.unlock();
+		if(chunk)
+			return reinterpret_cast<HelChunk *>(chunk);
+	}
+
+	return reinterpret_cast<HelChunk *>(operator new(sizeof(HelChunk) + chunk_size));
+}
+
+void ChunkPool::deallocate(HelChunk *chunk, size_t chunk_size) {
+	if(chunk_size != Dispatcher::defaultChunkSize) {
+		operator delete(chunk);
+		return;
+	}
+
+	auto free_chunk = reinterpret_cast<FreeChunk *>(chunk);
+	_mutex.lock();
+	free_chunk->next = _freeList;
+	_freeList = free_chunk;
+	_mutex.unlock();
+}
+
+ChunkPool &chunkPool() {
+	return globalChunkPool;
+}
+
+} // namespace helix
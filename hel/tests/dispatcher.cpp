@@ -0,0 +1,177 @@
+// Stress test for helix::Dispatcher in concurrent mode. Runs on the host.
+// The hel syscalls that the dispatcher uses are replaced by fakes (on top of Linux futexes)
+// and a fake kernel thread posts elements to the queue like thor's UserQueue does.
+
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <host-test.hpp>
+
+namespace {
+	HelQueue *fakeQueue;
+	HelChunk *fakeChunks[512];
+	size_t fakeChunkSize;
+
+	HelError fakeFutexWait(int *pointer, int expected) {
+		syscall(SYS_futex, pointer, FUTEX_WAIT, expected, nullptr, nullptr, 0);
+		return kHelErrNone;
+	}
+
+	HelError fakeFutexWake(int *pointer) {
+		syscall(SYS_futex, pointer, FUTEX_WAKE, 1 << 30, nullptr, nullptr, 0);
+		return kHelErrNone;
+	}
+
+	HelError fakeCreateQueue2(HelQueue *head, uint32_t, unsigned int, size_t,
+			size_t chunk_size, HelHandle *handle) {
+		fakeQueue = head;
+		fakeChunkSize = chunk_size;
+		*handle = 1;
+		return kHelErrNone;
+	}
+
+	HelError fakeSetupChunk(HelHandle, int index, HelChunk *chunk, uint32_t) {
+		fakeChunks[index] = chunk;
+		return kHelErrNone;
+	}
+
+	HelError fakeCloseDescriptor(HelHandle) {
+		return kHelErrNone;
+	}
+}
+
+#define helFutexWait fakeFutexWait
+#define helFutexWake fakeFutexWake
+#define helCreateQueue2 fakeCreateQueue2
+#define helSetupChunk fakeSetupChunk
+#define helCloseDescriptor fakeCloseDescriptor
+#include <helix/ipc.hpp>
+// The pools use FutexLock, hence they have to see the fake syscalls, too.
+#include "../src/pool.cpp"
+
+namespace {
+
+// --------------------------------------------------------
+// Fake kernel side of the queue.
+// --------------------------------------------------------
+
+int kernelIndex = 0;
+int kernelOffset = 0;
+
+void kernelPost(void *context, int payload) {
+	while(true) {
+		// Wait until user space enqueues a chunk.
+		while(true) {
+			auto head = __atomic_load_n(&fakeQueue->headFutex, __ATOMIC_ACQUIRE);
+			if((head & kHelHeadMask) != kernelIndex)
+				break;
+			if(__atomic_compare_exchange_n(&fakeQueue->headFutex, &head,
+					kernelIndex | kHelHeadWaiters, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+				fakeFutexWait(&fakeQueue->headFutex, kernelIndex | kHelHeadWaiters);
+		}
+
+		auto chunk = fakeChunks[fakeQueue->indexQueue[kernelIndex & 511]];
+		// Like thor, pad the payload to 8 bytes.
+		size_t length = sizeof(HelElement) + 8;
+		if(kernelOffset + length > fakeChunkSize) {
+			// Retire the chunk and move on to the next one.
+			auto futex = __atomic_fetch_or(&chunk->progressFutex, kHelProgressDone,
+					__ATOMIC_RELEASE);
+			if(futex & kHelProgressWaiters)
+				fakeFutexWake(&chunk->progressFutex);
+			kernelIndex = (kernelIndex + 1) & kHelHeadMask;
+			kernelOffset = 0;
+			continue;
+		}
+
+		auto element = reinterpret_cast<HelElement *>(chunk->buffer + kernelOffset);
+		element->length = 8;
+		element->context = context;
+		*reinterpret_cast<int *>(element + 1) = payload;
+		kernelOffset += length;
+
+		auto futex = __atomic_exchange_n(&chunk->progressFutex, kernelOffset, __ATOMIC_RELEASE);
+		if(futex & kHelProgressWaiters)
+			fakeFutexWake(&chunk->progressFutex);
+		return;
+	}
+}
+
+// --------------------------------------------------------
+// Test.
+// --------------------------------------------------------
+
+struct SumContext : helix::Context {
+	void complete(helix::ElementHandle element) override {
+		auto payload = *reinterpret_cast<int *>(element.data());
+		sum.fetch_add(payload, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_release);
+
+		// Keep some elements alive for a while to exercise the chunk reference counts.
+		if(!(payload % 7)) {
+			helix::ElementHandle keep = std::move(element);
+			std::this_thread::yield();
+		}
+	}
+
+	std::atomic<long> sum{0};
+	std::atomic<long> count{0};
+};
+
+void testConcurrentDispatch() {
+	constexpr int numElements = 2'000'000;
+	constexpr int numWaiters = 4;
+
+	// Small chunks make chunk retirement and requeueing frequent.
+	static helix::Dispatcher dispatcher{256, true};
+	static SumContext context;
+	dispatcher.acquire();
+
+	// wait() sleeps on the progress futex; dispatchAvailable() must not be blocked by that.
+	for(int i = 0; i < numWaiters; i++)
+		std::thread{[] {
+			while(true)
+				dispatcher.wait();
+		}}.detach();
+	std::thread{[] {
+		while(true) {
+			if(!dispatcher.dispatchAvailable(helix::Dispatcher::maxBatchSize))
+				std::this_thread::yield();
+		}
+	}}.detach();
+
+	long expected = 0;
+	for(int i = 1; i <= numElements; i++) {
+		kernelPost(&context, i);
+		expected += i;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+	while(context.count.load(std::memory_order_acquire) != numElements) {
+		EXPECT(std::chrono::steady_clock::now() < deadline);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	EXPECT(context.sum.load(std::memory_order_relaxed) == expected);
+}
+
+const host_test::Test tests[] = {
+	{"concurrent-dispatch", testConcurrentDispatch},
+};
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	int status = host_test::runTests(tests, argc, argv);
+
+	// The dispatcher threads block in wait() forever; do not run static destructors.
+	fflush(stdout);
+	_exit(status);
+}
@@ -726,6 +726,27 @@ extern "C" void eirMain(MbInfo *mb_info) {
 	info_ptr->coreRegion.numRoots = regions[core_idx].numRoots;
 	info_ptr->coreRegion.buddyTree = regions[core_idx].buddyMap;
 
+	// Pass all regions to thor; it distributes them among NUMA nodes.
+	size_t num_allocatable = 0;
+	for(size_t i = 0; i < numRegions; ++i) {
+		if(regions[i].regionType == RegionType::allocatable)
+			num_allocatable++;
+	}
+	auto region_info = bootAllocN<EirRegion>(num_allocatable);
+	size_t k = 0;
+	for(size_t i = 0; i < numRegions; ++i) {
+		if(regions[i].regionType != RegionType::allocatable)
+			continue;
+		region_info[k].address = regions[i].address;
+		region_info[k].length = regions[i].size;
+		region_info[k].order = regions[i].order;
+		region_info[k].numRoots = regions[i].numRoots;
+		region_info[k].buddyTree = regions[i].buddyMap;
+		k++;
+	}
+	info_ptr->numRegions = num_allocatable;
+	info_ptr->regionInfo = mapBootstrapData(region_info);
+
 	// Parse the kernel command line.
 	assert(mb_info->flags & kMbInfoCommandLine);
 	const char *l = mb_info->commandLine;
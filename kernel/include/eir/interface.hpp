@@ -44,5 +44,9 @@ struct EirInfo {
 	EirPtr moduleInfo;
 
 	EirFramebuffer frameBuffer;
+
+	// All allocatable regions (including the core region).
+	EirSize numRegions;
+	EirPtr regionInfo;
 };
 
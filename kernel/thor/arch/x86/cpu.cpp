@@ -3,13 +3,21 @@
 #include <arch/register.hpp>
 #include <arch/io_space.hpp>
 
+#include "generic/fiber.hpp"
 #include "generic/kernel.hpp"
 #include "generic/service_helpers.hpp"
+#include "generic/timer.hpp"
+#include "generic/trace.hpp"
 
 namespace thor {
 
 namespace {
 	constexpr bool disableSmp = false;
+
+	// Restore the extended state only once a thread actually uses it.
+	// CR0.TS is set on return to threads whose state is not in the registers;
+	// the first FPU/SSE/AVX instruction then traps (#NM) and loads the state.
+	constexpr bool lazyExtendedState = false;
 }
 
 // --------------------------------------------------------
@@ -59,20 +67,94 @@ extern bool debugToVga;
 extern bool debugToSerial;
 extern bool debugToBochs;
 
+// Log messages are published to logQueue without taking a lock.
+// Each message has a stamp that acts as a seqlock: it is stampWriting(seq) while
+// message seq is written and stampComplete(seq) once it is complete.
 struct LogMessage {
+	std::atomic<uint64_t> stamp;
 	char text[100];
 };
 
-size_t currentLogLength;
-LogMessage logQueue[1024];
-size_t logHead;
+constexpr size_t logQueueSize = 1024;
+
+LogMessage logQueue[logQueueSize];
+// Number of messages that loggers claimed (some of them might not be complete yet).
+std::atomic<uint64_t> logHead;
+
+namespace {
+	// If this is true, messages are only written to the log queue by the logger
+	// and the log fiber writes them to the output sinks.
+	std::atomic<bool> asyncLogOutput{false};
+
+	// Protects drainSequence and the output sinks.
+	frigg::TicketLock sinkLock;
+	// Next message that needs to be written to the output sinks.
+	uint64_t drainSequence;
+
+	// Handshake between loggers and the log fiber. The fiber sets drainSleeping before it
+	// blocks; the logger that resets it sends a ping IPI to itself. The IPI is delivered
+	// once the logger re-enables IRQs, i.e., when it does not hold any locks anymore.
+	FiberBlocker drainBlocker;
+	std::atomic<bool> drainSleeping{false};
+	std::atomic<bool> drainWakeupPending{false};
+
+	uint64_t stampWriting(uint64_t seq) {
+		return 2 * seq + 1;
+	}
+
+	uint64_t stampComplete(uint64_t seq) {
+		return 2 * seq + 2;
+	}
+
+	enum class LogReadStatus {
+		success,
+		pending,
+		overwritten
+	};
+
+	// Copies message seq to text; this can be called concurrently to loggers.
+	LogReadStatus readLogMessage(uint64_t seq, char *text) {
+		auto message = &logQueue[seq % logQueueSize];
+		auto stamp = message->stamp.load(std::memory_order_acquire);
+		if(stamp < stampComplete(seq))
+			return LogReadStatus::pending;
+		if(stamp > stampComplete(seq))
+			return LogReadStatus::overwritten;
+
+		memcpy(text, message->text, 100);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(message->stamp.load(std::memory_order_relaxed) != stamp)
+			return LogReadStatus::overwritten;
+		return LogReadStatus::success;
+	}
+
+	void publishLogMessage(const char *text, size_t length) {
+		auto seq = logHead.fetch_add(1, std::memory_order_relaxed);
+		auto message = &logQueue[seq % logQueueSize];
+
+		// The previous message in this slot might still be written by another CPU
+		// (if loggers wrapped around the entire queue in the meantime).
+		if(seq >= logQueueSize) {
+			while(message->stamp.load(std::memory_order_acquire)
+					< stampComplete(seq - logQueueSize))
+				frigg::pause();
+		}
+
+		message->stamp.store(stampWriting(seq), std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(message->text, text, length);
+		memset(message->text + length, 0, 100 - length);
+		message->stamp.store(stampComplete(seq), std::memory_order_release);
+	}
+}
 
 size_t currentLogSequence() {
-	return logHead;
+	return logHead.load(std::memory_order_relaxed);
 }
 
 void copyLogMessage(size_t sequence, char *text) {
-	memcpy(text, logQueue[sequence % 1024].text, 100);
+	if(readLogMessage(sequence, text) != LogReadStatus::success)
+		memset(text, 0, 100);
 }
 
 frigg::LazyInitializer<frg::intrusive_list<
@@ -161,40 +243,46 @@ void callLegacy(char c) {
 
 } // anonymous namespace
 
-constexpr int maximalCsiLength = 16;
-char csiBuffer[maximalCsiLength];
-int csiState;
-int csiLength;
-
 void BochsSink::print(char c) {
-	auto doesFit = [] (int n) -> bool {
-		return currentLogLength + n < 100;
+	auto cpu_data = getCpuData();
+	auto nesting = cpu_data->logNesting;
+	if(!nesting) {
+		// Characters outside of records (e.g., from panicLogger()) form their own record.
+		auto irq_lock = frigg::guard(&irqMutex());
+		beginLogRecord();
+		print(c);
+		endLogRecord();
+		return;
+	}
+	if(nesting > maxLogNesting)
+		return;
+	auto staging = &cpu_data->logStaging[nesting - 1];
+
+	auto doesFit = [&] (int n) -> bool {
+		return staging->length + n < 100;
 	};
 
-	auto cutOff = [] () {
-		currentLogLength = 0;
-		logHead++;
-		memset(logQueue[logHead % 1024].text, 0, 100);
-		callLegacy('\n');
+	auto cutOff = [&] () {
+		publishLogMessage(staging->text, staging->length);
+		staging->length = 0;
 	};
 
-	auto emit = [] (char c) {
-		logQueue[logHead % 1024].text[currentLogLength] = c;
-		currentLogLength++;
-		callLegacy(c);
+	auto emit = [&] (char c) {
+		staging->text[staging->length] = c;
+		staging->length++;
 	};
 
-	if(!csiState) {
+	if(!staging->csiState) {
 		if(c == '\x1B') {
-			csiState = 1;
+			staging->csiState = 1;
 		}else if(c == '\n' || !doesFit(1)) {
 			cutOff();
 		}else{
 			emit(c);
 		}
-	}else if(csiState == 1) {
+	}else if(staging->csiState == 1) {
 		if(c == '[') {
-			csiState = 2;
+			staging->csiState = 2;
 		}else{
 			if(!doesFit(2)) {
 				cutOff();
@@ -202,32 +290,29 @@ void BochsSink::print(char c) {
 				emit('\x1B');
 				emit(c);
 			}
-			csiState = 0;
+			staging->csiState = 0;
 		}
 	}else{
 		// This is csiState == 2.
 		if((c >= '0' && c <= '9') || (c == ';')) {
-			if(csiLength < maximalCsiLength)
-				csiBuffer[csiLength] = c;
-			csiLength++;
+			if(staging->csiLength < LogStaging::maximalCsiLength)
+				staging->csiBuffer[staging->csiLength] = c;
+			staging->csiLength++;
 		}else{
-			if(csiLength >= maximalCsiLength || !doesFit(3 + csiLength)) {
+			if(staging->csiLength >= LogStaging::maximalCsiLength
+					|| !doesFit(3 + staging->csiLength)) {
 				cutOff();
 			}else{
 				emit('\x1B');
 				emit('[');
-				for(int i = 0; i < csiLength; i++)
-					emit(csiBuffer[i]);
+				for(int i = 0; i < staging->csiLength; i++)
+					emit(staging->csiBuffer[i]);
 				emit(c);
 			}
-			csiState = 0;
-			csiLength = 0;
+			staging->csiState = 0;
+			staging->csiLength = 0;
 		}
 	}
-
-	for(auto it = globalLogList->begin(); it != globalLogList->end(); ++it) {
-		(*it)->printChar(c);
-	}
 }
 
 void BochsSink::print(const char *str) {
@@ -235,6 +320,226 @@ void BochsSink::print(const char *str) {
 		print(*str++);
 }
 
+namespace {
+	void writeToSinks(const char *text, size_t length) {
+		for(size_t i = 0; i < length; i++) {
+			callLegacy(text[i]);
+			for(auto it = globalLogList->begin(); it != globalLogList->end(); ++it)
+				(*it)->printChar(text[i]);
+		}
+	}
+
+	void writeDropMarker(size_t count) {
+		char digits[20];
+		int n = 0;
+		do {
+			digits[n++] = '0' + count % 10;
+			count /= 10;
+		} while(count);
+
+		const char *prefix = "[thor: ";
+		const char *suffix = " log messages dropped]\n";
+		writeToSinks(prefix, strlen(prefix));
+		while(n)
+			writeToSinks(&digits[--n], 1);
+		writeToSinks(suffix, strlen(suffix));
+	}
+
+	// Takes the next complete message that needs to be written to the sinks.
+	// Must be called with sinkLock held.
+	bool takeDrainMessage(char *text, size_t *dropped) {
+		*dropped = 0;
+		while(true) {
+			auto status = readLogMessage(drainSequence, text);
+			if(status == LogReadStatus::pending)
+				return false;
+			if(status == LogReadStatus::success) {
+				drainSequence++;
+				return true;
+			}
+
+			// Skip to the oldest message that can still be in the queue.
+			auto oldest = logHead.load(std::memory_order_relaxed) - (logQueueSize - 1);
+			if(oldest <= drainSequence)
+				oldest = drainSequence + 1;
+			*dropped += oldest - drainSequence;
+			drainSequence = oldest;
+		}
+	}
+
+	void writeDrainMessage(char *text, size_t dropped) {
+		// Messages never contain more than 99 characters, hence this is NUL-terminated.
+		auto length = strlen(text);
+		text[length++] = '\n';
+
+		if(dropped)
+			writeDropMarker(dropped);
+		writeToSinks(text, length);
+	}
+
+	// Returns true if the log fiber would find a message (or a gap) at drainSequence.
+	bool haveDrainMessage() {
+		auto message = &logQueue[drainSequence % logQueueSize];
+		return message->stamp.load(std::memory_order_relaxed) >= stampComplete(drainSequence);
+	}
+
+	// Used before the log fiber runs. Whoever holds sinkLock writes all complete messages;
+	// loggers that fail to take the lock leave their messages to the lock holder.
+	void drainLogSynchronously() {
+		while(true) {
+			if(!sinkLock.tryLock())
+				return;
+			// The log fiber writes messages outside of sinkLock once it took over.
+			if(asyncLogOutput.load(std::memory_order_relaxed)) {
+				sinkLock.unlock();
+				return;
+			}
+
+			char text[101];
+			size_t dropped;
+			while(takeDrainMessage(text, &dropped))
+				writeDrainMessage(text, dropped);
+			sinkLock.unlock();
+
+			// Messages can be completed after our last check but before the unlock.
+			if(!haveDrainMessage())
+				return;
+		}
+	}
+
+	void wakeLogFiber() {
+		// Pairs with the fence in the log fiber (after it sets drainSleeping).
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(!drainSleeping.load(std::memory_order_relaxed))
+			return;
+		if(!drainSleeping.exchange(false, std::memory_order_relaxed))
+			return;
+		drainWakeupPending.store(true, std::memory_order_release);
+		sendPingIpi(getCpuData()->localApicId);
+	}
+}
+
+void beginLogRecord() {
+	getCpuData()->logNesting++;
+}
+
+void endLogRecord() {
+	auto cpu_data = getCpuData();
+	auto nesting = cpu_data->logNesting;
+	assert(nesting);
+	if(nesting <= maxLogNesting) {
+		// Publish incomplete lines; records are not interleaved with other records.
+		auto staging = &cpu_data->logStaging[nesting - 1];
+		if(staging->length)
+			publishLogMessage(staging->text, staging->length);
+		staging->length = 0;
+		staging->csiState = 0;
+		staging->csiLength = 0;
+	}
+	cpu_data->logNesting--;
+
+	if(asyncLogOutput.load(std::memory_order_relaxed)) {
+		wakeLogFiber();
+	}else{
+		drainLogSynchronously();
+	}
+}
+
+void handleLogWakeup() {
+	if(!drainWakeupPending.load(std::memory_order_relaxed))
+		return;
+	if(!drainWakeupPending.exchange(false, std::memory_order_acquire))
+		return;
+	KernelFiber::unblockOther(&drainBlocker);
+}
+
+void initializeAsyncLog() {
+	KernelFiber::run([] {
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&sinkLock);
+			asyncLogOutput.store(true, std::memory_order_relaxed);
+		}
+
+		while(true) {
+			char text[101];
+			size_t dropped;
+			bool have_message;
+			{
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&sinkLock);
+				have_message = takeDrainMessage(text, &dropped);
+			}
+
+			if(have_message) {
+				writeDrainMessage(text, dropped);
+				continue;
+			}
+
+			// Only this fiber modifies drainSequence, so we can read it without sinkLock.
+			drainBlocker.setup();
+			drainSleeping.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(haveDrainMessage()) {
+				// If a logger already reset drainSleeping, it will also unblock us.
+				if(drainSleeping.exchange(false, std::memory_order_relaxed))
+					continue;
+			}
+			KernelFiber::blockCurrent(&drainBlocker);
+		}
+	});
+}
+
+void flushLogSynchronously() {
+	asyncLogOutput.store(false, std::memory_order_relaxed);
+
+	// We do not take sinkLock here as we might have panicked while holding it.
+	char text[101];
+	size_t dropped;
+	while(takeDrainMessage(text, &dropped))
+		writeDrainMessage(text, dropped);
+}
+
+size_t readLogMessages(size_t *sequence, size_t *first, char *buffer, size_t max_size) {
+	size_t size = 0;
+
+	// Skip messages that were already overwritten.
+	auto head = logHead.load(std::memory_order_relaxed);
+	auto seq = *sequence;
+	if(seq > head)
+		seq = head;
+	if(head - seq >= logQueueSize)
+		seq = head - (logQueueSize - 1);
+	*first = seq;
+
+	while(seq < head) {
+		char text[100];
+		auto status = readLogMessage(seq, text);
+		if(status == LogReadStatus::pending)
+			break;
+		if(status == LogReadStatus::overwritten) {
+			// Report the gap via *first if we did not copy anything yet.
+			if(size)
+				break;
+			seq++;
+			*first = seq;
+			continue;
+		}
+
+		// Messages never contain more than 99 characters, hence this is NUL-terminated.
+		auto length = strlen(text);
+		if(size + length + 1 > max_size)
+			break;
+		memcpy(buffer + size, text, length);
+		buffer[size + length] = '\n';
+		size += length + 1;
+		seq++;
+	}
+	*sequence = seq;
+
+	return size;
+}
+
 // --------------------------------------------------------
 
 namespace {
@@ -274,14 +579,119 @@ bool FaultImageAccessor::allowUserPages() {
 // Executor
 // --------------------------------------------------------
 
+namespace {
+	enum class ExtendedStateMode {
+		fxsave,
+		xsave,
+		xsaveopt,
+		xsaves
+	};
+
+	// XCR0 components that we enable: x87, SSE, AVX and AVX-512.
+	constexpr uint64_t wantedXsaveComponents = 0x1 | 0x2 | 0x4 | 0x20 | 0x40 | 0x80;
+
+	ExtendedStateMode extendedStateMode = ExtendedStateMode::fxsave;
+	uint64_t xsaveComponents = 0;
+	size_t extendedStateSize = 512;
+	bool haveXinuse = false;
+
+	uint64_t readXcr(uint32_t index) {
+		uint32_t low, high;
+		asm volatile ("xgetbv" : "=a" (low), "=d" (high) : "c" (index));
+		return (uint64_t(high) << 32) | low;
+	}
+
+	void writeXcr(uint32_t index, uint64_t value) {
+		asm volatile ("xsetbv" : : "c" (index),
+				"a" (uint32_t(value)), "d" (uint32_t(value >> 32)));
+	}
+
+	// Offsets of XSTATE_BV and XCOMP_BV within the XSAVE header.
+	constexpr ptrdiff_t xstateBvOffset = 512;
+	constexpr ptrdiff_t xcompBvOffset = 520;
+
+	// XRSTORS requires the compacted format bit (and the set of components)
+	// in XCOMP_BV, even if the area has never been written by XSAVES.
+	void initializeExtendedStateArea(void *area) {
+		if(extendedStateMode != ExtendedStateMode::xsaves)
+			return;
+		*reinterpret_cast<uint64_t *>(static_cast<char *>(area) + xcompBvOffset)
+				= (uint64_t(1) << 63) | xsaveComponents;
+	}
+
+	void setTaskSwitched(bool trap) {
+		uint64_t cr0;
+		asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+		if(trap) {
+			cr0 |= uint64_t(1) << 3;
+		}else{
+			cr0 &= ~(uint64_t(1) << 3);
+		}
+		asm volatile ("mov %0, %%cr0" : : "r" (cr0) : "memory");
+	}
+}
+
+void probeExtendedState() {
+	if(!(frigg::arch_x86::cpuid(0x01)[2] & (uint32_t(1) << 26))) {
+		frigg::infoLogger() << "\e[37mthor: CPU does not support XSAVE\e[39m" << frigg::endLog;
+		return;
+	}
+
+	auto leaf = frigg::arch_x86::cpuid(0x0D);
+	uint64_t supported = (uint64_t(leaf[3]) << 32) | leaf[0];
+	xsaveComponents = supported & wantedXsaveComponents;
+
+	auto features = frigg::arch_x86::cpuid(0x0D, 1)[0];
+	haveXinuse = features & (uint32_t(1) << 2);
+	if(features & (uint32_t(1) << 3)) {
+		extendedStateMode = ExtendedStateMode::xsaves;
+	}else if(features & 1) {
+		extendedStateMode = ExtendedStateMode::xsaveopt;
+	}else{
+		extendedStateMode = ExtendedStateMode::xsave;
+	}
+
+	// The legacy region and the XSAVE header occupy the first 576 bytes.
+	// We cannot use CPUID.(EAX=0Dh,ECX=1).EBX for the compacted size
+	// as XCR0 is not set up yet; compute both sizes from the per-component leaves.
+	size_t size = 576;
+	for(int i = 2; i < 64; i++) {
+		if(!(xsaveComponents & (uint64_t(1) << i)))
+			continue;
+		auto component = frigg::arch_x86::cpuid(0x0D, i);
+		if(extendedStateMode == ExtendedStateMode::xsaves) {
+			// In the compacted format, components are packed in order;
+			// some of them need to be aligned to 64 bytes.
+			if(component[2] & 2)
+				size = (size + 63) & ~size_t(63);
+			size += component[0];
+		}else{
+			size = frg::max(size, size_t(component[1]) + component[0]);
+		}
+	}
+	extendedStateSize = size;
+
+	const char *mode_name = "XSAVE";
+	if(extendedStateMode == ExtendedStateMode::xsaves) {
+		mode_name = "XSAVES (compacted)";
+	}else if(extendedStateMode == ExtendedStateMode::xsaveopt) {
+		mode_name = "XSAVEOPT";
+	}
+	frigg::infoLogger() << "\e[37mthor: Using " << mode_name
+			<< ", components: 0x" << frigg::logHex(xsaveComponents)
+			<< ", area size: " << extendedStateSize << " bytes\e[39m" << frigg::endLog;
+}
+
 size_t Executor::determineSize() {
-	return sizeof(General) + sizeof(FxState);
+	// Reserve slack so that _fxState() can align the area to 64 bytes.
+	return sizeof(General) + 64 + extendedStateSize;
 }
 
 Executor::Executor()
-: _pointer{nullptr}, _syscallStack{nullptr}, _tss{nullptr} { }
+: _pointer{nullptr}, _syscallStack{nullptr}, _tss{nullptr}, _extendedStateCpu{nullptr} { }
 
-Executor::Executor(UserContext *context, AbiParameters abi) {
+Executor::Executor(UserContext *context, AbiParameters abi)
+: _extendedStateCpu{nullptr} {
 	_pointer = (char *)kernelAlloc->allocate(getStateSize());
 	memset(_pointer, 0, getStateSize());
 
@@ -291,6 +701,7 @@ Executor::Executor(UserContext *context, AbiParameters abi) {
 	_fxState()->mxcsr |= 1 << 10;
 	_fxState()->mxcsr |= 1 << 11;
 	_fxState()->mxcsr |= 1 << 12;
+	initializeExtendedStateArea(_fxState());
 
 	general()->rip = abi.ip;
 	general()->rflags = 0x200;
@@ -303,7 +714,7 @@ Executor::Executor(UserContext *context, AbiParameters abi) {
 }
 
 Executor::Executor(FiberContext *context, AbiParameters abi)
-: _syscallStack{nullptr}, _tss{nullptr} {
+: _syscallStack{nullptr}, _tss{nullptr}, _extendedStateCpu{nullptr} {
 	_pointer = (char *)kernelAlloc->allocate(getStateSize());
 	memset(_pointer, 0, getStateSize());
 
@@ -313,6 +724,7 @@ Executor::Executor(FiberContext *context, AbiParameters abi)
 	_fxState()->mxcsr |= 1 << 10;
 	_fxState()->mxcsr |= 1 << 11;
 	_fxState()->mxcsr |= 1 << 12;
+	initializeExtendedStateArea(_fxState());
 
 	general()->rip = abi.ip;
 	general()->rflags = 0x200;
@@ -323,9 +735,89 @@ Executor::Executor(FiberContext *context, AbiParameters abi)
 }
 
 Executor::~Executor() {
+	// Make sure that a new executor at the same address cannot inherit the registers.
+	if(lazyExtendedState && _extendedStateCpu) {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto cpu_data = getCpuData();
+		if(cpu_data->extendedStateOwner == this)
+			cpu_data->extendedStateOwner = nullptr;
+	}
 	kernelAlloc->free(_pointer);
 }
 
+void saveExtendedState(Executor *executor) {
+	// With lazy restore, the registers do not belong to the executor while TS is set.
+	if(lazyExtendedState && getCpuData()->extendedStateTrap)
+		return;
+
+	auto area = executor->_fxState();
+	auto low = uint32_t(xsaveComponents);
+	auto high = uint32_t(xsaveComponents >> 32);
+	switch(extendedStateMode) {
+	case ExtendedStateMode::fxsave:
+		asm volatile ("fxsaveq %0" : "=m" (*area) : : "memory");
+		break;
+	case ExtendedStateMode::xsave:
+		asm volatile ("xsaveq %0" : "=m" (*area) : "a" (low), "d" (high) : "memory");
+		break;
+	case ExtendedStateMode::xsaveopt:
+		// XSAVEOPT skips components that are in their init state or that
+		// were not modified since the last XRSTOR from the same area.
+		asm volatile ("xsaveoptq %0" : "+m" (*area) : "a" (low), "d" (high) : "memory");
+		break;
+	case ExtendedStateMode::xsaves:
+		// XSAVES performs the same optimizations as XSAVEOPT
+		// and only stores the components that are in use (compacted format).
+		asm volatile ("xsaves64 %0" : "+m" (*area) : "a" (low), "d" (high) : "memory");
+		break;
+	}
+}
+
+void restoreExtendedState(Executor *executor) {
+	auto area = executor->_fxState();
+	if(extendedStateMode == ExtendedStateMode::fxsave) {
+		asm volatile ("fxrstorq %0" : : "m" (*area) : "memory");
+		return;
+	}
+
+	// Init-optimization: if all components are in their init state (XSTATE_BV is
+	// zero) and the CPU tracks that its registers are in the init state as well,
+	// XRSTOR would not change anything. XINUSE is available via XGETBV(1).
+	auto xstate_bv = *reinterpret_cast<uint64_t *>(reinterpret_cast<char *>(area)
+			+ xstateBvOffset);
+	if(haveXinuse && !(xstate_bv & xsaveComponents)
+			&& !(readXcr(1) & xsaveComponents))
+		return;
+
+	auto low = uint32_t(xsaveComponents);
+	auto high = uint32_t(xsaveComponents >> 32);
+	if(extendedStateMode == ExtendedStateMode::xsaves) {
+		asm volatile ("xrstors64 %0" : : "m" (*area), "a" (low), "d" (high) : "memory");
+	}else{
+		asm volatile ("xrstorq %0" : : "m" (*area), "a" (low), "d" (high) : "memory");
+	}
+}
+
+bool handleLazyExtendedState(Executor *executor) {
+	if(!lazyExtendedState)
+		return false;
+
+	auto cpu_data = getCpuData();
+	if(!cpu_data->extendedStateTrap)
+		return false;
+
+	setTaskSwitched(false);
+	cpu_data->extendedStateTrap = false;
+
+	// Unless the registers still hold the state from the last time this executor
+	// ran on this CPU, load it from memory. Previous owners already saved theirs.
+	if(cpu_data->extendedStateOwner != executor || executor->_extendedStateCpu != cpu_data)
+		restoreExtendedState(executor);
+	cpu_data->extendedStateOwner = executor;
+	executor->_extendedStateCpu = cpu_data;
+	return true;
+}
+
 void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->rax = accessor._frame()->rax;
 	executor->general()->rbx = accessor._frame()->rbx;
@@ -352,7 +844,7 @@ void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->clientFs = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrIndexFsBase);
 	executor->general()->clientGs = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrIndexKernelGsBase);
 	
-	asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
+	saveExtendedState(executor);
 }
 
 void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
@@ -381,7 +873,7 @@ void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
 	executor->general()->clientFs = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrIndexFsBase);
 	executor->general()->clientGs = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrIndexKernelGsBase);
 	
-	asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
+	saveExtendedState(executor);
 }
 
 void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
@@ -410,7 +902,7 @@ void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
 	executor->general()->clientFs = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrIndexFsBase);
 	executor->general()->clientGs = frigg::arch_x86::rdmsr(frigg::arch_x86::kMsrIndexKernelGsBase);
 	
-	asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
+	saveExtendedState(executor);
 }
 
 void switchExecutor(frigg::UnsafePtr<Thread> thread) {
@@ -461,6 +953,19 @@ extern "C" [[ noreturn ]] void _restoreExecutorRegisters(void *pointer);
 	uint16_t cs = executor->general()->cs;
 	assert(cs == kSelExecutorFaultCode || cs == kSelExecutorSyscallCode
 			|| cs == kSelClientUserCode || cs == kSelSystemFiberCode);
+	if(!lazyExtendedState) {
+		restoreExtendedState(executor);
+	}else{
+		// Only clear TS if the registers still hold this executor's state.
+		auto cpu_data = getCpuData();
+		bool trap = cpu_data->extendedStateOwner != executor
+				|| executor->_extendedStateCpu != cpu_data;
+		if(trap != cpu_data->extendedStateTrap) {
+			setTaskSwitched(trap);
+			cpu_data->extendedStateTrap = trap;
+		}
+	}
+
 	if(cs == kSelClientUserCode)
 		asm volatile ( "swapgs" : : : "memory" );
 
@@ -508,7 +1013,9 @@ FiberContext::FiberContext(UniqueKernelStack stack)
 // --------------------------------------------------------
 
 PlatformCpuData::PlatformCpuData()
-: haveSmap{false}, havePcids{false} {
+: haveSmap{false}, havePcids{false},
+		extendedStateOwner{nullptr}, extendedStateTrap{false},
+		bootStartNanos{0}, bootOnlineNanos{0} {
 	for(int i = 0; i < maxPcidCount; i++)
 		pcidBindings[i].setupPcid(i);
 
@@ -550,6 +1057,7 @@ void disableUserAccess() {
 // --------------------------------------------------------
 
 namespace {
+	frigg::TicketLock cpuContextsMutex;
 	frigg::LazyInitializer<frigg::Vector<CpuData *, KernelAlloc>> allCpuContexts;
 }
 
@@ -597,6 +1105,9 @@ void setupCpuContext(AssemblyCpuData *context) {
 void earlyInitializeBootProcessor() {
 	staticBootCpuContext.initialize();
 	setupCpuContext(staticBootCpuContext.get());
+
+	// Executors are already created before initializeBootProcessor().
+	probeExtendedState();
 }
 
 void initializeBootProcessor() {
@@ -612,8 +1123,15 @@ void initializeThisProcessor() {
 	// move it to a global variable and initialize it in initializeTheSystem() etc.!
 	auto cpu_data = getCpuData();
 	
-	// TODO: If we want to make bootSecondary() parallel, we have to lock here.
-	allCpuContexts->push(cpu_data);
+	// APs boot in parallel; this is the only global state that they touch.
+	uint32_t cpu_index;
+	{
+		auto lock = frigg::guard(&cpuContextsMutex);
+		cpu_index = allCpuContexts->size();
+		allCpuContexts->push(cpu_data);
+	}
+
+	initializeTraceBuffer(cpu_data, cpu_index);
 
 	// Allocate per-CPU areas.
 	cpu_data->irqStack = UniqueKernelStack::make();
@@ -664,6 +1182,20 @@ void initializeThisProcessor() {
 		asm volatile ("mov %0, %%cr4" : : "r" (cr4));
 	}
 
+	// Enable XSAVE and the extended state components.
+	if(xsaveComponents) {
+		uint64_t cr4;
+		asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+		cr4 |= uint32_t(1) << 18;
+		asm volatile ("mov %0, %%cr4" : : "r" (cr4));
+
+		writeXcr(0, xsaveComponents);
+
+		// We do not use any supervisor state components.
+		if(extendedStateMode == ExtendedStateMode::xsaves)
+			frigg::arch_x86::wrmsr(frigg::arch_x86::kMsrXss, 0);
+	}
+
 	// Enable the wr{fs,gs}base instructions.
 	// FIXME: does not seem to work under qemu
 //	if(!(frigg::arch_x86::cpuid(frigg::arch_x86::kCpuIndexStructuredExtendedFeaturesEnum)[1]
@@ -746,77 +1278,113 @@ struct StatusBlock {
 
 static_assert(sizeof(StatusBlock) == 40, "Bad sizeof(StatusBlock)");
 
+// Each AP that is booted concurrently gets its own trampoline page (see memory.txt).
+// The SIPI vector encodes the page number, hence the pages need to be below 1 MiB.
+constexpr uintptr_t trampolineBase = 0x10000;
+constexpr size_t maxParallelBoots = 64;
+
 void secondaryMain(StatusBlock *status_block) {
 	setupCpuContext(status_block->cpuContext);
 	initializeThisProcessor();
+	getCpuData()->bootOnlineNanos = systemClockSource()->currentNanos();
 	__atomic_store_n(&status_block->targetStage, 2, __ATOMIC_RELEASE);
 
 	frigg::infoLogger() << "Hello world from CPU #" << getLocalApicId() << frigg::endLog;	
 	localScheduler()->reschedule();
 }
 
-void bootSecondary(unsigned int apic_id) {
-	if(disableSmp)
-		return;
+namespace {
+	void bootSecondaryBatch(const unsigned int *apic_ids, size_t count) {
+		assert(count <= maxParallelBoots);
+
+		auto image_size = (uintptr_t)_binary_kernel_thor_trampoline_bin_end
+				- (uintptr_t)_binary_kernel_thor_trampoline_bin_start;
+		assert(image_size <= kPageSize - sizeof(StatusBlock));
+
+		StatusBlock *status_blocks[maxParallelBoots];
+		CpuData *contexts[maxParallelBoots];
+
+		for(size_t i = 0; i < count; i++) {
+			// Copy the trampoline code into low physical memory.
+			uintptr_t pma = trampolineBase + i * kPageSize;
+			PageAccessor accessor{pma};
+			memcpy(accessor.get(), _binary_kernel_thor_trampoline_bin_start, image_size);
+
+			// Allocate a stack for the initialization code.
+			constexpr size_t stack_size = 0x10000;
+			void *stack_ptr = kernelAlloc->allocate(stack_size);
+
+			contexts[i] = frigg::construct<CpuData>(*kernelAlloc);
+			contexts[i]->localApicId = apic_ids[i];
+			contexts[i]->numaNode = numaNodeOfApic(apic_ids[i]);
+
+			// Setup a status block to communicate information to the AP.
+			// Note that the physical window stays valid after the PageAccessor is destructed.
+			auto status_block = reinterpret_cast<StatusBlock *>(
+					reinterpret_cast<char *>(accessor.get())
+					+ (kPageSize - sizeof(StatusBlock)));
+			status_block->targetStage = 0;
+			status_block->initiatorStage = 0;
+			status_block->pml4 = KernelPageSpace::global().rootTable();
+			status_block->stack = (uintptr_t)stack_ptr + stack_size;
+			status_block->main = &secondaryMain;
+			status_block->cpuContext = contexts[i];
+			status_blocks[i] = status_block;
+		}
 
-	// TODO: Allocate a page in low physical memory instead of hard-coding it.
-	uintptr_t pma = 0x10000;
+		// Send the IPI sequence that starts up the APs.
+		// On modern processors INIT lets the processor enter the wait-for-SIPI state.
+		// The BIOS is not involved in this process at all.
+		// All APs of the batch share the mandatory delays.
+		for(size_t i = 0; i < count; i++) {
+			frigg::infoLogger() << "thor: Booting AP " << apic_ids[i] << "." << frigg::endLog;
+			contexts[i]->bootStartNanos = systemClockSource()->currentNanos();
+			raiseInitAssertIpi(apic_ids[i]);
+		}
+		fiberSleep(10000000); // Wait for 10ms.
+
+		// SIPI causes the processor to resume execution and resets CS:IP.
+		// Intel suggets to send two SIPIs (probably for redundancy reasons).
+		for(size_t i = 0; i < count; i++)
+			raiseStartupIpi(apic_ids[i], trampolineBase + i * kPageSize);
+		fiberSleep(200000); // Wait for 200us.
+		for(size_t i = 0; i < count; i++)
+			raiseStartupIpi(apic_ids[i], trampolineBase + i * kPageSize);
+		fiberSleep(200000); // Wait for 200us.
+
+		// Wait until the APs wake up.
+		// We only let each AP proceed after all IPIs have been sent.
+		// This ensures that the AP does not execute boot code twice (e.g. in case
+		// it already wakes up after a single SIPI).
+		for(size_t i = 0; i < count; i++) {
+			while(__atomic_load_n(&status_blocks[i]->targetStage, __ATOMIC_ACQUIRE) < 1) {
+				frigg::pause();
+			}
+			__atomic_store_n(&status_blocks[i]->initiatorStage, 1, __ATOMIC_RELEASE);
+		}
 
-	// Copy the trampoline code into low physical memory.
-	auto image_size = (uintptr_t)_binary_kernel_thor_trampoline_bin_end
-			- (uintptr_t)_binary_kernel_thor_trampoline_bin_start;
-	assert(image_size <= kPageSize);
-	PageAccessor accessor{pma};
-	memcpy(accessor.get(), _binary_kernel_thor_trampoline_bin_start, image_size);
-	
-	// Allocate a stack for the initialization code.
-	constexpr size_t stack_size = 0x10000;
-	void *stack_ptr = kernelAlloc->allocate(stack_size);
-	
-	auto context = frigg::construct<CpuData>(*kernelAlloc);
-	context->localApicId = apic_id;
-
-	// Setup a status block to communicate information to the AP.
-	auto status_block = reinterpret_cast<StatusBlock *>(reinterpret_cast<char *>(accessor.get())
-			+ (kPageSize - sizeof(StatusBlock)));
-
-	status_block->targetStage = 0;
-	status_block->initiatorStage = 0;
-	status_block->pml4 = KernelPageSpace::global().rootTable();
-	status_block->stack = (uintptr_t)stack_ptr + stack_size;
-	status_block->main = &secondaryMain;
-	status_block->cpuContext = context;
-
-	// Send the IPI sequence that starts up the AP.
-	// On modern processors INIT lets the processor enter the wait-for-SIPI state.
-	// The BIOS is not involved in this process at all.
-	frigg::infoLogger() << "thor: Booting AP " << apic_id << "." << frigg::endLog;
-	raiseInitAssertIpi(apic_id);
-	fiberSleep(10000000); // Wait for 10ms.
-
-	// SIPI causes the processor to resume execution and resets CS:IP.
-	// Intel suggets to send two SIPIs (probably for redundancy reasons).
-	raiseStartupIpi(apic_id, pma);
-	fiberSleep(200000); // Wait for 200us.
-	raiseStartupIpi(apic_id, pma);
-	fiberSleep(200000); // Wait for 200us.
-	
-	// Wait until the AP wakes up.
-	while(__atomic_load_n(&status_block->targetStage, __ATOMIC_ACQUIRE) < 1) {
-		frigg::pause();
+		// Wait until the APs exit the boot code. The APs initialize themselves concurrently.
+		for(size_t i = 0; i < count; i++) {
+			while(__atomic_load_n(&status_blocks[i]->targetStage, __ATOMIC_ACQUIRE) < 2) {
+				frigg::pause();
+			}
+			frigg::infoLogger() << "thor: AP " << apic_ids[i] << " finished booting after "
+					<< (contexts[i]->bootOnlineNanos - contexts[i]->bootStartNanos) / 1000
+					<< " us." << frigg::endLog;
+		}
 	}
-	frigg::infoLogger() << "thor: AP did wake up." << frigg::endLog;
+}
 
-	// We only let the AP proceed after all IPIs have been sent.
-	// This ensures that the AP does not execute boot code twice (e.g. in case
-	// it already wakes up after a single SIPI).
-	__atomic_store_n(&status_block->initiatorStage, 1, __ATOMIC_RELEASE);
-	
-	// Wait until the AP exits the boot code.
-	while(__atomic_load_n(&status_block->targetStage, __ATOMIC_ACQUIRE) < 2) {
-		frigg::pause();
-	}
-	frigg::infoLogger() << "thor: AP finished booting." << frigg::endLog;
+void bootSecondaries(const unsigned int *apic_ids, size_t count) {
+	if(disableSmp)
+		return;
+
+	auto start = systemClockSource()->currentNanos();
+	for(size_t k = 0; k < count; k += maxParallelBoots)
+		bootSecondaryBatch(apic_ids + k, frigg::min(count - k, maxParallelBoots));
+	frigg::infoLogger() << "thor: Booted " << count << " APs in "
+			<< (systemClockSource()->currentNanos() - start) / 1000 << " us."
+			<< frigg::endLog;
 }
 
 } // namespace thor
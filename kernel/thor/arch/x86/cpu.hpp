@@ -190,6 +190,10 @@ struct IrqImageAccessor {
 	Word *cs() { return &_frame()->cs; }
 	Word *rflags() { return &_frame()->rflags; }
 	Word *ss() { return &_frame()->ss; }
+
+	// These are exposed for the sampling profiler.
+	Word *sp() { return &_frame()->rsp; }
+	Word *bp() { return &_frame()->rbp; }
 	
 	bool inPreemptibleDomain() {
 		assert(*cs() == kSelSystemIdleCode
@@ -408,6 +412,9 @@ struct Executor {
 	friend void saveExecutor(Executor *executor, SyscallImageAccessor accessor);
 	friend void workOnExecutor(Executor *executor);
 	friend void restoreExecutor(Executor *executor);
+	friend void saveExtendedState(Executor *executor);
+	friend void restoreExtendedState(Executor *executor);
+	friend bool handleLazyExtendedState(Executor *executor);
 
 	static size_t determineSize();
 
@@ -518,26 +525,45 @@ public:
 	}
 
 private:
-	
+	// The extended state area follows the general state. XSAVE requires
+	// 64-byte alignment, FXSAVE is content with 16 bytes.
 	FxState *_fxState() {
-		return reinterpret_cast<FxState *>(_pointer + sizeof(General));
+		auto address = reinterpret_cast<uintptr_t>(_pointer + sizeof(General));
+		return reinterpret_cast<FxState *>((address + 63) & ~uintptr_t(63));
 	}
 
 	char *_pointer;
 	void *_syscallStack;
 	frigg::arch_x86::Tss64 *_tss;
+
+	// CPU on which the extended state was last loaded into the registers.
+	// Only used if extended state is restored lazily.
+	CpuData *_extendedStateCpu;
 };
 
 void saveExecutor(Executor *executor, FaultImageAccessor accessor);
 void saveExecutor(Executor *executor, IrqImageAccessor accessor);
 void saveExecutor(Executor *executor, SyscallImageAccessor accessor);
 
+// Saves the CPU's extended (FPU/SSE/AVX) state into the executor.
+void saveExtendedState(Executor *executor);
+
+// Loads the executor's extended state into the CPU.
+void restoreExtendedState(Executor *executor);
+
+// Handles #NM if extended state is restored lazily.
+// Returns false if the fault was not caused by lazy restore.
+bool handleLazyExtendedState(Executor *executor);
+
 template<typename F>
 void forkExecutor(F functor, Executor *executor) {
 	auto delegate = [] (void *p) {
 		auto fp = static_cast<F *>(p);
 		(*fp)();
 	};
+	// The kernel is compiled with -mgeneral-regs-only, hence the extended state
+	// does not change until doForkExecutor() captures the general registers.
+	saveExtendedState(executor);
 	doForkExecutor(executor, delegate, &functor);
 }
 
@@ -552,6 +578,10 @@ void workOnExecutor(Executor *executor);
 
 size_t getStateSize();
 
+// Determines the set of XSAVE components and the size of the extended state.
+// Has to be called before the first Executor is constructed.
+void probeExtendedState();
+
 // switches the active executor.
 // does NOT restore the executor's state.
 struct Thread;
@@ -586,6 +616,18 @@ struct PlatformCpuData : public AssemblyCpuData {
 	bool haveSmap;
 	bool havePcids;
 
+	// Executor whose extended state is currently held in the registers
+	// (if _extendedStateCpu also points to this CPU) and whether CR0.TS is set.
+	// Only used if extended state is restored lazily.
+	Executor *extendedStateOwner;
+	bool extendedStateTrap;
+
+	// Bring-up timestamps (relative to systemClockSource()).
+	// bootStartNanos is taken before the INIT IPI is sent, bootOnlineNanos
+	// once the CPU has finished its initialization. Both are zero on the BSP.
+	uint64_t bootStartNanos;
+	uint64_t bootOnlineNanos;
+
 	LocalApicContext apicContext;
 	
 	// TODO: This is not really arch-specific!
@@ -624,7 +666,8 @@ void earlyInitializeBootProcessor();
 void initializeBootProcessor();
 void initializeThisProcessor();
 
-void bootSecondary(unsigned int apic_id);
+// Boots the given APs. APs are started in parallel.
+void bootSecondaries(const unsigned int *apic_ids, size_t count);
 
 } // namespace thor
 
@@ -1,5 +1,6 @@
 
 #include "generic/kernel.hpp"
+#include "generic/rcu.hpp"
 
 extern char stubsPtr[], stubsLimit[];
 
@@ -203,8 +204,10 @@ bool inStub(uintptr_t ip) {
 
 void handlePageFault(FaultImageAccessor image, uintptr_t address);
 void handleOtherFault(FaultImageAccessor image, Interrupt fault);
+extern "C" void handleNoFpuFault(FaultImageAccessor image);
 void handleIrq(IrqImageAccessor image, int number);
 void handlePreemption(IrqImageAccessor image);
+void handleProfileTick(IrqImageAccessor image);
 void handleSyscall(SyscallImageAccessor image);
 
 void handleDebugFault(FaultImageAccessor image) {
@@ -243,6 +246,9 @@ extern "C" void onPlatformFault(FaultImageAccessor image, int number) {
 	case 6: {
 		handleOtherFault(image, kIntrIllegalInstruction);
 	} break;
+	case 7: {
+		handleNoFpuFault(image);
+	} break;
 	case 13: {
 		handleOtherFault(image, kIntrGeneralFault);
 	} break;
@@ -274,7 +280,15 @@ extern "C" void onPlatformIrq(IrqImageAccessor image, int number) {
 	assert(!irqMutex().nesting());
 	disableUserAccess();
 
+	if(cs == kSelClientUserCode)
+		rcuQuiescentState();
+	else if(cs == kSelSystemIdleCode)
+		rcuExitIdle();
+
 	handleIrq(image, number);
+
+	if(cs == kSelSystemIdleCode)
+		rcuEnterIdle();
 }
 
 extern "C" void onPlatformLegacyIrq(IrqImageAccessor image, int number) {
@@ -317,13 +331,22 @@ extern "C" void onPlatformPreemption(IrqImageAccessor image) {
 	assert(!irqMutex().nesting());
 	disableUserAccess();
 
+	if(cs == kSelClientUserCode)
+		rcuQuiescentState();
+	else if(cs == kSelSystemIdleCode)
+		rcuExitIdle();
+
 	LocalApicContext::handleTimerIrq();
+	handleProfileTick(image);
 
 	getCpuData()->heartbeat.fetch_add(1, std::memory_order_relaxed);
 
 	acknowledgeIrq(0);
 
 	handlePreemption(image);
+
+	if(cs == kSelSystemIdleCode)
+		rcuEnterIdle();
 }
 
 extern "C" void onPlatformSyscall(SyscallImageAccessor image) {
@@ -369,9 +392,21 @@ extern "C" void onPlatformPing(IrqImageAccessor image) {
 	assert(!irqMutex().nesting());
 	disableUserAccess();
 
+	// Ping IPIs are also used to force quiescent states, see rcu.cpp.
+	if(cs == kSelClientUserCode)
+		rcuQuiescentState();
+	else if(cs == kSelSystemIdleCode)
+		rcuExitIdle();
+
 	acknowledgeIpi();
 
+	// Loggers send ping IPIs to themselves to wake the log fiber.
+	handleLogWakeup();
+
 	handlePreemption(image);
+
+	if(cs == kSelSystemIdleCode)
+		rcuEnterIdle();
 }
 
 extern "C" void onPlatformWork() {
@@ -896,6 +896,16 @@ void ClientPageSpace::Walk::walkTo(uintptr_t address) {
 	_accessor1 = PageAccessor{};
 }
 
+bool ClientPageSpace::Walk::peekPresent() {
+	_update();
+	if(!_accessor1)
+		return false;
+
+	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
+	auto ent = tbl[(_address >> 12) & 0x1FF].load();
+	return ent & kPagePresent;
+}
+
 PageFlags ClientPageSpace::Walk::peekFlags() {
 	_update();
 	assert(_accessor1);
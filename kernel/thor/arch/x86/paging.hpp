@@ -280,6 +280,7 @@ public:
 
 		void walkTo(uintptr_t address);
 
+		bool peekPresent();
 		PageFlags peekFlags();
 		PhysicalAddr peekPhysical();
 
@@ -89,7 +89,7 @@ void GlobalApicContext::GlobalAlarmSlot::arm(uint64_t nanos) {
 }
 
 LocalApicContext::LocalApicContext()
-: _preemptionDeadline{0}, _globalDeadline{0} { }
+: _preemptionDeadline{0}, _profileDeadline{0}, _globalDeadline{0} { }
 
 void LocalApicContext::setPreemption(uint64_t nanos) {
 	assert(apicTicksPerMilli > 0);
@@ -98,6 +98,13 @@ void LocalApicContext::setPreemption(uint64_t nanos) {
 	LocalApicContext::_updateLocalTimer();
 }
 
+void LocalApicContext::setProfileDeadline(uint64_t nanos) {
+	assert(apicTicksPerMilli > 0);
+
+	localApicContext()->_profileDeadline = nanos;
+	LocalApicContext::_updateLocalTimer();
+}
+
 void LocalApicContext::handleTimerIrq() {
 //	frigg::infoLogger() << "thor [CPU " << getLocalApicId() << "]: Timer IRQ triggered"
 //			<< frigg::endLog;
@@ -106,6 +113,8 @@ void LocalApicContext::handleTimerIrq() {
 
 	if(self->_preemptionDeadline && now > self->_preemptionDeadline)
 		self->_preemptionDeadline = 0;
+	if(self->_profileDeadline && now > self->_profileDeadline)
+		self->_profileDeadline = 0;
 
 	if(self->_globalDeadline && now > self->_globalDeadline) {
 		self->_globalDeadline = 0;
@@ -139,6 +148,7 @@ void LocalApicContext::_updateLocalTimer() {
 	}
 
 	consider(localApicContext()->_preemptionDeadline);
+	consider(localApicContext()->_profileDeadline);
 	consider(localApicContext()->_globalDeadline);
 	
 	if(!deadline) {
@@ -232,9 +242,14 @@ uint64_t rdtsc() {
 
 uint64_t tscTicksPerMilli;
 
+// TSC ticks are converted to nanoseconds by (ticks * tscMult) >> tscShift.
+// User space performs the same computation on the clock page.
+constexpr uint32_t tscShift = 32;
+uint64_t tscMult;
+
 struct TimeStampCounter : ClockSource {
 	uint64_t currentNanos() override {
-		auto r = rdtsc() * 1'000'000 / tscTicksPerMilli;
+		auto r = (static_cast<unsigned __int128>(rdtsc()) * tscMult) >> tscShift;
 //		frigg::infoLogger() << r << frigg::endLog;
 		return r;
 	}
@@ -242,6 +257,45 @@ struct TimeStampCounter : ClockSource {
 
 TimeStampCounter *globalTscInstance;
 
+frigg::LazyInitializer<frigg::SharedPtr<Memory>> clockPageMemory;
+
+namespace {
+	bool haveInvariantTsc() {
+		if(frigg::arch_x86::cpuid(0x80000000)[0] < 0x80000007)
+			return false;
+		return frigg::arch_x86::cpuid(0x80000007)[3] & (uint32_t(1) << 8);
+	}
+
+	void initializeClockPage() {
+		auto physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+
+		PageAccessor accessor{physical};
+		memset(accessor.get(), 0, kPageSize);
+
+		// The page is only written once; the seqlock allows us to recalibrate later.
+		auto page = reinterpret_cast<HelClockPage *>(accessor.get());
+		__atomic_store_n(&page->seqlock, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		page->tscMult = tscMult;
+		page->tscShift = tscShift;
+		page->nanosOffset = 0;
+		if(haveInvariantTsc())
+			page->flags |= kHelClockPageTscStable;
+		__atomic_store_n(&page->seqlock, 2, __ATOMIC_RELEASE);
+
+		frigg::infoLogger() << "thor: TSC is " << (haveInvariantTsc() ? "" : "not ")
+				<< "invariant" << frigg::endLog;
+
+		clockPageMemory.initialize(frigg::makeShared<HardwareMemory>(*kernelAlloc,
+				physical, kPageSize, CachingMode::null));
+	}
+}
+
+frigg::SharedPtr<Memory> getClockPageMemory() {
+	return *clockPageMemory;
+}
+
 extern ClockSource *hpetClockSource;
 extern AlarmTracker *hpetAlarmTracker;
 extern ClockSource *globalClockSource;
@@ -264,7 +318,9 @@ void calibrateApicTimer() {
 	auto tsc_elapsed = rdtsc() - tsc_start;
 	
 	tscTicksPerMilli = tsc_elapsed / millis;
+	tscMult = (uint64_t{1'000'000} << tscShift) / tscTicksPerMilli;
 	frigg::infoLogger() << "thor: TSC ticks/ms: " << tscTicksPerMilli << frigg::endLog;
+	initializeClockPage();
 
 	globalTscInstance = frigg::construct<TimeStampCounter>(*kernelAlloc);
 	globalApicContextInstance = frigg::construct<GlobalApicContext>(*kernelAlloc);
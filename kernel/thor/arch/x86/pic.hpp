@@ -40,6 +40,9 @@ struct LocalApicContext {
 
 	static void setPreemption(uint64_t nanos);
 
+	// Deadline of the next profiler sample on this CPU (zero to disable).
+	static void setProfileDeadline(uint64_t nanos);
+
 	static void handleTimerIrq();
 
 private:
@@ -47,6 +50,7 @@ private:
 
 private:
 	uint64_t _preemptionDeadline;
+	uint64_t _profileDeadline;
 	uint64_t _globalDeadline;
 };
 
@@ -61,6 +65,11 @@ uint64_t localTicks();
 
 void calibrateApicTimer();
 
+struct Memory;
+
+// Returns the page that allows user space to read the system clock (see HelClockPage).
+frigg::SharedPtr<Memory> getClockPageMemory();
+
 void armPreemption(uint64_t nanos);
 void disarmPreemption();
 
@@ -151,7 +151,9 @@ IrqMutex &irqMutex() {
 ExecutorContext::ExecutorContext() { }
 
 CpuData::CpuData()
-: scheduler{this}, activeFiber{nullptr}, heartbeat{0} { }
+: scheduler{this}, activeFiber{nullptr}, heartbeat{0},
+		tracePhysical{PhysicalAddr(-1)}, traceBuffer{nullptr}, profileBuffer{nullptr},
+		zpoolBuffer{nullptr}, rcuEpoch{0}, rcuIdle{false}, numaNode{0}, logNesting{0} { }
 
 // --------------------------------------------------------
 // Threading related functions
@@ -191,15 +193,13 @@ frigg::Optional<AnyDescriptor> Universe::detachDescriptor(Guard &guard, Handle h
 // Frigg glue functions
 // --------------------------------------------------------
 
-frigg::TicketLock logLock;
-
 void friggBeginLog() {
 	thor::irqMutex().lock();
-	logLock.lock();
+	thor::beginLogRecord();
 }
 
 void friggEndLog() {
-	logLock.unlock();
+	thor::endLogRecord();
 	thor::irqMutex().unlock();
 }
 
@@ -211,6 +211,7 @@ void friggPrintCritical(char const *str) {
 }
 void friggPanic() {
 	thor::disableInts();
+	thor::flushLogSynchronously();
 	while(true) {
 		thor::halt();
 	}
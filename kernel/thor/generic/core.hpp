@@ -33,6 +33,41 @@ void disableLogHandler(LogHandler *sink);
 size_t currentLogSequence();
 void copyLogMessage(size_t sequence, char *text);
 
+// Loggers format the current line of their record into a per-CPU buffer and publish
+// complete lines to the log queue without taking a lock.
+struct LogStaging {
+	static constexpr int maximalCsiLength = 16;
+
+	char text[100];
+	size_t length = 0;
+
+	// State of the parser for CSI escape sequences.
+	int csiState = 0;
+	int csiLength = 0;
+	char csiBuffer[maximalCsiLength];
+};
+
+// Records can be nested (e.g., if a logger faults); deeper records are dropped.
+constexpr int maxLogNesting = 2;
+
+// Called by friggBeginLog() and friggEndLog() with IRQs disabled.
+void beginLogRecord();
+void endLogRecord();
+
+// Called on ping IPIs; wakes the log fiber if a logger requested it.
+void handleLogWakeup();
+
+// Moves the output of log messages to a KernelFiber.
+// Loggers then only append to the log queue, which does not involve (slow) I/O.
+void initializeAsyncLog();
+// Writes all pending messages synchronously; used when the kernel panics.
+void flushLogSynchronously();
+
+// Copies complete messages (terminated by newlines) into buffer, starting at *sequence.
+// On return, *first is the first copied sequence (messages before it were overwritten)
+// and *sequence is the next sequence to read. Returns the number of bytes copied.
+size_t readLogMessages(size_t *sequence, size_t *first, char *buffer, size_t max_size);
+
 // --------------------------------------------------------
 // Kernel data types
 // --------------------------------------------------------
@@ -49,6 +84,8 @@ class IoSpace;
 
 struct WorkQueue;
 struct KernelFiber;
+struct TraceHeader;
+struct ProfileBuffer;
 
 // TODO: For now, this class is empty but it will be required for QST.
 struct ExecutorContext {
@@ -74,6 +111,27 @@ struct CpuData : public PlatformCpuData {
 	ExecutorContext *executorContext;
 	KernelFiber *activeFiber;
 	std::atomic<uint64_t> heartbeat;
+
+	// Per-CPU trace buffer, see trace.hpp.
+	PhysicalAddr tracePhysical;
+	TraceHeader *traceBuffer;
+
+	// Allocated on the first helStartProfiling(), see profile.hpp.
+	ProfileBuffer *profileBuffer;
+
+	// Staging buffer for compression, allocated on first use, see zpool.hpp.
+	uint8_t *zpoolBuffer;
+
+	// Last RCU epoch in which this CPU passed through a quiescent state, see rcu.hpp.
+	std::atomic<uint64_t> rcuEpoch;
+	std::atomic<bool> rcuIdle;
+
+	// NUMA node of this CPU, see numa.hpp.
+	int numaNode;
+
+	// Log records that are currently formatted on this CPU.
+	int logNesting;
+	LogStaging logStaging[maxLogNesting];
 };
 
 inline ExecutorContext *localExecutorContext() {
@@ -108,8 +166,8 @@ DirectSpaceAccessor<T>::DirectSpaceAccessor(AddressSpaceLockHandle &lock, ptrdif
 
 class Universe {
 public:
-	typedef frigg::TicketLock Lock;
-	typedef frigg::LockGuard<frigg::TicketLock> Guard;
+	typedef ClassLock<frigg::McsLock, LockClass::universe> Lock;
+	typedef frigg::LockGuard<Lock> Guard;
 
 	Universe();
 	~Universe();
@@ -38,17 +38,20 @@ struct UniverseDescriptor {
 // --------------------------------------------------------
 
 struct MemoryViewDescriptor {
-	MemoryViewDescriptor(frigg::SharedPtr<Memory> memory)
-	: memory(frigg::move(memory)) { }
+	MemoryViewDescriptor(frigg::SharedPtr<Memory> memory, bool read_only = false)
+	: memory(frigg::move(memory)), readOnly(read_only) { }
 
 	frigg::SharedPtr<Memory> memory;
+	// Read-only views cannot be mapped writable (except copy-on-write).
+	bool readOnly;
 };
 
 struct MemorySliceDescriptor {
-	MemorySliceDescriptor(frigg::SharedPtr<MemorySlice> slice)
-	: slice(frigg::move(slice)) { }
+	MemorySliceDescriptor(frigg::SharedPtr<MemorySlice> slice, bool read_only = false)
+	: slice(frigg::move(slice)), readOnly(read_only) { }
 
 	frigg::SharedPtr<MemorySlice> slice;
+	bool readOnly;
 };
 
 struct AddressSpaceDescriptor {
@@ -62,6 +62,11 @@ public:
 		return &_associatedWorkQueue;
 	}
 
+	// Used by the profiler to bound stack walks.
+	UniqueKernelStack &kernelStack() {
+		return _fiberContext.stack;
+	}
+
 private:
 	frigg::TicketLock _mutex;
 	bool _blocked;
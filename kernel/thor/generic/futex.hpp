@@ -7,6 +7,7 @@
 #include <frigg/hashmap.hpp>
 #include "cancel.hpp"
 #include "kernel_heap.hpp"
+#include "trace.hpp"
 #include "work-queue.hpp"
 #include "../arch/x86/ints.hpp"
 
@@ -36,6 +37,8 @@ struct Futex {
 	
 	template<typename C>
 	bool checkSubmitWait(Address address, C condition, FutexNode *node) {
+		trace(TraceEvent::futexWait, 0, static_cast<uint64_t>(address));
+
 		auto irq_lock = frigg::guard(&irqMutex());
 		auto lock = frigg::guard(&_mutex);
 
@@ -87,14 +90,17 @@ struct Futex {
 		lock.unlock();
 		irq_lock.unlock();
 
+		uint32_t count = 0;
 		while(!wake_queue.empty()) {
 			auto node = wake_queue.pop_front();
 			WorkQueue::post(node->_woken);
+			count++;
 		}
+		trace(TraceEvent::futexWake, count, static_cast<uint64_t>(address));
 	}
 
 private:	
-	using Mutex = frigg::TicketLock;
+	using Mutex = ClassLock<frigg::McsLock, LockClass::futex>;
 
 	struct Slot {
 		frg::intrusive_list<
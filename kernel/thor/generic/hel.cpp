@@ -7,6 +7,8 @@
 #include "ipc-queue.hpp"
 #include "irq.hpp"
 #include "kernlet.hpp"
+#include "ksm.hpp"
+#include "profile.hpp"
 #include "../arch/x86/debug.hpp"
 
 using namespace thor;
@@ -264,13 +266,29 @@ HelError helCloseDescriptor(HelHandle handle) {
 
 HelError helCreateQueue(HelQueue *head, uint32_t flags,
 		unsigned int size_shift, size_t element_limit, HelHandle *handle) {
+	// helCreateQueue() never validated element_limit (the queue does not use it).
+	// Keep accepting all values; elements that do not fit into a chunk are
+	// rejected with kHelErrQueueTooSmall when they are submitted.
+	(void)element_limit;
+	return helCreateQueue2(head, flags, size_shift, 0,
+			IpcQueue::defaultChunkSize, handle);
+}
+
+HelError helCreateQueue2(HelQueue *head, uint32_t flags,
+		unsigned int size_shift, size_t element_limit, size_t chunk_size,
+		HelHandle *handle) {
 	assert(!flags);
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
+	if(!chunk_size)
+		chunk_size = IpcQueue::defaultChunkSize;
+	if(!IpcQueue::validParameters(element_limit, chunk_size))
+		return kHelErrIllegalArgs;
+
 	auto queue = frigg::makeShared<IpcQueue>(*kernelAlloc,
 			this_thread->getAddressSpace().lock(), head,
-			size_shift, element_limit);
+			size_shift, element_limit, chunk_size);
 	queue->setupSelfPtr(queue);
 	{
 		auto irq_lock = frigg::guard(&irqMutex());
@@ -339,9 +357,13 @@ HelError helAllocateMemory(size_t size, uint32_t flags, HelHandle *handle) {
 //	frigg::infoLogger() << "Allocate " << (void *)size
 //			<< ", sum of allocated memory: " << (void *)pressure << frigg::endLog;
 
-	frigg::SharedPtr<Memory> memory;
+	frigg::SharedPtr<AllocatedMemory> memory;
 	if(flags & kHelAllocContinuous) {
 		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size, size, kPageSize);
+	}else if(flags & kHelAllocSwappable) {
+		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size);
+		memory->selfPtr = memory;
+		memory->enableSwapping();
 	}else if(flags & kHelAllocOnDemand) {
 		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size);
 	}else{
@@ -349,6 +371,11 @@ HelError helAllocateMemory(size_t size, uint32_t flags, HelHandle *handle) {
 		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size);
 	}
 
+	if(flags & kHelAllocMergeable)
+		memory->enableMerging();
+	if(flags & kHelAllocAnonymous)
+		memory->markAnonymous();
+
 	{
 		auto irq_lock = frigg::guard(&irqMutex());
 		Universe::Guard universe_guard(&this_universe->lock);
@@ -437,6 +464,7 @@ HelError helCreateSliceView(HelHandle bundle_handle,
 	auto this_universe = this_thread->getUniverse();
 
 	frigg::SharedPtr<Memory> bundle;
+	bool read_only;
 	{
 		auto irq_lock = frigg::guard(&irqMutex());
 		Universe::Guard universe_guard(&this_universe->lock);
@@ -447,6 +475,7 @@ HelError helCreateSliceView(HelHandle bundle_handle,
 		if(!wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		bundle = wrapper->get<MemoryViewDescriptor>().memory;
+		read_only = wrapper->get<MemoryViewDescriptor>().readOnly;
 	}
 
 	auto slice = frigg::makeShared<MemorySlice>(*kernelAlloc,
@@ -456,7 +485,7 @@ HelError helCreateSliceView(HelHandle bundle_handle,
 		Universe::Guard universe_guard(&this_universe->lock);
 
 		*handle = this_universe->attachDescriptor(universe_guard,
-				MemorySliceDescriptor(frigg::move(slice)));
+				MemorySliceDescriptor(frigg::move(slice), read_only));
 	}
 
 	return kHelErrNone;
@@ -535,11 +564,15 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		return kHelErrIllegalArgs;
 	if(length % kPageSize != 0)
 		return kHelErrIllegalArgs;
+	// Populating would fail on pages that are not present.
+	if((flags & kHelMapPopulate) && (flags & kHelMapDontRequireBacking))
+		return kHelErrIllegalArgs;
 
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
 	frigg::SharedPtr<MemorySlice> slice;
+	bool read_only;
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
 		auto irq_lock = frigg::guard(&irqMutex());
@@ -550,8 +583,10 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 			return kHelErrNoDescriptor;
 		if(memory_wrapper->is<MemorySliceDescriptor>()) {
 			slice = memory_wrapper->get<MemorySliceDescriptor>().slice;
+			read_only = memory_wrapper->get<MemorySliceDescriptor>().readOnly;
 		}else if(memory_wrapper->is<MemoryViewDescriptor>()) {
 			auto memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
+			read_only = memory_wrapper->get<MemoryViewDescriptor>().readOnly;
 			auto bundle_length = memory->getLength();
 			slice = frigg::makeShared<MemorySlice>(*kernelAlloc,
 					frigg::move(memory), 0, bundle_length);
@@ -571,6 +606,10 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		}
 	}
 
+	// Private copies do not modify the underlying memory.
+	if(read_only && (flags & kHelMapProtWrite) && !(flags & kHelMapCopyOnWrite))
+		return kHelErrIllegalArgs;
+
 	// TODO: check proper alignment
 
 	uint32_t map_flags = 0;
@@ -612,13 +651,39 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 				map_flags, &actual_address);
 	}
 
-	if(error == kErrBufferTooSmall) {
+	if(error == kErrBufferTooSmall)
 		return kHelErrBufferTooSmall;
-	}else{
-		assert(!error);
-		*actual_pointer = (void *)actual_address;
-		return kHelErrNone;
+	assert(!error);
+
+	// Another thread might have unmapped (or replaced) the mapping since we dropped the lock.
+	// Populating is only an optimization, so we skip it in that case.
+	smarter::shared_ptr<Mapping> mapping;
+	if(flags & kHelMapPopulate)
+		mapping = space->getMapping(actual_address);
+	if(mapping && mapping->address() == actual_address && mapping->length() == length) {
+		// Queue the loads of the whole range at once; the pager can then serve
+		// them in large requests instead of one request per page fault.
+		mapping->prefetchVirtualRange(0, length);
+
+		struct Closure {
+			ThreadBlocker blocker;
+			Worklet worklet;
+			PopulateVirtualNode node;
+		} closure;
+
+		closure.worklet.setup([] (Worklet *base) {
+			auto closure = frg::container_of(base, &Closure::worklet);
+			Thread::unblockOther(&closure->blocker);
+		});
+		closure.node.setup(0, length, &closure.worklet);
+		closure.blocker.setup();
+
+		if(!mapping->populateVirtualRange(&closure.node))
+			Thread::blockCurrent(&closure.blocker);
 	}
+
+	*actual_pointer = (void *)actual_address;
+	return kHelErrNone;
 }
 
 HelError helUnmapMemory(HelHandle space_handle, void *pointer, size_t length) {
@@ -661,6 +726,79 @@ HelError helUnmapMemory(HelHandle space_handle, void *pointer, size_t length) {
 	return kHelErrNone;
 }
 
+HelError helAdviseMemory(HelHandle space_handle, void *pointer, size_t length,
+		uint32_t advice) {
+	if((uintptr_t)pointer % kPageSize != 0)
+		return kHelErrIllegalArgs;
+	if(length % kPageSize != 0)
+		return kHelErrIllegalArgs;
+	if(advice < kHelAdviseWillNeed || advice > kHelAdviseRandom)
+		return kHelErrIllegalArgs;
+
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		Universe::Guard universe_guard(&this_universe->lock);
+
+		if(space_handle == kHelNullHandle) {
+			space = this_thread->getAddressSpace().lock();
+		}else{
+			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			if(!space_wrapper)
+				return kHelErrNoDescriptor;
+			if(!space_wrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = space_wrapper->get<AddressSpaceDescriptor>().space;
+		}
+	}
+
+	// Apply the advice to each mapping that overlaps the range.
+	auto address = reinterpret_cast<VirtualAddr>(pointer);
+	auto limit = address + length;
+	while(address < limit) {
+		auto mapping = space->getMapping(address);
+		if(!mapping)
+			return kHelErrFault;
+		auto offset = address - mapping->address();
+		auto size = frigg::min(limit, mapping->address() + mapping->length()) - address;
+
+		if(advice == kHelAdviseWillNeed) {
+			mapping->prefetchVirtualRange(offset, size);
+		}else if(advice == kHelAdviseDontNeed) {
+			struct Closure {
+				ThreadBlocker blocker;
+				Worklet worklet;
+				DiscardVirtualNode node;
+			} closure;
+
+			closure.worklet.setup([] (Worklet *base) {
+				auto closure = frg::container_of(base, &Closure::worklet);
+				Thread::unblockOther(&closure->blocker);
+			});
+			closure.node.setup(offset, size, &closure.worklet);
+			closure.blocker.setup();
+
+			if(!mapping->discardVirtualRange(&closure.node))
+				Thread::blockCurrent(&closure.blocker);
+		}else if(advice == kHelAdviseSequential) {
+			// Access patterns apply to whole mappings.
+			mapping->setAccessPattern(AccessPattern::sequential);
+		}else if(advice == kHelAdviseRandom) {
+			mapping->setAccessPattern(AccessPattern::random);
+		}else{
+			assert(advice == kHelAdviseNormal);
+			mapping->setAccessPattern(AccessPattern::normal);
+		}
+
+		address += size;
+	}
+
+	return kHelErrNone;
+}
+
 HelError helPointerPhysical(void *pointer, uintptr_t *physical) {
 	auto this_thread = getCurrentThread();
 
@@ -1032,12 +1170,70 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 	}
 
-/*	auto handle_load = frigg::makeShared<AsyncInitiateLoad>(*kernelAlloc,
-			NullCompleter(), offset, length);
+	memory->prefetchRange(offset, length);
+
+	return kHelErrNone;
+}
+
+HelError helSetSwapMemory(HelHandle handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	// The swap space receives the evicted pages of all processes.
+	if(!(this_thread->flags & Thread::kFlagPrivileged))
+		return kHelErrIllegalArgs;
+
+	frigg::SharedPtr<Memory> memory;
 	{
-		// TODO: protect memory object with a guard
-		memory->submitInitiateLoad(frigg::move(handle_load));
-	}*/
+		auto irq_lock = frigg::guard(&irqMutex());
+		Universe::Guard universe_guard(&this_universe->lock);
+
+		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!memory_wrapper)
+			return kHelErrNoDescriptor;
+		if(!memory_wrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
+	}
+
+	if(memory->tag() != MemoryTag::backing)
+		return kHelErrBadDescriptor;
+	auto backing = static_cast<BackingMemory *>(memory.get());
+
+	if(!installSwapSpace(backing->managed()))
+		return kHelErrIllegalState;
+	return kHelErrNone;
+}
+
+HelError helQueryCompressedPoolStats(HelCompressedPoolStats *user_stats) {
+	auto pool_stats = compressedPool->stats();
+
+	HelCompressedPoolStats stats;
+	memset(&stats, 0, sizeof(HelCompressedPoolStats));
+	stats.storedPages = pool_stats.storedPages;
+	stats.compressedBytes = pool_stats.compressedBytes;
+	stats.poolPages = pool_stats.poolPages;
+	stats.numStores = pool_stats.numStores;
+	stats.numHits = pool_stats.numHits;
+	stats.numRejects = pool_stats.numRejects;
+
+	writeUserObject(user_stats, stats);
+
+	return kHelErrNone;
+}
+
+HelError helQueryPageMergeStats(HelPageMergeStats *user_stats) {
+	auto merger_stats = pageMerger->stats();
+
+	HelPageMergeStats stats;
+	memset(&stats, 0, sizeof(HelPageMergeStats));
+	stats.sharedPages = merger_stats.sharedPages;
+	stats.sharingPages = merger_stats.sharingPages;
+	stats.numScanned = merger_stats.numScanned;
+	stats.numMerged = merger_stats.numMerged;
+	stats.numBroken = merger_stats.numBroken;
+
+	writeUserObject(user_stats, stats);
 
 	return kHelErrNone;
 }
@@ -1050,7 +1246,7 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
-	if(flags & ~(kHelThreadStopped))
+	if(flags & ~(kHelThreadStopped | kHelThreadNoRealtime | kHelThreadUnprivileged))
 		return kHelErrIllegalArgs;
 
 	frigg::SharedPtr<Universe> universe;
@@ -1088,6 +1284,10 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 
 	auto new_thread = Thread::create(frigg::move(universe), frigg::move(space), params);
 	new_thread->self = new_thread;
+	if((this_thread->flags & Thread::kFlagRealtime) && !(flags & kHelThreadNoRealtime))
+		new_thread->flags |= Thread::kFlagRealtime;
+	if((this_thread->flags & Thread::kFlagPrivileged) && !(flags & kHelThreadUnprivileged))
+		new_thread->flags |= Thread::kFlagPrivileged;
 
 	// Adding a large prime (coprime to getCpuCount()) should yield a good distribution.
 	auto cpu = globalNextCpu.fetch_add(4099, std::memory_order_relaxed) % getCpuCount();
@@ -1108,6 +1308,8 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 	return kHelErrNone;
 }
 
+static_assert(numLatencyBuckets == kHelNumLatencyBuckets, "Bad numLatencyBuckets");
+
 HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -1127,9 +1329,41 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 		thread = thread_wrapper->get<ThreadDescriptor>().thread;
 	}
 
+	auto sched_stats = Scheduler::queryStats(thread.get());
+
 	HelThreadStats stats;
 	memset(&stats, 0, sizeof(HelThreadStats));
 	stats.userTime = thread->runTime();
+	stats.waitTime = sched_stats.waitTime;
+	stats.numVoluntarySwitches = sched_stats.numVoluntarySwitches;
+	stats.numInvoluntarySwitches = sched_stats.numInvoluntarySwitches;
+	stats.numMigrations = sched_stats.numMigrations;
+	for(int i = 0; i < kHelNumLatencyBuckets; i++) {
+		stats.wakeupLatency[i] = sched_stats.wakeupLatency[i];
+		stats.runQueueWait[i] = sched_stats.runQueueWait[i];
+	}
+
+	writeUserObject(user_stats, stats);
+
+	return kHelErrNone;
+}
+
+HelError helQueryCpuStats(int cpu, HelCpuStats *user_stats) {
+	if(cpu < 0 || cpu >= getCpuCount())
+		return kHelErrIllegalArgs;
+
+	auto sched_stats = getCpuData(cpu)->scheduler.queryCpuStats();
+
+	HelCpuStats stats;
+	memset(&stats, 0, sizeof(HelCpuStats));
+	stats.waitTime = sched_stats.waitTime;
+	stats.numVoluntarySwitches = sched_stats.numVoluntarySwitches;
+	stats.numInvoluntarySwitches = sched_stats.numInvoluntarySwitches;
+	stats.numMigrations = sched_stats.numMigrations;
+	for(int i = 0; i < kHelNumLatencyBuckets; i++) {
+		stats.wakeupLatency[i] = sched_stats.wakeupLatency[i];
+		stats.runQueueWait[i] = sched_stats.runQueueWait[i];
+	}
 
 	writeUserObject(user_stats, stats);
 
@@ -1160,6 +1394,47 @@ HelError helSetPriority(HelHandle handle, int priority) {
 	return kHelErrNone;
 }
 
+HelError helSetSchedulingPolicy(HelHandle handle, int policy, int priority) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	SchedulingPolicy sched_policy;
+	if(policy == kHelSchedFair) {
+		if(priority)
+			return kHelErrIllegalArgs;
+		sched_policy = SchedulingPolicy::fair;
+	}else if(policy == kHelSchedFifo || policy == kHelSchedRoundRobin) {
+		if(priority < kHelMinRtPriority || priority > kHelMaxRtPriority)
+			return kHelErrIllegalArgs;
+		// Real-time threads can starve everything else; only privileged threads may use them.
+		if(!(this_thread->flags & Thread::kFlagRealtime))
+			return kHelErrIllegalArgs;
+		sched_policy = (policy == kHelSchedFifo) ? SchedulingPolicy::fifo
+				: SchedulingPolicy::roundRobin;
+	}else{
+		return kHelErrIllegalArgs;
+	}
+
+	frigg::SharedPtr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.toShared();
+	}else{
+		auto irq_lock = frigg::guard(&irqMutex());
+		Universe::Guard universe_guard(&this_universe->lock);
+
+		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = thread_wrapper->get<ThreadDescriptor>().thread;
+	}
+
+	Scheduler::setPolicy(thread.get(), sched_policy, priority);
+
+	return kHelErrNone;
+}
+
 HelError helYield() {
 	Thread::deferCurrent();
 
@@ -1387,6 +1662,50 @@ HelError helStoreRegisters(HelHandle handle, int set, const void *image) {
 	return kHelErrNone;
 }
 
+HelError helStartProfiling(uint64_t interval) {
+	// Samples contain kernel addresses and user stacks of all processes.
+	if(!(getCurrentThread()->flags & Thread::kFlagPrivileged))
+		return kHelErrIllegalArgs;
+
+	if(auto error = startProfiling(interval); error) {
+		assert(error == kErrIllegalArgs);
+		return kHelErrIllegalArgs;
+	}
+	return kHelErrNone;
+}
+
+HelError helStopProfiling() {
+	if(!(getCurrentThread()->flags & Thread::kFlagPrivileged))
+		return kHelErrIllegalArgs;
+
+	stopProfiling();
+	return kHelErrNone;
+}
+
+HelError helReadProfile(unsigned int cpu, HelProfileSample *user_samples,
+		size_t max_samples, size_t *num_samples) {
+	if(!(getCurrentThread()->flags & Thread::kFlagPrivileged))
+		return kHelErrIllegalArgs;
+	if(cpu >= static_cast<unsigned int>(getCpuCount()))
+		return kHelErrIllegalArgs;
+
+	// Copy the samples in small batches to avoid a large kernel buffer.
+	constexpr size_t batchSize = 16;
+	HelProfileSample batch[batchSize];
+	size_t progress = 0;
+	while(progress < max_samples) {
+		auto n = drainProfile(getCpuData(cpu), batch,
+				frigg::min(batchSize, max_samples - progress));
+		if(!n)
+			break;
+		writeUserArray(user_samples + progress, batch, n);
+		progress += n;
+	}
+
+	*num_samples = progress;
+	return kHelErrNone;
+}
+
 HelError helWriteFsBase(void *pointer) {
 	frigg::arch_x86::wrmsr(frigg::arch_x86::kMsrIndexFsBase, (uintptr_t)pointer);
 	return kHelErrNone;
@@ -1397,6 +1716,30 @@ HelError helGetClock(uint64_t *counter) {
 	return kHelErrNone;
 }
 
+HelError helMapClockPage(void **pointer) {
+	auto this_thread = getCurrentThread();
+	auto space = this_thread->getAddressSpace().lock();
+
+	auto memory = getClockPageMemory();
+	auto slice = frigg::makeShared<MemorySlice>(*kernelAlloc,
+			frigg::move(memory), 0, kPageSize);
+
+	VirtualAddr address;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		AddressSpace::Guard space_guard(&space->lock);
+
+		auto error = space->map(space_guard, frigg::move(slice), 0, 0, kPageSize,
+				AddressSpace::kMapPreferTop | AddressSpace::kMapProtRead
+					| AddressSpace::kMapShareAtFork,
+				&address);
+		assert(!error);
+	}
+
+	*pointer = reinterpret_cast<void *>(address);
+	return kHelErrNone;
+}
+
 HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t context,
 		uint64_t *async_id) {
 	struct Closure : CancelNode, PrecisionTimerNode, IpcNode {
@@ -1986,13 +2329,14 @@ HelError helAccessIrq(int number, HelHandle *handle) {
 }
 
 HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence) {
-	assert(!(flags & ~(kHelAckAcknowledge | kHelAckNack | kHelAckKick)));
-
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
-	auto mode = flags & (kHelAckAcknowledge | kHelAckNack | kHelAckKick);
-	if(mode != kHelAckAcknowledge && mode != kHelAckNack && mode != kHelAckKick)
+	auto mode = flags & ~uint32_t{kHelAckPoll};
+	if(mode != kHelAckAcknowledge && mode != kHelAckNack && mode != kHelAckKick
+			&& mode != kHelAckUnmask)
+		return kHelErrIllegalArgs;
+	if((flags & kHelAckPoll) && mode != kHelAckAcknowledge)
 		return kHelErrIllegalArgs;
 
 	frigg::SharedPtr<IrqObject> irq;
@@ -2010,9 +2354,11 @@ HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence)
 
 	Error error;
 	if(mode == kHelAckAcknowledge) {
-		error = IrqPin::ackSink(irq.get(), sequence);
+		error = IrqPin::ackSink(irq.get(), sequence, flags & kHelAckPoll);
 	}else if(mode == kHelAckNack) {
 		error = IrqPin::nackSink(irq.get(), sequence);
+	}else if(mode == kHelAckUnmask) {
+		error = IrqPin::unmaskSink(irq.get());
 	}else{
  		assert(mode == kHelAckKick);
 		error = IrqPin::kickSink(irq.get());
@@ -2040,6 +2386,7 @@ HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 			auto closure = frg::container_of(worklet, &IrqClosure::worklet);
 			closure->result.error = translateError(closure->irqNode.error());
 			closure->result.sequence = closure->irqNode.sequence();
+			closure->result.count = closure->irqNode.count();
 			closure->_queue->submit(closure);
 		}
 
@@ -2189,6 +2536,30 @@ HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet_hand
 	return kHelErrNone;
 }
 
+HelError helSetIrqCoalescing(HelHandle handle, uint64_t window, uint64_t burst) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	frigg::SharedPtr<IrqObject> irq;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		Universe::Guard universe_guard(&this_universe->lock);
+
+		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		if(!irq_wrapper)
+			return kHelErrNoDescriptor;
+		if(!irq_wrapper->is<IrqDescriptor>())
+			return kHelErrBadDescriptor;
+		irq = irq_wrapper->get<IrqDescriptor>().irq;
+	}
+
+	if(auto error = irq->setCoalescing(window, burst); error) {
+		assert(error == kErrIllegalArgs);
+		return kHelErrIllegalArgs;
+	}
+	return kHelErrNone;
+}
+
 HelError helAccessIo(uintptr_t *port_array, size_t num_ports,
 		HelHandle *handle) {
 	auto this_thread = getCurrentThread();
@@ -2284,6 +2655,9 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<MemoryViewDescriptor>())
 					return kHelErrBadDescriptor;
+				// The kernlet maps the memory writable.
+				if(wrapper->get<MemoryViewDescriptor>().readOnly)
+					return kHelErrIllegalArgs;
 				memory = wrapper->get<MemoryViewDescriptor>().memory;
 			}
 
@@ -5,6 +5,7 @@
 #include <frigg/debug.hpp>
 #include "ipc-queue.hpp"
 #include "kernel.hpp"
+#include "trace.hpp"
 
 namespace thor {
 
@@ -12,18 +13,26 @@ namespace thor {
 // IpcQueue
 // ----------------------------------------------------------------------------
 
+bool IpcQueue::validParameters(size_t element_limit, size_t chunk_size) {
+	if(chunk_size & 7)
+		return false;
+	// The progress futex needs to be able to represent the size of the chunk.
+	if(chunk_size > size_t(kProgressMask))
+		return false;
+	return sizeof(ElementStruct) + element_limit <= chunk_size;
+}
+
 IpcQueue::IpcQueue(smarter::shared_ptr<AddressSpace, BindableHandle> space, void *pointer,
-		unsigned int size_shift, size_t)
+		unsigned int size_shift, size_t, size_t chunk_size)
 : _space{frigg::move(space)}, _pointer{pointer}, _sizeShift{size_shift},
-		_nextIndex{0},
-		_currentChunk{nullptr}, _currentProgress{0},
+		_chunkSize{chunk_size}, _nextIndex{0},
+		_currentChunk{nullptr}, _currentProgress{0}, _publishedProgress{0},
 		_chunks{*kernelAlloc} {
 	_chunks.resize(1 << _sizeShift);
 }
 
 bool IpcQueue::validSize(size_t size) {
-	// TODO: Note that the chunk size is currently hardcoded.
-	return sizeof(ElementStruct) + size <= 4096;
+	return sizeof(ElementStruct) + size <= _chunkSize;
 }
 
 void IpcQueue::setupChunk(size_t index, smarter::shared_ptr<AddressSpace, BindableHandle> space, void *pointer) {
@@ -32,10 +41,12 @@ void IpcQueue::setupChunk(size_t index, smarter::shared_ptr<AddressSpace, Bindab
 
 	assert(index < _chunks.size());
 	assert(&_chunks[index] != _currentChunk);
-	_chunks[index] = Chunk{frigg::move(space), pointer};
+	_chunks[index] = Chunk{frigg::move(space), pointer, _chunkSize};
 }
 
 void IpcQueue::submit(IpcNode *node) {
+	trace(TraceEvent::ipcSubmit, 0, reinterpret_cast<uintptr_t>(this));
+
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
 
@@ -104,9 +115,8 @@ void IpcQueue::_progress() {
 			self->_nodeQueue.pop_front();
 			node->complete();
 
-			// Update the chunk progress futex.
+			// The progress futex is updated by _flushProgress().
 			self->_currentProgress += sizeof(ElementStruct) + length;
-			self->_wakeProgressFutex(false);
 		}
 	};
 
@@ -133,15 +143,16 @@ void IpcQueue::_progress() {
 		for(auto source = _nodeQueue.front()->_source; source; source = source->link)
 			length += (source->size + 7) & ~size_t(7);
 
-		assert(length <= _currentChunk->bufferSize);
+		assert(sizeof(ElementStruct) + length <= _currentChunk->bufferSize);
 
 		// Check if we need to retire the current chunk.
-		if(_currentProgress + length > _currentChunk->bufferSize) {
+		if(_currentProgress + sizeof(ElementStruct) + length > _currentChunk->bufferSize) {
 			_wakeProgressFutex(true);
 
 			_chunkLock = AddressSpaceLockHandle{};
 			_currentChunk = nullptr;
 			_currentProgress = 0;
+			_publishedProgress = 0;
 			continue;
 		}
 
@@ -153,11 +164,15 @@ void IpcQueue::_progress() {
 				reinterpret_cast<void *>(dest), sizeof(ElementStruct) + length};
 		_worklet.setup(&Ops::acquiredElement);
 		_acquireNode.setup(&_worklet);
-		if(!_elementLock.acquire(&_acquireNode))
+		if(!_elementLock.acquire(&_acquireNode)) {
+			// Do not delay the elements that we already emitted.
+			_flushProgress();
 			return;
+		}
 		Ops::emitElement(this);
 	}
 
+	_flushProgress();
 	_inProgressLoop = false;
 }
 
@@ -231,7 +246,13 @@ bool IpcQueue::_waitHeadFutex() {
 	}
 }
 
+void IpcQueue::_flushProgress() {
+	if(_currentChunk && _currentProgress != _publishedProgress)
+		_wakeProgressFutex(false);
+}
+
 void IpcQueue::_wakeProgressFutex(bool done) {
+	_publishedProgress = _currentProgress;
 	auto progress = _currentProgress;
 	if(done)
 		progress |= kProgressDone;
@@ -87,14 +87,15 @@ private:
 		>
 	>;
 
-	using Mutex = frigg::TicketLock;
+	using Mutex = ClassLock<frigg::McsLock, LockClass::ipcQueue>;
 
 	struct Chunk {
 		Chunk()
 		: pointer{nullptr} { }
 
-		Chunk(smarter::shared_ptr<AddressSpace, BindableHandle> space_, void *pointer_)
-		: space{frigg::move(space_)}, pointer{pointer_}, bufferSize{4096} { }
+		Chunk(smarter::shared_ptr<AddressSpace, BindableHandle> space_, void *pointer_,
+				size_t buffer_size)
+		: space{frigg::move(space_)}, pointer{pointer_}, bufferSize{buffer_size} { }
 
 		// Pointer (+ address space) to queue chunk struct.
 		smarter::shared_ptr<AddressSpace, BindableHandle> space;
@@ -105,8 +106,13 @@ private:
 	};
 
 public:
+	static constexpr size_t defaultChunkSize = 4096;
+
+	// Returns true if a queue with the given parameters can be constructed.
+	static bool validParameters(size_t element_limit, size_t chunk_size);
+
 	IpcQueue(smarter::shared_ptr<AddressSpace, BindableHandle> space, void *pointer,
-			unsigned int size_shift, size_t element_limit);
+			unsigned int size_shift, size_t element_limit, size_t chunk_size);
 
 	IpcQueue(const IpcQueue &) = delete;
 
@@ -122,6 +128,7 @@ private:
 	void _progress();
 	bool _advanceChunk();
 	bool _waitHeadFutex();
+	void _flushProgress();
 	void _wakeProgressFutex(bool done);
 
 private:
@@ -133,6 +140,9 @@ private:
 
 	unsigned int _sizeShift;
 
+	// Size of the buffer of each chunk.
+	size_t _chunkSize;
+
 	Worklet _worklet;
 	AcquireNode _acquireNode;
 	FutexNode _futex;
@@ -151,6 +161,9 @@ private:
 	AddressSpaceLockHandle _chunkLock;
 	// Progress into the current chunk.
 	int _currentProgress;
+	// Progress that was last written to the chunk's progress futex.
+	// Elements are published in batches to avoid waking user space once per element.
+	int _publishedProgress;
 
 	// Accessor for the current element.
 	AddressSpaceLockHandle _elementLock;
@@ -1,4 +1,5 @@
 
+#include <frg/container_of.hpp>
 #include "irq.hpp"
 #include "../arch/x86/ints.hpp"
 #include "../arch/x86/hpet.hpp"
@@ -25,7 +26,7 @@ void IrqSlot::link(IrqPin *pin) {
 
 IrqSink::IrqSink(frigg::String<KernelAlloc> name)
 : _name{frigg::move(name)}, _pin{nullptr}, _currentSequence{0},
-		_responseSequence{0}, _status{IrqStatus::null} { }
+		_responseSequence{0}, _status{IrqStatus::null}, _autoAckSequence{0} { }
 
 IrqPin *IrqSink::getPin() {
 	return _pin;
@@ -49,7 +50,7 @@ void IrqPin::attachSink(IrqPin *pin, IrqSink *sink) {
 	sink->_pin = pin;
 }
 
-Error IrqPin::ackSink(IrqSink *sink, uint64_t sequence) {
+Error IrqPin::ackSink(IrqSink *sink, uint64_t sequence, bool keepMasked) {
 	auto pin = sink->getPin();
 	assert(pin);
 
@@ -57,10 +58,16 @@ Error IrqPin::ackSink(IrqSink *sink, uint64_t sequence) {
 	auto lock = frigg::guard(&pin->_mutex);
 	assert(sink->currentSequence() == pin->_sinkSequence);
 
+	// The sink already acknowledged the IRQ in the kernel (e.g., while coalescing).
+	if(!keepMasked && sequence && sequence <= sink->_autoAckSequence)
+		return kErrSuccess;
+
 	if(sequence <= sink->_responseSequence)
 		return kErrIllegalArgs;
 	if(sequence > sink->currentSequence())
 		return kErrIllegalArgs;
+	if(keepMasked && pin->_isShared())
+		return kErrIllegalArgs;
 
 	if(sequence == sink->currentSequence()) {
 		// Because _responseSequence is lagging behind, the IRQ status must be null here.
@@ -80,6 +87,10 @@ Error IrqPin::ackSink(IrqSink *sink, uint64_t sequence) {
 	// Device B: Handles IRQ and ACKs.
 	// Now, the IrqPin is needs to be unmask()ed again, even though the ACK sequence
 	// does not necessarily match the currentSequence().
+	if(keepMasked) {
+		pin->_maskState |= maskedForPoll;
+		pin->_updateMask();
+	}
 	pin->_acknowledge();
 	return kErrSuccess;
 }
@@ -119,6 +130,20 @@ Error IrqPin::kickSink(IrqSink *sink) {
 	return kErrSuccess;
 }
 
+Error IrqPin::unmaskSink(IrqSink *sink) {
+	auto pin = sink->getPin();
+	assert(pin);
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&pin->_mutex);
+
+	if(!(pin->_maskState & maskedForPoll))
+		return kErrIllegalArgs;
+	pin->_maskState &= ~maskedForPoll;
+	pin->_updateMask();
+	return kErrSuccess;
+}
+
 // --------------------------------------------------------
 // IrqPin
 // --------------------------------------------------------
@@ -272,6 +297,7 @@ void IrqPin::_callSinks() {
 			(*it)->_responseSequence = _sinkSequence;
 
 		if(status == IrqStatus::acked) {
+			(*it)->_autoAckSequence = _sinkSequence;
 			_inService = false;
 		}else if(status == IrqStatus::nacked) {
 			// We do not need to do anything here; we just do not increment _dueSinks.
@@ -281,6 +307,14 @@ void IrqPin::_callSinks() {
 	}
 }
 
+bool IrqPin::_isShared() {
+	auto it = _sinkList.begin();
+	if(it == _sinkList.end())
+		return false;
+	++it;
+	return it != _sinkList.end();
+}
+
 void IrqPin::_updateMask() {
 	// TODO: Avoid the virtual calls if the state does not change?
 	if(!_maskState) {
@@ -309,9 +343,33 @@ void IrqObject::automate(frigg::SharedPtr<BoundKernlet> kernlet) {
 IrqStatus IrqObject::raise() {
 	while(!_waitQueue.empty()) {
 		auto node = _waitQueue.pop_front();
-		node->_error = kErrSuccess;
-		node->_sequence = currentSequence();
-		WorkQueue::post(node->_awaited);
+		if(!_coalesceWindow) {
+			_completeAwait(node);
+			continue;
+		}
+
+		// Defer the completion until the window elapses; further IRQs that arrive
+		// in the meantime are reported by the same completion.
+		_coalesceQueue.push_back(node);
+		node->_windowTimer.setup(systemClockSource()->currentNanos() + _coalesceWindow,
+				&node->_windowWorklet);
+		generalTimerEngine()->installTimer(&node->_windowTimer);
+	}
+
+	// Flush windows early once enough IRQs have accumulated.
+	// The node is completed by _windowElapsed() after the cancellation.
+	if(_coalesceBurst)
+		for(auto it = _coalesceQueue.begin(); it != _coalesceQueue.end(); ++it)
+			if(currentSequence() - (*it)->_submitSequence >= _coalesceBurst)
+				(*it)->_windowTimer.cancelTimer();
+
+	// While a completion is delayed, user space does not acknowledge the IRQ.
+	// Acknowledge it here such that further IRQs are counted (and other sinks
+	// that share the pin are not blocked). setCoalescing() ensures that this
+	// does not cause an IRQ storm on level-triggered pins.
+	if(!_automationKernlet && !_coalesceQueue.empty()) {
+		assert(getPin()->triggerMode() == TriggerMode::edge);
+		return IrqStatus::acked;
 	}
 
 	if(_automationKernlet) {
@@ -328,19 +386,55 @@ IrqStatus IrqObject::raise() {
 		return IrqStatus::null;
 }
 
+Error IrqObject::setCoalescing(uint64_t window, uint64_t burst) {
+	auto pin = getPin();
+	assert(pin);
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto pin_lock = frigg::guard(&pin->_mutex);
+	auto lock = frigg::guard(sinkMutex());
+
+	// Level-triggered IRQs stay asserted until the device is acknowledged.
+	if(window && !_automationKernlet && pin->triggerMode() != TriggerMode::edge)
+		return kErrIllegalArgs;
+
+	_coalesceWindow = window;
+	_coalesceBurst = burst;
+	return kErrSuccess;
+}
+
 void IrqObject::submitAwait(AwaitIrqNode *node, uint64_t sequence) {
+	node->_irq = this;
+	node->_submitSequence = sequence;
+	node->_windowWorklet.setup(&AwaitIrqNode::_windowElapsed);
+
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(sinkMutex());
 
 	assert(sequence <= currentSequence());
 	if(sequence < currentSequence()) {
-		node->_error = kErrSuccess;
-		node->_sequence = currentSequence();
-		WorkQueue::post(node->_awaited);
+		_completeAwait(node);
 	}else{
 		_waitQueue.push_back(node);
 	}
 }
 
+void IrqObject::_completeAwait(AwaitIrqNode *node) {
+	node->_error = kErrSuccess;
+	node->_sequence = currentSequence();
+	WorkQueue::post(node->_awaited);
+}
+
+void AwaitIrqNode::_windowElapsed(Worklet *worklet) {
+	auto node = frg::container_of(worklet, &AwaitIrqNode::_windowWorklet);
+	auto irq = node->_irq;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(irq->sinkMutex());
+
+	irq->_coalesceQueue.erase(irq->_coalesceQueue.iterator_to(node));
+	irq->_completeAwait(node);
+}
+
 } // namespace thor
 
@@ -8,10 +8,13 @@
 #include "error.hpp"
 #include "kernel_heap.hpp"
 #include "kernlet.hpp"
+#include "timer.hpp"
 #include "work-queue.hpp"
 
 namespace thor {
 
+struct IrqObject;
+
 struct AwaitIrqNode {
 	friend struct IrqObject;
 
@@ -22,12 +25,23 @@ struct AwaitIrqNode {
 	Error error() { return _error; }
 	uint64_t sequence() { return _sequence; }
 
+	// Number of IRQs that were coalesced into this completion.
+	uint64_t count() { return _sequence - _submitSequence; }
+
 private:
+	static void _windowElapsed(Worklet *worklet);
+
 	Worklet *_awaited;
+	IrqObject *_irq;
+	uint64_t _submitSequence;
 
 	Error _error;
 	uint64_t _sequence;
 
+	// Used to delay the completion if the IrqObject coalesces IRQs.
+	Worklet _windowWorklet;
+	PrecisionTimerNode _windowTimer;
+
 	frg::default_list_hook<AwaitIrqNode> _queueNode;
 };
 
@@ -131,6 +145,8 @@ private:
 	uint64_t _currentSequence;
 	uint64_t _responseSequence;
 	IrqStatus _status;
+	// Last sequence that raise() acknowledged in the kernel.
+	uint64_t _autoAckSequence;
 };
 
 enum class IrqStrategy {
@@ -142,15 +158,22 @@ enum class IrqStrategy {
 // Represents a (not necessarily physical) "pin" of an interrupt controller.
 // This class handles the IRQ configuration and acknowledgement.
 struct IrqPin {
+	friend struct IrqObject;
+
 private:
 	static constexpr int maskedForService = 1;
 	static constexpr int maskedForNack = 2;
+	static constexpr int maskedForPoll = 4;
 
 public:
 	static void attachSink(IrqPin *pin, IrqSink *sink);
-	static Error ackSink(IrqSink *sink, uint64_t sequence);
+	// If keepMasked is true, the pin stays masked until unmaskSink() is called.
+	// This allows drivers to poll the device instead of taking further IRQs.
+	// Shared pins are never masked on behalf of a single sink; keepMasked fails for them.
+	static Error ackSink(IrqSink *sink, uint64_t sequence, bool keepMasked = false);
 	static Error nackSink(IrqSink *sink, uint64_t sequence);
 	static Error kickSink(IrqSink *sink);
+	static Error unmaskSink(IrqSink *sink);
 
 public:
 	IrqPin(frigg::String<KernelAlloc> name);
@@ -165,6 +188,11 @@ public:
 
 	void configure(IrqConfiguration cfg);
 
+	// Must be called with the pin's mutex held (e.g., from IrqSink::raise()).
+	TriggerMode triggerMode() {
+		return _activeCfg.trigger;
+	}
+
 	// This function is called from IrqSlot::raise().
 	void raise();
 
@@ -188,6 +216,7 @@ protected:
 private:
 	void _callSinks();
 	void _updateMask();
+	bool _isShared();
 
 	frigg::String<KernelAlloc> _name;
 
@@ -225,17 +254,32 @@ private:
 
 // This class implements the user-visible part of IRQ handling.
 struct IrqObject : IrqSink {
+	friend struct AwaitIrqNode;
+
 	IrqObject(frigg::String<KernelAlloc> name);
 
 	void automate(frigg::SharedPtr<BoundKernlet> kernlet);
 
 	IrqStatus raise() override;
 
+	// Delays completions by up to window nanoseconds so that bursts of IRQs
+	// are reported by a single completion. A burst of zero means unlimited.
+	// While a completion is delayed, the kernel acknowledges further IRQs itself.
+	// That requires that the IRQ can be acknowledged without touching the device,
+	// i.e., an edge-triggered pin or an automation kernlet. Otherwise, this fails.
+	Error setCoalescing(uint64_t window, uint64_t burst);
+
 	void submitAwait(AwaitIrqNode *node, uint64_t sequence);
 
 private:
+	void _completeAwait(AwaitIrqNode *node);
+
 	frigg::SharedPtr<BoundKernlet> _automationKernlet;
 
+	// Protected by the sinkMutex.
+	uint64_t _coalesceWindow = 0;
+	uint64_t _coalesceBurst = 0;
+
 	// Protected by the sinkMutex.
 	frg::intrusive_list<
 		AwaitIrqNode,
@@ -245,6 +289,17 @@ private:
 			&AwaitIrqNode::_queueNode
 		>
 	> _waitQueue;
+
+	// Nodes that were raised but whose coalescing window did not elapse yet.
+	// Protected by the sinkMutex.
+	frg::intrusive_list<
+		AwaitIrqNode,
+		frg::locate_member<
+			AwaitIrqNode,
+			frg::default_list_hook<AwaitIrqNode>,
+			&AwaitIrqNode::_queueNode
+		>
+	> _coalesceQueue;
 };
 
 } // namespace thor
@@ -3,7 +3,9 @@
 #include "descriptor.hpp"
 #include "fiber.hpp"
 #include "kerncfg.hpp"
+#include "lockstat.hpp"
 #include "service_helpers.hpp"
+#include "trace.hpp"
 
 #include "kerncfg.frigg_pb.hpp"
 #include "mbus.frigg_pb.hpp"
@@ -33,6 +35,77 @@ bool handleReq(LaneHandle lane) {
 		resp.SerializeToString(&ser);
 		fiberSend(branch, ser.data(), ser.size());
 		fiberSend(branch, kernelCommandLine->data(), kernelCommandLine->size());
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_TRACE_BUFFER) {
+		size_t num_cpus = getCpuCount();
+		if(req.cpu() >= num_cpus) {
+			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::ILLEGAL_ARGUMENTS);
+			resp.set_num_cpus(num_cpus);
+
+			frigg::String<KernelAlloc> ser(*kernelAlloc);
+			resp.SerializeToString(&ser);
+			fiberSend(branch, ser.data(), ser.size());
+			return true;
+		}
+
+		auto cpu_data = getCpuData(req.cpu());
+		assert(cpu_data->traceBuffer);
+		auto memory = frigg::makeShared<HardwareMemory>(*kernelAlloc,
+				cpu_data->tracePhysical, traceBufferSize, CachingMode::null);
+
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_size(traceBufferSize);
+		resp.set_num_cpus(num_cpus);
+
+		frigg::String<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		fiberSend(branch, ser.data(), ser.size());
+		// The kernel writes the buffer while it is mapped; readers must not modify it.
+		fiberPushDescriptor(branch, MemoryViewDescriptor{frigg::move(memory), true});
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::SET_TRACING) {
+		traceActive.store(req.enable(), std::memory_order_relaxed);
+
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+		frigg::String<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		fiberSend(branch, ser.data(), ser.size());
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_LOCK_STATS) {
+		// Snapshot the counters; they keep changing while we send them.
+		LockStatRecord records[numLockClasses];
+		for(size_t i = 0; i < numLockClasses; i++)
+			fillLockStatRecord(static_cast<LockClass>(i), &records[i]);
+
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_size(sizeof(records));
+		resp.set_lock_stats_enabled(enableLockStats);
+
+		frigg::String<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		fiberSend(branch, ser.data(), ser.size());
+		fiberSend(branch, records, sizeof(records));
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_LOG) {
+		constexpr size_t maxLogChunk = 4096;
+		auto buffer = static_cast<char *>(kernelAlloc->allocate(maxLogChunk));
+
+		size_t sequence = req.sequence();
+		size_t first;
+		auto size = readLogMessages(&sequence, &first, buffer, maxLogChunk);
+
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_size(size);
+		resp.set_first_sequence(first);
+		resp.set_next_sequence(sequence);
+
+		frigg::String<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		fiberSend(branch, ser.data(), ser.size());
+		fiberSend(branch, buffer, size);
+		kernelAlloc->free(buffer);
 	}else{
 		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 		resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
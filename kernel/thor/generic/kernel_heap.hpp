@@ -5,6 +5,7 @@
 #include <frigg/initializer.hpp>
 #include <frigg/physical_buddy.hpp>
 #include <frg/slab.hpp>
+#include "lockstat.hpp"
 
 namespace thor {
 
@@ -17,7 +18,7 @@ private:
 };
 
 struct KernelVirtualMemory {
-	using Mutex = frigg::TicketLock;
+	using Mutex = ClassLock<frigg::McsLock, LockClass::kernelVirtual>;
 public:
 	static KernelVirtualMemory &global();
 
@@ -0,0 +1,404 @@
+#include <string.h>
+
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "ksm.hpp"
+#include "service_helpers.hpp"
+
+namespace thor {
+
+namespace {
+	constexpr bool logMerging = false;
+
+	// Disable the scanner; pages are never merged.
+	constexpr bool disableMerging = false;
+
+	// The scanner checksums up to scanBatchSize pages per interval.
+	constexpr size_t scanBatchSize = 256;
+	// Bounds the time that is spent on unpopulated parts of mappings.
+	constexpr size_t scanVisitLimit = 16 * 1024;
+	constexpr uint64_t scanInterval = 100'000'000;
+
+	// Maximal number of stable pages with the same checksum that we compare against.
+	constexpr size_t maxStableCompares = 4;
+}
+
+frigg::LazyInitializer<PageMerger> pageMerger;
+
+uint64_t checksumPage(PhysicalAddr physical) {
+	PageAccessor accessor{physical};
+	auto words = reinterpret_cast<const uint64_t *>(accessor.get());
+
+	// FNV-1a, applied to 64-bit words instead of bytes.
+	uint64_t checksum = 0xCBF29CE484222325;
+	for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i++) {
+		checksum ^= words[i];
+		checksum *= 0x100000001B3;
+	}
+	return checksum;
+}
+
+PageMerger::PageMerger()
+: _stableTree{frigg::DefaultHasher<uint64_t>{}, *kernelAlloc},
+		_registeredMappings{frigg::DefaultHasher<uint64_t>{}, *kernelAlloc} {
+	_unstableTree = frigg::construct<UnstableTree>(*kernelAlloc,
+			frigg::DefaultHasher<uint64_t>{}, *kernelAlloc);
+}
+
+void PageMerger::registerMapping(CowMapping *mapping) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	mapping->mergeId = _nextMergeId++;
+	_registeredMappings.insert(mapping->mergeId, mapping);
+	_mappings.push_back(mapping);
+	_numMappings++;
+}
+
+void PageMerger::unregisterMapping(CowMapping *mapping) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	if(_mappings.front() == mapping)
+		_scanOffset = 0;
+	_mappings.erase(_mappings.iterator_to(mapping));
+	_numMappings--;
+	// Entries of the unstable tree that refer to the mapping become stale.
+	_registeredMappings.remove(mapping->mergeId);
+}
+
+MergedPage *PageMerger::findStable(PhysicalAddr physical, uint64_t checksum) {
+	// Take references so that we can compare the pages without holding _mutex.
+	MergedPage *pages[maxStableCompares];
+	size_t n = 0;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		auto slot = _stableTree.get(checksum);
+		if(!slot)
+			return nullptr;
+		for(auto page : slot->pages) {
+			if(n == maxStableCompares)
+				break;
+			assert(page->refCount);
+			page->refCount++;
+			_sharingPages++;
+			pages[n++] = page;
+		}
+	}
+
+	MergedPage *match = nullptr;
+	PageAccessor accessor{physical};
+	for(size_t i = 0; i < n; i++) {
+		if(!match) {
+			PageAccessor stable_accessor{pages[i]->physical};
+			if(!memcmp(stable_accessor.get(), accessor.get(), kPageSize)) {
+				match = pages[i];
+				continue;
+			}
+		}
+		releaseReference(pages[i]);
+	}
+	return match;
+}
+
+smarter::shared_ptr<Mapping> PageMerger::findUnstable(CowMapping *mapping, uintptr_t offset,
+		PhysicalAddr physical, uint64_t checksum,
+		uintptr_t *match_offset, PhysicalAddr *match_physical) {
+	UnstableEntry entry;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		auto existing = _unstableTree->get(checksum);
+		if(!existing) {
+			_unstableTree->insert(checksum, UnstableEntry{mapping->mergeId, offset, physical});
+			return nullptr;
+		}
+		if(existing->mergeId == mapping->mergeId && existing->offset == offset) {
+			existing->physical = physical;
+			return nullptr;
+		}
+		entry = *existing;
+	}
+
+	// The entry might be stale and its page might even be freed. That is not a problem:
+	// accessing free physical memory is harmless and the caller confirms the match.
+	{
+		PageAccessor accessor{physical};
+		PageAccessor entry_accessor{entry.physical};
+		if(memcmp(entry_accessor.get(), accessor.get(), kPageSize))
+			return nullptr;
+	}
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	// The tree might have changed while we compared the pages.
+	auto existing = _unstableTree->get(checksum);
+	if(!existing || existing->mergeId != entry.mergeId || existing->offset != entry.offset)
+		return nullptr;
+	_unstableTree->remove(checksum);
+
+	auto other = _registeredMappings.get(entry.mergeId);
+	if(!other)
+		return nullptr;
+	*match_offset = entry.offset;
+	*match_physical = entry.physical;
+	// Registered mappings are not retired yet, hence the AddressSpace still holds a reference.
+	return (*other)->selfPtr.lock();
+}
+
+MergedPage *PageMerger::wrap(PhysicalAddr physical, uint64_t checksum) {
+	auto page = frigg::construct<MergedPage>(*kernelAlloc);
+	page->physical = physical;
+	page->checksum = checksum;
+	return page;
+}
+
+void PageMerger::merge(MergedPage *candidate, MergedPage *stable) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(candidate->scanning);
+	assert(!candidate->stable);
+	assert(stable->refCount);
+
+	// The reference that findStable() returned is now owned by the mapping.
+	assert(candidate->refCount);
+	candidate->refCount--;
+	_numMerged++;
+	if(logMerging)
+		frigg::infoLogger() << "thor: Merged page into 0x"
+				<< frigg::logHex(stable->physical) << ", " << stable->refCount
+				<< " references" << frigg::endLog;
+}
+
+void PageMerger::publish(MergedPage *candidate, uint64_t checksum) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(candidate->scanning);
+	assert(!candidate->stable);
+
+	candidate->checksum = checksum;
+	_insertStable(candidate);
+}
+
+bool PageMerger::unwrap(MergedPage *candidate, uint64_t checksum) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(candidate->scanning);
+	assert(!candidate->stable);
+	assert(candidate->refCount);
+
+	if(candidate->refCount > 1) {
+		// A forked mapping refers to the candidate; it is shared in any case.
+		candidate->checksum = checksum;
+		_insertStable(candidate);
+		return false;
+	}
+
+	frigg::destruct(*kernelAlloc, candidate);
+	return true;
+}
+
+void PageMerger::finish(MergedPage *candidate) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(candidate->scanning);
+
+	candidate->scanning = false;
+	if(!candidate->refCount) {
+		assert(!candidate->stable);
+		_free(candidate);
+	}else if(!candidate->stable) {
+		// The candidate was replaced but it is still used by a forked mapping.
+		_insertStable(candidate);
+	}
+}
+
+void PageMerger::addReference(MergedPage *page) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(page->refCount);
+
+	page->refCount++;
+	if(page->stable)
+		_sharingPages++;
+}
+
+void PageMerger::releaseReference(MergedPage *page) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(page->refCount);
+
+	page->refCount--;
+	if(page->refCount) {
+		if(page->stable)
+			_sharingPages--;
+		return;
+	}
+
+	if(page->stable)
+		_removeStable(page);
+	if(!page->scanning)
+		_free(page);
+}
+
+bool PageMerger::breakSharing(MergedPage *page) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	assert(page->refCount);
+
+	_numBroken++;
+	if(page->refCount > 1 || page->scanning)
+		return false;
+
+	if(page->stable)
+		_removeStable(page);
+	frigg::destruct(*kernelAlloc, page);
+	return true;
+}
+
+PageMergerStats PageMerger::stats() {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	PageMergerStats stats;
+	stats.sharedPages = _sharedPages;
+	stats.sharingPages = _sharingPages;
+	stats.numScanned = _numScanned;
+	stats.numMerged = _numMerged;
+	stats.numBroken = _numBroken;
+	return stats;
+}
+
+KernelFiber *PageMerger::createScanFiber() {
+	return KernelFiber::post([=] {
+		while(true) {
+			fiberSleep(scanInterval);
+			if(disableMerging)
+				continue;
+
+			// Visit each mapping at most once per interval. Otherwise, small mappings
+			// would be checksummed twice in a row and every page would appear stable.
+			Mapping *first = nullptr;
+			size_t scanned = 0;
+			size_t visited = 0;
+			while(scanned < scanBatchSize && visited < scanVisitLimit) {
+				uintptr_t offset;
+				auto mapping = _nextMapping(&offset);
+				if(!mapping || mapping.get() == first)
+					break;
+				if(!first)
+					first = mapping.get();
+
+				auto cow = static_cast<CowMapping *>(mapping.get());
+				while(offset < cow->length()
+						&& scanned < scanBatchSize && visited < scanVisitLimit) {
+					if(cow->mergePage(offset))
+						scanned++;
+					visited++;
+					offset += kPageSize;
+				}
+				_advance(cow, offset);
+			}
+
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
+
+			_numScanned += scanned;
+			if(logMerging && scanned)
+				frigg::infoLogger() << "thor: Scanned " << scanned << " pages for merging, "
+						<< _sharedPages << " shared, " << _sharingPages << " sharing"
+						<< frigg::endLog;
+		}
+	});
+}
+
+// Must be called with _mutex held.
+void PageMerger::_insertStable(MergedPage *page) {
+	assert(!page->stable);
+	auto slot = _stableTree.get(page->checksum);
+	if(!slot) {
+		_stableTree.insert(page->checksum, Slot());
+		slot = _stableTree.get(page->checksum);
+	}
+	slot->pages.push_back(page);
+	page->stable = true;
+	_sharedPages++;
+	_sharingPages += page->refCount - 1;
+}
+
+// Must be called with _mutex held.
+void PageMerger::_removeStable(MergedPage *page) {
+	assert(page->stable);
+	assert(page->refCount <= 1);
+	auto slot = _stableTree.get(page->checksum);
+	assert(slot);
+	slot->pages.erase(slot->pages.iterator_to(page));
+	if(slot->pages.empty())
+		_stableTree.remove(page->checksum);
+	page->stable = false;
+	_sharedPages--;
+}
+
+// Must be called with _mutex held.
+void PageMerger::_free(MergedPage *page) {
+	assert(!page->refCount);
+	physicalAllocator->free(page->physical, kPageSize);
+	frigg::destruct(*kernelAlloc, page);
+}
+
+smarter::shared_ptr<Mapping> PageMerger::_nextMapping(uintptr_t *offset) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	if(_mappings.empty())
+		return nullptr;
+
+	// Registered mappings are not retired yet, hence the AddressSpace still holds a reference.
+	auto mapping = _mappings.front();
+	*offset = _scanOffset;
+	return mapping->selfPtr.lock();
+}
+
+void PageMerger::_advance(CowMapping *mapping, uintptr_t offset) {
+	UnstableTree *stale_tree = nullptr;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		// The mapping might have been unregistered in the meantime.
+		if(_mappings.empty() || _mappings.front() != mapping)
+			return;
+
+		if(offset < mapping->length()) {
+			_scanOffset = offset;
+			return;
+		}
+
+		_mappings.pop_front();
+		_mappings.push_back(mapping);
+		_scanOffset = 0;
+
+		// Entries of the unstable tree refer to writable pages, so they become
+		// less accurate over time. Start with an empty tree after each round.
+		_roundProgress++;
+		if(_roundProgress >= _numMappings) {
+			_roundProgress = 0;
+			stale_tree = _unstableTree;
+			_unstableTree = frigg::construct<UnstableTree>(*kernelAlloc,
+					frigg::DefaultHasher<uint64_t>{}, *kernelAlloc);
+		}
+	}
+
+	if(stale_tree)
+		frigg::destruct(*kernelAlloc, stale_tree);
+}
+
+void initializePageMerging() {
+	pageMerger.initialize();
+}
+
+} // namespace thor
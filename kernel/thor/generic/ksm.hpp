@@ -0,0 +1,199 @@
+#ifndef THOR_GENERIC_KSM_HPP
+#define THOR_GENERIC_KSM_HPP
+
+#include <frigg/atomic.hpp>
+#include <frigg/hashmap.hpp>
+#include <frigg/initializer.hpp>
+#include <frg/list.hpp>
+#include "kernel_heap.hpp"
+#include "types.hpp"
+#include "usermem.hpp"
+
+namespace thor {
+
+struct KernelFiber;
+
+// Merging of identical anonymous pages. A scanner fiber walks over the private copies
+// of CowMappings whose memory opted into merging (see AllocatedMemory::enableMerging()).
+// Pages that do not change between two scans are looked up in the stable tree
+// (a hash table of read-only merged pages, keyed by page checksums). If an identical
+// page is found, the copy is write-protected, compared again and replaced by a
+// read-only mapping of that page.
+// Otherwise, the page is looked up in the unstable tree, which holds pages that are
+// still writable. Only if an identical page is found there, the copy is write-protected
+// and moved to the stable tree; the other page is then merged with it. Pages without
+// any match are never write-protected. The unstable tree is rebuilt after each round.
+// Writes to merged pages are handled by the usual CoW fault path of CowMapping.
+
+struct MergedPage {
+	PhysicalAddr physical;
+	uint64_t checksum = 0;
+	// Number of CowMapping pages that refer to this page.
+	unsigned int refCount = 1;
+	// True while the scanner still needs the page (see PageMerger::finish()).
+	bool scanning = true;
+	// True if the page is in the stable tree.
+	bool stable = false;
+	frg::default_list_hook<MergedPage> hook;
+};
+
+struct PageMergerStats {
+	// Pages in the stable tree.
+	size_t sharedPages;
+	// Additional references to pages in the stable tree, i.e., the number of saved pages.
+	size_t sharingPages;
+	uint64_t numScanned;
+	uint64_t numMerged;
+	uint64_t numBroken;
+};
+
+uint64_t checksumPage(PhysicalAddr physical);
+
+struct PageMerger {
+	PageMerger();
+
+	PageMerger(const PageMerger &) = delete;
+
+	PageMerger &operator= (const PageMerger &) = delete;
+
+	// Called by CowMappings over mergeable memory when they are installed/retired.
+	void registerMapping(CowMapping *mapping);
+	void unregisterMapping(CowMapping *mapping);
+
+	// Returns a stable page that has the same contents as the page at physical
+	// (or nullptr if there is none). The caller owns a reference to the returned page.
+	// As the page at physical can still be writable, the match is only a hint.
+	MergedPage *findStable(PhysicalAddr physical, uint64_t checksum);
+
+	// Looks up a page with the same contents in the unstable tree. If there is such
+	// a page, it is removed from the tree and its mapping and offset are returned.
+	// Otherwise, the page is inserted into the tree and nullptr is returned.
+	// As both pages can still be writable, the match is only a hint.
+	smarter::shared_ptr<Mapping> findUnstable(CowMapping *mapping, uintptr_t offset,
+			PhysicalAddr physical, uint64_t checksum,
+			uintptr_t *match_offset, PhysicalAddr *match_physical);
+
+	// Turns a write-protected private page into a merge candidate.
+	// The candidate has a single reference (owned by the mapping) and is not yet
+	// visible to other mappings.
+	MergedPage *wrap(PhysicalAddr physical, uint64_t checksum);
+
+	// Transfers the reference of the candidate to a stable page (obtained from
+	// findStable()). The contents of both pages must be equal.
+	void merge(MergedPage *candidate, MergedPage *stable);
+
+	// Inserts the candidate into the stable tree. Its contents must not change anymore.
+	void publish(MergedPage *candidate, uint64_t checksum);
+
+	// Called if the candidate should not be merged after all. Returns true if
+	// the mapping holds the only reference; in this case, the candidate is freed
+	// (but not its physical page) and the mapping takes the page back.
+	// Otherwise, the candidate is published.
+	bool unwrap(MergedPage *candidate, uint64_t checksum);
+
+	// Called by the scanner once it does not access the candidate anymore,
+	// i.e., after all TLBs that may refer to it have been shot down.
+	void finish(MergedPage *candidate);
+
+	void addReference(MergedPage *page);
+	void releaseReference(MergedPage *page);
+
+	// Called when a mapping writes to a merged page. If the caller holds the only
+	// reference, it takes over the physical page and true is returned. Otherwise,
+	// the caller has to copy the page and release its reference afterwards.
+	bool breakSharing(MergedPage *page);
+
+	PageMergerStats stats();
+
+	KernelFiber *createScanFiber();
+
+private:
+	void _insertStable(MergedPage *page);
+	void _removeStable(MergedPage *page);
+	void _free(MergedPage *page);
+
+	struct UnstableEntry {
+		uint64_t mergeId;
+		uintptr_t offset;
+		PhysicalAddr physical;
+	};
+
+	using UnstableTree = frigg::Hashmap<
+		uint64_t,
+		UnstableEntry,
+		frigg::DefaultHasher<uint64_t>,
+		KernelAlloc
+	>;
+
+	// Returns the mapping to scan and the offset at which scanning continues.
+	smarter::shared_ptr<Mapping> _nextMapping(uintptr_t *offset);
+	void _advance(CowMapping *mapping, uintptr_t offset);
+
+	// Protects all members. Ordered after CowMapping::_mutex.
+	frigg::TicketLock _mutex;
+
+	using PageList = frg::intrusive_list<
+		MergedPage,
+		frg::locate_member<
+			MergedPage,
+			frg::default_list_hook<MergedPage>,
+			&MergedPage::hook
+		>
+	>;
+
+	struct Slot {
+		PageList pages;
+	};
+
+	// Stable tree of merged pages, keyed by their checksum.
+	frigg::Hashmap<
+		uint64_t,
+		Slot,
+		frigg::DefaultHasher<uint64_t>,
+		KernelAlloc
+	> _stableTree;
+
+	// Unstable tree, keyed by checksum. Each checksum only has a single entry.
+	// Entries refer to mappings by their mergeId; they might be stale.
+	UnstableTree *_unstableTree;
+
+	// Registered mappings by their mergeId.
+	frigg::Hashmap<
+		uint64_t,
+		CowMapping *,
+		frigg::DefaultHasher<uint64_t>,
+		KernelAlloc
+	> _registeredMappings;
+
+	uint64_t _nextMergeId = 1;
+	size_t _numMappings = 0;
+
+	frg::intrusive_list<
+		CowMapping,
+		frg::locate_member<
+			CowMapping,
+			frg::default_list_hook<CowMapping>,
+			&CowMapping::mergeHook
+		>
+	> _mappings;
+
+	// The scanner works on the first mapping of _mappings and rotates the list
+	// once it reaches the end of that mapping. This is the offset at which it continues.
+	uintptr_t _scanOffset = 0;
+	// Number of mappings that were scanned completely in the current round.
+	size_t _roundProgress = 0;
+
+	size_t _sharedPages = 0;
+	size_t _sharingPages = 0;
+	uint64_t _numScanned = 0;
+	uint64_t _numMerged = 0;
+	uint64_t _numBroken = 0;
+};
+
+extern frigg::LazyInitializer<PageMerger> pageMerger;
+
+void initializePageMerging();
+
+} // namespace thor
+
+#endif // THOR_GENERIC_KSM_HPP
@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "lockstat.hpp"
+
+namespace thor {
+
+bool enableLockStats = false;
+
+LockStats lockStats[numLockClasses];
+
+namespace {
+	const char *lockClassNames[numLockClasses] = {
+		"scheduler",
+		"futex",
+		"universe",
+		"address-space",
+		"ipc-queue",
+		"stream",
+		"thread",
+		"physical",
+		"kernel-virtual"
+	};
+}
+
+void fillLockStatRecord(LockClass cls, LockStatRecord *record) {
+	auto index = static_cast<size_t>(cls);
+	auto &stats = lockStats[index];
+
+	memset(record, 0, sizeof(LockStatRecord));
+	strncpy(record->name, lockClassNames[index], sizeof(record->name) - 1);
+	record->acquisitions = stats.acquisitions.load(std::memory_order_relaxed);
+	record->contended = stats.contended.load(std::memory_order_relaxed);
+	record->spinTotal = stats.spinTotal.load(std::memory_order_relaxed);
+	record->spinMax = stats.spinMax.load(std::memory_order_relaxed);
+	record->holdTotal = stats.holdTotal.load(std::memory_order_relaxed);
+	record->holdMax = stats.holdMax.load(std::memory_order_relaxed);
+}
+
+void configureLockStats(const char *cmdline, size_t length) {
+	const char option[] = "lockstat";
+	size_t i = 0;
+	while(i < length) {
+		// Options are separated by spaces.
+		size_t end = i;
+		while(end < length && cmdline[end] != ' ')
+			end++;
+		if(end - i == sizeof(option) - 1 && !memcmp(cmdline + i, option, end - i))
+			enableLockStats = true;
+		i = end + 1;
+	}
+}
+
+} // namespace thor
@@ -0,0 +1,138 @@
+#ifndef THOR_GENERIC_LOCKSTAT_HPP
+#define THOR_GENERIC_LOCKSTAT_HPP
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+// Per-class lock statistics are collected if "lockstat" is passed on the kernel command line.
+// This is only set during early boot (see configureLockStats()) and never cleared.
+// If it is false, ClassLock<> only pays for a (predicted) branch.
+extern bool enableLockStats;
+
+enum class LockClass {
+	scheduler,
+	futex,
+	universe,
+	addressSpace,
+	ipcQueue,
+	stream,
+	thread,
+	physical,
+	kernelVirtual,
+	numClasses
+};
+
+constexpr size_t numLockClasses = static_cast<size_t>(LockClass::numClasses);
+
+struct LockStats {
+	std::atomic<uint64_t> acquisitions{0};
+	std::atomic<uint64_t> contended{0};
+	std::atomic<uint64_t> spinTotal{0};
+	std::atomic<uint64_t> spinMax{0};
+	std::atomic<uint64_t> holdTotal{0};
+	std::atomic<uint64_t> holdMax{0};
+};
+
+// Binary layout of the records that kerncfg returns for GET_LOCK_STATS.
+// Keep this in sync with the reader in posix/subsystem.
+// All times are measured in TSC cycles.
+struct LockStatRecord {
+	char name[16];
+	uint64_t acquisitions;
+	uint64_t contended;
+	uint64_t spinTotal;
+	uint64_t spinMax;
+	uint64_t holdTotal;
+	uint64_t holdMax;
+};
+static_assert(sizeof(LockStatRecord) == 64, "Bad sizeof(LockStatRecord)");
+
+extern LockStats lockStats[numLockClasses];
+
+void fillLockStatRecord(LockClass cls, LockStatRecord *record);
+
+// Parses the kernel command line and sets enableLockStats.
+void configureLockStats(const char *cmdline, size_t length);
+
+inline uint64_t lockStatTimestamp() {
+	uint32_t lsw, msw;
+	asm volatile ("rdtsc" : "=a"(lsw), "=d"(msw));
+	return (static_cast<uint64_t>(msw) << 32) | lsw;
+}
+
+inline void updateLockStatMax(std::atomic<uint64_t> &max, uint64_t value) {
+	auto current = max.load(std::memory_order_relaxed);
+	while(value > current) {
+		if(max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+			break;
+	}
+}
+
+// Wraps a spinlock and accounts acquisitions, contention, spin time and hold time
+// to a lock class (if enableLockStats is set). The underlying lock needs to provide tryLock().
+template<typename Lock, LockClass C>
+struct InstrumentedLock {
+	void lock() {
+		if(__builtin_expect(!enableLockStats, 1)) {
+			_lock.lock();
+			return;
+		}
+
+		auto &stats = lockStats[static_cast<size_t>(C)];
+		if(_lock.tryLock()) {
+			_acquireTimestamp = lockStatTimestamp();
+		}else{
+			auto start = lockStatTimestamp();
+			_lock.lock();
+			_acquireTimestamp = lockStatTimestamp();
+
+			auto spin = _acquireTimestamp - start;
+			stats.contended.fetch_add(1, std::memory_order_relaxed);
+			stats.spinTotal.fetch_add(spin, std::memory_order_relaxed);
+			updateLockStatMax(stats.spinMax, spin);
+		}
+		stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool tryLock() {
+		if(!_lock.tryLock())
+			return false;
+		if(__builtin_expect(!enableLockStats, 1))
+			return true;
+		_acquireTimestamp = lockStatTimestamp();
+		lockStats[static_cast<size_t>(C)].acquisitions.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void unlock() {
+		// _acquireTimestamp is zero if the lock was taken before statistics were enabled.
+		if(__builtin_expect(!_acquireTimestamp, 1)) {
+			_lock.unlock();
+			return;
+		}
+
+		auto &stats = lockStats[static_cast<size_t>(C)];
+		auto hold = lockStatTimestamp() - _acquireTimestamp;
+		_acquireTimestamp = 0;
+		_lock.unlock();
+
+		stats.holdTotal.fetch_add(hold, std::memory_order_relaxed);
+		updateLockStatMax(stats.holdMax, hold);
+	}
+
+private:
+	Lock _lock;
+
+	// Protected by _lock.
+	uint64_t _acquireTimestamp = 0;
+};
+
+template<typename Lock, LockClass C>
+using ClassLock = InstrumentedLock<Lock, C>;
+
+} // namespace thor
+
+#endif // THOR_GENERIC_LOCKSTAT_HPP
@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include "kernel.hpp"
+#include "lz4.hpp"
+
+namespace thor {
+
+namespace {
+	constexpr bool logLz4 = false;
+
+	constexpr uint32_t lz4FrameMagic = 0x184D2204;
+
+	// LZ4 matches can reach back at most 64 KiB.
+	constexpr size_t lz4WindowSize = 0x10000;
+
+	// Flags in the FLG byte of the frame descriptor.
+	constexpr uint8_t flagVersionMask = 0xC0;
+	constexpr uint8_t flagVersion = 0x40;
+	constexpr uint8_t flagBlockChecksum = 0x10;
+	constexpr uint8_t flagContentSize = 0x08;
+	constexpr uint8_t flagDictId = 0x01;
+
+	uint32_t readLe32(const uint8_t *p) {
+		return uint32_t(p[0]) | (uint32_t(p[1]) << 8)
+				| (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+	}
+
+	uint64_t readLe64(const uint8_t *p) {
+		return uint64_t(readLe32(p)) | (uint64_t(readLe32(p + 4)) << 32);
+	}
+
+	struct FrameHeader {
+		uint8_t flags;
+		size_t blockMaxSize;
+		size_t contentSize;
+		size_t length;
+	};
+
+	FrameHeader parseFrameHeader(const uint8_t *p, size_t size) {
+		if(size < 7 || readLe32(p) != lz4FrameMagic)
+			frigg::panicLogger() << "thor: Not an LZ4 frame" << frigg::endLog;
+
+		FrameHeader header;
+		header.flags = p[4];
+		if((header.flags & flagVersionMask) != flagVersion)
+			frigg::panicLogger() << "thor: Unsupported LZ4 frame version" << frigg::endLog;
+		if(!(header.flags & flagContentSize))
+			frigg::panicLogger() << "thor: LZ4 frame does not declare its content size"
+					<< frigg::endLog;
+		if(header.flags & flagDictId)
+			frigg::panicLogger() << "thor: LZ4 dictionaries are not supported" << frigg::endLog;
+
+		auto block_id = (p[5] >> 4) & 7;
+		if(block_id < 4)
+			frigg::panicLogger() << "thor: Invalid LZ4 block size" << frigg::endLog;
+		header.blockMaxSize = size_t(1) << (8 + 2 * block_id);
+
+		// Magic, FLG, BD, content size and header checksum.
+		header.length = 4 + 2 + 8 + 1;
+		if(size < header.length)
+			frigg::panicLogger() << "thor: Truncated LZ4 frame header" << frigg::endLog;
+		header.contentSize = readLe64(p + 6);
+		return header;
+	}
+
+	// Decompresses a single block. The block may reference up to lz4WindowSize bytes
+	// before out. Returns the number of bytes written to out.
+	size_t decompressBlock(const uint8_t *in, size_t in_size,
+			uint8_t *out_base, uint8_t *out, size_t out_size) {
+		auto ip = in;
+		auto in_end = in + in_size;
+		auto op = out;
+		auto out_end = out + out_size;
+
+		auto readLength = [&] (size_t length) {
+			if(length == 15) {
+				uint8_t b;
+				do {
+					assert(ip < in_end);
+					b = *ip++;
+					length += b;
+				} while(b == 255);
+			}
+			return length;
+		};
+
+		while(ip < in_end) {
+			auto token = *ip++;
+
+			auto literals = readLength(token >> 4);
+			if(literals > size_t(in_end - ip) || literals > size_t(out_end - op))
+				frigg::panicLogger() << "thor: Corrupted LZ4 block (literals)" << frigg::endLog;
+			memcpy(op, ip, literals);
+			ip += literals;
+			op += literals;
+
+			// The last sequence of a block only contains literals.
+			if(ip == in_end)
+				break;
+
+			assert(in_end - ip >= 2);
+			size_t offset = ip[0] | (size_t(ip[1]) << 8);
+			ip += 2;
+
+			auto match_length = readLength(token & 15) + 4;
+			if(!offset || offset > size_t(op - out_base)
+					|| match_length > size_t(out_end - op))
+				frigg::panicLogger() << "thor: Corrupted LZ4 block (match)" << frigg::endLog;
+
+			// Matches can overlap the output; copy byte by byte.
+			auto match = op - offset;
+			for(size_t i = 0; i < match_length; i++)
+				op[i] = match[i];
+			op += match_length;
+		}
+
+		return op - out;
+	}
+
+	// The compressor uses a small hash table as it runs on kernel stacks.
+	constexpr int hashShift = 10;
+
+	// The last match must start at least 12 bytes before the end of the block
+	// and the last 5 bytes of a block are always literals.
+	constexpr size_t matchStartLimit = 12;
+	constexpr size_t lastLiterals = 5;
+
+	uint32_t hashSequence(uint32_t sequence) {
+		return (sequence * 2654435761U) >> (32 - hashShift);
+	}
+
+	// Writes a sequence. match_length is zero for the final (literal-only) sequence.
+	// Returns false if the output buffer is too small.
+	bool writeSequence(uint8_t *&op, uint8_t *out_end, const uint8_t *literals,
+			size_t num_literals, size_t offset, size_t match_length) {
+		auto bound = 1 + num_literals / 255 + 1 + num_literals;
+		if(match_length)
+			bound += 2 + (match_length - 4) / 255 + 1;
+		if(bound > size_t(out_end - op))
+			return false;
+
+		auto writeLength = [&] (size_t length) {
+			length -= 15;
+			while(length >= 255) {
+				*op++ = 255;
+				length -= 255;
+			}
+			*op++ = length;
+		};
+
+		auto token = op++;
+		*token = frigg::min(num_literals, size_t(15)) << 4;
+		if(num_literals >= 15)
+			writeLength(num_literals);
+		memcpy(op, literals, num_literals);
+		op += num_literals;
+
+		if(match_length) {
+			*op++ = offset & 0xFF;
+			*op++ = offset >> 8;
+			*token |= frigg::min(match_length - 4, size_t(15));
+			if(match_length - 4 >= 15)
+				writeLength(match_length - 4);
+		}
+		return true;
+	}
+}
+
+size_t compressLz4Block(const void *data, size_t size, void *out, size_t capacity) {
+	assert(size < lz4WindowSize);
+	auto in = static_cast<const uint8_t *>(data);
+	auto op = static_cast<uint8_t *>(out);
+	auto out_end = op + capacity;
+
+	// Stores positions + 1; zero marks empty entries.
+	uint16_t table[size_t(1) << hashShift];
+	memset(table, 0, sizeof(table));
+
+	size_t ip = 0;
+	size_t anchor = 0;
+	if(size > matchStartLimit) {
+		while(ip < size - matchStartLimit) {
+			auto sequence = readLe32(in + ip);
+			auto h = hashSequence(sequence);
+			size_t ref = table[h];
+			table[h] = ip + 1;
+			if(!ref || readLe32(in + ref - 1) != sequence) {
+				ip++;
+				continue;
+			}
+			ref--;
+
+			size_t match_length = 4;
+			while(ip + match_length < size - lastLiterals
+					&& in[ref + match_length] == in[ip + match_length])
+				match_length++;
+
+			if(!writeSequence(op, out_end, in + anchor, ip - anchor, ip - ref, match_length))
+				return 0;
+			ip += match_length;
+			anchor = ip;
+		}
+	}
+
+	if(!writeSequence(op, out_end, in + anchor, size - anchor, 0, 0))
+		return 0;
+	return op - static_cast<uint8_t *>(out);
+}
+
+size_t decompressLz4Block(const void *data, size_t size, void *out, size_t capacity) {
+	auto p = static_cast<uint8_t *>(out);
+	return decompressBlock(static_cast<const uint8_t *>(data), size, p, p, capacity);
+}
+
+bool isLz4Frame(const void *data, size_t size) {
+	return size >= 4 && readLe32(static_cast<const uint8_t *>(data)) == lz4FrameMagic;
+}
+
+size_t getLz4ContentSize(const void *data, size_t size) {
+	return parseFrameHeader(static_cast<const uint8_t *>(data), size).contentSize;
+}
+
+void decompressLz4Frame(const void *data, size_t size, Memory *memory) {
+	auto p = static_cast<const uint8_t *>(data);
+	auto limit = p + size;
+	auto header = parseFrameHeader(p, size);
+	p += header.length;
+
+	// The buffer holds the last lz4WindowSize bytes of output, followed by the current block.
+	auto buffer_size = lz4WindowSize + header.blockMaxSize;
+	auto buffer = static_cast<uint8_t *>(kernelAlloc->allocate(buffer_size));
+	size_t history = 0;
+	size_t progress = 0;
+
+	while(true) {
+		if(limit - p < 4)
+			frigg::panicLogger() << "thor: Truncated LZ4 frame" << frigg::endLog;
+		auto word = readLe32(p);
+		p += 4;
+		if(!word)
+			break; // End mark. We do not verify the optional content checksum.
+
+		size_t block_size = word & 0x7FFFFFFF;
+		if(block_size > header.blockMaxSize || block_size > size_t(limit - p))
+			frigg::panicLogger() << "thor: Invalid LZ4 block size" << frigg::endLog;
+
+		size_t produced;
+		if(word & 0x80000000) {
+			// Uncompressed block.
+			memcpy(buffer + history, p, block_size);
+			produced = block_size;
+		}else{
+			produced = decompressBlock(p, block_size, buffer, buffer + history,
+					header.blockMaxSize);
+		}
+		p += block_size;
+		if(header.flags & flagBlockChecksum)
+			p += 4;
+
+		if(progress + produced > header.contentSize)
+			frigg::panicLogger() << "thor: LZ4 frame exceeds its content size" << frigg::endLog;
+
+		// AllocatedMemory completes copies synchronously.
+		CopyToBundleNode node;
+		if(!copyToBundle(memory, progress, buffer + history, produced, &node, nullptr))
+			assert(!"Unexpected asynchronous copy");
+		progress += produced;
+
+		// Keep the last lz4WindowSize bytes for the next block.
+		auto total = history + produced;
+		auto keep = frigg::min(total, lz4WindowSize);
+		// The regions may overlap; a forward copy is fine as we move data downwards.
+		for(size_t i = 0; i < keep; i++)
+			buffer[i] = buffer[total - keep + i];
+		history = keep;
+	}
+
+	if(progress != header.contentSize)
+		frigg::panicLogger() << "thor: LZ4 frame is shorter than its content size"
+				<< frigg::endLog;
+	if(logLz4)
+		frigg::infoLogger() << "thor: Decompressed " << size << " bytes of LZ4 data into "
+				<< progress << " bytes" << frigg::endLog;
+
+	kernelAlloc->free(buffer);
+}
+
+} // namespace thor
@@ -0,0 +1,32 @@
+#ifndef THOR_GENERIC_LZ4_HPP
+#define THOR_GENERIC_LZ4_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+struct Memory;
+
+// Minimal decoder for the LZ4 frame format.
+// Only frames that declare their content size (i.e., lz4 --content-size) are supported.
+
+// Returns true if the data starts with an LZ4 frame.
+bool isLz4Frame(const void *data, size_t size);
+
+// Returns the uncompressed size that is declared in the frame header.
+size_t getLz4ContentSize(const void *data, size_t size);
+
+// Decompresses the frame to the start of memory.
+void decompressLz4Frame(const void *data, size_t size, Memory *memory);
+
+// Compresses data into a raw LZ4 block (without frame). size must be less than 64 KiB.
+// Returns the compressed size or zero if the block does not fit into capacity bytes.
+size_t compressLz4Block(const void *data, size_t size, void *out, size_t capacity);
+
+// Decompresses a raw LZ4 block. Returns the number of bytes written to out.
+size_t decompressLz4Block(const void *data, size_t size, void *out, size_t capacity);
+
+} // namespace thor
+
+#endif // THOR_GENERIC_LZ4_HPP
@@ -7,8 +7,11 @@
 #include "fiber.hpp"
 #include "kerncfg.hpp"
 #include "kernlet.hpp"
+#include "lockstat.hpp"
 #include "servers.hpp"
 #include "service_helpers.hpp"
+#include "rcu.hpp"
+#include "trace.hpp"
 #include <frg/string.hpp>
 #include <frigg/elf.hpp>
 #include <eir/interface.hpp>
@@ -76,8 +79,10 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 
 	SkeletalRegion::initialize();
 	physicalAllocator.initialize();
-	physicalAllocator->bootstrap(info->coreRegion.address, info->coreRegion.order,
-			info->coreRegion.numRoots, reinterpret_cast<int8_t *>(info->coreRegion.buddyTree));
+	auto regions = reinterpret_cast<EirRegion *>(info->regionInfo);
+	for(size_t i = 0; i < info->numRegions; i++)
+		physicalAllocator->bootstrap(regions[i].address, regions[i].order,
+				regions[i].numRoots, reinterpret_cast<int8_t *>(regions[i].buddyTree));
 	
 	kernelVirtualAlloc.initialize();
 	kernelAlloc.initialize(*kernelVirtualAlloc);
@@ -87,6 +92,7 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	frigg::infoLogger() << "\e[37mthor: Basic memory management is ready\e[39m" << frigg::endLog;
 
 	kernelCommandLine.initialize(*kernelAlloc, reinterpret_cast<const char *>(info->commandLine));
+	configureLockStats(kernelCommandLine->data(), kernelCommandLine->size());
 	earlyFibers.initialize(*kernelAlloc);
 
 	initializeReclaim();
@@ -111,6 +117,8 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	KernelFiber::run([=] () mutable {
 		// Complete the system initialization.
 		initializeExtendedSystem();
+		initializeRcu();
+		initializeAsyncLog();
 
 		transitionBootFb();
 
@@ -217,14 +225,22 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	//				if(logInitialization)
 						frigg::infoLogger() << "thor: initrd file " << path << frigg::endLog;
 
-					auto memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc,
-							(file_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
-					fiberCopyToBundle(memory.get(), 0, data, file_size);
-		
 					auto name = frigg::String<KernelAlloc>{*kernelAlloc,
 							path.subString(it - path.data(), end - it)};
-					dir->link(std::move(name), frigg::construct<MfsRegular>(*kernelAlloc,
-							std::move(memory), file_size));
+
+					if(isLz4Frame(data, file_size)) {
+						// Compressed files are decompressed on first access.
+						// Note that the initrd stays mapped, so data remains valid.
+						dir->link(std::move(name), frigg::construct<MfsRegular>(*kernelAlloc,
+								data, file_size, getLz4ContentSize(data, file_size)));
+					}else{
+						auto memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc,
+								(file_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
+						fiberCopyToBundle(memory.get(), 0, data, file_size);
+
+						dir->link(std::move(name), frigg::construct<MfsRegular>(*kernelAlloc,
+								std::move(memory), file_size));
+					}
 				}
 
 				p = data + ((file_size + 3) & ~uint32_t{3});
@@ -276,6 +292,11 @@ extern "C" void handleOpcodeFault(FaultImageAccessor image) {
 }
 
 extern "C" void handleNoFpuFault(FaultImageAccessor image) {
+	// The kernel itself never touches the extended state.
+	if(*image.cs() == kSelClientUserCode
+			&& handleLazyExtendedState(&getCurrentThread()->_executor))
+		return;
+
 	frigg::panicLogger() << "FPU invoked at "
 			<< (void *)*image.ip() << frigg::endLog;
 }
@@ -449,6 +470,8 @@ void handleIrq(IrqImageAccessor image, int number) {
 	if(logEveryIrq)
 		frigg::infoLogger() << "thor: IRQ slot #" << number << frigg::endLog;
 
+	trace(TraceEvent::irq, number);
+
 	globalIrqSlots[number]->raise();
 
 	// TODO: Can this function actually be called from non-preemptible domains?
@@ -564,6 +587,12 @@ void handleSyscall(SyscallImageAccessor image) {
 				(unsigned int)arg2, (size_t)arg3, &handle);
 		*image.out0() = handle;
 	} break;
+	case kHelCallCreateQueue2: {
+		HelHandle handle;
+		*image.error() = helCreateQueue2((HelQueue *)arg0, (uint32_t)arg1,
+				(unsigned int)arg2, (size_t)arg3, (size_t)arg4, &handle);
+		*image.out0() = handle;
+	} break;
 	case kHelCallSetupChunk: {
 		HelHandle handle;
 		*image.error() = helSetupChunk((HelHandle)arg0, (int)arg1,
@@ -619,6 +648,10 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallUnmapMemory: {
 		*image.error() = helUnmapMemory((HelHandle)arg0, (void *)arg1, (size_t)arg2);
 	} break;
+	case kHelCallAdviseMemory: {
+		*image.error() = helAdviseMemory((HelHandle)arg0, (void *)arg1, (size_t)arg2,
+				(uint32_t)arg3);
+	} break;
 	case kHelCallPointerPhysical: {
 		uintptr_t physical;
 		*image.error() = helPointerPhysical((void *)arg0, &physical);
@@ -652,6 +685,15 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallLoadahead: {
 		*image.error() = helLoadahead((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2);
 	} break;
+	case kHelCallSetSwapMemory: {
+		*image.error() = helSetSwapMemory((HelHandle)arg0);
+	} break;
+	case kHelCallQueryCompressedPoolStats: {
+		*image.error() = helQueryCompressedPoolStats((HelCompressedPoolStats *)arg0);
+	} break;
+	case kHelCallQueryPageMergeStats: {
+		*image.error() = helQueryPageMergeStats((HelPageMergeStats *)arg0);
+	} break;
 
 	case kHelCallCreateThread: {
 //		frigg::infoLogger() << "[" << this_thread->globalThreadId << "]"
@@ -665,9 +707,15 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallQueryThreadStats: {
 		*image.error() = helQueryThreadStats((HelHandle)arg0, (HelThreadStats *)arg1);
 	} break;
+	case kHelCallQueryCpuStats: {
+		*image.error() = helQueryCpuStats((int)arg0, (HelCpuStats *)arg1);
+	} break;
 	case kHelCallSetPriority: {
 		*image.error() = helSetPriority((HelHandle)arg0, (int)arg1);
 	} break;
+	case kHelCallSetSchedulingPolicy: {
+		*image.error() = helSetSchedulingPolicy((HelHandle)arg0, (int)arg1, (int)arg2);
+	} break;
 	case kHelCallYield: {
 		*image.error() = helYield();
 	} break;
@@ -690,6 +738,18 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallStoreRegisters: {
 		*image.error() = helStoreRegisters((HelHandle)arg0, (int)arg1, (const void *)arg2);
 	} break;
+	case kHelCallStartProfiling: {
+		*image.error() = helStartProfiling((uint64_t)arg0);
+	} break;
+	case kHelCallStopProfiling: {
+		*image.error() = helStopProfiling();
+	} break;
+	case kHelCallReadProfile: {
+		size_t num_samples;
+		*image.error() = helReadProfile((unsigned int)arg0, (HelProfileSample *)arg1,
+				(size_t)arg2, &num_samples);
+		*image.out0() = num_samples;
+	} break;
 	case kHelCallWriteFsBase: {
 		*image.error() = helWriteFsBase((void *)arg0);
 	} break;
@@ -698,6 +758,11 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helGetClock(&counter);
 		*image.out0() = counter;
 	} break;
+	case kHelCallMapClockPage: {
+		void *pointer;
+		*image.error() = helMapClockPage(&pointer);
+		*image.out0() = (Word)pointer;
+	} break;
 	case kHelCallSubmitAwaitClock: {
 		uint64_t async_id;
 		*image.error() = helSubmitAwaitClock((uint64_t)arg0,
@@ -757,6 +822,9 @@ void handleSyscall(SyscallImageAccessor image) {
 		HelHandle handle;
 		*image.error() = helAutomateIrq((HelHandle)arg0, (uint32_t)arg1, (HelHandle)arg2);
 	} break;
+	case kHelCallSetIrqCoalescing: {
+		*image.error() = helSetIrqCoalescing((HelHandle)arg0, (uint64_t)arg1, (uint64_t)arg2);
+	} break;
 
 	case kHelCallAccessIo: {
 		HelHandle handle;
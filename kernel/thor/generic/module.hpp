@@ -4,6 +4,7 @@
 #include <frigg/string.hpp>
 #include <frigg/vector.hpp>
 #include "kernel_heap.hpp"
+#include "lz4.hpp"
 #include "usermem.hpp"
 
 namespace thor {
@@ -57,11 +58,35 @@ private:
 
 struct MfsRegular : MfsNode {
 	MfsRegular(frigg::SharedPtr<Memory> memory, size_t size)
-	: MfsNode{MfsType::regular}, _memory{frigg::move(memory)}, _size{size} {
+	: MfsNode{MfsType::regular}, _memory{frigg::move(memory)}, _size{size},
+			_compressed{nullptr}, _compressedSize{0} {
 		assert(_size <= _memory->getLength());
 	}
 
+	// Regular file whose contents are an LZ4 frame. The memory is only allocated
+	// (and the data decompressed) when the file is first accessed.
+	// The compressed data must stay mapped for the lifetime of this object.
+	MfsRegular(const void *compressed, size_t compressed_size, size_t size)
+	: MfsNode{MfsType::regular}, _size{size},
+			_compressed{compressed}, _compressedSize{compressed_size} { }
+
 	frigg::SharedPtr<Memory> getMemory() {
+		{
+			auto lock = frigg::guard(&_mutex);
+			if(_memory)
+				return _memory;
+		}
+
+		// Decompression allocates and takes a while; do not hold the spinlock during it.
+		// If multiple threads race here, the first one to publish its copy wins.
+		assert(_compressed);
+		frigg::SharedPtr<Memory> memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc,
+				(_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
+		decompressLz4Frame(_compressed, _compressedSize, memory.get());
+
+		auto lock = frigg::guard(&_mutex);
+		if(!_memory)
+			_memory = frigg::move(memory);
 		return _memory;
 	}
 
@@ -70,8 +95,13 @@ struct MfsRegular : MfsNode {
 	}
 
 private:
+	frigg::TicketLock _mutex;
+
 	frigg::SharedPtr<Memory> _memory;
 	size_t _size;
+
+	const void *_compressed;
+	size_t _compressedSize;
 };
 
 extern MfsDirectory *mfsRoot;
@@ -0,0 +1,170 @@
+#include "kernel.hpp"
+#include "numa.hpp"
+
+namespace thor {
+
+namespace {
+	constexpr bool logNuma = false;
+
+	constexpr size_t maxNumaMemoryRanges = 32;
+	constexpr size_t maxNumaCpus = 256;
+
+	struct MemoryRange {
+		PhysicalAddr base;
+		size_t length;
+		int node;
+	};
+
+	struct CpuAffinity {
+		uint32_t apicId;
+		int node;
+	};
+
+	// The topology is only written during boot (before APs are started).
+	int numNodes = 1;
+	uint32_t nodeDomains[maxNumaNodes];
+	int distances[maxNumaNodes][maxNumaNodes];
+	bool haveDistances = false;
+	int fallbackOrders[maxNumaNodes][maxNumaNodes] = {{0}};
+
+	MemoryRange memoryRanges[maxNumaMemoryRanges];
+	size_t numMemoryRanges = 0;
+
+	CpuAffinity cpuAffinities[maxNumaCpus];
+	size_t numCpuAffinities = 0;
+
+	// Set once the topology is final; before that, everything belongs to node zero.
+	bool numaActive = false;
+	bool haveDomains = false;
+}
+
+int numNumaNodes() {
+	return numNodes;
+}
+
+int numaDistance(int from, int to) {
+	assert(from >= 0 && from < numNodes);
+	assert(to >= 0 && to < numNodes);
+	if(haveDistances)
+		return distances[from][to];
+	// ACPI suggests this value if no SLIT is present.
+	return from == to ? numaLocalDistance : 2 * numaLocalDistance;
+}
+
+const int *numaFallbackOrder(int node) {
+	assert(node >= 0 && node < numNodes);
+	return fallbackOrders[node];
+}
+
+int numaNodeOfApic(uint32_t apic_id) {
+	for(size_t i = 0; i < numCpuAffinities; i++)
+		if(cpuAffinities[i].apicId == apic_id)
+			return cpuAffinities[i].node;
+	return 0;
+}
+
+int numaNodeOfAddress(PhysicalAddr address) {
+	for(size_t i = 0; i < numMemoryRanges; i++) {
+		auto range = &memoryRanges[i];
+		if(address >= range->base && address - range->base < range->length)
+			return range->node;
+	}
+	return -1;
+}
+
+int localNumaNode() {
+	if(!numaActive)
+		return 0;
+	return getCpuData()->numaNode;
+}
+
+int numaNodeOfDomain(uint32_t domain) {
+	assert(!numaActive);
+	if(!haveDomains) {
+		// The first domain replaces the implicit node zero.
+		haveDomains = true;
+		nodeDomains[0] = domain;
+		return 0;
+	}
+
+	for(int i = 0; i < numNodes; i++)
+		if(nodeDomains[i] == domain)
+			return i;
+	if(numNodes == maxNumaNodes) {
+		frigg::infoLogger() << "\e[31m" "thor: Too many NUMA nodes, merging domain "
+				<< domain << " into node 0" "\e[39m" << frigg::endLog;
+		return 0;
+	}
+	nodeDomains[numNodes] = domain;
+	return numNodes++;
+}
+
+int numaNodeOfKnownDomain(uint32_t domain) {
+	if(!haveDomains)
+		return -1;
+	for(int i = 0; i < numNodes; i++)
+		if(nodeDomains[i] == domain)
+			return i;
+	return -1;
+}
+
+void numaAddMemory(int node, PhysicalAddr base, size_t length) {
+	assert(!numaActive);
+	if(numMemoryRanges == maxNumaMemoryRanges) {
+		frigg::infoLogger() << "\e[31m" "thor: Too many NUMA memory ranges" "\e[39m"
+				<< frigg::endLog;
+		return;
+	}
+	memoryRanges[numMemoryRanges++] = MemoryRange{base, length, node};
+}
+
+void numaAddCpu(int node, uint32_t apic_id) {
+	assert(!numaActive);
+	if(numCpuAffinities == maxNumaCpus) {
+		frigg::infoLogger() << "\e[31m" "thor: Too many NUMA CPU entries" "\e[39m"
+				<< frigg::endLog;
+		return;
+	}
+	cpuAffinities[numCpuAffinities++] = CpuAffinity{apic_id, node};
+}
+
+void numaSetDistance(int from, int to, int distance) {
+	assert(!numaActive);
+	haveDistances = true;
+	distances[from][to] = distance;
+}
+
+void finalizeNumaTopology() {
+	assert(!numaActive);
+
+	// Sort the nodes by distance. The node itself always comes first,
+	// even if the SLIT reports a smaller distance to some other node.
+	for(int i = 0; i < numNodes; i++) {
+		auto order = fallbackOrders[i];
+		for(int j = 0; j < numNodes; j++)
+			order[j] = (i + j) % numNodes;
+		for(int j = 1; j < numNodes; j++) {
+			for(int k = j; k > 1 && numaDistance(i, order[k]) < numaDistance(i, order[k - 1]); k--) {
+				auto tmp = order[k];
+				order[k] = order[k - 1];
+				order[k - 1] = tmp;
+			}
+		}
+	}
+
+	if(logNuma) {
+		frigg::infoLogger() << "thor: " << numNodes << " NUMA node(s)" << frigg::endLog;
+		for(size_t i = 0; i < numMemoryRanges; i++)
+			frigg::infoLogger() << "    Node " << memoryRanges[i].node
+					<< ": memory at 0x" << frigg::logHex(memoryRanges[i].base)
+					<< ", length: 0x" << frigg::logHex(memoryRanges[i].length)
+					<< frigg::endLog;
+	}
+
+	physicalAllocator->assignNodes();
+
+	getCpuData()->numaNode = numaNodeOfApic(getCpuData()->localApicId);
+	numaActive = true;
+}
+
+} // namespace thor
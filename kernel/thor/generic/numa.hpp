@@ -0,0 +1,51 @@
+#ifndef THOR_GENERIC_NUMA_HPP
+#define THOR_GENERIC_NUMA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.hpp"
+
+namespace thor {
+
+constexpr int maxNumaNodes = 8;
+
+// Distance between a node and itself, as defined by the ACPI SLIT.
+constexpr int numaLocalDistance = 10;
+
+// The NUMA topology is built from the ACPI SRAT and SLIT.
+// Without an SRAT, the system consists of a single node.
+// Nodes are numbered densely, starting at zero.
+
+int numNumaNodes();
+
+// Relative memory access latency between two nodes (10 = local).
+int numaDistance(int from, int to);
+
+// Returns all nodes sorted by increasing distance from the given node.
+// The first entry is the node itself.
+const int *numaFallbackOrder(int node);
+
+// Returns the node of the given CPU or zero if it is not known.
+int numaNodeOfApic(uint32_t apic_id);
+
+// Returns the node that contains the given physical address or -1 if it is not known.
+int numaNodeOfAddress(PhysicalAddr address);
+
+// Returns the node of the current CPU.
+int localNumaNode();
+
+// The following functions are used by the ACPI code to describe the topology.
+// Returns the node that corresponds to the given proximity domain (creating it if necessary).
+int numaNodeOfDomain(uint32_t domain);
+// Like numaNodeOfDomain() but returns -1 for unknown domains.
+int numaNodeOfKnownDomain(uint32_t domain);
+void numaAddMemory(int node, PhysicalAddr base, size_t length);
+void numaAddCpu(int node, uint32_t apic_id);
+void numaSetDistance(int from, int to, int distance);
+
+// Computes the fallback orders and assigns physical memory to nodes.
+void finalizeNumaTopology();
+
+} // namespace thor
+
+#endif // THOR_GENERIC_NUMA_HPP
@@ -28,29 +28,76 @@ void *SkeletalRegion::access(PhysicalAddr physical) {
 // PhysicalChunkAllocator
 // --------------------------------------------------------
 
-PhysicalChunkAllocator::PhysicalChunkAllocator() {
-}
+PhysicalChunkAllocator::PhysicalChunkAllocator()
+: _numRegions{0}, _usedPages{0}, _freePages{0} { }
 
 void PhysicalChunkAllocator::bootstrap(PhysicalAddr address,
 		int order, size_t num_roots, int8_t *buddy_tree) {
-	_physicalBase = address;
-	_buddyOrder = order;
-	_buddyRoots = num_roots;
-	_buddyPointer = buddy_tree;
-
-	_usedPages = 0;
-	_freePages = _buddyRoots << _buddyOrder;
-	frigg::infoLogger() << "Number of available pages: " << _freePages << frigg::endLog;
+	assert(_numRegions < maxRegions);
+	assert(num_roots <= maxRootsPerRegion);
+
+	auto region = &_regions[_numRegions++];
+	region->physicalBase = address;
+	region->length = num_roots << (order + kPageShift);
+	region->buddyPointer = buddy_tree;
+	region->buddyOrder = order;
+	region->buddyRoots = num_roots;
+	for(size_t i = 0; i < num_roots; i++)
+		region->rootNodes[i] = 0;
+
+	_freePages.fetch_add(num_roots << order, std::memory_order_relaxed);
+	frigg::infoLogger() << "Number of available pages: "
+			<< (num_roots << order) << frigg::endLog;
 }
 
-PhysicalAddr PhysicalChunkAllocator::allocate(size_t size) {
+void PhysicalChunkAllocator::assignNodes() {
 	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
+	for(int k = 0; k < maxNumaNodes; k++)
+		_nodes[k].mutex.lock();
+
+	size_t node_pages[maxNumaNodes] = {0};
+	for(size_t i = 0; i < _numRegions; i++) {
+		auto region = &_regions[i];
+		auto root_size = size_t(kPageSize) << region->buddyOrder;
+
+		// Roots that straddle a node boundary belong to the node of their first page.
+		for(size_t r = 0; r < region->buddyRoots; r++) {
+			auto node = numaNodeOfAddress(region->physicalBase + r * root_size);
+			if(node < 0)
+				node = 0;
+			region->rootNodes[r] = node;
+			node_pages[node] += size_t(1) << region->buddyOrder;
+		}
+	}
+
+	for(int k = maxNumaNodes - 1; k >= 0; k--)
+		_nodes[k].mutex.unlock();
+
+	for(int k = 0; k < numNumaNodes(); k++)
+		frigg::infoLogger() << "thor: NUMA node " << k << " manages "
+				<< (node_pages[k] * (kPageSize / 1024)) << " KiB" << frigg::endLog;
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocate(size_t size) {
+	return allocate(size, localNumaNode());
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int node) {
+	assert(_freePages.load(std::memory_order_relaxed) > size / kPageSize);
+
+	auto physical = tryAllocate(size, node);
+	if(physical == PhysicalAddr(-1)) {
+		frigg::panicLogger() << "thor: Out of physical memory" << frigg::endLog;
+		__builtin_unreachable();
+	}
+	return physical;
+}
 
-	assert(_freePages > size / kPageSize);
-	_freePages -= size / kPageSize;
-	_usedPages += size / kPageSize;
+PhysicalAddr PhysicalChunkAllocator::tryAllocate(size_t size) {
+	return tryAllocate(size, localNumaNode());
+}
 
+PhysicalAddr PhysicalChunkAllocator::tryAllocate(size_t size, int node) {
 	// TODO: This could be solved better.
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
@@ -59,42 +106,100 @@ PhysicalAddr PhysicalChunkAllocator::allocate(size_t size) {
 
 	if(logPhysicalAllocs)
 		frigg::infoLogger() << "thor: Allocating physical memory of order "
-					<< (target + kPageShift) << frigg::endLog;
-	auto physical = _physicalBase + (frigg::buddy_tools::allocate(_buddyPointer,
-			_buddyRoots, _buddyOrder, target) << kPageShift);
-//	frigg::infoLogger() << "Allocate " << (void *)physical << frigg::endLog;
-	assert(!(physical % (size_t(kPageSize) << target)));
-	return physical;
+					<< (target + kPageShift) << " on node " << node << frigg::endLog;
+
+	// Prefer the given node, then fall back to the closest nodes.
+	auto order = numaFallbackOrder(node);
+	for(int k = 0; k < numNumaNodes(); k++) {
+		auto physical = _allocateFromNode(target, order[k]);
+		if(physical != PhysicalAddr(-1)) {
+//			frigg::infoLogger() << "Allocate " << (void *)physical << frigg::endLog;
+			assert(!(physical % (size_t(kPageSize) << target)));
+			_freePages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
+			_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+			return physical;
+		}
+	}
+
+	return PhysicalAddr(-1);
 }
 
-void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
+PhysicalAddr PhysicalChunkAllocator::_allocateFromNode(int target, int node) {
 	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
-	
+	auto lock = frigg::guard(&_nodes[node].mutex);
+
+	for(size_t i = 0; i < _numRegions; i++) {
+		auto region = &_regions[i];
+		if(target > region->buddyOrder)
+			continue;
+
+		// Consecutive roots of the same node are searched together.
+		size_t r = 0;
+		while(r < region->buddyRoots) {
+			if(region->rootNodes[r] != node) {
+				r++;
+				continue;
+			}
+			auto end = r + 1;
+			while(end < region->buddyRoots && region->rootNodes[end] == node)
+				end++;
+
+			auto index = frigg::buddy_tools::allocate_in_roots(region->buddyPointer,
+					region->buddyRoots, region->buddyOrder, target, r, end);
+			if(index != frigg::buddy_tools::address_type(-1))
+				return region->physicalBase + (index << kPageShift);
+			r = end;
+		}
+	}
+
+	return PhysicalAddr(-1);
+}
+
+void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
 		target++;
 
-	auto index = (address - _physicalBase) >> kPageShift;
-	frigg::buddy_tools::free(_buddyPointer, _buddyRoots, _buddyOrder,
-			index, target);
-	
-	assert(_usedPages > size / kPageSize);
-	_freePages += size / kPageSize;
-	_usedPages -= size / kPageSize;
+	Region *region = nullptr;
+	for(size_t i = 0; i < _numRegions; i++) {
+		if(address >= _regions[i].physicalBase
+				&& address - _regions[i].physicalBase < _regions[i].length) {
+			region = &_regions[i];
+			break;
+		}
+	}
+	assert(region);
+
+	auto index = (address - region->physicalBase) >> kPageShift;
+	auto root = index >> region->buddyOrder;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		// Roots only change their node during assignNodes(), which takes all locks.
+		int node;
+		while(true) {
+			node = __atomic_load_n(&region->rootNodes[root], __ATOMIC_RELAXED);
+			_nodes[node].mutex.lock();
+			if(region->rootNodes[root] == node)
+				break;
+			_nodes[node].mutex.unlock();
+		}
+
+		frigg::buddy_tools::free(region->buddyPointer, region->buddyRoots,
+				region->buddyOrder, index, target);
+
+		_nodes[node].mutex.unlock();
+	}
+
+	assert(_usedPages.load(std::memory_order_relaxed) > size / kPageSize);
+	_freePages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	_usedPages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
 }
 
 size_t PhysicalChunkAllocator::numUsedPages() {
-	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
-
-	return _usedPages;
+	return _usedPages.load(std::memory_order_relaxed);
 }
 size_t PhysicalChunkAllocator::numFreePages() {
-	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
-
-	return _freePages;
+	return _freePages.load(std::memory_order_relaxed);
 }
 
 } // namespace thor
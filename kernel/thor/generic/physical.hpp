@@ -1,4 +1,8 @@
 
+#include <atomic>
+
+#include "lockstat.hpp"
+#include "numa.hpp"
 #include "types.hpp"
 
 namespace thor {
@@ -19,30 +23,64 @@ public:
 	void *access(PhysicalAddr physical);
 };
 
+// Manages the buddy trees that eir sets up for each memory region.
+// Each root of a buddy tree is owned by a single NUMA node; allocations prefer
+// the local node and fall back to other nodes in order of increasing distance.
 class PhysicalChunkAllocator {
-	typedef frigg::TicketLock Mutex;
+	typedef ClassLock<frigg::McsLock, LockClass::physical> Mutex;
+
+	static constexpr size_t maxRegions = 64;
+	// eir chooses the buddy order such that there are at most 64 roots per region.
+	static constexpr size_t maxRootsPerRegion = 64;
+
+	struct Region {
+		PhysicalAddr physicalBase;
+		size_t length;
+		int8_t *buddyPointer;
+		int buddyOrder;
+		size_t buddyRoots;
+
+		// NUMA node that owns each root. Protected by the node's mutex.
+		uint8_t rootNodes[maxRootsPerRegion];
+	};
+
+	struct Node {
+		Mutex mutex;
+	};
+
 public:
 	PhysicalChunkAllocator();
-	
+
+	// Adds a region; until assignNodes() is called, it belongs to node zero.
 	void bootstrap(PhysicalAddr address,
 			int order, size_t num_roots, int8_t *buddy_tree);
 
+	// Assigns each buddy root to the NUMA node that contains it (see numa.hpp).
+	void assignNodes();
+
+	// Allocates from the node of the current CPU.
 	PhysicalAddr allocate(size_t size);
+	PhysicalAddr allocate(size_t size, int node);
+
+	// Like allocate() but returns PhysicalAddr(-1) instead of panicking on OOM.
+	// Intended for callers that can do without the memory (e.g., caches).
+	PhysicalAddr tryAllocate(size_t size);
+	PhysicalAddr tryAllocate(size_t size, int node);
 	void free(PhysicalAddr address, size_t size);
 
 	size_t numUsedPages();
 	size_t numFreePages();
 
 private:
-	Mutex _mutex;
+	PhysicalAddr _allocateFromNode(int target, int node);
+
+	Region _regions[maxRegions];
+	size_t _numRegions;
 
-	PhysicalAddr _physicalBase;
-	int8_t *_buddyPointer;
-	int _buddyOrder;
-	size_t _buddyRoots;
+	Node _nodes[maxNumaNodes];
 
-	size_t _usedPages;
-	size_t _freePages;
+	std::atomic<size_t> _usedPages;
+	std::atomic<size_t> _freePages;
 };
 
 extern frigg::LazyInitializer<PhysicalChunkAllocator> physicalAllocator;
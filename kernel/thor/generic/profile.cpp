@@ -0,0 +1,179 @@
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "profile.hpp"
+#include "timer.hpp"
+
+namespace thor {
+
+namespace {
+	constexpr bool logProfiling = false;
+
+	// Lower bound on the sampling interval to keep the IRQ load bounded.
+	constexpr uint64_t minimalInterval = 100'000;
+
+	std::atomic<bool> profilingActive{false};
+	uint64_t profilingInterval;
+
+	// Protects the allocation of the per-CPU buffers.
+	frigg::TicketLock profilingMutex;
+
+	bool isUserCode(Word cs) {
+		return cs == kSelClientUserCode || cs == kSelClientUserCompat;
+	}
+
+	// Walks a user-mode frame pointer chain; only reads pages that are already present.
+	uint32_t walkUserFrames(AddressSpace *space, uintptr_t bp, uint64_t *frames) {
+		uint32_t n = 0;
+		while(n < kHelProfileMaxFrames) {
+			if(!bp || (bp & 7) || bp >= 0x8000'0000'0000 - 16)
+				break;
+			uint64_t next, ret;
+			if(!space->peekWord(bp, &next) || !space->peekWord(bp + 8, &ret))
+				break;
+			frames[n++] = ret;
+			if(next <= bp)
+				break;
+			bp = next;
+		}
+		return n;
+	}
+
+	// Walks a kernel-mode frame pointer chain within the given stack.
+	uint32_t walkKernelFrames(uintptr_t bp, uintptr_t stack_limit, uintptr_t stack_top,
+			uint64_t *frames) {
+		uint32_t n = 0;
+		while(n < kHelProfileMaxFrames) {
+			if((bp & 7) || bp < stack_limit || bp + 16 > stack_top)
+				break;
+			auto link = reinterpret_cast<uint64_t *>(bp);
+			frames[n++] = link[1];
+			if(link[0] <= bp)
+				break;
+			bp = link[0];
+		}
+		return n;
+	}
+}
+
+ProfileBuffer::ProfileBuffer()
+: head{0}, tail{0}, numDropped{0}, nextSample{0} { }
+
+Error startProfiling(uint64_t interval) {
+	if(interval < minimalInterval)
+		return kErrIllegalArgs;
+
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&profilingMutex);
+
+		// Buffers are allocated once and kept across profiling sessions.
+		for(int i = 0; i < getCpuCount(); i++) {
+			auto cpu_data = getCpuData(i);
+			if(!cpu_data->profileBuffer)
+				cpu_data->profileBuffer = frigg::construct<ProfileBuffer>(*kernelAlloc);
+		}
+
+		profilingInterval = interval;
+	}
+
+	// Publish the buffers to the timer IRQ handlers.
+	profilingActive.store(true, std::memory_order_release);
+
+	// Other CPUs pick up the profiler on their next timer IRQ.
+	auto irq_lock = frigg::guard(&irqMutex());
+	LocalApicContext::setProfileDeadline(systemClockSource()->currentNanos() + interval);
+
+	if(logProfiling)
+		frigg::infoLogger() << "thor: Starting profiler with an interval of "
+				<< interval << " ns" << frigg::endLog;
+	return kErrSuccess;
+}
+
+void stopProfiling() {
+	profilingActive.store(false, std::memory_order_relaxed);
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	LocalApicContext::setProfileDeadline(0);
+}
+
+size_t drainProfile(CpuData *cpu_data, HelProfileSample *samples, size_t max_samples) {
+	auto buffer = cpu_data->profileBuffer;
+	if(!buffer)
+		return 0;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&buffer->readMutex);
+
+	auto tail = buffer->tail.load(std::memory_order_relaxed);
+	auto head = buffer->head.load(std::memory_order_acquire);
+	size_t n = 0;
+	while(n < max_samples && tail != head) {
+		samples[n++] = buffer->samples[tail % profileSamplesPerCpu];
+		tail++;
+	}
+	buffer->tail.store(tail, std::memory_order_release);
+	return n;
+}
+
+void handleProfileTick(IrqImageAccessor image) {
+	if(!profilingActive.load(std::memory_order_acquire))
+		return;
+
+	auto cpu_data = getCpuData();
+	auto buffer = cpu_data->profileBuffer;
+	if(!buffer) // This CPU came online after the profiler was started.
+		return;
+
+	auto now = systemClockSource()->currentNanos();
+	if(now < buffer->nextSample) {
+		LocalApicContext::setProfileDeadline(buffer->nextSample);
+		return;
+	}
+	buffer->nextSample = now + profilingInterval;
+	LocalApicContext::setProfileDeadline(buffer->nextSample);
+
+	auto head = buffer->head.load(std::memory_order_relaxed);
+	if(head - buffer->tail.load(std::memory_order_acquire) == profileSamplesPerCpu) {
+		buffer->numDropped++;
+		return;
+	}
+
+	auto sample = &buffer->samples[head % profileSamplesPerCpu];
+	sample->timestamp = now;
+	sample->thread = 0;
+	sample->space = 0;
+	sample->ip = *image.ip();
+	sample->flags = 0;
+	sample->numFrames = 0;
+
+	if(image.inIdleDomain()) {
+		sample->flags |= kHelProfileIdle | kHelProfileKernel;
+	}else if(image.inFiberDomain()) {
+		sample->flags |= kHelProfileKernel;
+		// The IRQ preempted the fiber, so the fiber is still active on this CPU.
+		auto fiber = thisFiber();
+		if(fiber) {
+			auto top = reinterpret_cast<uintptr_t>(fiber->kernelStack().base());
+			sample->numFrames = walkKernelFrames(*image.bp(),
+					top - UniqueKernelStack::kSize, top, sample->frames);
+		}
+	}else{
+		auto thread = getCurrentThread();
+		auto space = thread->getAddressSpace();
+		sample->thread = reinterpret_cast<uintptr_t>(thread.get());
+		sample->space = reinterpret_cast<uintptr_t>(space.get());
+
+		if(isUserCode(*image.cs())) {
+			sample->numFrames = walkUserFrames(space.get(), *image.bp(), sample->frames);
+		}else{
+			sample->flags |= kHelProfileKernel;
+			auto top = reinterpret_cast<uintptr_t>(thread->getContext().kernelStack.base());
+			sample->numFrames = walkKernelFrames(*image.bp(),
+					top - UniqueKernelStack::kSize, top, sample->frames);
+		}
+	}
+
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+} // namespace thor
@@ -0,0 +1,43 @@
+#ifndef THOR_GENERIC_PROFILE_HPP
+#define THOR_GENERIC_PROFILE_HPP
+
+#include <atomic>
+#include <frigg/atomic.hpp>
+#include "../../hel/include/hel.h"
+#include "../arch/x86/cpu.hpp"
+#include "error.hpp"
+
+namespace thor {
+
+// Number of samples that each CPU can buffer until they are read.
+constexpr size_t profileSamplesPerCpu = 1024;
+
+// Single-producer/single-consumer ring of samples.
+// The producer is the timer IRQ of the owning CPU, the consumer is helReadProfile().
+struct ProfileBuffer {
+	ProfileBuffer();
+
+	HelProfileSample samples[profileSamplesPerCpu];
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+
+	// Number of samples that were discarded because the ring was full.
+	uint64_t numDropped;
+	uint64_t nextSample;
+
+	// Serializes readers.
+	frigg::TicketLock readMutex;
+};
+
+Error startProfiling(uint64_t interval);
+void stopProfiling();
+
+// Moves up to max_samples samples into the given (kernel) array.
+size_t drainProfile(CpuData *cpu_data, HelProfileSample *samples, size_t max_samples);
+
+// Called on each local timer IRQ.
+void handleProfileTick(IrqImageAccessor image);
+
+} // namespace thor
+
+#endif // THOR_GENERIC_PROFILE_HPP
@@ -0,0 +1,161 @@
+#include "fiber.hpp"
+#include "kernel.hpp"
+#include "rcu.hpp"
+#include "service_helpers.hpp"
+
+namespace thor {
+
+namespace {
+	constexpr bool logRcu = false;
+
+	// Interval at which the RCU fiber checks whether a grace period has elapsed.
+	constexpr uint64_t rcuPollInterval = 1'000'000;
+
+	// Number of polls after which we ping CPUs that have not reported a quiescent state.
+	// This is necessary for CPUs that run user space code without a preemption timer.
+	constexpr int rcuPingThreshold = 4;
+
+	using RcuCallbackList = frg::intrusive_list<
+		RcuCallback,
+		frg::locate_member<
+			RcuCallback,
+			frg::default_list_hook<RcuCallback>,
+			&RcuCallback::hook
+		>
+	>;
+
+	// Incremented at the start of each grace period.
+	std::atomic<uint64_t> rcuGlobalEpoch{1};
+
+	frigg::TicketLock rcuMutex;
+
+	// Protected by rcuMutex.
+	frigg::LazyInitializer<RcuCallbackList> rcuPending;
+	// Protected by rcuMutex. Non-null while the RCU fiber waits for callbacks.
+	FiberBlocker *rcuIdleBlocker;
+
+	bool isQuiescent(CpuData *cpu_data, uint64_t epoch) {
+		if(cpu_data->rcuEpoch.load(std::memory_order_acquire) >= epoch)
+			return true;
+		// Pairs with the fence in rcuExitIdle().
+		return cpu_data->rcuIdle.load(std::memory_order_seq_cst);
+	}
+
+	void waitForGracePeriod() {
+		auto epoch = rcuGlobalEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+		// The RCU fiber itself is never inside a read-side critical section.
+		{
+			StatelessIrqLock irq_lock;
+			rcuQuiescentState();
+		}
+
+		int polls = 0;
+		while(true) {
+			bool elapsed = true;
+			for(int i = 0; i < getCpuCount(); i++) {
+				auto cpu_data = getCpuData(i);
+				if(isQuiescent(cpu_data, epoch))
+					continue;
+				elapsed = false;
+				if(polls >= rcuPingThreshold)
+					sendPingIpi(cpu_data->localApicId);
+			}
+			if(elapsed)
+				break;
+
+			fiberSleep(rcuPollInterval);
+			polls++;
+		}
+
+		if(logRcu)
+			frigg::infoLogger() << "thor: RCU grace period " << epoch
+					<< " elapsed after " << polls << " polls" << frigg::endLog;
+	}
+}
+
+void rcuQuiescentState() {
+	assert(!intsAreEnabled());
+	auto epoch = rcuGlobalEpoch.load(std::memory_order_acquire);
+	getCpuData()->rcuEpoch.store(epoch, std::memory_order_release);
+}
+
+void rcuEnterIdle() {
+	assert(!intsAreEnabled());
+	rcuQuiescentState();
+	getCpuData()->rcuIdle.store(true, std::memory_order_release);
+}
+
+void rcuExitIdle() {
+	assert(!intsAreEnabled());
+	getCpuData()->rcuIdle.store(false, std::memory_order_relaxed);
+	// Order the store against subsequent reads of RCU-protected objects.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void rcuCall(RcuCallback *callback) {
+	FiberBlocker *blocker;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&rcuMutex);
+
+		rcuPending->push_back(callback);
+		blocker = rcuIdleBlocker;
+		rcuIdleBlocker = nullptr;
+	}
+
+	if(blocker)
+		KernelFiber::unblockOther(blocker);
+}
+
+void rcuSynchronize() {
+	struct Closure {
+		static void elapsed(RcuCallback *base) {
+			auto closure = frg::container_of(base, &Closure::callback);
+			KernelFiber::unblockOther(&closure->blocker);
+		}
+
+		FiberBlocker blocker;
+		RcuCallback callback;
+	} closure;
+
+	closure.blocker.setup();
+	closure.callback.setup(&Closure::elapsed);
+	rcuCall(&closure.callback);
+	KernelFiber::blockCurrent(&closure.blocker);
+}
+
+void initializeRcu() {
+	rcuPending.initialize();
+
+	KernelFiber::run([] {
+		while(true) {
+			RcuCallbackList batch;
+			FiberBlocker blocker;
+			blocker.setup();
+			{
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&rcuMutex);
+
+				batch.splice(batch.end(), *rcuPending);
+				if(batch.empty())
+					rcuIdleBlocker = &blocker;
+			}
+
+			if(batch.empty()) {
+				KernelFiber::blockCurrent(&blocker);
+				continue;
+			}
+
+			// Callbacks that are queued during the grace period are handled by the next one.
+			waitForGracePeriod();
+
+			while(!batch.empty()) {
+				auto callback = batch.pop_front();
+				callback->invoke();
+			}
+		}
+	});
+}
+
+} // namespace thor
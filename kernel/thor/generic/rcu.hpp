@@ -0,0 +1,54 @@
+#ifndef THOR_GENERIC_RCU_HPP
+#define THOR_GENERIC_RCU_HPP
+
+#include <frg/list.hpp>
+
+namespace thor {
+
+// Quiescent-state-based reclamation.
+//
+// Readers do not take any locks; they merely must not block (i.e., must not reach
+// a context switch) while they hold a reference to an RCU-protected object.
+// As thor does not preempt kernel code, this is the case for any code path that
+// does not suspend the current thread or fiber.
+//
+// A CPU passes through a quiescent state whenever it context switches, is idle or
+// is interrupted while running user space code. A grace period elapses once every CPU
+// has passed through a quiescent state after the grace period was started.
+
+struct RcuCallback {
+	void setup(void (*function)(RcuCallback *)) {
+		_function = function;
+	}
+
+	void invoke() {
+		_function(this);
+	}
+
+	frg::default_list_hook<RcuCallback> hook;
+
+private:
+	void (*_function)(RcuCallback *);
+};
+
+// Report a quiescent state of the current CPU. Must be called with IRQs disabled.
+void rcuQuiescentState();
+
+// Mark the current CPU as idle (an extended quiescent state) and leave that state again.
+// rcuExitIdle() must be called before the CPU reads any RCU-protected object.
+void rcuEnterIdle();
+void rcuExitIdle();
+
+// Invoke the callback after a grace period has elapsed. The callback runs on
+// the RCU fiber; it can thus free memory or take (non-IRQ-safe) locks.
+// This function can be called from any context.
+void rcuCall(RcuCallback *callback);
+
+// Blocks the current fiber until a full grace period has elapsed.
+void rcuSynchronize();
+
+void initializeRcu();
+
+} // namespace thor
+
+#endif // THOR_GENERIC_RCU_HPP
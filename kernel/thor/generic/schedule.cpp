@@ -1,5 +1,7 @@
 
 #include "kernel.hpp"
+#include "rcu.hpp"
+#include "trace.hpp"
 
 namespace thor {
 
@@ -8,25 +10,55 @@ namespace {
 	constexpr bool logNextBest = false;
 	constexpr bool logUpdates = false;
 	constexpr bool logTimeSlice = false;
+	constexpr bool logStealing = false;
 
 	constexpr bool disablePreemption = false;
 
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
+
+	// Length of a time slice of round-robin real-time entities in ns.
+	constexpr int64_t rtSliceLength = 5'000'000;
+
+	// Idle CPUs steal from CPUs on other NUMA nodes only if at least this many
+	// entities are waiting there; migrating across nodes makes memory accesses remote.
+	constexpr size_t remoteStealThreshold = 2;
+
+	// Real-time entities always take precedence over fair ones.
+	int classRank(const ScheduleEntity *entity) {
+		if(!entity->isRealTime())
+			return 0;
+		return 1 + entity->rtPriority;
+	}
+
+	int latencyBucket(uint64_t nanos) {
+		auto micros = nanos / 1000;
+		if(!micros)
+			return 0;
+		int k = 64 - __builtin_clzll(micros); // floor(log2(micros)) + 1.
+		return frigg::min(k, numLatencyBuckets - 1);
+	}
 }
 
 int ScheduleEntity::orderPriority(const ScheduleEntity *a, const ScheduleEntity *b) {
+	if(int rank = classRank(b) - classRank(a); rank)
+		return rank;
+	if(a->isRealTime())
+		return 0;
 	return b->priority - a->priority; // Prefer larger priority.
 }
 
 bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntity *b) {
+	if(a->isRealTime())
+		return a->_rtSequence < b->_rtSequence; // FIFO within each priority.
 	return a->baseUnfairness - a->refProgress
 			> b->baseUnfairness - b->refProgress; // Prefer greater unfairness.
 }
 
 ScheduleEntity::ScheduleEntity()
-: state{ScheduleState::null}, priority{0}, _refClock{0}, _runTime{0},
-		refProgress{0}, baseUnfairness{0} { }
+: _scheduler{nullptr}, _lastScheduler{nullptr}, _migratable{false}, state{ScheduleState::null}, priority{0},
+		policy{SchedulingPolicy::fair}, rtPriority{0}, _rtSequence{0}, _refClock{0}, _runTime{0}, refProgress{0}, baseUnfairness{0},
+		_queuedClock{0}, _wokenUp{false} { }
 
 ScheduleEntity::~ScheduleEntity() {
 	assert(state == ScheduleState::null);
@@ -38,7 +70,12 @@ void Scheduler::associate(ScheduleEntity *entity, Scheduler *scheduler) {
 
 //	frigg::infoLogger() << "associate " << entity << frigg::endLog;
 	assert(entity->state == ScheduleState::null);
+	if(entity->_lastScheduler && entity->_lastScheduler != scheduler) {
+		entity->_stats.numMigrations++;
+		scheduler->_cpuStats.numMigrations++;
+	}
 	entity->_scheduler = scheduler;
+	entity->_lastScheduler = scheduler;
 	entity->state = ScheduleState::attached;
 }
 
@@ -68,6 +105,36 @@ void Scheduler::setPriority(ScheduleEntity *entity, int priority) {
 	entity->priority = priority;
 }
 
+void Scheduler::setPolicy(ScheduleEntity *entity, SchedulingPolicy policy, int rt_priority) {
+	auto irq_lock = frigg::guard(&irqMutex());
+
+	frigg::LockGuard<Mutex> lock;
+	auto self = _lockAssociated(entity, lock);
+	assert(self);
+
+	self->_updateSystemProgress();
+
+	// The key of waiting entities changes; thus we need to remove-reinsert them.
+	bool waiting = entity->state == ScheduleState::active && entity != self->_current;
+	if(waiting)
+		self->_waitQueue.remove(entity);
+
+	entity->policy = policy;
+	entity->rtPriority = rt_priority;
+	if(entity->isRealTime())
+		self->_enqueueRealTime(entity);
+
+	if(waiting)
+		self->_waitQueue.push(entity);
+
+	if(self == &getCpuData()->scheduler) {
+		if(self->_updatePreemption())
+			sendPingIpi(self->_cpuContext->localApicId);
+	}else{
+		sendPingIpi(self->_cpuContext->localApicId);
+	}
+}
+
 void Scheduler::resume(ScheduleEntity *entity) {
 	auto irq_lock = frigg::guard(&irqMutex());
 
@@ -87,6 +154,10 @@ void Scheduler::resume(ScheduleEntity *entity) {
 	entity->refProgress = self->_systemProgress;
 	entity->_refClock = self->_refClock;
 	entity->state = ScheduleState::active;
+	entity->_queuedClock = self->_refClock;
+	entity->_wokenUp = true;
+	if(entity->isRealTime())
+		self->_enqueueRealTime(entity);
 	
 	self->_waitQueue.push(entity);
 	self->_numWaiting++;
@@ -97,6 +168,10 @@ void Scheduler::resume(ScheduleEntity *entity) {
 	}else{
 		sendPingIpi(self->_cpuContext->localApicId);
 	}
+
+	// Halted CPUs only steal when they reschedule; wake one up if the entity has to wait.
+	if(self->_current && entity->_migratable && !entity->isRealTime())
+		_kickIdle(self);
 }
 
 void Scheduler::suspendCurrent() {
@@ -113,6 +188,7 @@ void Scheduler::suspendCurrent() {
 	// Update the unfairness on suspend.
 	self->_updateCurrentEntity();
 	self->_updateEntityStats(entity);
+	self->_accountSwitch(entity, true);
 	entity->state = ScheduleState::attached;
 
 	self->_current = nullptr;
@@ -124,9 +200,9 @@ void Scheduler::suspendWaiting(ScheduleEntity *entity) {
 //	frigg::infoLogger() << "suspend " << entity << frigg::endLog;
 	assert(entity->state == ScheduleState::active);
 	
-	auto self = entity->_scheduler;
+	frigg::LockGuard<Mutex> lock;
+	auto self = _lockAssociated(entity, lock);
 	assert(self);
-	auto lock = frigg::guard(&self->_mutex);
 	assert(entity != self->_current);
 
 	assert(!"This function is untested");
@@ -149,9 +225,33 @@ void Scheduler::suspendWaiting(ScheduleEntity *entity) {
 	}
 }
 
+ScheduleStats Scheduler::queryStats(ScheduleEntity *entity) {
+	auto irq_lock = frigg::guard(&irqMutex());
+
+	// Entities of terminated threads are not associated anymore;
+	// their statistics do not change anymore.
+	frigg::LockGuard<Mutex> lock;
+	_lockAssociated(entity, lock);
+	return entity->_stats;
+}
+
+// Waiting entities can be stolen by other CPUs. Thus, we need to check that the
+// association did not change while we were waiting for the lock.
+Scheduler *Scheduler::_lockAssociated(ScheduleEntity *entity, frigg::LockGuard<Mutex> &lock) {
+	while(true) {
+		auto self = __atomic_load_n(&entity->_scheduler, __ATOMIC_RELAXED);
+		if(!self)
+			return nullptr;
+		lock = frigg::guard(&self->_mutex);
+		if(__atomic_load_n(&entity->_scheduler, __ATOMIC_RELAXED) == self)
+			return self;
+		lock.unlock();
+	}
+}
+
 Scheduler::Scheduler(CpuData *cpu_context)
 : _cpuContext{cpu_context}, _current{nullptr},
-		_numWaiting{0}, _refClock{0}, _systemProgress{0} { }
+		_numWaiting{0}, _idle{false}, _refClock{0}, _rtSequence{0}, _systemProgress{0} { }
 
 Progress Scheduler::_liveUnfairness(const ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active);
@@ -178,11 +278,26 @@ bool Scheduler::wantSchedule() {
 	auto lock = frigg::guard(&_mutex);
 
 	_updateSystemProgress();
+	// Idle CPUs reschedule to steal work (e.g. after they were kicked by _kickIdle()).
+	// Otherwise, they stay halted and can be kicked again.
+	if(!_current && _waitQueue.empty()) {
+		__atomic_store_n(&_idle, true, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		return _canSteal();
+	}
 	return _updatePreemption();
 }
 
+ScheduleStats Scheduler::queryCpuStats() {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+	return _cpuStats;
+}
+
 void Scheduler::reschedule() {
 	assert(!intsAreEnabled());
+	rcuQuiescentState();
+
 	auto lock = frigg::guard(&_mutex);
 
 	_updateSystemProgress();
@@ -192,14 +307,24 @@ void Scheduler::reschedule() {
 	
 	_sliceClock = _refClock;
 	
+	if(_waitQueue.empty()) {
+		// Announce that we are idle before looking for work. Pairs with the fence in
+		// _kickIdle(): either we see the new waiter or the waker sees the flag.
+		__atomic_store_n(&_idle, true, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		_stealWork();
+	}
+
 	if(_waitQueue.empty()) {
 		if(logScheduling)
 			frigg::infoLogger() << "System is idle" << frigg::endLog;
 		lock.unlock();
+		rcuEnterIdle();
 		suspendSelf();
 		frigg::panicLogger() << "Return from suspendSelf()" << frigg::endLog;
 	}
 
+	__atomic_store_n(&_idle, false, __ATOMIC_RELAXED);
 	_schedule();
 	assert(_current);
 
@@ -217,8 +342,14 @@ void Scheduler::_unschedule() {
 	// Decrease the unfairness at the end of the time slice.
 	_updateCurrentEntity();
 	_updateEntityStats(_current);
+	_accountSwitch(_current, _current->state != ScheduleState::active);
 
 	if(_current->state == ScheduleState::active) {
+		_current->_queuedClock = _refClock;
+		_current->_wokenUp = false;
+		// Preempted FIFO entities keep their place; round-robin entities go to the back.
+		if(_current->policy == SchedulingPolicy::roundRobin)
+			_enqueueRealTime(_current);
 		_waitQueue.push(_current);
 		_numWaiting++;
 	}
@@ -238,6 +369,9 @@ void Scheduler::_schedule() {
 	assert(entity->state == ScheduleState::active);
 	_updateWaitingEntity(entity);
 	_updateEntityStats(entity);
+	_accountDequeue(entity);
+
+	trace(TraceEvent::schedule, _numWaiting, reinterpret_cast<uintptr_t>(entity));
 
 	if(logScheduling) {
 //		frigg::infoLogger() << "System progress: " << (_systemProgress / 256) / (1000 * 1000)
@@ -256,6 +390,124 @@ void Scheduler::_schedule() {
 	_current = entity;
 }
 
+// Called by idle CPUs. Pulls a waiting entity from another CPU,
+// preferring CPUs on the same NUMA node.
+bool Scheduler::_stealWork() {
+	assert(!_current);
+	assert(_waitQueue.empty());
+
+	auto count = getCpuCount();
+	int self_index = 0;
+	for(int i = 0; i < count; i++)
+		if(getCpuData(i) == _cpuContext)
+			self_index = i;
+
+	for(int pass = 0; pass < 2; pass++) {
+		bool remote = pass;
+		for(int k = 1; k < count; k++) {
+			// Start at our neighbor such that idle CPUs do not all pick the same victim.
+			auto victim_context = getCpuData((self_index + k) % count);
+			if((victim_context->numaNode != _cpuContext->numaNode) != remote)
+				continue;
+
+			auto victim = &victim_context->scheduler;
+			// This read is racy but it only serves as a hint.
+			auto num_waiting = __atomic_load_n(&victim->_numWaiting, __ATOMIC_RELAXED);
+			if(num_waiting < (remote ? remoteStealThreshold : 1))
+				continue;
+
+			// Lock ordering between schedulers is undefined; never block on the victim.
+			if(!victim->_mutex.tryLock())
+				continue;
+
+			ScheduleEntity *entity = nullptr;
+			if(!victim->_waitQueue.empty()) {
+				auto top = victim->_waitQueue.top();
+				// Real-time entities stay on their CPU to keep their ordering guarantees.
+				if(top->_migratable && !top->isRealTime())
+					entity = top;
+			}
+			if(!entity) {
+				victim->_mutex.unlock();
+				continue;
+			}
+
+			// The victim's preemption timer is re-armed when its current time slice ends.
+			victim->_updateSystemProgress();
+			if(victim->_current)
+				victim->_updateCurrentEntity();
+			victim->_updateWaitingEntity(entity);
+			victim->_waitQueue.pop();
+			victim->_numWaiting--;
+
+			entity->_stats.numMigrations++;
+			_cpuStats.numMigrations++;
+			__atomic_store_n(&entity->_scheduler, this, __ATOMIC_RELAXED);
+			entity->_lastScheduler = this;
+			victim->_mutex.unlock();
+
+			// Keep the accumulated unfairness but measure progress on this CPU from now on.
+			entity->refProgress = _systemProgress;
+			entity->_refClock = _refClock;
+			_waitQueue.push(entity);
+			_numWaiting++;
+
+			if(logStealing)
+				frigg::infoLogger() << "thor: Stole entity from CPU #"
+						<< ((self_index + k) % count) << (remote ? " (remote)" : "")
+						<< frigg::endLog;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Racy check whether _stealWork() would find a victim.
+bool Scheduler::_canSteal() {
+	auto count = getCpuCount();
+	for(int i = 0; i < count; i++) {
+		auto victim_context = getCpuData(i);
+		if(victim_context == _cpuContext)
+			continue;
+		bool remote = victim_context->numaNode != _cpuContext->numaNode;
+		auto num_waiting = __atomic_load_n(&victim_context->scheduler._numWaiting,
+				__ATOMIC_RELAXED);
+		if(num_waiting >= (remote ? remoteStealThreshold : 1))
+			return true;
+	}
+	return false;
+}
+
+// Sends a ping IPI to an idle CPU such that it steals work from the busy scheduler.
+// Prefers CPUs on the same NUMA node; only kicks remote CPUs if they would steal.
+void Scheduler::_kickIdle(Scheduler *busy) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	auto num_waiting = __atomic_load_n(&busy->_numWaiting, __ATOMIC_RELAXED);
+	auto count = getCpuCount();
+	for(int pass = 0; pass < 2; pass++) {
+		bool remote = pass;
+		if(remote && num_waiting < remoteStealThreshold)
+			return;
+		for(int i = 0; i < count; i++) {
+			auto idle_context = getCpuData(i);
+			if(idle_context == busy->_cpuContext)
+				continue;
+			if((idle_context->numaNode != busy->_cpuContext->numaNode) != remote)
+				continue;
+
+			// Only the first kicker sends an IPI; the flag is set again if the CPU stays idle.
+			auto idle = &idle_context->scheduler;
+			if(!__atomic_load_n(&idle->_idle, __ATOMIC_RELAXED))
+				continue;
+			if(!__atomic_exchange_n(&idle->_idle, false, __ATOMIC_RELAXED))
+				continue;
+			sendPingIpi(idle_context->localApicId);
+			return;
+		}
+	}
+}
+
 void Scheduler::_updateSystemProgress() {
 	// Returns the reciprocal in 0.8 fixed point format.
 	auto fixedInverse = [] (uint32_t x) -> uint32_t {
@@ -300,6 +552,18 @@ bool Scheduler::_updatePreemption() {
 		return false;
 	}
 
+	if(_current->policy == SchedulingPolicy::fifo) {
+		// FIFO entities run until they block or a higher priority entity appears.
+		disarmPreemption();
+		return false;
+	}else if(_current->policy == SchedulingPolicy::roundRobin) {
+		auto remaining = rtSliceLength - static_cast<int64_t>(_refClock - _sliceClock);
+		if(remaining <= 0)
+			return true;
+		armPreemption(remaining);
+		return false;
+	}
+
 	// If the thread exhausted its time slice already, switch threads immediately.
 	auto diff = _liveUnfairness(_current) - _liveUnfairness(_waitQueue.top());
 	if(diff < 0)
@@ -346,6 +610,36 @@ void Scheduler::_updateEntityStats(ScheduleEntity *entity) {
 	entity->_refClock = _refClock;
 }
 
+void Scheduler::_accountSwitch(ScheduleEntity *entity, bool voluntary) {
+	if(voluntary) {
+		entity->_stats.numVoluntarySwitches++;
+		_cpuStats.numVoluntarySwitches++;
+	}else{
+		entity->_stats.numInvoluntarySwitches++;
+		_cpuStats.numInvoluntarySwitches++;
+	}
+}
+
+// Called when an entity leaves the wait queue to run.
+void Scheduler::_accountDequeue(ScheduleEntity *entity) {
+	auto wait = _refClock - entity->_queuedClock;
+	auto bucket = latencyBucket(wait);
+
+	entity->_stats.waitTime += wait;
+	entity->_stats.runQueueWait[bucket]++;
+	_cpuStats.waitTime += wait;
+	_cpuStats.runQueueWait[bucket]++;
+	if(entity->_wokenUp) {
+		entity->_stats.wakeupLatency[bucket]++;
+		_cpuStats.wakeupLatency[bucket]++;
+	}
+}
+
+void Scheduler::_enqueueRealTime(ScheduleEntity *entity) {
+	assert(entity->isRealTime());
+	entity->_rtSequence = _rtSequence++;
+}
+
 Scheduler *localScheduler() {
 	return &getCpuData()->scheduler;
 }
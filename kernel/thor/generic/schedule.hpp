@@ -3,6 +3,7 @@
 
 #include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
+#include "lockstat.hpp"
 
 namespace thor {
 
@@ -14,6 +15,24 @@ enum class ScheduleState {
 	active
 };
 
+enum class SchedulingPolicy {
+	fair,
+	fifo,
+	roundRobin
+};
+
+constexpr int numLatencyBuckets = 16;
+
+// Keep this in sync with HelThreadStats and HelCpuStats.
+struct ScheduleStats {
+	uint64_t waitTime = 0;
+	uint64_t numVoluntarySwitches = 0;
+	uint64_t numInvoluntarySwitches = 0;
+	uint64_t numMigrations = 0;
+	uint64_t wakeupLatency[numLatencyBuckets] = {};
+	uint64_t runQueueWait[numLatencyBuckets] = {};
+};
+
 // This needs to store a large timeframe.
 // For now, store it as 55.8 0 signed integer nanoseconds.
 using Progress = int64_t;
@@ -36,14 +55,34 @@ struct ScheduleEntity {
 		return _runTime;
 	}
 
+	bool isRealTime() const {
+		return policy != SchedulingPolicy::fair;
+	}
+
 	[[ noreturn ]] virtual void invoke() = 0;
 
+protected:
+	// Allows idle CPUs to steal this entity while it waits to run.
+	// Must be called before the entity is associated with a scheduler.
+	void allowMigration() {
+		_migratable = true;
+	}
+
 private:
 	frigg::TicketLock _associationMutex;
 	Scheduler *_scheduler;
+	// Scheduler that this entity was associated with before; used to count migrations.
+	Scheduler *_lastScheduler;
+	bool _migratable;
 
 	ScheduleState state;
 	int priority;
+
+	SchedulingPolicy policy;
+	// Only meaningful for real-time entities.
+	int rtPriority;
+	// Orders real-time entities of the same priority (FIFO within each priority).
+	uint64_t _rtSequence;
 	
 	frg::pairing_heap_hook<ScheduleEntity> hook;
 
@@ -56,26 +95,41 @@ private:
 
 	// Unfairness value at slice T.
 	Progress baseUnfairness;
+
+	// Time at which the entity was inserted into the wait queue.
+	uint64_t _queuedClock;
+	// True if the entity was inserted into the wait queue by resume().
+	bool _wokenUp;
+
+	// Protected by the scheduler's _mutex.
+	ScheduleStats _stats;
 };
 
 struct ScheduleGreater {
 	bool operator() (const ScheduleEntity *a, const ScheduleEntity *b) {
 		if(int po = ScheduleEntity::orderPriority(a, b); po)
-			return -po;
+			return po > 0;
 		return !ScheduleEntity::scheduleBefore(a, b);
 	}
 };
 
 struct Scheduler {
+private:
+	using Mutex = ClassLock<frigg::McsLock, LockClass::scheduler>;
+
+public:
 	static void associate(ScheduleEntity *entity, Scheduler *scheduler);
 	static void unassociate(ScheduleEntity *entity);
 
 	static void setPriority(ScheduleEntity *entity, int priority);
+	static void setPolicy(ScheduleEntity *entity, SchedulingPolicy policy, int rt_priority);
 
 	static void resume(ScheduleEntity *entity);
 	static void suspendCurrent();
 	static void suspendWaiting(ScheduleEntity *entity);
 
+	static ScheduleStats queryStats(ScheduleEntity *entity);
+
 	Scheduler(CpuData *cpu_context);
 
 	Scheduler(const Scheduler &) = delete;
@@ -83,17 +137,24 @@ struct Scheduler {
 	Scheduler &operator= (const Scheduler &) = delete;
 
 private:
+	static Scheduler *_lockAssociated(ScheduleEntity *entity, frigg::LockGuard<Mutex> &lock);
+
 	Progress _liveUnfairness(const ScheduleEntity *entity);
 	int64_t _liveRuntime(const ScheduleEntity *entity);
 
 public:
 	bool wantSchedule();
 
+	ScheduleStats queryCpuStats();
+
 	[[ noreturn ]] void reschedule();
 
 private:
 	void _unschedule();
 	void _schedule();
+	bool _stealWork();
+	bool _canSteal();
+	static void _kickIdle(Scheduler *busy);
 
 private:
 	void _updateSystemProgress();
@@ -104,9 +165,14 @@ private:
 
 	void _updateEntityStats(ScheduleEntity *entity);
 
+	void _enqueueRealTime(ScheduleEntity *entity);
+
+	void _accountSwitch(ScheduleEntity *entity, bool voluntary);
+	void _accountDequeue(ScheduleEntity *entity);
+
 	CpuData *_cpuContext;
 
-	frigg::TicketLock _mutex;
+	Mutex _mutex;
 
 	ScheduleEntity *_current;
 	
@@ -122,6 +188,10 @@ private:
 
 	size_t _numWaiting;
 
+	// Set (under _mutex) while the CPU looks for work in reschedule() and while it halts.
+	// Reset by the first CPU that kicks it with a ping IPI. Read without _mutex.
+	bool _idle;
+
 	// The last tick at which the scheduler's state (i.e. progress) was updated.
 	// In our model this is the time point at which slice T started.
 	uint64_t _refClock;
@@ -129,6 +199,12 @@ private:
 	// Start of the current timeslice.
 	uint64_t _sliceClock;
 
+	// Aggregated statistics of all entities on this CPU.
+	ScheduleStats _cpuStats;
+
+	// Source of ScheduleEntity::_rtSequence.
+	uint64_t _rtSequence;
+
 	// This variables stores sum{t = 0, ... T} w(t)/n(t).
 	// This allows us to easily track u_p(T) for all waiting processes.
 	Progress _systemProgress;
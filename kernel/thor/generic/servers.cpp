@@ -2,6 +2,7 @@
 #include <algorithm>
 
 #include <frg/hash_map.hpp>
+#include <frg/list.hpp>
 #include <frg/string.hpp>
 #include <frigg/debug.hpp>
 #include <frigg/elf.hpp>
@@ -179,49 +180,85 @@ ImageInfo loadModuleImage(smarter::shared_ptr<AddressSpace, BindableHandle> spac
 		
 		if(phdr.p_type == PT_LOAD) {
 			assert(phdr.p_memsz > 0);
-			
+			assert(phdr.p_filesz <= phdr.p_memsz);
+
 			// align virtual address and length to page size
 			uintptr_t virt_address = phdr.p_vaddr;
 			virt_address -= virt_address % kPageSize;
+			auto misalign = phdr.p_vaddr - virt_address;
 
 			size_t virt_length = (phdr.p_vaddr + phdr.p_memsz) - virt_address;
 			if((virt_length % kPageSize) != 0)
 				virt_length += kPageSize - virt_length % kPageSize;
-			
-			auto memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, virt_length);
-			TransferNode copy;
-			copy.setup(memory.get(), phdr.p_vaddr - virt_address,
-					image.get(), phdr.p_offset, phdr.p_filesz, nullptr);
-			if(!Memory::transfer(&copy))
-				assert(!"Fix the asynchronous case");
-
-			auto view = frigg::makeShared<MemorySlice>(*kernelAlloc,
-					frigg::move(memory), 0, virt_length);
-
-			VirtualAddr actual_address;
+
+			// Pages that are backed by the file are mapped from the image directly.
+			// This requires the file offset to be congruent to the virtual address.
+			// Read-only segments share the image's pages (including the remainder of
+			// the last page) unless they contain BSS. Writable segments are mapped CoW.
+			auto file_offset = phdr.p_offset - misalign;
+			size_t file_length = 0;
+			if(phdr.p_offset % kPageSize == misalign) {
+				if(!(phdr.p_flags & PF_W) && phdr.p_filesz == phdr.p_memsz) {
+					file_length = virt_length;
+				}else{
+					file_length = (misalign + phdr.p_filesz) & ~size_t{kPageSize - 1};
+				}
+			}
+			assert(file_offset + file_length <= image->getLength());
+
+			AddressSpace::MapFlags prot_flags;
 			if((phdr.p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_W)) {
+				prot_flags = AddressSpace::kMapProtRead | AddressSpace::kMapProtWrite;
+			}else if((phdr.p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_X)) {
+				prot_flags = AddressSpace::kMapProtRead | AddressSpace::kMapProtExecute;
+			}else if((phdr.p_flags & (PF_R | PF_W | PF_X)) == PF_R) {
+				prot_flags = AddressSpace::kMapProtRead;
+			}else{
+				frigg::panicLogger() << "Illegal combination of segment permissions"
+						<< frigg::endLog;
+				__builtin_unreachable();
+			}
+
+			if(file_length) {
+				auto view = frigg::makeShared<MemorySlice>(*kernelAlloc,
+						image, file_offset, file_length);
+
 				auto irq_lock = frigg::guard(&irqMutex());
 				AddressSpace::Guard space_guard(&space->lock);
 
+				VirtualAddr actual_address;
 				auto error = space->map(space_guard, frigg::move(view),
-						base + virt_address, 0, virt_length,
-						AddressSpace::kMapFixed | AddressSpace::kMapProtRead
-							| AddressSpace::kMapProtWrite,
+						base + virt_address, 0, file_length,
+						AddressSpace::kMapFixed | prot_flags
+							| ((phdr.p_flags & PF_W) ? AddressSpace::kMapCopyOnWrite : 0),
 						&actual_address);
 				assert(!error);
-			}else if((phdr.p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_X)) {
+			}
+
+			// The remaining pages contain the partial last page of the file and BSS.
+			if(file_length < virt_length) {
+				auto anon_length = virt_length - file_length;
+				auto memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, anon_length);
+
+				if(misalign + phdr.p_filesz > file_length) {
+					auto dest_offset = file_length ? 0 : misalign;
+					auto src_offset = file_length ? file_offset + file_length : phdr.p_offset;
+					fiberTransfer(memory.get(), dest_offset, image.get(), src_offset,
+							misalign + phdr.p_filesz - file_length - dest_offset);
+				}
+
+				auto view = frigg::makeShared<MemorySlice>(*kernelAlloc,
+						frigg::move(memory), 0, anon_length);
+
 				auto irq_lock = frigg::guard(&irqMutex());
 				AddressSpace::Guard space_guard(&space->lock);
 
+				VirtualAddr actual_address;
 				auto error = space->map(space_guard, frigg::move(view),
-						base + virt_address, 0, virt_length,
-						AddressSpace::kMapFixed | AddressSpace::kMapProtRead
-							| AddressSpace::kMapProtExecute,
+						base + virt_address + file_length, 0, anon_length,
+						AddressSpace::kMapFixed | prot_flags,
 						&actual_address);
 				assert(!error);
-			}else{
-				frigg::panicLogger() << "Illegal combination of segment permissions"
-						<< frigg::endLog;
 			}
 		}else if(phdr.p_type == PT_INTERP) {
 			info.interpreter.resize(phdr.p_filesz);
@@ -362,7 +399,7 @@ void executeModule(frigg::StringView name, MfsRegular *module,
 
 	auto thread = Thread::create(std::move(universe), frigg::move(space), params);
 	thread->self = thread;
-	thread->flags |= Thread::kFlagServer;
+	thread->flags |= Thread::kFlagServer | Thread::kFlagRealtime | Thread::kFlagPrivileged;
 	
 	// listen to POSIX calls from the thread.
 	runService(frg::string<KernelAlloc>{*kernelAlloc, name.data(), name.size()},
@@ -377,6 +414,83 @@ void executeModule(frigg::StringView name, MfsRegular *module,
 	Thread::resumeOther(thread);
 }
 
+// Servers are loaded by a single long-lived fiber. Fibers cannot exit yet, so a fiber
+// per launch would leak its stack (and everything that it captured).
+namespace {
+	struct LaunchRequest {
+		LaunchRequest(frigg::StringView name, MfsRegular *module,
+				LaneHandle control_lane, LaneHandle xpipe_lane, bool needs_mbus,
+				Scheduler *scheduler)
+		: name{*kernelAlloc, name}, module{module},
+				controlLane{std::move(control_lane)}, xpipeLane{std::move(xpipe_lane)},
+				needsMbus{needs_mbus}, scheduler{scheduler} { }
+
+		frigg::String<KernelAlloc> name;
+		MfsRegular *module;
+		LaneHandle controlLane;
+		LaneHandle xpipeLane;
+		bool needsMbus;
+		Scheduler *scheduler;
+
+		frg::default_list_hook<LaunchRequest> hook;
+	};
+
+	frigg::TicketLock launchMutex;
+	frg::intrusive_list<
+		LaunchRequest,
+		frg::locate_member<
+			LaunchRequest,
+			frg::default_list_hook<LaunchRequest>,
+			&LaunchRequest::hook
+		>
+	> launchQueue;
+	FiberBlocker launchBlocker;
+	// Protected by launchMutex. True if the loader fiber waits for launchBlocker.
+	bool launchSleeping = false;
+
+	void postLaunch(LaunchRequest *request) {
+		bool wake;
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&launchMutex);
+			launchQueue.push_back(request);
+			wake = launchSleeping;
+			launchSleeping = false;
+		}
+		if(wake)
+			KernelFiber::unblockOther(&launchBlocker);
+	}
+
+	void runLoaderFiber() {
+		KernelFiber::run([] {
+			while(true) {
+				LaunchRequest *request = nullptr;
+				{
+					auto irq_lock = frigg::guard(&irqMutex());
+					auto lock = frigg::guard(&launchMutex);
+					if(!launchQueue.empty()) {
+						request = launchQueue.pop_front();
+					}else{
+						launchBlocker.setup();
+						launchSleeping = true;
+					}
+				}
+
+				if(!request) {
+					KernelFiber::blockCurrent(&launchBlocker);
+					continue;
+				}
+
+				// Move the lanes out such that only the server keeps them alive.
+				executeModule(request->name, request->module,
+						std::move(request->controlLane), std::move(request->xpipeLane),
+						request->needsMbus ? *mbusClient : LaneHandle{}, request->scheduler);
+				frigg::destruct(*kernelAlloc, request);
+			}
+		});
+	}
+}
+
 void runMbus() {
 	if(debugLaunch)
 		frigg::infoLogger() << "thor: Launching mbus" << frigg::endLog;
@@ -392,9 +506,11 @@ void runMbus() {
 
 	auto module = resolveModule("/sbin/mbus");
 	assert(module && module->type == MfsType::regular);
-	executeModule("/sbin/mbus", static_cast<MfsRegular *>(module),
-			control_stream.get<0>(),
-			mbus_stream.get<0>(), LaneHandle{}, localScheduler());
+
+	// Load the image on the loader fiber.
+	postLaunch(frigg::construct<LaunchRequest>(*kernelAlloc, "/sbin/mbus",
+			static_cast<MfsRegular *>(module), control_stream.get<0>(),
+			mbus_stream.get<0>(), false, localScheduler()));
 }
 
 LaneHandle runServer(frigg::StringView name) {
@@ -417,9 +533,10 @@ LaneHandle runServer(frigg::StringView name) {
 	auto control_stream = createStream();
 	allServers->insert(name_str, control_stream.get<1>());
 
-	executeModule(name, static_cast<MfsRegular *>(module),
-			control_stream.get<0>(),
-			LaneHandle{}, *mbusClient, localScheduler());
+	// Requests to the server are buffered by the stream until it is running.
+	postLaunch(frigg::construct<LaunchRequest>(*kernelAlloc, name,
+			static_cast<MfsRegular *>(module), control_stream.get<0>(),
+			LaneHandle{}, true, localScheduler()));
 
 	return control_stream.get<1>();
 }
@@ -571,6 +688,7 @@ void handleBind(LaneHandle object_lane) {
 
 void initializeSvrctl() {
 	allServers.initialize(frg::hash<frg::string<KernelAlloc>>{}, *kernelAlloc);
+	runLoaderFiber();
 
 	// Create a fiber to manage requests to the svrctl mbus object.
 	KernelFiber::run([=] {
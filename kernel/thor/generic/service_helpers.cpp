@@ -54,6 +54,27 @@ void fiberCopyFromBundle(Memory *bundle, ptrdiff_t offset, void *pointer, size_t
 		KernelFiber::blockCurrent(&closure.blocker);
 }
 
+void fiberTransfer(Memory *dest_bundle, uintptr_t dest_offset,
+		Memory *src_bundle, uintptr_t src_offset, size_t size) {
+	struct Closure {
+		static void copied(Worklet *worklet) {
+			auto closure = frg::container_of(worklet, &Closure::worklet);
+			KernelFiber::unblockOther(&closure->blocker);
+		}
+
+		FiberBlocker blocker;
+		Worklet worklet;
+		TransferNode transfer;
+	} closure;
+
+	closure.blocker.setup();
+	closure.worklet.setup(&Closure::copied);
+	closure.transfer.setup(dest_bundle, dest_offset, src_bundle, src_offset, size,
+			&closure.worklet);
+	if(!Memory::transfer(&closure.transfer))
+		KernelFiber::blockCurrent(&closure.blocker);
+}
+
 void fiberSleep(uint64_t nanos) {
 	struct Closure {
 		static void elapsed(Worklet *worklet) {
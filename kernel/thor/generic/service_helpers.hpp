@@ -7,6 +7,8 @@ namespace thor {
 
 void fiberCopyToBundle(Memory *bundle, ptrdiff_t offset, const void *pointer, size_t size);
 void fiberCopyFromBundle(Memory *bundle, ptrdiff_t offset, void *pointer, size_t size);
+void fiberTransfer(Memory *dest_bundle, uintptr_t dest_offset,
+		Memory *src_bundle, uintptr_t src_offset, size_t size);
 
 void fiberSleep(uint64_t nanos);
 
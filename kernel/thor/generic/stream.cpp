@@ -1,5 +1,6 @@
 
 #include "kernel.hpp"
+#include "trace.hpp"
 
 namespace thor {
 
@@ -151,6 +152,10 @@ void Stream::Submitter::run() {
 		if(getStreamOrientation(u->tag()) < getStreamOrientation(v->tag()))
 			std::swap(u, v);
 
+		trace(TraceEvent::streamTransfer,
+				(static_cast<uint32_t>(u->tag()) << 16) | static_cast<uint32_t>(v->tag()),
+				reinterpret_cast<uintptr_t>(u->_transmitLane.getStream()));
+
 		// Do the main work here, after we released the lock.
 		if(OfferBase::classOf(*u) && AcceptBase::classOf(*v)) {
 			// Initially there will be 3 references to the new stream:
@@ -202,7 +202,7 @@ private:
 
 	std::atomic<int> _peerCount[2];
 
-	frigg::TicketLock _mutex;
+	ClassLock<frigg::TicketLock, LockClass::stream> _mutex;
 
 	// protected by _mutex.
 	frg::intrusive_list<
@@ -322,6 +322,7 @@ Thread::Thread(frigg::SharedPtr<Universe> universe,
 	memcpy(_credentials + 8, &id, sizeof(uint64_t));
 
 	_executorContext.associatedWorkQueue = &_mainWorkQueue;
+	allowMigration();
 
 	auto stream = createStream();
 	_superiorLane = frigg::move(stream.get<0>());
@@ -104,7 +104,12 @@ public:
 	};
 
 	enum Flags : uint32_t {
-		kFlagServer = 1
+		kFlagServer = 1,
+		// The thread may use real-time scheduling policies.
+		kFlagRealtime = 2,
+		// The thread may use system calls that affect the whole system
+		// (e.g., helSetSwapMemory()).
+		kFlagPrivileged = 4
 	};
 
 	Thread(frigg::SharedPtr<Universe> universe,
@@ -160,7 +165,7 @@ public:
 	uint32_t flags;
 
 private:
-	typedef frigg::TicketLock Mutex;
+	typedef ClassLock<frigg::TicketLock, LockClass::thread> Mutex;
 
 	enum RunState {
 		kRunNone,
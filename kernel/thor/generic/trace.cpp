@@ -0,0 +1,47 @@
+#include "kernel.hpp"
+#include "timer.hpp"
+#include "trace.hpp"
+
+namespace thor {
+
+std::atomic<bool> traceActive{false};
+
+void initializeTraceBuffer(CpuData *cpu_data, uint32_t cpu) {
+	auto physical = physicalAllocator->allocate(traceBufferSize);
+	assert(physical != PhysicalAddr(-1) && "OOM");
+
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, traceBufferSize);
+
+	auto header = reinterpret_cast<TraceHeader *>(accessor.get());
+	header->magic = traceMagic;
+	header->version = traceVersion;
+	header->cpu = cpu;
+	header->numRecords = numTraceRecords;
+
+	// The buffer is physically contiguous; we access it through the direct physical mapping.
+	cpu_data->tracePhysical = physical;
+	cpu_data->traceBuffer = header;
+}
+
+void emitTrace(TraceEvent event, uint32_t arg0, uint64_t arg1) {
+	auto header = getCpuData()->traceBuffer;
+	if(!header)
+		return;
+	auto records = reinterpret_cast<TraceRecord *>(header + 1);
+
+	// IRQs may interrupt us at any point; the atomic increment hands out unique slots.
+	auto slot = header->head.fetch_add(1, std::memory_order_relaxed);
+	auto record = &records[slot % numTraceRecords];
+
+	record->sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	record->timestamp = systemClockSource()->currentNanos();
+	record->event = static_cast<uint16_t>(event);
+	record->reserved = 0;
+	record->arg0 = arg0;
+	record->arg1 = arg1;
+	record->sequence.store(slot + 1, std::memory_order_release);
+}
+
+} // namespace thor
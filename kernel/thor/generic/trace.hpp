@@ -0,0 +1,73 @@
+#ifndef THOR_GENERIC_TRACE_HPP
+#define THOR_GENERIC_TRACE_HPP
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+struct CpuData;
+
+// The types in this file define the binary layout of the trace buffers.
+// Keep them in sync with tools/thor-trace/thor-trace.
+
+enum class TraceEvent : uint16_t {
+	null,
+	schedule,
+	ipcSubmit,
+	streamTransfer,
+	fault,
+	futexWait,
+	futexWake,
+	irq
+};
+
+struct TraceRecord {
+	// Zero while the record is being written, otherwise the slot number plus one.
+	// Readers use this (like a seqlock) to detect torn or overwritten records.
+	std::atomic<uint64_t> sequence;
+	uint64_t timestamp;
+	uint16_t event;
+	uint16_t reserved;
+	uint32_t arg0;
+	uint64_t arg1;
+};
+static_assert(sizeof(TraceRecord) == 32, "Bad sizeof(TraceRecord)");
+
+constexpr uint32_t traceMagic = 0x45435254; // "TRCE"
+constexpr uint32_t traceVersion = 1;
+
+// Each CPU owns a buffer that consists of a header followed by the ring of records.
+struct TraceHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t cpu;
+	uint32_t numRecords;
+	// Total number of records ever written; the ring index is head % numRecords.
+	std::atomic<uint64_t> head;
+	uint64_t reserved[5];
+};
+static_assert(sizeof(TraceHeader) == 64, "Bad sizeof(TraceHeader)");
+
+// Size of each per-CPU trace buffer in bytes.
+constexpr size_t traceBufferSize = 0x10000;
+
+// The kernel never reads TraceHeader::numRecords back as user space can map the buffer.
+constexpr size_t numTraceRecords = (traceBufferSize - sizeof(TraceHeader)) / sizeof(TraceRecord);
+
+extern std::atomic<bool> traceActive;
+
+void initializeTraceBuffer(CpuData *cpu_data, uint32_t cpu);
+
+void emitTrace(TraceEvent event, uint32_t arg0, uint64_t arg1);
+
+// Tracepoints only cost a relaxed load while tracing is disabled.
+inline void trace(TraceEvent event, uint32_t arg0 = 0, uint64_t arg1 = 0) {
+	if(traceActive.load(std::memory_order_relaxed))
+		emitTrace(event, arg0, arg1);
+}
+
+} // namespace thor
+
+#endif // THOR_GENERIC_TRACE_HPP
@@ -2,7 +2,10 @@
 #include <type_traits>
 #include "kernel.hpp"
 #include "fiber.hpp"
+#include "ksm.hpp"
 #include "service_helpers.hpp"
+#include "trace.hpp"
+#include "zpool.hpp"
 #include <frg/container_of.hpp>
 #include "types.hpp"
 
@@ -22,6 +25,18 @@ namespace {
 	// The following flags are debugging options to debug the correctness of various components.
 	constexpr bool disableUncaching = false;
 	constexpr bool disableCow = false;
+	constexpr bool disableSwap = false;
+
+	// Marks pages that do not have a swap slot.
+	constexpr uint64_t noSwapSlot = ~uint64_t(0);
+
+	// Number of anonymous pages that are evicted before queued writebacks are flushed.
+	// Larger clusters result in larger (and fewer) writes to the swap device.
+	constexpr size_t swapClusterSize = 64;
+
+	// Number of pages (including the faulting page) that are read ahead on page faults.
+	constexpr size_t defaultReadahead = 4;
+	constexpr size_t sequentialReadahead = 32;
 
 	void logRss(AddressSpace *space) {
 		if(!logUsage)
@@ -59,9 +74,9 @@ struct MemoryReclaimer {
 		page->refcount.fetch_add(1, std::memory_order_acq_rel);
 
 		assert(!(page->flags & CachePage::reclaimStateMask));
-		_lruList.push_back(page);
+		_listOf(page).push_back(page);
 		page->flags |= CachePage::reclaimCached;
-		_cachedSize += kPageSize;
+		_sizeOf(page) += kPageSize;
 	}
 
 	void bumpPage(CachePage *page) {
@@ -70,16 +85,16 @@ struct MemoryReclaimer {
 		auto lock = frigg::guard(&_mutex);
 
 		if((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimCached) {
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
+			auto it = _listOf(page).iterator_to(page);
+			_listOf(page).erase(it);
 		}else {
 			assert((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimUncaching);
 			page->flags &= ~CachePage::reclaimStateMask;
 			page->flags |= CachePage::reclaimCached;
-			_cachedSize += kPageSize;
+			_sizeOf(page) += kPageSize;
 		}
 
-		_lruList.push_back(page);
+		_listOf(page).push_back(page);
 	}
 
 	void removePage(CachePage *page) {
@@ -88,9 +103,9 @@ struct MemoryReclaimer {
 		auto lock = frigg::guard(&_mutex);
 
 		if((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimCached) {
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
-			_cachedSize -= kPageSize;
+			auto it = _listOf(page).iterator_to(page);
+			_listOf(page).erase(it);
+			_sizeOf(page) -= kPageSize;
 		}else{
 			assert((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimUncaching);
 		}
@@ -100,91 +115,287 @@ struct MemoryReclaimer {
 			page->bundle->retirePage(page);
 	}
 
-	KernelFiber *createReclaimFiber() {
-		auto checkReclaim = [this] () -> bool {
-			if(disableUncaching)
-				return false;
+	// Wakes up the swap fiber if free memory is low.
+	void checkPressure() {
+		if(!_belowWatermark(lowWatermarkShift))
+			return;
 
-			// Take a single page out of the LRU list.
-			// TODO: We have to acquire a refcount here.
-			CachePage *page;
-			{
-				auto irq_lock = frigg::guard(&irqMutex());
-				auto lock = frigg::guard(&_mutex);
+		FiberBlocker *blocker;
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
 
-				if(_cachedSize <= (1 << 20))
-					return false;
+			blocker = _swapIdleBlocker;
+			_swapIdleBlocker = nullptr;
+		}
 
-				page = _lruList.pop_front();
+		if(blocker)
+			KernelFiber::unblockOther(blocker);
+	}
 
-				// Take another reference while we do the uncaching. (removePage() could be
-				// called concurrently and release the reclaimer's reference).
-				page->refcount.fetch_add(1, std::memory_order_acq_rel);
+	KernelFiber *createReclaimFiber() {
+		return KernelFiber::post([=] {
+			while(true) {
+				if(logUncaching) {
+					auto irq_lock = frigg::guard(&irqMutex());
+					auto lock = frigg::guard(&_mutex);
+					frigg::infoLogger() << "thor: " << (_cachedSize / 1024)
+							<< " KiB of cached pages, " << (_anonymousSize / 1024)
+							<< " KiB of evictable anonymous pages" << frigg::endLog;
+
+					auto stats = compressedPool->stats();
+					frigg::infoLogger() << "thor: Compressed pool holds " << stats.storedPages
+							<< " pages in " << stats.poolPages << " pages, "
+							<< stats.numHits << " hits, " << stats.numRejects
+							<< " rejects" << frigg::endLog;
+				}
 
-				page->flags &= ~CachePage::reclaimStateMask;
-				page->flags |= CachePage::reclaimUncaching;
-				_cachedSize -= kPageSize;
+				while(_reclaimCached(1 << 20))
+					;
+				fiberSleep(1'000'000'000);
 			}
+		});
+	}
 
-			// Evict the page and wait until it is evicted.
-			struct Closure {
+	KernelFiber *createSwapFiber() {
+		return KernelFiber::post([=] {
+			while(true) {
 				FiberBlocker blocker;
-				Worklet worklet;
-				ReclaimNode node;
-			} closure;
+				blocker.setup();
+				{
+					auto irq_lock = frigg::guard(&irqMutex());
+					auto lock = frigg::guard(&_mutex);
 
-			closure.worklet.setup([] (Worklet *base) {
-				auto closure = frg::container_of(base, &Closure::worklet);
-				KernelFiber::unblockOther(&closure->blocker);
-			});
+					_swapIdleBlocker = &blocker;
+				}
 
-			closure.blocker.setup();
-			closure.node.setup(&closure.worklet);
-			if(!page->bundle->uncachePage(page, &closure.node))
-				KernelFiber::blockCurrent(&closure.blocker);
+				// Re-check to avoid missing wake-ups that happened before we installed the blocker.
+				if(_belowWatermark(lowWatermarkShift)) {
+					bool taken;
+					{
+						auto irq_lock = frigg::guard(&irqMutex());
+						auto lock = frigg::guard(&_mutex);
 
-			if(page->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
-				page->bundle->retirePage(page);
+						taken = _swapIdleBlocker != &blocker;
+						_swapIdleBlocker = nullptr;
+					}
 
-			return true;
-		};
+					// If checkPressure() took the blocker, wait until it is done with it.
+					if(taken)
+						KernelFiber::blockCurrent(&blocker);
+				}else{
+					KernelFiber::blockCurrent(&blocker);
+				}
 
-		return KernelFiber::post([=] {
-			while(true) {
-				if(logUncaching) {
+				// Pages that cannot be evicted (e.g., incompressible pages without swap)
+				// return to the LRU list. Make at most one pass over the list.
+				size_t budget;
+				{
 					auto irq_lock = frigg::guard(&irqMutex());
 					auto lock = frigg::guard(&_mutex);
-					frigg::infoLogger() << "thor: " << (_cachedSize / 1024)
-							<< " KiB of cached pages" << frigg::endLog;
+
+					budget = _anonymousSize / kPageSize;
 				}
 
-				while(checkReclaim())
-					;
-				fiberSleep(1'000'000'000);
+				// Evict until the high watermark is reached. Dropping clean cached pages
+				// is cheaper than swapping; do that first.
+				size_t evicted = 0;
+				while(_belowWatermark(highWatermarkShift)) {
+					while(_belowWatermark(highWatermarkShift) && _reclaimCached(0))
+						;
+					if(!_belowWatermark(highWatermarkShift))
+						break;
+
+					size_t batch = 0;
+					while(batch < swapClusterSize && batch < budget && _evictAnonymous())
+						batch++;
+					if(!batch)
+						break;
+					evicted += batch;
+					budget -= batch;
+
+					auto swap = getSwapSpace();
+					if(swap)
+						swap->flush();
+				}
+
+				if(logUncaching && evicted)
+					frigg::infoLogger() << "thor: Evicted " << evicted
+							<< " anonymous pages" << frigg::endLog;
+
+				// Memory is only released once writeback completes. Give the server time
+				// to make progress; also avoid spinning if there is nothing to evict.
+				fiberSleep(10'000'000);
 			}
 		});
 	}
 
+	SwapSpace *getSwapSpace() {
+		return _swapSpace.load(std::memory_order_acquire);
+	}
+
+	bool installSwapSpace(SwapSpace *swap) {
+		SwapSpace *expected = nullptr;
+		return _swapSpace.compare_exchange_strong(expected, swap, std::memory_order_acq_rel);
+	}
+
 private:
-	frigg::TicketLock _mutex;
+	// Free memory is low if less than 1/32 of all pages are free.
+	static constexpr int lowWatermarkShift = 5;
+	// The swap fiber evicts pages until 1/16 of all pages are free.
+	static constexpr int highWatermarkShift = 4;
+
+	bool _belowWatermark(int shift) {
+		auto free_pages = physicalAllocator->numFreePages();
+		auto total_pages = free_pages + physicalAllocator->numUsedPages();
+		return free_pages < (total_pages >> shift);
+	}
 
-	frg::intrusive_list<
+	using PageList = frg::intrusive_list<
 		CachePage,
 		frg::locate_member<
 			CachePage,
 			frg::default_list_hook<CachePage>,
 			&CachePage::listHook
 		>
-	> _lruList;
+	>;
+
+	PageList &_listOf(CachePage *page) {
+		if(page->flags & CachePage::anonymous)
+			return _anonymousList;
+		return _lruList;
+	}
+
+	size_t &_sizeOf(CachePage *page) {
+		if(page->flags & CachePage::anonymous)
+			return _anonymousSize;
+		return _cachedSize;
+	}
+
+	// Evicts the page and waits until it is evicted.
+	// The caller must hold a reference to the page.
+	void _uncache(CachePage *page) {
+		struct Closure {
+			FiberBlocker blocker;
+			Worklet worklet;
+			ReclaimNode node;
+		} closure;
+
+		closure.worklet.setup([] (Worklet *base) {
+			auto closure = frg::container_of(base, &Closure::worklet);
+			KernelFiber::unblockOther(&closure->blocker);
+		});
+
+		closure.blocker.setup();
+		closure.node.setup(&closure.worklet);
+		if(!page->bundle->uncachePage(page, &closure.node))
+			KernelFiber::blockCurrent(&closure.blocker);
+
+		if(page->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			page->bundle->retirePage(page);
+	}
+
+	// Evicts a single cached page if more than threshold bytes are cached.
+	bool _reclaimCached(size_t threshold) {
+		if(disableUncaching)
+			return false;
+
+		// Take a single page out of the LRU list.
+		// TODO: We have to acquire a refcount here.
+		CachePage *page;
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
+
+			if(_lruList.empty() || _cachedSize <= threshold)
+				return false;
+
+			page = _lruList.pop_front();
+
+			// Take another reference while we do the uncaching. (removePage() could be
+			// called concurrently and release the reclaimer's reference).
+			page->refcount.fetch_add(1, std::memory_order_acq_rel);
+
+			page->flags &= ~CachePage::reclaimStateMask;
+			page->flags |= CachePage::reclaimUncaching;
+			_cachedSize -= kPageSize;
+		}
+
+		_uncache(page);
+		return true;
+	}
+
+	// Evicts a single anonymous page to the swap space.
+	bool _evictAnonymous() {
+		if(disableUncaching || disableSwap)
+			return false;
+
+		CachePage *page;
+		frigg::SharedPtr<AllocatedMemory> memory;
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
+
+			// Skip pages of objects that are currently being destructed.
+			// The destructor removes them from the list.
+			for(size_t n = 0; !memory && n < _anonymousSize / kPageSize; n++) {
+				page = _anonymousList.pop_front();
+				memory = static_cast<AllocatedMemory *>(page->bundle)->selfPtr.grab();
+				if(!memory)
+					_anonymousList.push_back(page);
+			}
+			if(!memory)
+				return false;
+
+			page->refcount.fetch_add(1, std::memory_order_acq_rel);
+
+			page->flags &= ~CachePage::reclaimStateMask;
+			page->flags |= CachePage::reclaimUncaching;
+			_anonymousSize -= kPageSize;
+		}
+
+		// The page must be retired before we drop our reference to its owner.
+		_uncache(page);
+		return true;
+	}
+
+	frigg::TicketLock _mutex;
+
+	PageList _lruList;
+	PageList _anonymousList;
 
 	size_t _cachedSize = 0;
+	size_t _anonymousSize = 0;
+
+	// Non-null while the swap fiber waits for memory pressure.
+	FiberBlocker *_swapIdleBlocker = nullptr;
+
+	std::atomic<SwapSpace *> _swapSpace{nullptr};
 };
 
 frigg::LazyInitializer<MemoryReclaimer> globalReclaimer;
 
 void initializeReclaim() {
 	globalReclaimer.initialize();
+	initializeCompressedPool();
+	initializePageMerging();
 	earlyFibers->push(globalReclaimer->createReclaimFiber());
+	earlyFibers->push(globalReclaimer->createSwapFiber());
+	earlyFibers->push(pageMerger->createScanFiber());
+}
+
+bool installSwapSpace(frigg::SharedPtr<ManagedSpace> managed) {
+	auto swap = frigg::construct<SwapSpace>(*kernelAlloc, managed);
+	if(!globalReclaimer->installSwapSpace(swap)) {
+		frigg::destruct(*kernelAlloc, swap);
+		return false;
+	}
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&managed->mutex);
+
+	managed->dropUnobserved = true;
+	return true;
 }
 
 // --------------------------------------------------------
@@ -195,6 +406,18 @@ Error MemoryView::updateRange(ManageRequest type, size_t offset, size_t length)
 	return kErrIllegalObject;
 }
 
+bool MemoryView::isMergeable() {
+	return false;
+}
+
+bool MemoryView::isAnonymous() {
+	return false;
+}
+
+void MemoryView::prefetchRange(uintptr_t, size_t) {
+	// Most memory objects do not have a backing store that could be prefetched.
+}
+
 // --------------------------------------------------------
 // Memory
 // --------------------------------------------------------
@@ -527,7 +750,8 @@ size_t HardwareMemory::getLength() {
 
 AllocatedMemory::AllocatedMemory(size_t desired_length, size_t desired_chunk_size,
 		size_t chunk_align)
-: Memory(MemoryTag::allocated), _physicalChunks(*kernelAlloc), _chunkAlign(chunk_align) {
+: Memory(MemoryTag::allocated), _physicalChunks(*kernelAlloc), _chunkAlign(chunk_align),
+		_anonymousPages{kernelAlloc.get()}, _observers{*kernelAlloc} {
 	static_assert(sizeof(unsigned long) == sizeof(uint64_t), "Fix use of __builtin_clzl");
 	_chunkSize = size_t(1) << (64 - __builtin_clzl(desired_chunk_size - 1));
 	if(_chunkSize != desired_chunk_size)
@@ -553,6 +777,21 @@ AllocatedMemory::~AllocatedMemory() {
 		frigg::infoLogger() << "thor: Releasing AllocatedMemory ("
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frigg::endLog;
 	for(size_t i = 0; i < _physicalChunks.size(); ++i) {
+		if(_swappable) {
+			auto pit = _anonymousPages.find(i);
+			if(pit) {
+				// The reclaimer keeps this object alive while it evicts pages and
+				// fetches keep it alive while pages are swapped in.
+				assert(pit->state != AnonymousState::evicting
+						&& pit->state != AnonymousState::swappingIn);
+				if(pit->state == AnonymousState::present && !pit->lockCount)
+					globalReclaimer->removePage(&pit->cachePage);
+				if(pit->state == AnonymousState::swapped)
+					globalReclaimer->getSwapSpace()->releaseSlot(pit->swapSlot);
+				if(pit->state == AnonymousState::compressed)
+					compressedPool->discard(&pit->compressed);
+			}
+		}
 		if(_physicalChunks[i] != PhysicalAddr(-1))
 			physicalAllocator->free(_physicalChunks[i], _chunkSize);
 	}
@@ -561,6 +800,137 @@ AllocatedMemory::~AllocatedMemory() {
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frigg::endLog;
 }
 
+void AllocatedMemory::enableSwapping() {
+	assert(selfPtr.grab().get() == this);
+	assert(_chunkSize == kPageSize);
+	_swappable = true;
+}
+
+void AllocatedMemory::enableMerging() {
+	_mergeable = true;
+}
+
+void AllocatedMemory::markAnonymous() {
+	_anonymous = true;
+}
+
+bool AllocatedMemory::uncachePage(CachePage *page, ReclaimNode *continuation) {
+	size_t index = page->identity;
+	AnonymousPage *pit;
+	uint64_t slot = noSwapSlot;
+	// Mappings take their own locks in observeEviction() and they call addObserver()
+	// and removeObserver() while holding those locks. Hence, we must not call the
+	// observers with _mutex held; take references to them instead.
+	frigg::Vector<smarter::shared_ptr<MemoryObserver>, KernelAlloc> observers{*kernelAlloc};
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		pit = _anonymousPages.find(index);
+		assert(pit);
+		assert(pit->state == AnonymousState::present);
+		// The page might have been locked after the reclaimer took it out of the LRU list.
+		// lockRange() already removed it from the reclaimer in this case.
+		if(pit->lockCount)
+			return true;
+		globalReclaimer->removePage(&pit->cachePage);
+
+		// Reserve a swap slot in case the page does not compress well.
+		// Without a slot, such pages stay resident.
+		auto swap = globalReclaimer->getSwapSpace();
+		if(swap)
+			swap->reserveSlot(&slot);
+		pit->state = AnonymousState::evicting;
+
+		for(auto &observer : _observers)
+			observers.push(observer);
+	}
+
+	struct Closure {
+		AllocatedMemory *bundle;
+		size_t index;
+		uint64_t slot;
+		AnonymousPage *page;
+		Worklet worklet;
+		EvictNode node;
+		ReclaimNode *continuation;
+	} *closure = frigg::construct<Closure>(*kernelAlloc);
+
+	// Since _mutex is dropped while the observers run, the eviction may be cancelled
+	// (by lockRange() or fetchRange()) in the meantime. This re-checks the state.
+	static constexpr auto finishEviction = [] (AllocatedMemory *bundle,
+			size_t index, uint64_t slot, AnonymousPage *page) {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&bundle->_mutex);
+
+		auto swap = globalReclaimer->getSwapSpace();
+		if(page->state != AnonymousState::evicting) {
+			// The eviction was cancelled; the slot is not needed anymore.
+			if(slot != noSwapSlot)
+				swap->releaseSlot(slot);
+			return;
+		}
+		assert(!page->lockCount);
+
+		auto physical = bundle->_physicalChunks[index];
+		assert(physical != PhysicalAddr(-1));
+
+		// Prefer the compressed pool; it avoids I/O when the page is accessed again.
+		if(compressedPool->store(physical, &page->compressed)) {
+			if(slot != noSwapSlot)
+				swap->releaseSlot(slot);
+			physicalAllocator->free(physical, kPageSize);
+			page->state = AnonymousState::compressed;
+		}else if(slot != noSwapSlot) {
+			page->state = AnonymousState::swapped;
+			page->swapSlot = slot;
+			swap->writeSlot(slot, physical);
+		}else{
+			page->state = AnonymousState::present;
+			globalReclaimer->addPage(&page->cachePage);
+			return;
+		}
+		bundle->_physicalChunks[index] = PhysicalAddr(-1);
+	};
+
+	closure->worklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::worklet);
+		finishEviction(closure->bundle, closure->index, closure->slot, closure->page);
+
+		closure->continuation->complete();
+		frigg::destruct(*kernelAlloc, closure);
+	});
+	closure->bundle = this;
+	closure->index = index;
+	closure->slot = slot;
+	closure->page = pit;
+	closure->continuation = continuation;
+
+	if(observers.empty()) {
+		finishEviction(this, index, slot, pit);
+		frigg::destruct(*kernelAlloc, closure);
+		return true;
+	}
+
+	closure->node.setup(&closure->worklet, observers.size());
+	size_t fast_paths = 0;
+	for(auto &observer : observers)
+		if(observer->observeEviction(index << kPageShift, kPageSize, &closure->node))
+			fast_paths++;
+	if(!fast_paths)
+		return false;
+	if(!closure->node.retirePending(fast_paths))
+		return false;
+
+	finishEviction(this, index, slot, pit);
+	frigg::destruct(*kernelAlloc, closure);
+	return true;
+}
+
+void AllocatedMemory::retirePage(CachePage *page) {
+	// AnonymousPages are owned by the AllocatedMemory; nothing to do here.
+}
+
 void AllocatedMemory::resize(size_t new_length) {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
@@ -572,6 +942,8 @@ void AllocatedMemory::resize(size_t new_length) {
 }
 
 void AllocatedMemory::copyKernelToThisSync(ptrdiff_t offset, void *pointer, size_t size) {
+	globalReclaimer->checkPressure();
+
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
 
@@ -581,6 +953,16 @@ void AllocatedMemory::copyKernelToThisSync(ptrdiff_t offset, void *pointer, size
 
 	size_t index = offset / _chunkSize;
 	assert(index < _physicalChunks.size());
+	if(_swappable) {
+		// Callers only use this to initialize memory that is not mapped yet.
+		auto pit = _getAnonymousPage(index);
+		assert(pit->state == AnonymousState::missing || pit->state == AnonymousState::present);
+		if(pit->state == AnonymousState::missing) {
+			pit->state = AnonymousState::present;
+			if(!pit->lockCount)
+				globalReclaimer->addPage(&pit->cachePage);
+		}
+	}
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
 		auto physical = physicalAllocator->allocate(_chunkSize);
 		assert(physical != PhysicalAddr(-1));
@@ -599,20 +981,80 @@ void AllocatedMemory::copyKernelToThisSync(ptrdiff_t offset, void *pointer, size
 }
 
 void AllocatedMemory::addObserver(smarter::shared_ptr<MemoryObserver> observer) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+	// Only swappable memory is ever evicted.
+	if(!_swappable)
+		return;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	_observers.push(std::move(observer));
 }
 
 void AllocatedMemory::removeObserver(smarter::borrowed_ptr<MemoryObserver> observer) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+	if(!_swappable)
+		return;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	for(size_t i = 0; i < _observers.size(); i++) {
+		if(_observers[i].get() != observer.get())
+			continue;
+		// Order does not matter; move the last observer into the free slot.
+		if(i + 1 < _observers.size())
+			_observers[i] = std::move(_observers.back());
+		_observers.pop();
+		return;
+	}
+	assert(!"removeObserver(): observer is not registered");
 }
 
 Error AllocatedMemory::lockRange(uintptr_t offset, size_t size) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+	if(!_swappable)
+		return kErrSuccess;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	auto end = (offset + size + kPageSize - 1) >> kPageShift;
+	if(end > _physicalChunks.size())
+		return kErrBufferTooSmall;
+
+	for(size_t index = offset >> kPageShift; index < end; index++) {
+		auto pit = _getAnonymousPage(index);
+		pit->lockCount++;
+		if(pit->lockCount == 1) {
+			if(pit->state == AnonymousState::present) {
+				globalReclaimer->removePage(&pit->cachePage);
+			}else if(pit->state == AnonymousState::evicting) {
+				// Stop the eviction to keep the page present.
+				pit->state = AnonymousState::present;
+			}
+		}
+		assert(pit->state != AnonymousState::evicting);
+	}
 	return kErrSuccess;
 }
 
 void AllocatedMemory::unlockRange(uintptr_t offset, size_t size) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+	if(!_swappable)
+		return;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	auto end = (offset + size + kPageSize - 1) >> kPageShift;
+	assert(end <= _physicalChunks.size());
+
+	for(size_t index = offset >> kPageShift; index < end; index++) {
+		auto pit = _anonymousPages.find(index);
+		assert(pit);
+		assert(pit->lockCount > 0);
+		pit->lockCount--;
+		if(!pit->lockCount && pit->state == AnonymousState::present)
+			globalReclaimer->addPage(&pit->cachePage);
+	}
 }
 
 frigg::Tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offset) {
@@ -625,6 +1067,13 @@ frigg::Tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t off
 	auto disp = offset & (_chunkSize - 1);
 	assert(index < _physicalChunks.size());
 
+	// Pages that are being evicted must not be mapped again.
+	if(_swappable) {
+		auto pit = _anonymousPages.find(index);
+		if(!pit || pit->state != AnonymousState::present)
+			return frigg::Tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+	}
+
 	if(_physicalChunks[index] == PhysicalAddr(-1))
 		return frigg::Tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
 	return frigg::Tuple<PhysicalAddr, CachingMode>{_physicalChunks[index] + disp,
@@ -632,6 +1081,8 @@ frigg::Tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t off
 }
 
 bool AllocatedMemory::fetchRange(uintptr_t offset, FetchNode *node) {
+	globalReclaimer->checkPressure();
+
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
 
@@ -639,6 +1090,109 @@ bool AllocatedMemory::fetchRange(uintptr_t offset, FetchNode *node) {
 	auto disp = offset & (_chunkSize - 1);
 	assert(index < _physicalChunks.size());
 
+	if(_swappable) {
+		auto pit = _getAnonymousPage(index);
+		if(pit->state == AnonymousState::present) {
+			if(!pit->lockCount)
+				globalReclaimer->bumpPage(&pit->cachePage);
+		}else if(pit->state == AnonymousState::evicting) {
+			// Cancel eviction -- the page is still needed.
+			pit->state = AnonymousState::present;
+			globalReclaimer->addPage(&pit->cachePage);
+		}else if(pit->state == AnonymousState::compressed) {
+			auto physical = physicalAllocator->allocate(kPageSize);
+			assert(physical != PhysicalAddr(-1));
+			compressedPool->load(&pit->compressed, physical);
+			_physicalChunks[index] = physical;
+			pit->state = AnonymousState::present;
+			if(!pit->lockCount)
+				globalReclaimer->addPage(&pit->cachePage);
+		}else if(pit->state == AnonymousState::swapped
+				|| pit->state == AnonymousState::swappingIn) {
+			if(node->flags() & FetchNode::disallowBacking) {
+				frigg::infoLogger() << "\e[31m" "thor: Backing of page is disallowed" "\e[39m"
+						<< frigg::endLog;
+				completeFetch(node, kErrFault);
+				return true;
+			}
+
+			// Allocating here is fine: kernelAlloc does not block and this path
+			// waits for swap I/O anyway (ManagedSpace handles fetches the same way).
+			struct Closure {
+				AllocatedMemory *bundle;
+				size_t index;
+				Worklet worklet;
+				SwapReadNode read;
+			};
+
+			struct Ops {
+				static void swappedIn(Worklet *worklet) {
+					auto closure = frg::container_of(worklet, &Closure::worklet);
+					auto bundle = closure->bundle;
+					auto physical = closure->read.physical();
+
+					auto irq_lock = frigg::guard(&irqMutex());
+					auto lock = frigg::guard(&bundle->_mutex);
+
+					auto pit = bundle->_anonymousPages.find(closure->index);
+					assert(pit);
+					assert(pit->state == AnonymousState::swappingIn);
+					bundle->_physicalChunks[closure->index] = physical;
+					pit->state = AnonymousState::present;
+					if(!pit->lockCount)
+						globalReclaimer->addPage(&pit->cachePage);
+
+					decltype(pit->waiters) waiters;
+					waiters.splice(waiters.end(), pit->waiters);
+
+					lock.unlock();
+					irq_lock.unlock();
+
+					while(!waiters.empty()) {
+						auto waiter = waiters.pop_front();
+						auto misalign = waiter->offset & (kPageSize - 1);
+						completeFetch(waiter->fetch, kErrSuccess,
+								physical + misalign, kPageSize - misalign, CachingMode::null);
+						callbackFetch(waiter->fetch);
+						frigg::destruct(*kernelAlloc, waiter);
+					}
+					frigg::destruct(*kernelAlloc, closure);
+				}
+			};
+
+			if(pit->state == AnonymousState::swapped) {
+				auto closure = frigg::construct<Closure>(*kernelAlloc);
+				closure->bundle = this;
+				closure->index = index;
+				closure->worklet.setup(&Ops::swappedIn);
+				closure->read.setup(&closure->worklet);
+
+				if(globalReclaimer->getSwapSpace()->readSlot(pit->swapSlot, &closure->read)) {
+					_physicalChunks[index] = closure->read.physical();
+					pit->state = AnonymousState::present;
+					if(!pit->lockCount)
+						globalReclaimer->addPage(&pit->cachePage);
+					frigg::destruct(*kernelAlloc, closure);
+				}else{
+					pit->state = AnonymousState::swappingIn;
+				}
+			}
+
+			if(pit->state == AnonymousState::swappingIn) {
+				auto waiter = frigg::construct<SwapInWaiter>(*kernelAlloc);
+				waiter->fetch = node;
+				waiter->offset = offset;
+				pit->waiters.push_back(waiter);
+				return false;
+			}
+		}else{
+			assert(pit->state == AnonymousState::missing);
+			pit->state = AnonymousState::present;
+			if(!pit->lockCount)
+				globalReclaimer->addPage(&pit->cachePage);
+		}
+	}
+
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
 		auto physical = physicalAllocator->allocate(_chunkSize);
 		assert(physical != PhysicalAddr(-1));
@@ -661,6 +1215,14 @@ void AllocatedMemory::markDirty(uintptr_t offset, size_t size) {
 	// Do nothing for now.
 }
 
+bool AllocatedMemory::isMergeable() {
+	return _mergeable;
+}
+
+bool AllocatedMemory::isAnonymous() {
+	return _anonymous;
+}
+
 size_t AllocatedMemory::getLength() {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
@@ -668,6 +1230,13 @@ size_t AllocatedMemory::getLength() {
 	return _physicalChunks.size() * _chunkSize;
 }
 
+AllocatedMemory::AnonymousPage *AllocatedMemory::_getAnonymousPage(size_t index) {
+	auto pit = _anonymousPages.find(index);
+	if(!pit)
+		pit = _anonymousPages.insert(index, this, index);
+	return pit;
+}
+
 // --------------------------------------------------------
 // ManagedSpace
 // --------------------------------------------------------
@@ -689,12 +1258,26 @@ bool ManagedSpace::uncachePage(CachePage *page, ReclaimNode *continuation) {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&mutex);
 
-	if(!numObservers)
-		return true;
-
 	size_t index = page->identity;
 	auto pit = pages.find(index);
 	assert(pit);
+
+	if(!numObservers) {
+		if(!dropUnobserved)
+			return true;
+
+		// Nobody can access the page; we can free it immediately.
+		assert(pit->loadState == kStatePresent);
+		if(pit->lockCount)
+			return true;
+		globalReclaimer->removePage(&pit->cachePage);
+		assert(pit->physical != PhysicalAddr(-1));
+		physicalAllocator->free(pit->physical, kPageSize);
+		pit->loadState = kStateMissing;
+		pit->physical = PhysicalAddr(-1);
+		return true;
+	}
+
 	assert(pit->loadState == kStatePresent);
 	pit->loadState = kStateEvicting;
 	globalReclaimer->removePage(&pit->cachePage);
@@ -926,6 +1509,201 @@ void ManagedSpace::_progressMonitors() {
 	}
 }
 
+// --------------------------------------------------------
+// SwapSpace
+// --------------------------------------------------------
+
+SwapSpace::SwapSpace(frigg::SharedPtr<ManagedSpace> managed)
+: _managed{frigg::move(managed)}, _usedSlots{*kernelAlloc} {
+	_numSlots = _managed->numPages;
+	_numFree = _numSlots;
+	_usedSlots.resize((_numSlots + 63) / 64, 0);
+}
+
+bool SwapSpace::reserveSlot(uint64_t *slot) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_managed->mutex);
+
+	if(!_numFree)
+		return false;
+
+	// Next-fit allocation keeps consecutively evicted pages in adjacent slots.
+	for(size_t n = 0; n < _numSlots; n++) {
+		auto candidate = (_cursor + n) % _numSlots;
+		if(_usedSlots[candidate / 64] & (uint64_t(1) << (candidate % 64)))
+			continue;
+
+		auto pit = _managed->pages.find(candidate);
+		assert(pit);
+		if(pit->loadState == ManagedSpace::kStatePresent && !pit->lockCount) {
+			// Discard stale contents of a released slot.
+			globalReclaimer->removePage(&pit->cachePage);
+			physicalAllocator->free(pit->physical, kPageSize);
+			pit->loadState = ManagedSpace::kStateMissing;
+			pit->physical = PhysicalAddr(-1);
+		}
+		// Wait until pending I/O on released slots completes.
+		if(pit->loadState != ManagedSpace::kStateMissing)
+			continue;
+
+		_usedSlots[candidate / 64] |= uint64_t(1) << (candidate % 64);
+		_numFree--;
+		_cursor = candidate + 1;
+		*slot = candidate;
+		return true;
+	}
+	return false;
+}
+
+void SwapSpace::releaseSlot(uint64_t slot) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_managed->mutex);
+
+	auto pit = _managed->pages.find(slot);
+	assert(pit);
+	if(pit->loadState == ManagedSpace::kStateWantWriteback) {
+		// The contents were never written; drop them.
+		auto it = _managed->_writebackList.iterator_to(&pit->cachePage);
+		_managed->_writebackList.erase(it);
+		physicalAllocator->free(pit->physical, kPageSize);
+		pit->loadState = ManagedSpace::kStateMissing;
+		pit->physical = PhysicalAddr(-1);
+	}else if(pit->loadState == ManagedSpace::kStatePresent && !pit->lockCount) {
+		globalReclaimer->removePage(&pit->cachePage);
+		physicalAllocator->free(pit->physical, kPageSize);
+		pit->loadState = ManagedSpace::kStateMissing;
+		pit->physical = PhysicalAddr(-1);
+	}
+	// Otherwise, reserveSlot() discards the contents once I/O is done.
+	_clearSlot(slot);
+}
+
+void SwapSpace::writeSlot(uint64_t slot, PhysicalAddr physical) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_managed->mutex);
+
+	assert(_usedSlots[slot / 64] & (uint64_t(1) << (slot % 64)));
+	auto pit = _managed->pages.find(slot);
+	assert(pit);
+	assert(pit->loadState == ManagedSpace::kStateMissing);
+	pit->physical = physical;
+	pit->loadState = ManagedSpace::kStateWantWriteback;
+	_managed->_writebackList.push_back(&pit->cachePage);
+}
+
+void SwapSpace::flush() {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_managed->mutex);
+
+	_managed->_progressManagement();
+}
+
+bool SwapSpace::readSlot(uint64_t slot, SwapReadNode *node) {
+	node->_space = this;
+	node->_slot = slot;
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_managed->mutex);
+
+	if(_tryRead(slot, &node->_physical))
+		return true;
+	_requestRead(node);
+	return false;
+}
+
+// Must be called with the mutex of the ManagedSpace held.
+void SwapSpace::_requestRead(SwapReadNode *node) {
+	struct Ops {
+		static void initiated(Worklet *worklet) {
+			auto node = frg::container_of(worklet, &SwapReadNode::_initiated);
+			auto self = node->_space;
+			assert(node->_initiate.error() == kErrSuccess);
+
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&self->_managed->mutex);
+
+			// The page can be reclaimed again before we get here. Retry in this case.
+			if(!self->_tryRead(node->_slot, &node->_physical)) {
+				self->_requestRead(node);
+				return;
+			}
+
+			lock.unlock();
+			irq_lock.unlock();
+
+			WorkQueue::post(node->_worklet);
+		}
+	};
+
+	auto pit = _managed->pages.find(node->_slot);
+	assert(pit);
+	if(pit->loadState == ManagedSpace::kStateMissing) {
+		pit->loadState = ManagedSpace::kStateWantInitialization;
+		_managed->_initializationList.push_back(&pit->cachePage);
+	}
+	_managed->_progressManagement();
+
+	node->_initiated.setup(&Ops::initiated);
+	node->_initiate.setup(ManageRequest::initialize,
+			node->_slot << kPageShift, kPageSize, &node->_initiated);
+	node->_initiate.progress = 0;
+	_managed->_monitorQueue.push_back(&node->_initiate);
+	_managed->_progressMonitors();
+}
+
+// Must be called with the mutex of the ManagedSpace held.
+bool SwapSpace::_tryRead(uint64_t slot, PhysicalAddr *physical) {
+	auto pit = _managed->pages.find(slot);
+	assert(pit);
+
+	auto copyPage = [&] {
+		*physical = physicalAllocator->allocate(kPageSize);
+		assert(*physical != PhysicalAddr(-1));
+		PageAccessor dest_accessor{*physical};
+		PageAccessor src_accessor{pit->physical};
+		memcpy(dest_accessor.get(), src_accessor.get(), kPageSize);
+	};
+
+	if((pit->loadState == ManagedSpace::kStatePresent && !pit->lockCount)
+			|| pit->loadState == ManagedSpace::kStateWantWriteback) {
+		// Steal the page from the swap space.
+		if(pit->loadState == ManagedSpace::kStatePresent) {
+			globalReclaimer->removePage(&pit->cachePage);
+		}else{
+			auto it = _managed->_writebackList.iterator_to(&pit->cachePage);
+			_managed->_writebackList.erase(it);
+		}
+		*physical = pit->physical;
+		pit->loadState = ManagedSpace::kStateMissing;
+		pit->physical = PhysicalAddr(-1);
+	}else if(pit->loadState == ManagedSpace::kStatePresent
+			|| pit->loadState == ManagedSpace::kStateWriteback
+			|| pit->loadState == ManagedSpace::kStateAnotherWriteback) {
+		// The server is accessing the page; leave it alone.
+		copyPage();
+	}else if(pit->loadState == ManagedSpace::kStateEvicting) {
+		// Cancel the eviction; observers might still access the page.
+		pit->loadState = ManagedSpace::kStatePresent;
+		globalReclaimer->addPage(&pit->cachePage);
+		copyPage();
+	}else{
+		assert(pit->loadState == ManagedSpace::kStateMissing
+				|| pit->loadState == ManagedSpace::kStateWantInitialization
+				|| pit->loadState == ManagedSpace::kStateInitialization);
+		return false;
+	}
+
+	_clearSlot(slot);
+	return true;
+}
+
+// Must be called with the mutex of the ManagedSpace held.
+void SwapSpace::_clearSlot(uint64_t slot) {
+	assert(_usedSlots[slot / 64] & (uint64_t(1) << (slot % 64)));
+	_usedSlots[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+	_numFree++;
+}
+
 // --------------------------------------------------------
 // BackingMemory
 // --------------------------------------------------------
@@ -1252,6 +2030,24 @@ void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 	_managed->_progressManagement();
 }
 
+void FrontalMemory::prefetchRange(uintptr_t offset, size_t size) {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_managed->mutex);
+
+	// Missing pages are queued for initialization; _progressManagement() fuses
+	// adjacent pages into a single request.
+	auto end = frigg::min((offset + size + kPageSize - 1) >> kPageShift, _managed->numPages);
+	for(size_t index = offset >> kPageShift; index < end; index++) {
+		auto pit = _managed->pages.find(index);
+		assert(pit);
+		if(pit->loadState == ManagedSpace::kStateMissing) {
+			pit->loadState = ManagedSpace::kStateWantInitialization;
+			_managed->_initializationList.push_back(&pit->cachePage);
+		}
+	}
+	_managed->_progressManagement();
+}
+
 size_t FrontalMemory::getLength() {
 	// Size is constant so we do not need to lock.
 	return _managed->numPages << kPageShift;
@@ -1395,6 +2191,24 @@ bool Mapping::populateVirtualRange(PopulateVirtualNode *continuation) {
 	return true;
 }
 
+void Mapping::readahead(MemoryView *view, uintptr_t view_offset, uintptr_t offset) {
+	size_t num_pages;
+	switch(accessPattern()) {
+	case AccessPattern::random:
+		// Only the faulting page is fetched.
+		return;
+	case AccessPattern::sequential:
+		num_pages = sequentialReadahead;
+		break;
+	default:
+		num_pages = defaultReadahead;
+	}
+
+	offset &= ~(kPageSize - 1);
+	auto size = frigg::min(num_pages << kPageShift, length() - offset);
+	view->prefetchRange(view_offset + offset, size);
+}
+
 uint32_t Mapping::compilePageFlags() {
 	uint32_t page_flags = 0;
 	// TODO: Allow inaccessible mappings.
@@ -1466,6 +2280,10 @@ bool NormalMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 					& ~(kPageSize - 1), kPageSize); e)
 				assert(!"lockRange() failed");
 
+			if(!(fetch_flags & FetchNode::disallowBacking))
+				self->readahead(self->_view.get(), self->_viewOffset,
+						closure->continuation->_offset);
+
 			closure->fetch.setup(&closure->worklet, fetch_flags);
 			closure->worklet.setup([] (Worklet *base) {
 				auto closure = frg::container_of(base, &Closure::worklet);
@@ -1499,6 +2317,13 @@ bool NormalMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 			auto self = closure->self;
 			auto page_offset = self->address() + closure->continuation->_offset;
 
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&self->_mutex);
+
+			// The mapping might have been unmapped while we fetched the page.
+			if(self->_state != MappingState::active)
+				return;
+
 			// TODO: Update RSS, handle dirty pages, etc.
 			self->owner()->_pageSpace.unmapSingle4k(page_offset & ~(kPageSize - 1));
 			self->owner()->_pageSpace.mapSingle4k(page_offset & ~(kPageSize - 1),
@@ -1519,6 +2344,58 @@ bool NormalMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 	return true;
 }
 
+void NormalMapping::prefetchVirtualRange(uintptr_t offset, size_t size) {
+	if(flags() & MappingFlags::dontRequireBacking)
+		return;
+	_view->prefetchRange(_viewOffset + offset, size);
+}
+
+bool NormalMapping::discardVirtualRange(DiscardVirtualNode *continuation) {
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(_state != MappingState::active)
+			return true;
+
+		// The pages stay in the view; we only drop them from the page tables.
+		for(size_t pg = 0; pg < continuation->_size; pg += kPageSize) {
+			auto status = owner()->_pageSpace.unmapSingle4k(
+					address() + continuation->_offset + pg);
+			if(!(status & page_status::present))
+				continue;
+			if(status & page_status::dirty)
+				_view->markDirty(_viewOffset + continuation->_offset + pg, kPageSize);
+			owner()->_residuentSize -= kPageSize;
+		}
+	}
+
+	// Perform shootdown.
+	struct Closure {
+		smarter::shared_ptr<Mapping> mapping; // Need to keep the Mapping alive.
+		Worklet worklet;
+		ShootNode node;
+		DiscardVirtualNode *continuation;
+	} *closure = frigg::construct<Closure>(*kernelAlloc);
+
+	closure->worklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::worklet);
+		WorkQueue::post(closure->continuation->_discarded);
+		frigg::destruct(*kernelAlloc, closure);
+	});
+	closure->mapping = selfPtr.lock();
+	closure->continuation = continuation;
+
+	closure->node.address = address() + continuation->_offset;
+	closure->node.size = continuation->_size;
+	closure->node.setup(&closure->worklet);
+	if(!owner()->_pageSpace.submitShootdown(&closure->node))
+		return false;
+
+	frigg::destruct(*kernelAlloc, closure);
+	return true;
+}
+
 smarter::shared_ptr<Mapping> NormalMapping::forkMapping() {
 	auto mapping = smarter::allocate_shared<NormalMapping>(Allocator{},
 			length(), flags(), _slice, _viewOffset);
@@ -1560,6 +2437,8 @@ void NormalMapping::install() {
 }
 
 void NormalMapping::uninstall() {
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
 	assert(_state == MappingState::active);
 	_state = MappingState::zombie;
 
@@ -1581,7 +2460,10 @@ void NormalMapping::retire() {
 
 bool NormalMapping::observeEviction(uintptr_t evict_offset, size_t evict_length,
 		EvictNode *continuation) {
-	assert(_state == MappingState::active);
+	// Observers can be called after they are retired (e.g., AllocatedMemory calls them
+	// without holding its lock). Retired mappings do not map any pages anymore.
+	if(_state != MappingState::active)
+		return true;
 
 	if(evict_offset + evict_length <= _viewOffset
 			|| evict_offset >= _viewOffset + length())
@@ -1598,7 +2480,8 @@ bool NormalMapping::observeEviction(uintptr_t evict_offset, size_t evict_length,
 	assert(!(shoot_offset & (kPageSize - 1)));
 	assert(!(shoot_size & (kPageSize - 1)));
 
-	// TODO: Perform proper locking here!
+	// TODO: Perform proper locking here! We cannot take _mutex yet: ManagedSpace calls
+	//       observers with its lock held while markDirty() takes that lock under _mutex.
 
 	// Unmap the memory range.
 	for(size_t pg = 0; pg < shoot_size; pg += kPageSize) {
@@ -1673,9 +2556,15 @@ CowMapping::~CowMapping() {
 		frigg::infoLogger() << "\e[31mthor: CowMapping is destructed\e[39m" << frigg::endLog;
 
 	for(auto it = _ownedPages.begin(); it != _ownedPages.end(); ++it) {
-		assert(it->state == CowState::hasCopy);
+		if(it->state == CowState::discarded)
+			continue;
 		assert(it->physical != PhysicalAddr(-1));
-		physicalAllocator->free(it->physical, kPageSize);
+		if(it->state == CowState::merged) {
+			pageMerger->releaseReference(it->merged);
+		}else{
+			assert(it->state == CowState::hasCopy);
+			physicalAllocator->free(it->physical, kPageSize);
+		}
 	}
 }
 
@@ -1687,6 +2576,8 @@ bool CowMapping::lockVirtualRange(LockVirtualNode *continuation) {
 		CowMapping *self;
 		size_t progress = 0;
 		PhysicalAddr physical;
+		MergedPage *merged = nullptr;
+		bool zeroFill = false;
 		PageAccessor accessor;
 		CopyFromBundleNode copy;
 		ShootNode shoot;
@@ -1716,28 +2607,70 @@ bool CowMapping::lockVirtualRange(LockVirtualNode *continuation) {
 				assert(self->_state == MappingState::active);
 
 				if(auto it = self->_ownedPages.find(offset >> kPageShift);
-						it) {
+						it && it->state == CowState::merged) {
+					// Locked pages are always private copies. Break sharing of merged pages.
+					if(pageMerger->breakSharing(it->merged)) {
+						self->_takeOverMergedPage(offset, it);
+						it->lockCount++;
+						closure->progress += kPageSize;
+						return true;
+					}
+
+					closure->merged = it->merged;
+					it->state = CowState::inProgress;
+					it->merged = nullptr;
+				}else if(it && it->state == CowState::discarded) {
+					// Do not refill the page from the chain; its contents predate the discard.
+					if(self->_slice->getView()->isAnonymous()) {
+						closure->zeroFill = true;
+					}else{
+						view = self->_slice->getView();
+						view_offset = self->_viewOffset;
+					}
+					it->state = CowState::inProgress;
+				}else if(it) {
 					assert(it->state == CowState::hasCopy);
 					assert(it->physical != PhysicalAddr(-1));
 
 					it->lockCount++;
 					closure->progress += kPageSize;
 					return true;
-				}
-
-				chain = self->_copyChain;
-				view = self->_slice->getView();
-				view_offset = self->_viewOffset;
+				}else{
+					chain = self->_copyChain;
+					view = self->_slice->getView();
+					view_offset = self->_viewOffset;
 
-				// Otherwise we need to copy from the chain or from the root view.
-				auto it = self->_ownedPages.insert(offset >> kPageShift);
-				it->state = CowState::inProgress;
+					// Otherwise we need to copy from the chain or from the root view.
+					auto cow_it = self->_ownedPages.insert(offset >> kPageShift);
+					cow_it->state = CowState::inProgress;
+				}
 			}
 
 			closure->physical = physicalAllocator->allocate(kPageSize);
 			assert(closure->physical != PhysicalAddr(-1));
 			closure->accessor = PageAccessor{closure->physical};
 
+			// Discarded pages of anonymous memory read as zeros.
+			if(closure->zeroFill) {
+				memset(closure->accessor.get(), 0, kPageSize);
+
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&self->_mutex);
+
+				return mapPage(closure);
+			}
+
+			// Merged pages are never evicted; copy them synchronously.
+			if(closure->merged) {
+				PageAccessor merged_accessor{closure->merged->physical};
+				memcpy(closure->accessor.get(), merged_accessor.get(), kPageSize);
+
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&self->_mutex);
+
+				return mapPage(closure);
+			}
+
 			// Try to copy from a descendant CoW chain.
 			auto page_offset = view_offset + offset;
 			while(chain) {
@@ -1816,6 +2749,12 @@ bool CowMapping::lockVirtualRange(LockVirtualNode *continuation) {
 			cow_it->physical = closure->physical;
 			cow_it->lockCount++;
 			closure->progress += kPageSize;
+
+			// Shootdown is complete; no TLB refers to the merged page anymore.
+			if(closure->merged) {
+				pageMerger->releaseReference(closure->merged);
+				closure->merged = nullptr;
+			}
 		}
 
 		static bool mapPage(Closure *closure) {
@@ -1834,8 +2773,11 @@ bool CowMapping::lockVirtualRange(LockVirtualNode *continuation) {
 			self->owner()->_pageSpace.mapSingle4k(address & ~(kPageSize - 1),
 					closure->physical,
 					true, self->compilePageFlags() & ~page_access::write, CachingMode::null);
-			self->owner()->_residuentSize += kPageSize;
-			logRss(self->owner());
+			// Merged pages are already accounted for.
+			if(!closure->merged) {
+				self->owner()->_residuentSize += kPageSize;
+				logRss(self->owner());
+			}
 
 			closure->worklet.setup([] (Worklet *base) {
 				auto closure = frg::container_of(base, &Closure::worklet);
@@ -1894,6 +2836,9 @@ CowMapping::resolveRange(ptrdiff_t offset) {
 	assert(_state == MappingState::active);
 
 	if(auto it = _ownedPages.find(offset >> kPageShift); it) {
+		// Discarded pages are not mapped.
+		if(it->state == CowState::discarded)
+			return frigg::Tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
 		assert(it->state == CowState::hasCopy);
 		return frigg::Tuple<PhysicalAddr, CachingMode>{it->physical, CachingMode::null};
 	}
@@ -1905,6 +2850,8 @@ bool CowMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 	struct Closure {
 		CowMapping *self;
 		PhysicalAddr physical;
+		MergedPage *merged = nullptr;
+		bool zeroFill = false;
 		PageAccessor accessor;
 		CopyFromBundleNode copy;
 		ShootNode shoot;
@@ -1927,7 +2874,28 @@ bool CowMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 				assert(self->_state == MappingState::active);
 
 				if(auto it = self->_ownedPages.find(closure->continuation->_offset >> kPageShift);
-						it) {
+						it && it->state == CowState::merged) {
+					// Break sharing. If we are the only user, we can take over the page.
+					if(pageMerger->breakSharing(it->merged)) {
+						self->_takeOverMergedPage(closure->continuation->_offset, it);
+						closure->continuation->setResult(kErrSuccess, it->physical + misalign,
+								kPageSize - misalign, CachingMode::null);
+						return true;
+					}
+
+					closure->merged = it->merged;
+					it->state = CowState::inProgress;
+					it->merged = nullptr;
+				}else if(it && it->state == CowState::discarded) {
+					// Do not refill the page from the chain; its contents predate the discard.
+					if(self->_slice->getView()->isAnonymous()) {
+						closure->zeroFill = true;
+					}else{
+						view = self->_slice->getView();
+						view_offset = self->_viewOffset;
+					}
+					it->state = CowState::inProgress;
+				}else if(it) {
 					assert(it->state == CowState::hasCopy);
 					if(thoroughSpuriousAssertions) {
 						ClientPageSpace::Walk walk{&self->owner()->_pageSpace};
@@ -1939,21 +2907,43 @@ bool CowMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 					closure->continuation->setResult(kErrSuccess, it->physical + misalign,
 							kPageSize - misalign, CachingMode::null, true);
 					return true;
+				}else{
+					chain = self->_copyChain;
+					view = self->_slice->getView();
+					view_offset = self->_viewOffset;
+
+					// Otherwise we need to copy from the chain or from the root view.
+					auto cow_it = self->_ownedPages.insert(
+							closure->continuation->_offset >> kPageShift);
+					cow_it->state = CowState::inProgress;
 				}
-
-				chain = self->_copyChain;
-				view = self->_slice->getView();
-				view_offset = self->_viewOffset;
-
-				// Otherwise we need to copy from the chain or from the root view.
-				auto it = self->_ownedPages.insert(closure->continuation->_offset >> kPageShift);
-				it->state = CowState::inProgress;
 			}
 
 			closure->physical = physicalAllocator->allocate(kPageSize);
 			assert(closure->physical != PhysicalAddr(-1));
 			closure->accessor = PageAccessor{closure->physical};
 
+			// Discarded pages of anonymous memory read as zeros.
+			if(closure->zeroFill) {
+				memset(closure->accessor.get(), 0, kPageSize);
+
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&self->_mutex);
+
+				return mapPage(closure);
+			}
+
+			// Merged pages are never evicted; copy them synchronously.
+			if(closure->merged) {
+				PageAccessor merged_accessor{closure->merged->physical};
+				memcpy(closure->accessor.get(), merged_accessor.get(), kPageSize);
+
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&self->_mutex);
+
+				return mapPage(closure);
+			}
+
 			// Try to copy from a descendant CoW chain.
 			auto page_offset = view_offset + closure->continuation->_offset;
 			while(chain) {
@@ -2000,6 +2990,7 @@ bool CowMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 				auto closure = frg::container_of(base, &Closure::copy);
 				WorkQueue::post(&closure->worklet);
 			};
+			self->readahead(view.get(), view_offset, closure->continuation->_offset);
 			if(!copyFromBundle(view.get(), page_offset & ~(kPageSize - 1),
 					closure->accessor.get(), kPageSize,
 					&closure->copy, complete))
@@ -2030,6 +3021,10 @@ bool CowMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 			assert(cow_it->state == CowState::inProgress);
 			cow_it->state = CowState::hasCopy;
 			cow_it->physical = closure->physical;
+
+			// Shootdown is complete; no TLB refers to the merged page anymore.
+			if(closure->merged)
+				pageMerger->releaseReference(closure->merged);
 		}
 
 		static bool mapPage(Closure *closure) {
@@ -2047,8 +3042,11 @@ bool CowMapping::touchVirtualPage(TouchVirtualNode *continuation) {
 			self->owner()->_pageSpace.mapSingle4k(address & ~(kPageSize - 1),
 					closure->physical,
 					true, self->compilePageFlags() & ~page_access::write, CachingMode::null);
-			self->owner()->_residuentSize += kPageSize;
-			logRss(self->owner());
+			// Merged pages are already accounted for.
+			if(!closure->merged) {
+				self->owner()->_residuentSize += kPageSize;
+				logRss(self->owner());
+			}
 
 			closure->worklet.setup([] (Worklet *base) {
 				auto closure = frg::container_of(base, &Closure::worklet);
@@ -2112,6 +3110,24 @@ smarter::shared_ptr<Mapping> CowMapping::forkMapping() {
 
 		if(!os_it)
 			continue;
+
+		// Merged pages are read-only anyway; both mappings keep a reference.
+		if(os_it->state == CowState::merged) {
+			pageMerger->addReference(os_it->merged);
+
+			auto fs_it = forked->_ownedPages.insert(pg >> kPageShift);
+			fs_it->state = CowState::merged;
+			fs_it->physical = os_it->physical;
+			fs_it->merged = os_it->merged;
+			continue;
+		}
+
+		// Discarded pages bypass the chain in both mappings.
+		if(os_it->state == CowState::discarded) {
+			auto fs_it = forked->_ownedPages.insert(pg >> kPageShift);
+			fs_it->state = CowState::discarded;
+			continue;
+		}
 		assert(os_it->state == CowState::hasCopy);
 
 		// The page is locked. We *need* to keep it in the old address space.
@@ -2153,6 +3169,115 @@ smarter::shared_ptr<Mapping> CowMapping::forkMapping() {
 	return forked;
 }
 
+void CowMapping::prefetchVirtualRange(uintptr_t offset, size_t size) {
+	_slice->getView()->prefetchRange(_viewOffset + offset, size);
+}
+
+bool CowMapping::discardVirtualRange(DiscardVirtualNode *continuation) {
+	// The range is processed in batches to bound the time that IRQs are disabled.
+	constexpr size_t batchSize = 512 * kPageSize;
+
+	struct Closure {
+		smarter::shared_ptr<Mapping> mapping; // Need to keep the Mapping alive.
+		frigg::Vector<PhysicalAddr, KernelAlloc> copies{*kernelAlloc};
+		frigg::Vector<MergedPage *, KernelAlloc> merged{*kernelAlloc};
+		Worklet worklet;
+		ShootNode node;
+		DiscardVirtualNode *continuation;
+	} *closure = frigg::construct<Closure>(*kernelAlloc);
+
+	// Dropped pages can only be freed once no TLB refers to them anymore.
+	static constexpr auto freePages = [] (Closure *closure) {
+		for(size_t i = 0; i < closure->copies.size(); i++)
+			physicalAllocator->free(closure->copies[i], kPageSize);
+		for(size_t i = 0; i < closure->merged.size(); i++)
+			pageMerger->releaseReference(closure->merged[i]);
+		frigg::destruct(*kernelAlloc, closure);
+	};
+
+	for(size_t batch = 0; batch < continuation->_size; batch += batchSize) {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(_state != MappingState::active) {
+			if(!batch) {
+				frigg::destruct(*kernelAlloc, closure);
+				return true;
+			}
+			// uninstall() already unmapped the remaining pages.
+			break;
+		}
+		if(!batch)
+			closure->mapping = selfPtr.lock();
+
+		auto limit = frigg::min(continuation->_size, batch + batchSize);
+		for(size_t pg = batch; pg < limit; pg += kPageSize) {
+			auto offset = continuation->_offset + pg;
+			CowPage *page = _ownedPages.find(offset >> kPageShift);
+
+			// Locked pages and pages that are currently copied are kept.
+			if(page && (page->lockCount || page->state == CowState::inProgress))
+				continue;
+
+			auto status = owner()->_pageSpace.unmapSingle4k(address() + offset);
+			if(status & page_status::present)
+				owner()->_residuentSize -= kPageSize;
+
+			if(page) {
+				if(page->state == CowState::merged) {
+					closure->merged.push(page->merged);
+				}else if(page->state == CowState::hasCopy) {
+					closure->copies.push(page->physical);
+				}
+			}else if(!(status & page_status::present)) {
+				// Untouched pages do not need any state.
+				continue;
+			}
+
+			// Refilling the page from the CoW chain would bring back contents that
+			// predate the private copy. Only in that case, we need to remember the discard.
+			if(_chainHasPage(offset)) {
+				if(!page)
+					page = _ownedPages.insert(offset >> kPageShift);
+				page->state = CowState::discarded;
+				page->physical = PhysicalAddr(-1);
+				page->merged = nullptr;
+			}else if(page) {
+				_ownedPages.erase(offset >> kPageShift);
+			}
+		}
+	}
+
+	closure->worklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::worklet);
+		auto continuation = closure->continuation;
+		freePages(closure);
+		WorkQueue::post(continuation->_discarded);
+	});
+	closure->continuation = continuation;
+
+	closure->node.address = address() + continuation->_offset;
+	closure->node.size = continuation->_size;
+	closure->node.setup(&closure->worklet);
+	if(!owner()->_pageSpace.submitShootdown(&closure->node))
+		return false;
+
+	freePages(closure);
+	return true;
+}
+
+bool CowMapping::_chainHasPage(uintptr_t offset) {
+	auto page_offset = _viewOffset + offset;
+	auto chain = _copyChain.get();
+	while(chain) {
+		auto lock = frigg::guard(&chain->_mutex);
+		if(chain->_pages.find(page_offset >> kPageShift))
+			return true;
+		chain = chain->_superChain.get();
+	}
+	return false;
+}
+
 void CowMapping::install() {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
@@ -2163,6 +3288,11 @@ void CowMapping::install() {
 	_slice->getView()->addObserver(
 			smarter::static_pointer_cast<CowMapping>(selfPtr.lock()));
 
+	if(_slice->getView()->isMergeable()) {
+		_mergeable = true;
+		pageMerger->registerMapping(this);
+	}
+
 	auto findBorrowedPage = [&] (uintptr_t offset) -> frigg::Tuple<PhysicalAddr, CachingMode> {
 		auto page_offset = _viewOffset + offset;
 
@@ -2191,11 +3321,18 @@ void CowMapping::install() {
 
 	for(size_t pg = 0; pg < length(); pg += kPageSize) {
 		if(auto it = _ownedPages.find(pg >> kPageShift); it) {
+			if(it->state == CowState::discarded)
+				continue;
 			// TODO: Update RSS.
-			assert(it->state == CowState::hasCopy);
 			assert(it->physical != PhysicalAddr(-1));
-			owner()->_pageSpace.mapSingle4k(address() + pg,
-					it->physical, true, compilePageFlags(), CachingMode::null);
+			if(it->state == CowState::merged) {
+				owner()->_pageSpace.mapSingle4k(address() + pg, it->physical, true,
+						compilePageFlags() & ~page_access::write, CachingMode::null);
+			}else{
+				assert(it->state == CowState::hasCopy);
+				owner()->_pageSpace.mapSingle4k(address() + pg,
+						it->physical, true, compilePageFlags(), CachingMode::null);
+			}
 		}else{
 			auto range = findBorrowedPage(pg);
 			if(range.get<0>() == PhysicalAddr(-1))
@@ -2231,6 +3368,8 @@ void CowMapping::retire() {
 
 	_slice->getView()->removeObserver(
 			smarter::static_pointer_cast<CowMapping>(selfPtr));
+	if(_mergeable)
+		pageMerger->unregisterMapping(this);
 	_state = MappingState::retired;
 }
 
@@ -2238,7 +3377,10 @@ bool CowMapping::observeEviction(uintptr_t evict_offset, size_t evict_length,
 		EvictNode *continuation) {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
-	assert(_state == MappingState::active);
+	// Observers can be called after they are retired (e.g., AllocatedMemory calls them
+	// without holding its lock). Retired mappings do not map any pages anymore.
+	if(_state != MappingState::active)
+		return true;
 
 	if(evict_offset + evict_length <= _viewOffset
 			|| evict_offset >= _viewOffset + length())
@@ -2293,6 +3435,174 @@ bool CowMapping::observeEviction(uintptr_t evict_offset, size_t evict_length,
 	return true;
 }
 
+bool CowMapping::mergePage(uintptr_t offset) {
+	struct Closure {
+		static void shotDown(Worklet *base) {
+			auto closure = frg::container_of(base, &Closure::worklet);
+			KernelFiber::unblockOther(&closure->blocker);
+		}
+
+		FiberBlocker blocker;
+		Worklet worklet;
+		ShootNode shoot;
+	};
+
+	assert(!(offset & (kPageSize - 1)));
+	auto page_address = address() + offset;
+
+	// Must be called with _mutex held. Returns true if we need to wait for the shootdown.
+	auto submitShootdown = [&] (Closure *closure) -> bool {
+		closure->blocker.setup();
+		closure->worklet.setup(&Closure::shotDown);
+		closure->shoot.address = page_address;
+		closure->shoot.size = kPageSize;
+		closure->shoot.setup(&closure->worklet);
+		return !owner()->_pageSpace.submitShootdown(&closure->shoot);
+	};
+
+	// Pages that changed since the last scan are likely to change again.
+	// The checksum is computed without holding _mutex; we only use it if the
+	// page is still the same afterwards.
+	PhysicalAddr physical;
+	uint64_t last_checksum;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(_state != MappingState::active)
+			return false;
+		auto it = _ownedPages.find(offset >> kPageShift);
+		if(!it || it->state != CowState::hasCopy || it->lockCount)
+			return false;
+		physical = it->physical;
+		last_checksum = it->checksum;
+	}
+
+	auto checksum = checksumPage(physical);
+	if(checksum != last_checksum) {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(auto it = _ownedPages.find(offset >> kPageShift);
+				it && it->state == CowState::hasCopy && it->physical == physical)
+			it->checksum = checksum;
+		return true;
+	}
+
+	// Look for an identical page. The page is still writable, so matches are only hints.
+	// If there is no stable page, we only proceed if the unstable tree has a match;
+	// otherwise, the page stays writable.
+	smarter::shared_ptr<Mapping> buddy;
+	uintptr_t buddy_offset = 0;
+	PhysicalAddr buddy_physical = PhysicalAddr(-1);
+	auto stable = pageMerger->findStable(physical, checksum);
+	if(!stable) {
+		buddy = pageMerger->findUnstable(this, offset, physical, checksum,
+				&buddy_offset, &buddy_physical);
+		if(!buddy)
+			return true;
+	}
+
+	// Write-protect the page. We only confirm the match once the shootdown is complete;
+	// writes that happen afterwards go through touchVirtualPage() and break sharing.
+	MergedPage *candidate;
+	Closure protect;
+	bool pending;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		auto it = _ownedPages.find(offset >> kPageShift);
+		if(_state != MappingState::active || !it || it->state != CowState::hasCopy
+				|| it->lockCount || it->physical != physical) {
+			if(stable)
+				pageMerger->releaseReference(stable);
+			return true;
+		}
+
+		candidate = pageMerger->wrap(physical, checksum);
+		it->state = CowState::merged;
+		it->merged = candidate;
+
+		owner()->_pageSpace.unmapSingle4k(page_address);
+		owner()->_pageSpace.mapSingle4k(page_address, physical, true,
+				compilePageFlags() & ~page_access::write, CachingMode::null);
+		pending = submitShootdown(&protect);
+	}
+
+	if(pending)
+		KernelFiber::blockCurrent(&protect.blocker);
+
+	// The page cannot change anymore. Confirm the match (without holding any lock).
+	// If the match is from the unstable tree, the other page is still writable;
+	// it is confirmed again once it is merged into our page.
+	bool confirmed;
+	{
+		PageAccessor accessor{physical};
+		PageAccessor other_accessor{stable ? stable->physical : buddy_physical};
+		confirmed = !memcmp(accessor.get(), other_accessor.get(), kPageSize);
+	}
+	auto final_checksum = checksumPage(physical);
+
+	// Replace the candidate by the stable page or make the candidate stable.
+	Closure replace;
+	pending = false;
+	bool unwrapped = false;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(auto it = _ownedPages.find(offset >> kPageShift);
+				_state == MappingState::active && it
+				&& it->state == CowState::merged && it->merged == candidate) {
+			if(!confirmed) {
+				if(pageMerger->unwrap(candidate, final_checksum)) {
+					_takeOverMergedPage(offset, it);
+					unwrapped = true;
+				}
+			}else if(stable) {
+				pageMerger->merge(candidate, stable);
+				it->physical = stable->physical;
+				it->merged = stable;
+				stable = nullptr; // The reference is now owned by the CowPage.
+
+				owner()->_pageSpace.unmapSingle4k(page_address);
+				owner()->_pageSpace.mapSingle4k(page_address, it->physical, true,
+						compilePageFlags() & ~page_access::write, CachingMode::null);
+				pending = submitShootdown(&replace);
+			}else{
+				pageMerger->publish(candidate, final_checksum);
+			}
+		}
+	}
+
+	if(stable)
+		pageMerger->releaseReference(stable);
+
+	// The candidate can only be freed once no TLB refers to it anymore.
+	if(pending)
+		KernelFiber::blockCurrent(&replace.blocker);
+	if(!unwrapped)
+		pageMerger->finish(candidate);
+
+	// Our page is stable now; merge the page that matched in the unstable tree into it.
+	if(buddy && confirmed)
+		static_cast<CowMapping *>(buddy.get())->mergePage(buddy_offset);
+	return true;
+}
+
+void CowMapping::_takeOverMergedPage(uintptr_t offset, CowPage *page) {
+	assert(page->state == CowState::merged);
+	auto page_address = address() + (offset & ~(kPageSize - 1));
+
+	// Remap the page as read-write. As we only add permissions, no shootdown is necessary.
+	owner()->_pageSpace.unmapSingle4k(page_address);
+	owner()->_pageSpace.mapSingle4k(page_address, page->physical,
+			true, compilePageFlags(), CachingMode::null);
+	page->state = CowState::hasCopy;
+	page->merged = nullptr;
+}
+
 // --------------------------------------------------------
 // AddressSpace
 // --------------------------------------------------------
@@ -2556,7 +3866,24 @@ bool AddressSpace::unmap(VirtualAddr address, size_t length, AddressUnmapNode *n
 	return true;
 }
 
+bool AddressSpace::peekWord(VirtualAddr address, uint64_t *word) {
+	assert(!(address & (sizeof(uint64_t) - 1)));
+	auto misalign = address & (kPageSize - 1);
+
+	// Holding the page table lock keeps the physical page alive while we read.
+	ClientPageSpace::Walk walk{&_pageSpace};
+	walk.walkTo(address - misalign);
+	if(!walk.peekPresent())
+		return false;
+
+	PageAccessor accessor{walk.peekPhysical()};
+	memcpy(word, reinterpret_cast<char *>(accessor.get()) + misalign, sizeof(uint64_t));
+	return true;
+}
+
 bool AddressSpace::handleFault(VirtualAddr address, uint32_t fault_flags, FaultNode *node) {
+	trace(TraceEvent::fault, fault_flags, address);
+
 	node->_address = address;
 	node->_flags = fault_flags;
 
@@ -8,9 +8,11 @@
 #include <frg/vector.hpp>
 #include <smarter.hpp>
 #include "error.hpp"
+#include "lockstat.hpp"
 #include "mm-rc.hpp"
 #include "types.hpp"
 #include "futex.hpp"
+#include "zpool.hpp"
 #include "../arch/x86/paging.hpp"
 
 namespace thor {
@@ -26,6 +28,7 @@ struct Mapping;
 struct AddressSpace;
 struct AddressSpaceLockHandle;
 struct FaultNode;
+struct MergedPage;
 
 struct CachePage;
 
@@ -58,6 +61,9 @@ struct CachePage {
 	static constexpr uint32_t reclaimCached    = 0x01;
 	// Page is currently being evicted (not in LRU list).
 	static constexpr uint32_t reclaimUncaching  = 0x02;
+	// Page belongs to anonymous memory and can only be evicted to swap.
+	// The reclaimer keeps such pages on a separate LRU list.
+	static constexpr uint32_t anonymous = 0x04;
 
 	// CacheBundle that owns this page.
 	CacheBundle *bundle = nullptr;
@@ -273,6 +279,17 @@ public:
 
 	// Called (e.g. by user space) to update a range after loading or writeback.
 	virtual Error updateRange(ManageRequest type, size_t offset, size_t length);
+
+	// Returns true if private copies of this memory may be merged with identical pages.
+	virtual bool isMergeable();
+
+	// Returns true if the memory is only accessed through private copies and thus
+	// always reads as zeros (e.g., anonymous MAP_PRIVATE memory).
+	virtual bool isAnonymous();
+
+	// Starts to load a range of memory in the background (e.g. for readahead).
+	// Does not wait until the pages are present.
+	virtual void prefetchRange(uintptr_t offset, size_t size);
 };
 
 struct SliceRange {
@@ -407,15 +424,98 @@ private:
 	CachingMode _cacheMode;
 };
 
-struct AllocatedMemory : Memory {
+struct SwapSpace;
+
+struct SwapReadNode {
+	friend struct SwapSpace;
+
+	void setup(Worklet *worklet) {
+		_worklet = worklet;
+	}
+
+	PhysicalAddr physical() {
+		return _physical;
+	}
+
+private:
+	SwapSpace *_space;
+	uint64_t _slot;
+	PhysicalAddr _physical;
+
+	Worklet *_worklet;
+	Worklet _initiated;
+	MonitorNode _initiate;
+};
+
+struct AllocatedMemory : Memory, CacheBundle {
 	static bool classOf(const Memory &memory) {
 		return memory.tag() == MemoryTag::allocated;
 	}
 
+	enum class AnonymousState {
+		missing,
+		present,
+		evicting,
+		compressed,
+		swapped,
+		swappingIn
+	};
+
+	struct SwapInWaiter {
+		FetchNode *fetch;
+		uintptr_t offset;
+		frg::default_list_hook<SwapInWaiter> hook;
+	};
+
+	// Per-page state of swappable memory.
+	struct AnonymousPage {
+		AnonymousPage(AllocatedMemory *bundle, uint64_t identity) {
+			cachePage.bundle = bundle;
+			cachePage.identity = identity;
+			cachePage.flags = CachePage::anonymous;
+		}
+
+		AnonymousPage(const AnonymousPage &) = delete;
+
+		AnonymousPage &operator= (const AnonymousPage &) = delete;
+
+		AnonymousState state = AnonymousState::missing;
+		unsigned int lockCount = 0;
+		// Only valid in the swapped and swappingIn states.
+		uint64_t swapSlot = 0;
+		// Only valid in the compressed state.
+		CompressedObject compressed;
+		CachePage cachePage;
+
+		// Fetches that wait for the page to be swapped in.
+		frg::intrusive_list<
+			SwapInWaiter,
+			frg::locate_member<
+				SwapInWaiter,
+				frg::default_list_hook<SwapInWaiter>,
+				&SwapInWaiter::hook
+			>
+		> waiters;
+	};
+
 	AllocatedMemory(size_t length, size_t chunk_size = kPageSize,
 			size_t chunk_align = kPageSize);
 	~AllocatedMemory();
 
+	// Allows the reclaimer to evict pages of this object to the swap space.
+	// selfPtr must be set before this is called. Only supported for page-sized chunks.
+	void enableSwapping();
+
+	// Allows the PageMerger to merge private copies of this object.
+	void enableMerging();
+
+	// Promises that this object is never written directly (see isAnonymous()).
+	void markAnonymous();
+
+	bool uncachePage(CachePage *page, ReclaimNode *node) override;
+
+	void retirePage(CachePage *page) override;
+
 	void resize(size_t new_length) override;
 
 	void copyKernelToThisSync(ptrdiff_t offset, void *pointer, size_t length) override;
@@ -427,14 +527,32 @@ struct AllocatedMemory : Memory {
 	frigg::Tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
 	bool fetchRange(uintptr_t offset, FetchNode *node) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	bool isMergeable() override;
+	bool isAnonymous() override;
 
 	size_t getLength();
 
+	// Used by the reclaimer to keep this object alive while it evicts pages.
+	frigg::WeakPtr<AllocatedMemory> selfPtr;
+
 private:
+	AnonymousPage *_getAnonymousPage(size_t index);
+
 	frigg::TicketLock _mutex;
 
 	frigg::Vector<PhysicalAddr, KernelAlloc> _physicalChunks;
 	size_t _chunkSize, _chunkAlign;
+
+	bool _swappable = false;
+	bool _mergeable = false;
+	bool _anonymous = false;
+
+	// The following members are only used for swappable memory.
+	frg::rcu_radixtree<AnonymousPage, KernelAlloc> _anonymousPages;
+
+	// Observers are called without holding _mutex (see uncachePage()). Storing
+	// shared_ptrs allows us to keep them alive while they are called.
+	frigg::Vector<smarter::shared_ptr<MemoryObserver>, KernelAlloc> _observers;
 };
 
 struct ManagedSpace : CacheBundle {
@@ -497,6 +615,10 @@ struct ManagedSpace : CacheBundle {
 
 	size_t numObservers = 0;
 
+	// Evict pages even if they are not observed. Pages of swap spaces
+	// are only mapped by the swap server while it performs I/O.
+	bool dropUnobserved = false;
+
 	frg::intrusive_list<
 		CachePage,
 		frg::locate_member<
@@ -543,10 +665,58 @@ public:
 	void submitManage(ManageNode *handle);
 	Error updateRange(ManageRequest type, size_t offset, size_t length) override;
 
+	frigg::SharedPtr<ManagedSpace> managed() {
+		return _managed;
+	}
+
+private:
+	frigg::SharedPtr<ManagedSpace> _managed;
+};
+
+// Stores evicted anonymous pages in a ManagedSpace. Each page of the ManagedSpace
+// is a slot for one anonymous page. A user space server writes slots to its
+// device (writeback requests) and reads them back (initialization requests).
+struct SwapSpace {
+	SwapSpace(frigg::SharedPtr<ManagedSpace> managed);
+
+	SwapSpace(const SwapSpace &) = delete;
+
+	SwapSpace &operator= (const SwapSpace &) = delete;
+
+	// Reserves a free slot. Returns false if the swap space is full.
+	bool reserveSlot(uint64_t *slot);
+
+	// Releases a slot and discards its contents.
+	void releaseSlot(uint64_t slot);
+
+	// Moves a physical page into a reserved slot and queues it for writeback.
+	// The swap space takes ownership of the page.
+	void writeSlot(uint64_t slot, PhysicalAddr physical);
+
+	// Hands queued writebacks to the server. Adjacent slots are written by a single request.
+	void flush();
+
+	// Retrieves the contents of a slot as a newly owned physical page and releases the slot.
+	// Returns true if the operation completed synchronously.
+	bool readSlot(uint64_t slot, SwapReadNode *node);
+
 private:
+	bool _tryRead(uint64_t slot, PhysicalAddr *physical);
+	void _requestRead(SwapReadNode *node);
+	void _clearSlot(uint64_t slot);
+
 	frigg::SharedPtr<ManagedSpace> _managed;
+
+	// Protected by the mutex of the ManagedSpace.
+	frigg::Vector<uint64_t, KernelAlloc> _usedSlots;
+	size_t _numSlots;
+	size_t _numFree;
+	size_t _cursor = 0;
 };
 
+// Returns false if a swap space is already installed.
+bool installSwapSpace(frigg::SharedPtr<ManagedSpace> managed);
+
 struct FrontalMemory : Memory {
 public:
 	static bool classOf(const Memory &memory) {
@@ -563,6 +733,7 @@ public:
 	frigg::Tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
 	bool fetchRange(uintptr_t offset, FetchNode *node) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	void prefetchRange(uintptr_t offset, size_t size) override;
 
 	size_t getLength();
 
@@ -611,6 +782,13 @@ enum MappingFlags : uint32_t {
 	dontRequireBacking = 0x100
 };
 
+// Determines how much memory is read ahead when a mapping faults.
+enum class AccessPattern {
+	normal,
+	sequential,
+	random
+};
+
 struct LockVirtualNode {
 	static void post(LockVirtualNode *node) {
 		WorkQueue::post(node->_worklet);
@@ -686,6 +864,18 @@ struct PopulateVirtualNode {
 	Worklet *_prepared;
 };
 
+struct DiscardVirtualNode {
+	void setup(uintptr_t offset, size_t size, Worklet *discarded) {
+		_offset = offset;
+		_size = size;
+		_discarded = discarded;
+	}
+
+	uintptr_t _offset;
+	size_t _size;
+	Worklet *_discarded;
+};
+
 enum class MappingState {
 	null,
 	active,
@@ -718,6 +908,14 @@ struct Mapping {
 		return _flags;
 	}
 
+	AccessPattern accessPattern() const {
+		return _accessPattern.load(std::memory_order_relaxed);
+	}
+
+	void setAccessPattern(AccessPattern pattern) {
+		_accessPattern.store(pattern, std::memory_order_relaxed);
+	}
+
 public:
 	void tie(smarter::shared_ptr<AddressSpace> owner, VirtualAddr address);
 
@@ -736,6 +934,14 @@ public:
 	// Helper function that calls touchVirtualPage() on a certain range.
 	bool populateVirtualRange(PopulateVirtualNode *node);
 
+	// Starts to load the backing memory of a range without mapping it.
+	virtual void prefetchVirtualRange(uintptr_t offset, size_t size) = 0;
+
+	// Unmaps a range and drops private pages. Locked pages are not dropped.
+	// NormalMappings fault the pages of the view in again; CowMappings read the view
+	// again (bypassing their CoW chain) or zeros if the view is anonymous.
+	virtual bool discardVirtualRange(DiscardVirtualNode *node) = 0;
+
 	virtual smarter::shared_ptr<Mapping> forkMapping() = 0;
 
 	virtual void install() = 0;
@@ -749,11 +955,16 @@ public:
 protected:
 	uint32_t compilePageFlags();
 
+	// Called before a page is fetched from the view. Prefetches the following pages
+	// of the mapping, depending on the access pattern.
+	void readahead(MemoryView *view, uintptr_t view_offset, uintptr_t offset);
+
 private:
 	smarter::shared_ptr<AddressSpace> _owner;
 	VirtualAddr _address;
 	size_t _length;
 	MappingFlags _flags;
+	std::atomic<AccessPattern> _accessPattern{AccessPattern::normal};
 };
 
 struct NormalMapping : Mapping, MemoryObserver {
@@ -768,6 +979,8 @@ struct NormalMapping : Mapping, MemoryObserver {
 	void unlockVirtualRange(uintptr_t offset, size_t length) override;
 	frigg::Tuple<PhysicalAddr, CachingMode> resolveRange(ptrdiff_t offset) override;
 	bool touchVirtualPage(TouchVirtualNode *node) override;
+	void prefetchVirtualRange(uintptr_t offset, size_t size) override;
+	bool discardVirtualRange(DiscardVirtualNode *node) override;
 
 	smarter::shared_ptr<Mapping> forkMapping() override;
 
@@ -778,6 +991,10 @@ struct NormalMapping : Mapping, MemoryObserver {
 	bool observeEviction(uintptr_t offset, size_t length, EvictNode *node) override;
 
 private:
+	// Protects _state and the page table entries of this mapping
+	// (except in observeEviction(), see the TODO there).
+	frigg::TicketLock _mutex;
+
 	MappingState _state = MappingState::null;
 	frigg::SharedPtr<MemorySlice> _slice;
 	frigg::SharedPtr<MemoryView> _view;
@@ -809,6 +1026,8 @@ struct CowMapping : Mapping, MemoryObserver {
 	void unlockVirtualRange(uintptr_t offset, size_t length) override;
 	frigg::Tuple<PhysicalAddr, CachingMode> resolveRange(ptrdiff_t offset) override;
 	bool touchVirtualPage(TouchVirtualNode *node) override;
+	void prefetchVirtualRange(uintptr_t offset, size_t size) override;
+	bool discardVirtualRange(DiscardVirtualNode *node) override;
 
 	smarter::shared_ptr<Mapping> forkMapping() override;
 
@@ -818,19 +1037,47 @@ struct CowMapping : Mapping, MemoryObserver {
 
 	bool observeEviction(uintptr_t offset, size_t length, EvictNode *node) override;
 
+	// Called by the PageMerger's scanner fiber. Tries to merge the private copy at
+	// the given offset with an identical page. Returns false if there is no copy
+	// that could be merged.
+	bool mergePage(uintptr_t offset);
+
+	// Used by the PageMerger if the memory is mergeable.
+	frg::default_list_hook<CowMapping> mergeHook;
+	// Identifies the mapping in the PageMerger's unstable tree. Assigned on registration.
+	uint64_t mergeId = 0;
+
 private:
 	enum class CowState {
 		null,
 		inProgress,
-		hasCopy
+		hasCopy,
+		// The page is a read-only mapping of a MergedPage.
+		merged,
+		// The private copy was discarded but the CoW chain still contains the page.
+		// The page is refilled from the root view (bypassing the chain) or with zeros
+		// if the view is anonymous. No physical page is allocated until the page
+		// is accessed again.
+		discarded
 	};
 
 	struct CowPage {
 		PhysicalAddr physical = -1;
 		CowState state = CowState::null;
 		unsigned int lockCount = 0;
+		// Only valid in the merged state.
+		MergedPage *merged = nullptr;
+		// Checksum of the last scan. Only pages that do not change are merged.
+		uint64_t checksum = 0;
 	};
 
+	// Turns a merged page that is not shared anymore back into a private copy.
+	void _takeOverMergedPage(uintptr_t offset, CowPage *page);
+
+	// Returns true if the CoW chain contains the page at the given offset.
+	// Must be called with _mutex held.
+	bool _chainHasPage(uintptr_t offset);
+
 	frigg::TicketLock _mutex;
 
 	frigg::SharedPtr<MemorySlice> _slice;
@@ -839,6 +1086,9 @@ private:
 
 	MappingState _state = MappingState::null;
 	frg::rcu_radixtree<CowPage, KernelAlloc> _ownedPages;
+
+	// True if the mapping is registered with the PageMerger.
+	bool _mergeable = false;
 };
 
 struct HoleLess {
@@ -958,7 +1208,7 @@ struct AddressSpace : smarter::crtp_counter<AddressSpace, BindableHandle> {
 	friend struct CowMapping;
 
 public:
-	typedef frigg::TicketLock Lock;
+	typedef ClassLock<frigg::TicketLock, LockClass::addressSpace> Lock;
 	typedef frigg::LockGuard<Lock> Guard;
 
 	typedef uint32_t MapFlags;
@@ -1017,6 +1267,10 @@ public:
 
 	bool handleFault(VirtualAddr address, uint32_t flags, FaultNode *node);
 
+	// Reads a word from a page that is already present; never faults.
+	// This is safe to call from IRQ context.
+	bool peekWord(VirtualAddr address, uint64_t *word);
+
 	bool fork(ForkNode *node);
 
 	size_t rss() {
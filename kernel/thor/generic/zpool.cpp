@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "kernel.hpp"
+#include "lz4.hpp"
+#include "zpool.hpp"
+
+namespace thor {
+
+namespace {
+	constexpr bool logZpool = false;
+
+	// Disable the compressed tier; pages are evicted to swap directly.
+	constexpr bool disableZpool = false;
+
+	// The pool may use up to 1/4 of physical memory.
+	constexpr int maxPoolShift = 2;
+
+	size_t slotSizeOf(size_t size_class) {
+		return (size_class + 1) * CompressedPool::compressedGranularity;
+	}
+
+	size_t slotsPerPage(size_t size_class) {
+		return kPageSize / slotSizeOf(size_class);
+	}
+}
+
+frigg::LazyInitializer<CompressedPool> compressedPool;
+
+CompressedPool::CompressedPool(size_t max_pages)
+: _maxPages{max_pages} { }
+
+bool CompressedPool::store(PhysicalAddr physical, CompressedObject *object) {
+	if(disableZpool)
+		return false;
+
+	// With IRQs disabled, we cannot be preempted; hence the staging buffer
+	// of this CPU cannot be used concurrently.
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto cpu_data = getCpuData();
+	if(!cpu_data->zpoolBuffer)
+		cpu_data->zpoolBuffer = static_cast<uint8_t *>(kernelAlloc->allocate(maxObjectSize));
+	auto buffer = cpu_data->zpoolBuffer;
+
+	size_t size;
+	{
+		PageAccessor accessor{physical};
+		size = compressLz4Block(accessor.get(), kPageSize, buffer, maxObjectSize);
+	}
+	if(!size) {
+		_numRejects.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	auto size_class = (size - 1) / compressedGranularity;
+	assert(size_class < numSizeClasses);
+	auto sc = &_sizeClasses[size_class];
+
+	CompressedPoolPage *page;
+	int slot;
+	{
+		auto lock = frigg::guard(&sc->mutex);
+
+		if(sc->partialPages.empty()) {
+			if(_poolPages.fetch_add(1, std::memory_order_relaxed) >= _maxPages) {
+				_poolPages.fetch_sub(1, std::memory_order_relaxed);
+				_numRejects.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			// The pool is only a cache; do not panic if memory is tight.
+			auto pool_physical = physicalAllocator->tryAllocate(kPageSize);
+			if(pool_physical == PhysicalAddr(-1)) {
+				_poolPages.fetch_sub(1, std::memory_order_relaxed);
+				_numRejects.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			auto new_page = frigg::construct<CompressedPoolPage>(*kernelAlloc);
+			new_page->physical = pool_physical;
+			new_page->sizeClass = size_class;
+			sc->partialPages.push_back(new_page);
+		}
+
+		page = sc->partialPages.front();
+		slot = __builtin_ctzll(~page->usedSlots);
+		assert(size_t(slot) < slotsPerPage(size_class));
+		page->usedSlots |= uint64_t(1) << slot;
+		page->numUsed++;
+		if(page->numUsed == slotsPerPage(size_class))
+			sc->partialPages.pop_front();
+	}
+
+	// The slot is reserved now; nobody else touches it until it is freed.
+	PageAccessor accessor{page->physical};
+	memcpy(reinterpret_cast<uint8_t *>(accessor.get()) + slot * slotSizeOf(size_class),
+			buffer, size);
+
+	object->page = page;
+	object->slot = slot;
+	object->size = size;
+	_storedPages.fetch_add(1, std::memory_order_relaxed);
+	_compressedBytes.fetch_add(size, std::memory_order_relaxed);
+	_numStores.fetch_add(1, std::memory_order_relaxed);
+	if(logZpool)
+		frigg::infoLogger() << "thor: Compressed page to " << size << " bytes" << frigg::endLog;
+	return true;
+}
+
+void CompressedPool::load(CompressedObject *object, PhysicalAddr physical) {
+	auto page = object->page;
+	assert(page);
+	{
+		// The caller owns the object; its slot (and thus the page) cannot go away
+		// while we decompress it. No lock is required.
+		PageAccessor src_accessor{page->physical};
+		PageAccessor dest_accessor{physical};
+		auto data = reinterpret_cast<uint8_t *>(src_accessor.get())
+				+ object->slot * slotSizeOf(page->sizeClass);
+		auto size = decompressLz4Block(data, object->size, dest_accessor.get(), kPageSize);
+		assert(size == kPageSize);
+	}
+
+	_numHits.fetch_add(1, std::memory_order_relaxed);
+	_free(object);
+}
+
+void CompressedPool::discard(CompressedObject *object) {
+	_free(object);
+}
+
+CompressedPoolStats CompressedPool::stats() {
+	CompressedPoolStats stats;
+	stats.storedPages = _storedPages.load(std::memory_order_relaxed);
+	stats.compressedBytes = _compressedBytes.load(std::memory_order_relaxed);
+	stats.poolPages = _poolPages.load(std::memory_order_relaxed);
+	stats.numStores = _numStores.load(std::memory_order_relaxed);
+	stats.numHits = _numHits.load(std::memory_order_relaxed);
+	stats.numRejects = _numRejects.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void CompressedPool::_free(CompressedObject *object) {
+	auto page = object->page;
+	assert(page);
+	auto sc = &_sizeClasses[page->sizeClass];
+	bool free_page = false;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&sc->mutex);
+
+		assert(page->usedSlots & (uint64_t(1) << object->slot));
+		if(page->numUsed == slotsPerPage(page->sizeClass))
+			sc->partialPages.push_back(page);
+		page->usedSlots &= ~(uint64_t(1) << object->slot);
+		page->numUsed--;
+
+		if(!page->numUsed) {
+			sc->partialPages.erase(sc->partialPages.iterator_to(page));
+			free_page = true;
+		}
+	}
+
+	if(free_page) {
+		physicalAllocator->free(page->physical, kPageSize);
+		frigg::destruct(*kernelAlloc, page);
+		_poolPages.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	_storedPages.fetch_sub(1, std::memory_order_relaxed);
+	_compressedBytes.fetch_sub(object->size, std::memory_order_relaxed);
+	*object = CompressedObject{};
+}
+
+void initializeCompressedPool() {
+	auto total_pages = physicalAllocator->numFreePages() + physicalAllocator->numUsedPages();
+	compressedPool.initialize(total_pages >> maxPoolShift);
+}
+
+} // namespace thor
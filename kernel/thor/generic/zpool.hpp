@@ -0,0 +1,111 @@
+#ifndef THOR_GENERIC_ZPOOL_HPP
+#define THOR_GENERIC_ZPOOL_HPP
+
+#include <atomic>
+#include <frigg/atomic.hpp>
+#include <frigg/initializer.hpp>
+#include <frg/list.hpp>
+#include "types.hpp"
+
+namespace thor {
+
+// Pool of LZ4-compressed pages. It serves as an in-memory tier between resident
+// anonymous memory and swap: cold pages are compressed before they are written
+// to disk and decompressed when they are accessed again.
+//
+// Objects are packed into physical pages. Each pool page only stores objects
+// of a single size class (multiples of compressedGranularity).
+//
+// Compression and decompression do not take any pool lock: pages are compressed
+// into a per-CPU staging buffer and each size class has its own lock that only
+// protects its slot bookkeeping.
+
+struct CompressedPoolPage {
+	PhysicalAddr physical;
+	size_t sizeClass;
+	unsigned int numUsed = 0;
+	uint64_t usedSlots = 0;
+	frg::default_list_hook<CompressedPoolPage> hook;
+};
+
+struct CompressedObject {
+	CompressedPoolPage *page = nullptr;
+	uint16_t slot = 0;
+	uint16_t size = 0;
+};
+
+struct CompressedPoolStats {
+	// Pages and compressed bytes that are currently stored.
+	size_t storedPages;
+	size_t compressedBytes;
+	// Physical pages that are used by the pool.
+	size_t poolPages;
+	// Number of successful store() and load() calls.
+	uint64_t numStores;
+	uint64_t numHits;
+	// Number of pages that did not compress well enough (or did not fit into the pool).
+	uint64_t numRejects;
+};
+
+struct CompressedPool {
+	static constexpr size_t compressedGranularity = 64;
+	// Pages that do not compress below this size are not worth storing.
+	// This ensures that each pool page holds at least two objects.
+	static constexpr size_t maxObjectSize = 2048;
+	static constexpr size_t numSizeClasses = maxObjectSize / compressedGranularity;
+
+	CompressedPool(size_t max_pages);
+
+	CompressedPool(const CompressedPool &) = delete;
+
+	CompressedPool &operator= (const CompressedPool &) = delete;
+
+	// Compresses the page. Returns false if it should be evicted to swap instead.
+	// The caller keeps ownership of the physical page in any case.
+	bool store(PhysicalAddr physical, CompressedObject *object);
+
+	// Decompresses the object into the physical page and frees the object.
+	void load(CompressedObject *object, PhysicalAddr physical);
+
+	// Frees the object without decompressing it.
+	void discard(CompressedObject *object);
+
+	CompressedPoolStats stats();
+
+private:
+	void _free(CompressedObject *object);
+
+	size_t _maxPages;
+
+	using PageList = frg::intrusive_list<
+		CompressedPoolPage,
+		frg::locate_member<
+			CompressedPoolPage,
+			frg::default_list_hook<CompressedPoolPage>,
+			&CompressedPoolPage::hook
+		>
+	>;
+
+	struct SizeClass {
+		frigg::TicketLock mutex;
+		// Pages that have at least one free slot.
+		PageList partialPages;
+	};
+
+	SizeClass _sizeClasses[numSizeClasses];
+
+	std::atomic<size_t> _storedPages{0};
+	std::atomic<size_t> _compressedBytes{0};
+	std::atomic<size_t> _poolPages{0};
+	std::atomic<uint64_t> _numStores{0};
+	std::atomic<uint64_t> _numHits{0};
+	std::atomic<uint64_t> _numRejects{0};
+};
+
+extern frigg::LazyInitializer<CompressedPool> compressedPool;
+
+void initializeCompressedPool();
+
+} // namespace thor
+
+#endif // THOR_GENERIC_ZPOOL_HPP
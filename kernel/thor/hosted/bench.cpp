@@ -0,0 +1,191 @@
+// Microbenchmarks for arch-independent thor code that runs on the host.
+// Results use the format of the system benchmarks ("bench: <name> <value> <unit>")
+// such that tools/run-benchmarks can compare them against baseline.json.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <frg/container_of.hpp>
+#include <frigg/hashmap.hpp>
+#include <frigg/physical_buddy.hpp>
+#include "../generic/futex.hpp"
+#include "../generic/kernel_heap.hpp"
+#include "shim.hpp"
+
+using namespace thor;
+
+namespace {
+
+void report(const char *name, double value, const char *unit) {
+	printf("bench: %s %.2f %s\n", name, value, unit);
+	fflush(stdout);
+}
+
+// Prevents the compiler from optimizing away the computation of value.
+template<typename T>
+void keep(T &value) {
+	asm volatile ("" : : "r,m"(value) : "memory");
+}
+
+// Keys are spaced like futex words on separate cache lines.
+void benchHashmap() {
+	constexpr uint64_t n = 100'000;
+	frigg::Hashmap<uint64_t, uint64_t, frigg::DefaultHasher<uint64_t>, KernelAlloc>
+			map{frigg::DefaultHasher<uint64_t>{}, *kernelAlloc};
+
+	auto start = currentNanos();
+	for(uint64_t i = 0; i < n; i++)
+		map.insert(i * 64, i);
+	report("hashmap-insert", double(currentNanos() - start) / n, "ns/op");
+
+	start = currentNanos();
+	uint64_t sum = 0;
+	for(uint64_t i = 0; i < n; i++)
+		sum += *map.get(((i * 7919) % n) * 64);
+	keep(sum);
+	report("hashmap-lookup", double(currentNanos() - start) / n, "ns/op");
+
+	start = currentNanos();
+	for(uint64_t i = 0; i < n; i++)
+		map.remove(i * 64);
+	report("hashmap-remove", double(currentNanos() - start) / n, "ns/op");
+}
+
+// Mimics the usage pattern of the physical allocator: a 4 GiB region of 4 KiB pages.
+void benchBuddyTools() {
+	using address_type = frigg::buddy_tools::address_type;
+	constexpr address_type num_items = 1 << 20;
+	constexpr uint64_t n = 1'000'000;
+	auto table_order = frigg::buddy_tools::suitable_order(num_items);
+	auto num_roots = num_items >> table_order;
+
+	std::vector<int8_t> table(frigg::buddy_tools::determine_size(num_roots, table_order));
+	frigg::buddy_tools::initialize(table.data(), num_roots, table_order);
+
+	// Fragment the allocator a bit so that allocations need to descend.
+	std::vector<address_type> held;
+	for(address_type i = 0; i < num_items / 2; i++)
+		held.push_back(frigg::buddy_tools::allocate(table.data(), num_roots, table_order, 0));
+	for(address_type i = 0; i < held.size(); i += 2)
+		frigg::buddy_tools::free(table.data(), num_roots, table_order, held[i], 0);
+
+	auto start = currentNanos();
+	for(uint64_t i = 0; i < n; i++) {
+		auto address = frigg::buddy_tools::allocate(table.data(), num_roots, table_order, 0);
+		frigg::buddy_tools::free(table.data(), num_roots, table_order, address, 0);
+	}
+	report("buddy-alloc-free", double(currentNanos() - start) / n, "ns/op");
+}
+
+// Returns the throughput of KernelAlloc in millions of allocate/free pairs per second.
+double runKernelAlloc(unsigned int num_threads, size_t size) {
+	constexpr uint64_t n = 1'000'000;
+	constexpr size_t batch = 64;
+	std::atomic<unsigned int> ready{0};
+	std::atomic<bool> go{false};
+
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < num_threads; i++) {
+		threads.emplace_back([&, i] {
+			pinToCpu(i);
+			HostedCpu cpu;
+			void *blocks[batch];
+			ready.fetch_add(1);
+			while(!go.load(std::memory_order_acquire))
+				;
+			for(uint64_t k = 0; k < n; k += batch) {
+				for(size_t j = 0; j < batch; j++)
+					blocks[j] = kernelAlloc->allocate(size);
+				for(size_t j = 0; j < batch; j++)
+					kernelAlloc->free(blocks[j]);
+			}
+		});
+	}
+
+	while(ready.load() != num_threads)
+		;
+	auto start = currentNanos();
+	go.store(true, std::memory_order_release);
+	for(auto &thread : threads)
+		thread.join();
+	return (num_threads * n) * 1000.0 / (currentNanos() - start);
+}
+
+void benchKernelAlloc(unsigned int max_threads) {
+	for(unsigned int n = 1; n <= max_threads; n *= 2) {
+		char name[32];
+		snprintf(name, sizeof(name), "kernel-alloc-64b-t%u", n);
+		report(name, runKernelAlloc(n, 64), "Mops/s");
+	}
+	report("kernel-alloc-4k-t1", runKernelAlloc(1, 4096), "Mops/s");
+}
+
+struct FutexWaiter {
+	FutexWaiter() {
+		worklet.setup([] (Worklet *base) {
+			auto self = frg::container_of(base, &FutexWaiter::worklet);
+			self->woken.store(true, std::memory_order_release);
+		});
+		node.setup(&worklet);
+	}
+
+	Worklet worklet;
+	FutexNode node;
+	std::atomic<bool> woken{false};
+};
+
+// Two CPUs alternately wait on and wake a futex. Unlike the unit test, the CPUs
+// poll their work queues instead of sleeping to measure the latency of the futex itself.
+void benchFutexPingPong() {
+	constexpr int rounds = 100'000;
+	Futex futex;
+	std::atomic<int> turn{0};
+
+	auto player = [&] (int self) {
+		pinToCpu(self);
+		HostedCpu cpu;
+		for(int i = 0; i < rounds; i++) {
+			FutexWaiter waiter;
+			futex.submitWait(0x1000, [&] {
+				return turn.load(std::memory_order_acquire) % 2 != self;
+			}, &waiter.node);
+			while(!waiter.woken.load(std::memory_order_acquire))
+				cpu.drain();
+			while(turn.load(std::memory_order_acquire) % 2 != self)
+				;
+
+			turn.fetch_add(1, std::memory_order_acq_rel);
+			futex.wake(0x1000);
+		}
+	};
+
+	auto start = currentNanos();
+	std::thread t0{player, 0};
+	std::thread t1{player, 1};
+	t0.join();
+	t1.join();
+	report("futex-ping-pong", double(currentNanos() - start) / (2 * rounds), "ns/op");
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	unsigned int max_threads = std::thread::hardware_concurrency();
+	if(argc > 1)
+		max_threads = strtoul(argv[1], nullptr, 10);
+
+	initializeHosted();
+	HostedCpu cpu;
+
+	benchHashmap();
+	benchBuddyTools();
+	benchKernelAlloc(max_threads);
+	// The players spin; this is only meaningful if they run on different CPUs.
+	if(max_threads >= 2 && std::thread::hardware_concurrency() >= 2)
+		benchFutexPingPong();
+	report("heap-usage", hostedHeapUsage() / 1024.0, "KiB");
+	printf("bench-done\n");
+}
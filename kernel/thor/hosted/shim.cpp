@@ -0,0 +1,264 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <thread>
+
+#include "../generic/kernel_heap.hpp"
+#include "../generic/lockstat.hpp"
+#include "../generic/trace.hpp"
+#include "../arch/x86/ints.hpp"
+#include "shim.hpp"
+
+namespace thor {
+
+namespace {
+	thread_local HostedCpu *currentCpu = nullptr;
+	// Plays the role of ExecutorContext::associatedWorkQueue.
+	thread_local WorkQueue *associatedWorkQueue = nullptr;
+
+	thread_local bool intsEnabled = true;
+	thread_local IrqMutex cpuIrqMutex;
+
+	std::atomic<size_t> heapUsage{0};
+
+	size_t ceilToPowerOf2(size_t x) {
+		size_t p = 1;
+		while(p < x)
+			p <<= 1;
+		return p;
+	}
+}
+
+// --------------------------------------------------------
+// CPU emulation
+// --------------------------------------------------------
+
+bool intsAreEnabled() {
+	return intsEnabled;
+}
+
+void enableInts() {
+	intsEnabled = true;
+}
+
+void disableInts() {
+	intsEnabled = false;
+}
+
+IrqMutex &irqMutex() {
+	return cpuIrqMutex;
+}
+
+HostedCpu::HostedCpu()
+: _outer{currentCpu} {
+	currentCpu = this;
+	associatedWorkQueue = &_queue;
+}
+
+HostedCpu::~HostedCpu() {
+	assert(currentCpu == this);
+	assert(!_queue.check());
+	currentCpu = _outer;
+	associatedWorkQueue = _outer ? _outer->queue() : nullptr;
+}
+
+void HostedCpu::drain() {
+	while(_queue.check())
+		_queue.run();
+}
+
+void HostedCpu::waitAndDrain() {
+	{
+		// WorkQueue::post() sets the posted flag before it calls wakeup().
+		std::unique_lock<std::mutex> lock{_queue.mutex};
+		_queue.cv.wait(lock, [&] { return _queue.check(); });
+	}
+	drain();
+}
+
+void HostedCpu::Queue::wakeup() {
+	std::lock_guard<std::mutex> lock{mutex};
+	cv.notify_one();
+}
+
+HostedCpu *hostedCpu() {
+	return currentCpu;
+}
+
+// --------------------------------------------------------
+// WorkQueue
+// Keep this in sync with generic/work-queue.cpp; only the executor context differs.
+// --------------------------------------------------------
+
+WorkScope::WorkScope(WorkQueue *queue)
+: _scopedQueue{queue}, _outerQueue{associatedWorkQueue} {
+	associatedWorkQueue = _scopedQueue;
+}
+
+WorkScope::~WorkScope() {
+	assert(associatedWorkQueue == _scopedQueue);
+	associatedWorkQueue = _outerQueue;
+}
+
+WorkQueue *WorkQueue::localQueue() {
+	assert(associatedWorkQueue);
+	return associatedWorkQueue;
+}
+
+void WorkQueue::post(Worklet *worklet) {
+	auto wq = worklet->_workQueue;
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&wq->_mutex);
+
+	auto was_empty = wq->_posted.empty();
+	wq->_posted.push_back(worklet);
+	wq->_anyPosted.store(true, std::memory_order_relaxed);
+
+	lock.unlock();
+	irq_lock.unlock();
+
+	if(was_empty)
+		wq->wakeup();
+}
+
+bool WorkQueue::check() {
+	return !_pending.empty() || _anyPosted.load(std::memory_order_relaxed);
+}
+
+void WorkQueue::run() {
+	if(_anyPosted.load(std::memory_order_relaxed)) {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		_pending.splice(_pending.end(), _posted);
+		_anyPosted.store(false, std::memory_order_relaxed);
+	}
+
+	while(!_pending.empty()) {
+		auto worklet = _pending.pop_front();
+		worklet->_run(worklet);
+	}
+}
+
+// --------------------------------------------------------
+// Kernel heap
+// --------------------------------------------------------
+
+void IrqSpinlock::lock() {
+	irqMutex().lock();
+	_spinlock.lock();
+}
+
+void IrqSpinlock::unlock() {
+	_spinlock.unlock();
+	irqMutex().unlock();
+}
+
+KernelVirtualAlloc::KernelVirtualAlloc() { }
+
+// Like the buddy allocator of KernelVirtualMemory, we return naturally aligned regions.
+uintptr_t KernelVirtualAlloc::map(size_t length) {
+	auto alignment = ceilToPowerOf2(length);
+	auto p = mmap(nullptr, length + alignment, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		fprintf(stderr, "thor-hosted: Out of memory\n");
+		abort();
+	}
+
+	auto base = reinterpret_cast<uintptr_t>(p);
+	auto address = (base + alignment - 1) & ~(alignment - 1);
+	if(address > base)
+		munmap(p, address - base);
+	munmap(reinterpret_cast<void *>(address + length), base + alignment - address);
+	heapUsage += length;
+
+	return address;
+}
+
+void KernelVirtualAlloc::unmap(uintptr_t address, size_t length) {
+	munmap(reinterpret_cast<void *>(address), length);
+	heapUsage -= length;
+}
+
+void *KernelAlloc::allocate(size_t size) {
+	return _allocator.allocate(size);
+}
+
+void *KernelAlloc::reallocate(void *pointer, size_t size) {
+	return _allocator.realloc(pointer, size);
+}
+
+void KernelAlloc::free(void *pointer) {
+	_allocator.free(pointer);
+}
+
+void KernelAlloc::deallocate(void *pointer, size_t size) {
+	_allocator.deallocate(pointer, size);
+}
+
+frigg::LazyInitializer<KernelVirtualAlloc> kernelVirtualAlloc;
+frigg::LazyInitializer<KernelAlloc> kernelAlloc;
+
+void initializeHosted() {
+	kernelVirtualAlloc.initialize();
+	kernelAlloc.initialize(*kernelVirtualAlloc);
+}
+
+size_t hostedHeapUsage() {
+	return heapUsage.load(std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------
+// Tracing and lock statistics
+// --------------------------------------------------------
+
+// There are no trace buffers; traceActive is never set.
+std::atomic<bool> traceActive{false};
+
+void emitTrace(TraceEvent, uint32_t, uint64_t) { }
+
+bool enableLockStats = false;
+LockStats lockStats[numLockClasses];
+
+// --------------------------------------------------------
+// Utilities
+// --------------------------------------------------------
+
+uint64_t currentNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+}
+
+void pinToCpu(unsigned int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+}
+
+} // namespace thor
+
+// --------------------------------------------------------
+// frigg glue code
+// --------------------------------------------------------
+
+void friggBeginLog() { }
+
+void friggEndLog() { }
+
+void friggPrintCritical(char c) {
+	fputc(c, stderr);
+}
+
+void friggPrintCritical(char const *str) {
+	fputs(str, stderr);
+}
+
+void friggPanic() {
+	abort();
+}
@@ -0,0 +1,68 @@
+#ifndef THOR_HOSTED_SHIM_HPP
+#define THOR_HOSTED_SHIM_HPP
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+
+#include "../generic/work-queue.hpp"
+
+// Hosted environment for arch-independent parts of thor.
+// Each pthread that runs kernel code takes the role of a CPU: it owns a HostedCpu
+// that provides the executor context (i.e., the work queue that Worklet::setup() uses)
+// and the per-CPU IRQ state behind irqMutex(). IRQs are only simulated; the shim
+// tracks whether they are "enabled" so that IrqMutex nesting can be checked.
+//
+// TODO: IpcQueue, Scheduler and the MemoryReclaimer are not covered yet. They need
+//       fakes for address spaces, per-CPU data (CpuData, ping IPIs, the preemption timer)
+//       and physical pages, respectively.
+
+namespace thor {
+
+struct HostedCpu {
+	HostedCpu();
+
+	HostedCpu(const HostedCpu &) = delete;
+
+	~HostedCpu();
+
+	HostedCpu &operator= (const HostedCpu &) = delete;
+
+	WorkQueue *queue() {
+		return &_queue;
+	}
+
+	// Runs all worklets that are currently posted to this CPU.
+	void drain();
+
+	// Blocks until at least one worklet is posted to this CPU, then drains the queue.
+	void waitAndDrain();
+
+private:
+	struct Queue final : WorkQueue {
+		void wakeup() override;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+
+	Queue _queue;
+	HostedCpu *_outer;
+};
+
+// Returns the HostedCpu of the calling thread.
+HostedCpu *hostedCpu();
+
+// Sets up the kernel heap. Must be called before any thor code allocates memory.
+void initializeHosted();
+
+// Returns the number of bytes that the kernel heap obtained from the host.
+size_t hostedHeapUsage();
+
+uint64_t currentNanos();
+
+void pinToCpu(unsigned int cpu);
+
+} // namespace thor
+
+#endif // THOR_HOSTED_SHIM_HPP
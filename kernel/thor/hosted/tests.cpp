@@ -0,0 +1,259 @@
+// Unit tests for arch-independent thor code that runs on the host.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <frg/container_of.hpp>
+#include <frigg/hashmap.hpp>
+#include <frigg/physical_buddy.hpp>
+#include "../generic/futex.hpp"
+#include "../generic/kernel_heap.hpp"
+#include <host-test.hpp>
+#include "shim.hpp"
+
+using namespace thor;
+
+namespace {
+
+// --------------------------------------------------------
+// frigg::Hashmap
+// --------------------------------------------------------
+
+void testHashmap() {
+	constexpr uint64_t n = 10000;
+	frigg::Hashmap<uint64_t, uint64_t, frigg::DefaultHasher<uint64_t>, KernelAlloc>
+			map{frigg::DefaultHasher<uint64_t>{}, *kernelAlloc};
+	EXPECT(map.empty());
+
+	for(uint64_t i = 0; i < n; i++)
+		map.insert(i * 4096, i);
+	for(uint64_t i = 0; i < n; i++) {
+		auto v = map.get(i * 4096);
+		EXPECT(v && *v == i);
+	}
+	EXPECT(!map.get(uint64_t(1)));
+
+	for(uint64_t i = 0; i < n; i += 2) {
+		auto v = map.remove(i * 4096);
+		EXPECT(v && *v == i);
+	}
+	EXPECT(!map.remove(0));
+
+	uint64_t count = 0;
+	for(auto it = map.iterator(); it; ++it) {
+		EXPECT(it->get<1>() % 2);
+		count++;
+	}
+	EXPECT(count == n / 2);
+
+	for(uint64_t i = 1; i < n; i += 2)
+		EXPECT(map.remove(i * 4096));
+	EXPECT(map.empty());
+}
+
+// --------------------------------------------------------
+// frigg::buddy_tools (used by the physical allocator)
+// --------------------------------------------------------
+
+void testBuddyTools() {
+	using address_type = frigg::buddy_tools::address_type;
+	constexpr address_type num_roots = 8;
+	constexpr int table_order = 6;
+	constexpr address_type num_items = num_roots << table_order;
+
+	// Each root spans a complete binary tree with 2^(table_order + 1) - 1 nodes.
+	EXPECT(frigg::buddy_tools::determine_size(num_roots, table_order)
+			== num_roots * ((size_t(2) << table_order) - 1));
+
+	std::vector<int8_t> table(frigg::buddy_tools::determine_size(num_roots, table_order));
+	frigg::buddy_tools::initialize(table.data(), num_roots, table_order);
+
+	// Allocate every item once; all addresses must be distinct.
+	std::vector<bool> used(num_items, false);
+	for(address_type i = 0; i < num_items; i++) {
+		auto address = frigg::buddy_tools::allocate_in_roots(table.data(), num_roots,
+				table_order, 0, 0, num_roots);
+		EXPECT(address < num_items);
+		EXPECT(!used[address]);
+		used[address] = true;
+	}
+	EXPECT(frigg::buddy_tools::allocate_in_roots(table.data(), num_roots,
+			table_order, 0, 0, num_roots) == address_type(-1));
+
+	// Freeing all items must coalesce them into full roots again.
+	for(address_type i = 0; i < num_items; i++)
+		frigg::buddy_tools::free(table.data(), num_roots, table_order, i, 0);
+	for(address_type r = 0; r < num_roots; r++) {
+		auto address = frigg::buddy_tools::allocate(table.data(), num_roots,
+				table_order, table_order);
+		EXPECT(address % (address_type(1) << table_order) == 0);
+	}
+
+	// Restricting the roots restricts the addresses.
+	for(address_type r = 0; r < num_roots; r++)
+		frigg::buddy_tools::free(table.data(), num_roots, table_order,
+				r << table_order, table_order);
+	for(int order = 0; order < table_order; order++) {
+		auto address = frigg::buddy_tools::allocate_in_roots(table.data(), num_roots,
+				table_order, order, 3, 4);
+		EXPECT(address != address_type(-1));
+		EXPECT((address >> table_order) == 3);
+		EXPECT(address % (address_type(1) << order) == 0);
+	}
+	// The root is partially used by now; other roots are not considered.
+	EXPECT(frigg::buddy_tools::allocate_in_roots(table.data(), num_roots,
+			table_order, table_order, 3, 4) == address_type(-1));
+}
+
+// --------------------------------------------------------
+// frigg::BuddyAllocator (used for kernel virtual memory)
+// --------------------------------------------------------
+
+void testBuddyAllocator() {
+	constexpr int fine_shift = 16, coarse_shift = 24;
+	constexpr size_t length = size_t(64) << coarse_shift;
+	constexpr uintptr_t base = uintptr_t(1) << 40;
+
+	auto overhead = frigg::BuddyAllocator::computeOverhead(length, fine_shift, coarse_shift);
+	std::vector<char> intern(overhead);
+	frigg::BuddyAllocator buddy;
+	buddy.addChunk(base, length, fine_shift, coarse_shift, intern.data());
+
+	std::vector<std::pair<uintptr_t, size_t>> regions;
+	for(size_t size = size_t(1) << fine_shift; size <= (size_t(1) << coarse_shift);
+			size <<= 1) {
+		for(int k = 0; k < 3; k++) {
+			auto address = buddy.allocate(size);
+			EXPECT(address >= base && address + size <= base + length);
+			EXPECT(!(address % size));
+			regions.push_back({address, size});
+		}
+	}
+
+	for(size_t i = 0; i < regions.size(); i++)
+		for(size_t j = i + 1; j < regions.size(); j++)
+			EXPECT(regions[i].first + regions[i].second <= regions[j].first
+					|| regions[j].first + regions[j].second <= regions[i].first);
+}
+
+// --------------------------------------------------------
+// KernelAlloc
+// --------------------------------------------------------
+
+void testKernelAlloc() {
+	std::vector<std::pair<char *, size_t>> blocks;
+	for(size_t size = 8; size <= 0x40000; size *= 2) {
+		for(int k = 0; k < 16; k++) {
+			auto p = static_cast<char *>(kernelAlloc->allocate(size));
+			EXPECT(p);
+			memset(p, k, size);
+			blocks.push_back({p, size});
+		}
+	}
+
+	for(size_t i = 0; i < blocks.size(); i++) {
+		auto [p, size] = blocks[i];
+		auto k = static_cast<char>(i % 16);
+		EXPECT(p[0] == k && p[size - 1] == k);
+		kernelAlloc->free(p);
+	}
+}
+
+// --------------------------------------------------------
+// Futex
+// --------------------------------------------------------
+
+struct FutexWaiter {
+	FutexWaiter() {
+		worklet.setup([] (Worklet *base) {
+			auto self = frg::container_of(base, &FutexWaiter::worklet);
+			self->woken = true;
+		});
+		node.setup(&worklet);
+	}
+
+	Worklet worklet;
+	FutexNode node;
+	bool woken = false;
+};
+
+void testFutexLocal() {
+	HostedCpu cpu;
+	Futex futex;
+
+	// The worklet is posted immediately if the condition fails.
+	FutexWaiter early;
+	futex.submitWait(0x1000, [] { return false; }, &early.node);
+	cpu.drain();
+	EXPECT(early.woken);
+	EXPECT(futex.empty());
+
+	// Wake only affects waiters on the same address.
+	FutexWaiter a, b, c;
+	futex.submitWait(0x1000, [] { return true; }, &a.node);
+	futex.submitWait(0x1000, [] { return true; }, &b.node);
+	futex.submitWait(0x2000, [] { return true; }, &c.node);
+	cpu.drain();
+	EXPECT(!a.woken && !b.woken && !c.woken);
+
+	futex.wake(0x3000);
+	futex.wake(0x1000);
+	cpu.drain();
+	EXPECT(a.woken && b.woken && !c.woken);
+
+	futex.wake(0x2000);
+	cpu.drain();
+	EXPECT(c.woken);
+	EXPECT(futex.empty());
+}
+
+// Two CPUs wake each other through the futex. This checks that no wakeup is lost
+// between checkSubmitWait() and wake().
+void testFutexPingPong() {
+	constexpr int rounds = 10000;
+	Futex futex;
+	std::atomic<int> turn{0};
+
+	auto player = [&] (int self) {
+		pinToCpu(self);
+		HostedCpu cpu;
+		for(int i = 0; i < rounds; i++) {
+			FutexWaiter waiter;
+			futex.submitWait(0x1000, [&] {
+				return turn.load(std::memory_order_acquire) % 2 != self;
+			}, &waiter.node);
+			while(!waiter.woken)
+				cpu.waitAndDrain();
+			// Wakes from previous rounds can arrive late; wait until it is our turn.
+			while(turn.load(std::memory_order_acquire) % 2 != self)
+				;
+
+			turn.fetch_add(1, std::memory_order_acq_rel);
+			futex.wake(0x1000);
+		}
+	};
+
+	std::thread t0{player, 0};
+	std::thread t1{player, 1};
+	t0.join();
+	t1.join();
+	EXPECT(turn.load() == 2 * rounds);
+	EXPECT(futex.empty());
+}
+
+const host_test::Test tests[] = {
+	{"hashmap", testHashmap},
+	{"buddy-tools", testBuddyTools},
+	{"buddy-allocator", testBuddyAllocator},
+	{"kernel-alloc", testKernelAlloc},
+	{"futex-local", testFutexLocal},
+	{"futex-ping-pong", testFutexPingPong},
+};
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	initializeHosted();
+	return host_test::runTests(tests, argc, argv);
+}
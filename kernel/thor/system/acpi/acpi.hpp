@@ -17,6 +17,8 @@ namespace thor {
 namespace acpi {
 
 void initializeBasicSystem();
+// Parses the SRAT and SLIT to determine the NUMA topology, see numa.hpp.
+void initializeNuma();
 void initializeExtendedSystem();
 
 } } // namespace thor::acpi
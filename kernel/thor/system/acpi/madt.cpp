@@ -151,6 +151,7 @@ void bootOtherProcessors() {
 
 	frigg::infoLogger() << "thor: Booting APs." << frigg::endLog;
 
+	frigg::Vector<unsigned int, KernelAlloc> apic_ids{*kernelAlloc};
 	size_t offset = sizeof(acpi_header_t) + sizeof(MadtHeader);
 	while(offset < madt->length) {
 		auto generic = (MadtGenericEntry *)((uint8_t *)madt + offset);
@@ -159,10 +160,12 @@ void bootOtherProcessors() {
 			// TODO: Support BSPs with APIC ID != 0.
 			if((entry->flags & local_flags::enabled)
 					&& entry->localApicId) // We ignore the BSP here.
-				bootSecondary(entry->localApicId);
+				apic_ids.push(entry->localApicId);
 		}
 		offset += generic->length;
 	}
+
+	bootSecondaries(apic_ids.data(), apic_ids.size());
 }
 
 // --------------------------------------------------------
@@ -250,6 +253,7 @@ void initializeBasicSystem() {
 	lai_create_namespace();
 
 	dumpMadt();
+	initializeNuma();
 
 	void *madtWindow = laihost_scan("APIC", 0);
 	assert(madtWindow);
@@ -0,0 +1,140 @@
+#include <frigg/debug.hpp>
+#include "../../generic/kernel.hpp"
+#include "../../generic/numa.hpp"
+#include "acpi.hpp"
+
+#include <lai/core.h>
+
+namespace thor {
+namespace acpi {
+
+namespace {
+	constexpr bool logSrat = false;
+}
+
+struct SratHeader {
+	uint32_t reserved0;
+	uint64_t reserved1;
+} __attribute__ (( packed ));
+
+struct SratGenericEntry {
+	uint8_t type;
+	uint8_t length;
+};
+
+struct SratApicEntry {
+	SratGenericEntry generic;
+	uint8_t domainLow;
+	uint8_t apicId;
+	uint32_t flags;
+	uint8_t sapicEid;
+	uint8_t domainHigh[3];
+	uint32_t clockDomain;
+} __attribute__ (( packed ));
+
+struct SratMemoryEntry {
+	SratGenericEntry generic;
+	uint32_t domain;
+	uint16_t reserved0;
+	uint64_t base;
+	uint64_t length;
+	uint32_t reserved1;
+	uint32_t flags;
+	uint64_t reserved2;
+} __attribute__ (( packed ));
+
+struct SratX2ApicEntry {
+	SratGenericEntry generic;
+	uint16_t reserved0;
+	uint32_t domain;
+	uint32_t x2apicId;
+	uint32_t flags;
+	uint32_t clockDomain;
+	uint32_t reserved1;
+} __attribute__ (( packed ));
+
+namespace srat_flags {
+	static constexpr uint32_t enabled = 1;
+};
+
+void initializeNuma() {
+	void *srat_window = laihost_scan("SRAT", 0);
+	if(!srat_window) {
+		frigg::infoLogger() << "thor: No SRAT present, assuming a single NUMA node"
+				<< frigg::endLog;
+		finalizeNumaTopology();
+		return;
+	}
+	auto srat = reinterpret_cast<acpi_header_t *>(srat_window);
+
+	size_t offset = sizeof(acpi_header_t) + sizeof(SratHeader);
+	while(offset + sizeof(SratGenericEntry) <= srat->length) {
+		auto generic = (SratGenericEntry *)((uint8_t *)srat_window + offset);
+		if(!generic->length)
+			break;
+
+		if(generic->type == 0) { // Local APIC affinity.
+			auto entry = (SratApicEntry *)generic;
+			if(entry->flags & srat_flags::enabled) {
+				uint32_t domain = entry->domainLow | (entry->domainHigh[0] << 8)
+						| (entry->domainHigh[1] << 16) | (entry->domainHigh[2] << 24);
+				auto node = numaNodeOfDomain(domain);
+				if(logSrat)
+					frigg::infoLogger() << "    SRAT: APIC " << (int)entry->apicId
+							<< " in domain " << domain << frigg::endLog;
+				numaAddCpu(node, entry->apicId);
+			}
+		}else if(generic->type == 1) { // Memory affinity.
+			auto entry = (SratMemoryEntry *)generic;
+			if(entry->flags & srat_flags::enabled) {
+				auto node = numaNodeOfDomain(entry->domain);
+				if(logSrat)
+					frigg::infoLogger() << "    SRAT: Memory at 0x" << frigg::logHex(entry->base)
+							<< ", length: 0x" << frigg::logHex(entry->length)
+							<< " in domain " << entry->domain << frigg::endLog;
+				numaAddMemory(node, entry->base, entry->length);
+			}
+		}else if(generic->type == 2) { // Local x2APIC affinity.
+			auto entry = (SratX2ApicEntry *)generic;
+			if(entry->flags & srat_flags::enabled) {
+				auto node = numaNodeOfDomain(entry->domain);
+				if(logSrat)
+					frigg::infoLogger() << "    SRAT: x2APIC " << entry->x2apicId
+							<< " in domain " << entry->domain << frigg::endLog;
+				numaAddCpu(node, entry->x2apicId);
+			}
+		}
+		offset += generic->length;
+	}
+
+	// The SLIT is indexed by proximity domain. Domains that do not appear in
+	// the SRAT are skipped; the domains that we know are translated to nodes.
+	void *slit_window = laihost_scan("SLIT", 0);
+	if(slit_window) {
+		auto slit = reinterpret_cast<acpi_header_t *>(slit_window);
+		auto count = *reinterpret_cast<uint64_t *>((uint8_t *)slit_window
+				+ sizeof(acpi_header_t));
+		auto matrix = (uint8_t *)slit_window + sizeof(acpi_header_t) + sizeof(uint64_t);
+		assert(sizeof(acpi_header_t) + sizeof(uint64_t) + count * count <= slit->length);
+
+		for(int i = 0; i < numNumaNodes(); i++) {
+			for(int j = 0; j < numNumaNodes(); j++) {
+				// Default to the value that ACPI suggests for remote nodes.
+				numaSetDistance(i, j, i == j ? numaLocalDistance : 2 * numaLocalDistance);
+			}
+		}
+		for(uint64_t d = 0; d < count; d++) {
+			for(uint64_t e = 0; e < count; e++) {
+				auto from = numaNodeOfKnownDomain(d);
+				auto to = numaNodeOfKnownDomain(e);
+				if(from < 0 || to < 0)
+					continue;
+				numaSetDistance(from, to, matrix[d * count + e]);
+			}
+		}
+	}
+
+	finalizeNumaTopology();
+}
+
+} } // namespace thor::acpi
@@ -7,10 +7,18 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <iostream>
+#include <string>
 
 int main() {
+	// The benchmark runner reports this as the boot time (see benchmarks/system).
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	auto init_nanos = std::to_string(now.tv_sec * 1'000'000'000ull + now.tv_nsec);
+	setenv("MANAGARM_INIT_NANOS", init_nanos.c_str(), 1);
+
 	int fd = open("/dev/helout", O_WRONLY);
 	dup2(fd, STDOUT_FILENO);
 	dup2(fd, STDERR_FILENO);
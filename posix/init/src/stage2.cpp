@@ -138,6 +138,8 @@ int main() {
 		}else if(launch == "weston") {
 			execl("/usr/bin/weston", "weston", nullptr);
 			//execl("/usr/bin/weston", "weston", "--use-pixman", nullptr);
+		}else if(launch == "bench") {
+			execl("/usr/bin/bench-runner", "bench-runner", nullptr);
 		}else{
 			std::cout << "init: init does not know how to launch " << launch << std::endl;
 		}
@@ -1,5 +1,6 @@
 
 #include <async/jump.hpp>
+#include <helix/clock.hpp>
 #include <helix/memory.hpp>
 #include <protocols/clock/defs.hpp>
 #include <protocols/mbus/client.hpp>
@@ -76,21 +77,26 @@ async::result<void> enumerateTracker() {
 struct timespec getRealtime() {
 	auto page = reinterpret_cast<TrackerPage *>(trackerPageMapping.get());
 
-	// Start the seqlock read.
-	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
-	assert(!(seqlock & 1));
-
-	// Perform the actual loads.
-	auto ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
-	auto base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
-
-	// Finish the seqlock read.
-	__atomic_thread_fence(__ATOMIC_ACQUIRE);
-	assert(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock);
-
-	// Calculate the current time.
-	uint64_t now;
-	HEL_CHECK(helGetClock(&now));
+	int64_t ref;
+	int64_t base;
+	while(true) {
+		// Start the seqlock read.
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue;
+
+		// Perform the actual loads.
+		ref = __atomic_load_n(&page->refClock, __ATOMIC_RELAXED);
+		base = __atomic_load_n(&page->baseRealtime, __ATOMIC_RELAXED);
+
+		// Finish the seqlock read.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) == seqlock)
+			break;
+	}
+
+	// Calculate the current time. This does not enter the kernel if the TSC is stable.
+	uint64_t now = helix::currentClock();
 
 	int64_t realtime = base + (now - ref);
 
@@ -86,7 +86,8 @@ expected<ImageInfo> load(SharedFilePtr file,
 			}else{
 				// map the segment with write permission into this address space.
 				HelHandle segment_memory;
-				HEL_CHECK(helAllocateMemory(map_length, 0, &segment_memory));
+				HEL_CHECK(helAllocateMemory(map_length,
+						kHelAllocSwappable | kHelAllocMergeable, &segment_memory));
 
 				void *window;
 				HEL_CHECK(helMapMemory(segment_memory, kHelNullHandle, nullptr,
@@ -160,7 +161,8 @@ expected<helix::UniqueDescriptor> execute(ViewPath root, ViewPath workdir,
 
 	// allocate memory for the stack and map it into the remote space.
 	HelHandle stack_memory;
-	HEL_CHECK(helAllocateMemory(stack_size, kHelAllocOnDemand, &stack_memory));
+	HEL_CHECK(helAllocateMemory(stack_size, kHelAllocOnDemand | kHelAllocSwappable,
+			&stack_memory));
 
 	void *stack_base;
 	HEL_CHECK(helMapMemory(stack_memory, vm_context->getSpace().getHandle(),
@@ -239,7 +241,8 @@ expected<helix::UniqueDescriptor> execute(ViewPath root, ViewPath workdir,
 	HelHandle thread;
 	HEL_CHECK(helCreateThread(universe.getHandle(),
 			vm_context->getSpace().getHandle(), kHelAbiSystemV,
-			(void *)interp_info.entryIp, (char *)stack_base + d, 0, &thread));
+			(void *)interp_info.entryIp, (char *)stack_base + d,
+			kHelThreadNoRealtime | kHelThreadUnprivileged, &thread));
 
 	co_return helix::UniqueDescriptor{thread};
 }
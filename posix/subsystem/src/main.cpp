@@ -12,6 +12,7 @@
 #include <sys/wait.h>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include <async/jump.hpp>
 #include <cofiber.hpp>
@@ -523,11 +524,16 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			void *address;
 			if(req.flags() & MAP_ANONYMOUS) {
+				if(req.flags() & MAP_POPULATE)
+					native_flags |= kHelMapPopulate;
+
 				assert(req.fd() == -1);
 				assert(!req.rel_offset());
 
 				HelHandle memory;
-				HEL_CHECK(helAllocateMemory(req.size(), 0, &memory));
+				HEL_CHECK(helAllocateMemory(req.size(),
+						kHelAllocSwappable | kHelAllocMergeable | kHelAllocAnonymous,
+						&memory));
 
 				// Perform the actual mapping.
 				HEL_CHECK(helMapMemory(memory, self->vmContext()->getSpace().getHandle(),
@@ -538,6 +544,13 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				assert(file && "Illegal FD for VM_MAP");
 				address = co_await self->vmContext()->mapFile(std::move(file),
 						req.rel_offset(), req.size(), native_flags);
+
+				// Populating file mappings could block on the file system, which might
+				// be served by this thread. Start to read the file instead.
+				if(req.flags() & MAP_POPULATE)
+					HEL_CHECK(helAdviseMemory(self->vmContext()->getSpace().getHandle(),
+							address, (req.size() + 0xFFF) & ~size_t(0xFFF),
+							kHelAdviseWillNeed));
 			}
 
 			managarm::posix::SvrResponse resp;
@@ -579,6 +592,42 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			managarm::posix::SvrResponse resp;
 			resp.set_error(managarm::posix::Errors::SUCCESS);
 
+			auto ser = resp.SerializeAsString();
+			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+					helix::action(&send_resp, ser.data(), ser.size()));
+			co_await transmit.async_wait();
+			HEL_CHECK(send_resp.error());
+		}else if(req.request_type() == managarm::posix::CntReqType::VM_ADVISE) {
+			if(logRequests)
+				std::cout << "posix: VM_ADVISE address: " << (void *)req.address()
+						<< ", size: " << (void *)(size_t)req.size()
+						<< ", advice: " << req.flags() << std::endl;
+
+			helix::SendBuffer send_resp;
+
+			uint32_t advice = 0;
+			switch(req.flags()) {
+			case MADV_NORMAL: advice = kHelAdviseNormal; break;
+			case MADV_RANDOM: advice = kHelAdviseRandom; break;
+			case MADV_SEQUENTIAL: advice = kHelAdviseSequential; break;
+			case MADV_WILLNEED: advice = kHelAdviseWillNeed; break;
+			case MADV_DONTNEED: advice = kHelAdviseDontNeed; break;
+			}
+
+			managarm::posix::SvrResponse resp;
+			if(!advice) {
+				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			}else{
+				auto error = helAdviseMemory(self->vmContext()->getSpace().getHandle(),
+						reinterpret_cast<void *>(req.address()), req.size(), advice);
+				if(error == kHelErrIllegalArgs || error == kHelErrFault) {
+					resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				}else{
+					HEL_CHECK(error);
+					resp.set_error(managarm::posix::Errors::SUCCESS);
+				}
+			}
+
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size()));
@@ -2054,6 +2103,189 @@ struct CmdlineNode final : public procfs::RegularNode {
 	}
 };
 
+// Binary layout of the records returned by GET_LOCK_STATS.
+// Keep this in sync with thor's LockStatRecord.
+struct LockStatRecord {
+	char name[16];
+	uint64_t acquisitions;
+	uint64_t contended;
+	uint64_t spinTotal;
+	uint64_t spinMax;
+	uint64_t holdTotal;
+	uint64_t holdMax;
+};
+static_assert(sizeof(LockStatRecord) == 64, "Bad sizeof(LockStatRecord)");
+
+struct LockstatNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		helix::Offer offer;
+		helix::SendBuffer send_req;
+		helix::RecvInline recv_resp;
+		helix::RecvInline recv_records;
+
+		managarm::kerncfg::CntRequest req;
+		req.set_req_type(managarm::kerncfg::CntReqType::GET_LOCK_STATS);
+
+		auto ser = req.SerializeAsString();
+		auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+				helix::action(&offer, kHelItemAncillary),
+				helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+				helix::action(&recv_resp, kHelItemChain),
+				helix::action(&recv_records));
+		co_await transmit.async_wait();
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+		HEL_CHECK(recv_records.error());
+
+		managarm::kerncfg::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+		if(!resp.lock_stats_enabled())
+			co_return "lock statistics are disabled in this kernel\n";
+
+		// All times are in TSC cycles.
+		std::stringstream stream;
+		stream << "class acquisitions contended spin-total spin-max hold-total hold-max\n";
+		auto records = reinterpret_cast<const LockStatRecord *>(recv_records.data());
+		for(size_t i = 0; i < recv_records.length() / sizeof(LockStatRecord); i++) {
+			auto &record = records[i];
+			stream << std::string{record.name, strnlen(record.name, sizeof(record.name))}
+					<< ' ' << record.acquisitions << ' ' << record.contended
+					<< ' ' << record.spinTotal << ' ' << record.spinMax
+					<< ' ' << record.holdTotal << ' ' << record.holdMax << '\n';
+		}
+		co_return stream.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/lockstat");
+	}
+};
+
+// Snapshot of the kernel log, similar to dmesg.
+// Unlike Linux' /proc/kmsg, reading this file neither blocks nor consumes messages.
+struct KmsgNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		std::string log;
+		uint64_t sequence = 0;
+		while(true) {
+			helix::Offer offer;
+			helix::SendBuffer send_req;
+			helix::RecvInline recv_resp;
+			helix::RecvBuffer recv_log;
+
+			managarm::kerncfg::CntRequest req;
+			req.set_req_type(managarm::kerncfg::CntReqType::GET_LOG);
+			req.set_sequence(sequence);
+
+			std::vector<char> buffer(4096);
+			auto ser = req.SerializeAsString();
+			auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+					helix::action(&offer, kHelItemAncillary),
+					helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+					helix::action(&recv_resp, kHelItemChain),
+					helix::action(&recv_log, buffer.data(), buffer.size()));
+			co_await transmit.async_wait();
+			HEL_CHECK(offer.error());
+			HEL_CHECK(send_req.error());
+			HEL_CHECK(recv_resp.error());
+			HEL_CHECK(recv_log.error());
+
+			managarm::kerncfg::SvrResponse resp;
+			resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+			assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+
+			// The first request starts at the oldest message that the kernel still retains.
+			if(sequence && resp.first_sequence() > sequence)
+				log += "[" + std::to_string(resp.first_sequence() - sequence)
+						+ " messages dropped]\n";
+			log.append(buffer.data(), recv_log.actualLength());
+
+			if(resp.next_sequence() == resp.first_sequence())
+				break;
+			sequence = resp.next_sequence();
+		}
+		co_return log;
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/kmsg");
+	}
+};
+
+// Per-CPU scheduling statistics; one line per CPU.
+struct CpuSchedstatNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		std::stringstream stream;
+		for(int cpu = 0; ; cpu++) {
+			HelCpuStats stats;
+			auto error = helQueryCpuStats(cpu, &stats);
+			if(error == kHelErrIllegalArgs)
+				break;
+			HEL_CHECK(error);
+
+			stream << "cpu" << cpu << ' ' << stats.waitTime
+					<< ' ' << stats.numVoluntarySwitches
+					<< ' ' << stats.numInvoluntarySwitches
+					<< ' ' << stats.numMigrations;
+			stream << " wakeup_latency:";
+			for(int i = 0; i < kHelNumLatencyBuckets; i++)
+				stream << ' ' << stats.wakeupLatency[i];
+			stream << " runqueue_wait:";
+			for(int i = 0; i < kHelNumLatencyBuckets; i++)
+				stream << ' ' << stats.runQueueWait[i];
+			stream << '\n';
+		}
+		co_return stream.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/schedstat");
+	}
+};
+
+// Statistics of the kernel's compressed memory pool.
+struct ZramstatNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		HelCompressedPoolStats stats;
+		HEL_CHECK(helQueryCompressedPoolStats(&stats));
+
+		std::stringstream stream;
+		stream << "stored_pages " << stats.storedPages << '\n'
+				<< "compressed_bytes " << stats.compressedBytes << '\n'
+				<< "pool_pages " << stats.poolPages << '\n'
+				<< "stores " << stats.numStores << '\n'
+				<< "hits " << stats.numHits << '\n'
+				<< "rejects " << stats.numRejects << '\n';
+		co_return stream.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/zramstat");
+	}
+};
+
+// Statistics of the kernel's merging of identical anonymous pages.
+struct KsmstatNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		HelPageMergeStats stats;
+		HEL_CHECK(helQueryPageMergeStats(&stats));
+
+		std::stringstream stream;
+		stream << "pages_shared " << stats.sharedPages << '\n'
+				<< "pages_sharing " << stats.sharingPages << '\n'
+				<< "pages_scanned " << stats.numScanned << '\n'
+				<< "merges " << stats.numMerged << '\n'
+				<< "cow_breaks " << stats.numBroken << '\n';
+		co_return stream.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/ksmstat");
+	}
+};
+
 async::result<void> enumerateKerncfg() {
 	auto root = co_await mbus::Instance::global().getRoot();
 
@@ -2074,6 +2306,11 @@ async::result<void> enumerateKerncfg() {
 
 	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
 	procfs_root->directMkregular("cmdline", std::make_shared<CmdlineNode>());
+	procfs_root->directMkregular("lockstat", std::make_shared<LockstatNode>());
+	procfs_root->directMkregular("schedstat", std::make_shared<CpuSchedstatNode>());
+	procfs_root->directMkregular("zramstat", std::make_shared<ZramstatNode>());
+	procfs_root->directMkregular("ksmstat", std::make_shared<KsmstatNode>());
+	procfs_root->directMkregular("kmsg", std::make_shared<KmsgNode>());
 }
 
 // --------------------------------------------------------
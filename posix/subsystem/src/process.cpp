@@ -2,12 +2,14 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/auxv.h>
+#include <sstream>
 
 #include <cofiber.hpp>
 #include "common.hpp"
 #include "clock.hpp"
 #include "exec.hpp"
 #include "process.hpp"
+#include "procfs.hpp"
 
 static bool logFileAttach = false;
 static bool logCleanup = false;
@@ -544,6 +546,69 @@ Generation::~Generation() {
 // Process.
 // ----------------------------------------------------------------------------
 
+namespace {
+
+std::string formatLatencyHistogram(const uint64_t *buckets) {
+	std::stringstream stream;
+	for(int i = 0; i < kHelNumLatencyBuckets; i++) {
+		if(i)
+			stream << ' ';
+		stream << buckets[i];
+	}
+	return stream.str();
+}
+
+// The first line matches the format of Linux: run time, wait time, number of time slices.
+// The following lines contain the switch statistics and the latency histograms.
+struct SchedstatNode final : public procfs::RegularNode {
+	SchedstatNode(std::weak_ptr<Process> process)
+	: _process{std::move(process)} { }
+
+	async::result<std::string> show() override {
+		HelThreadStats stats;
+		memset(&stats, 0, sizeof(HelThreadStats));
+
+		auto process = _process.lock();
+		if(process) {
+			auto generation = process->currentGeneration();
+			if(generation)
+				HEL_CHECK(helQueryThreadStats(generation->threadDescriptor.getHandle(),
+						&stats));
+		}
+
+		std::stringstream stream;
+		stream << stats.userTime << ' ' << stats.waitTime << ' '
+				<< (stats.numVoluntarySwitches + stats.numInvoluntarySwitches) << '\n';
+		stream << "voluntary_switches: " << stats.numVoluntarySwitches << '\n';
+		stream << "involuntary_switches: " << stats.numInvoluntarySwitches << '\n';
+		stream << "migrations: " << stats.numMigrations << '\n';
+		stream << "wakeup_latency: " << formatLatencyHistogram(stats.wakeupLatency) << '\n';
+		stream << "runqueue_wait: " << formatLatencyHistogram(stats.runQueueWait) << '\n';
+		co_return stream.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/<pid>/schedstat");
+	}
+
+private:
+	std::weak_ptr<Process> _process;
+};
+
+void createProcfsDirectory(std::shared_ptr<Process> process) {
+	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
+	auto link = procfs_root->directMkdir(std::to_string(process->pid()));
+	auto dir = std::static_pointer_cast<procfs::DirectoryNode>(link->getTarget());
+	dir->directMkregular("schedstat", std::make_shared<SchedstatNode>(process));
+}
+
+void removeProcfsDirectory(Process *process) {
+	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
+	procfs_root->directUnlink(std::to_string(process->pid()));
+}
+
+} // anonymous namespace
+
 // PID 1 is reserved for the init process, therefore we start at 2.
 ProcessId nextPid = 2;
 std::map<ProcessId, Process *> globalPidMap;
@@ -591,6 +656,7 @@ async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 	assert(globalPidMap.find(1) == globalPidMap.end());
 	process->_pid = 1;
 	globalPidMap.insert({1, process.get()});
+	createProcfsDirectory(process);
 
 	// TODO: Do not pass an empty argument vector?
 	auto thread_or_error = co_await execute(process->_fsContext->getRoot(),
@@ -643,12 +709,14 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 	process->_pid = pid;
 	original->_children.push_back(process);
 	globalPidMap.insert({pid, process.get()});
+	createProcfsDirectory(process);
 
 	auto generation = std::make_shared<Generation>();
 	HelHandle new_thread;
 	HEL_CHECK(helCreateThread(process->fileContext()->getUniverse().getHandle(),
 			process->vmContext()->getSpace().getHandle(), kHelAbiSystemV,
-			0, 0, kHelThreadStopped, &new_thread));
+			0, 0, kHelThreadStopped | kHelThreadNoRealtime | kHelThreadUnprivileged,
+			&new_thread));
 	generation->threadDescriptor = helix::UniqueDescriptor{new_thread};
 	generation->posixLane = std::move(server_lane);
 
@@ -717,6 +785,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 
 void Process::retire(Process *process) {
 	assert(process->_parent);
+	removeProcfsDirectory(process);
 	process->_parent->_childrenUsage.userTime += process->_generationUsage.userTime;
 }
 
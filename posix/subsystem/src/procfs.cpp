@@ -92,19 +92,18 @@ void DirectoryFile::serve(smarter::shared_ptr<DirectoryFile> file) {
 
 DirectoryFile::DirectoryFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link)
 : File{StructName::get("procfs.dir"), std::move(mount), std::move(link)},
-		_node{static_cast<DirectoryNode *>(associatedLink()->getTarget().get())},
-		_iter{_node->_entries.begin()} { }
+		_node{static_cast<DirectoryNode *>(associatedLink()->getTarget().get())} { }
 
 void DirectoryFile::handleClose() {
 	_cancelServe.cancel();
 }
 
-// TODO: This iteration mechanism only works as long as _iter is not concurrently deleted.
 async::result<ReadEntriesResult> DirectoryFile::readEntries() {
-	if(_iter != _node->_entries.end()) {
-		auto name = (*_iter)->getName();
-		_iter++;
-		co_return name;
+	// Entries are sorted by name, so we can resume after the last name that we returned.
+	auto it = _lastName ? _node->_entries.upper_bound(*_lastName) : _node->_entries.begin();
+	if(it != _node->_entries.end()) {
+		_lastName = (*it)->getName();
+		co_return _lastName;
 	}else{
 		co_return std::nullopt;
 	}
@@ -215,6 +214,12 @@ std::shared_ptr<Link> DirectoryNode::directMkdir(std::string name) {
 	return link;
 }
 
+void DirectoryNode::directUnlink(std::string name) {
+	auto it = _entries.find(name);
+	assert(it != _entries.end());
+	_entries.erase(it);
+}
+
 VfsType DirectoryNode::getType() {
 	return VfsType::directory;
 }
@@ -64,7 +64,9 @@ private:
 	helix::UniqueLane _passthrough;
 	async::cancellation_event _cancelServe;
 
-	std::set<std::shared_ptr<Link>, LinkCompare>::iterator _iter;
+	// Name of the last entry that readEntries() returned.
+	// We do not store an iterator as entries can be unlinked while the file is open.
+	std::optional<std::string> _lastName;
 };
 
 struct Link final : FsLink, std::enable_shared_from_this<Link> {
@@ -110,6 +112,7 @@ struct DirectoryNode final : FsNode, std::enable_shared_from_this<DirectoryNode>
 	std::shared_ptr<Link> directMkregular(std::string name,
 			std::shared_ptr<RegularNode> regular);
 	std::shared_ptr<Link> directMkdir(std::string name);
+	void directUnlink(std::string name);
 
 	VfsType getType() override;
 	FutureMaybe<FileStats> getStats() override;
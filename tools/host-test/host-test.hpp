@@ -0,0 +1,49 @@
+#ifndef HOST_TEST_HPP
+#define HOST_TEST_HPP
+
+// Scaffolding for unit tests that run on the host (kernel/thor/hosted, hel/tests).
+// Each test is a function that aborts on failure; runTests() runs all of them
+// (or only the test that is named on the command line).
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPECT(cond) \
+	do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: Expectation '%s' failed\n", __FILE__, __LINE__, #cond); \
+			abort(); \
+		} \
+	} while(0)
+
+namespace host_test {
+
+struct Test {
+	const char *name;
+	void (*run)();
+};
+
+// Returns the exit status of the test program.
+template<size_t N>
+int runTests(const Test (&tests)[N], int argc, char **argv) {
+	int ran = 0;
+	for(auto &test : tests) {
+		if(argc > 1 && strcmp(argv[1], test.name))
+			continue;
+		test.run();
+		printf("%s: OK\n", test.name);
+		ran++;
+	}
+
+	if(!ran) {
+		fprintf(stderr, "No such test: %s\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
+
+} // namespace host_test
+
+#endif // HOST_TEST_HPP
@@ -0,0 +1,87 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+// Each sample in the output file is prefixed by this header.
+// Keep this in sync with tools/thor-profile/thor-profile.
+struct SampleHeader {
+	uint32_t cpu;
+	uint32_t reserved;
+};
+
+static void writeAll(int fd, const void *buffer, size_t size) {
+	size_t progress = 0;
+	while(progress < size) {
+		auto chunk = write(fd, reinterpret_cast<const char *>(buffer) + progress,
+				size - progress);
+		if(chunk < 0)
+			throw std::runtime_error("Error while writing profile");
+		progress += chunk;
+	}
+}
+
+// Drains the sample buffers of all CPUs into fd. Returns the number of samples.
+static size_t drainSamples(int fd) {
+	std::vector<HelProfileSample> samples(256);
+	size_t total = 0;
+	for(unsigned int cpu = 0; ; cpu++) {
+		while(true) {
+			size_t n;
+			auto error = helReadProfile(cpu, samples.data(), samples.size(), &n);
+			if(error == kHelErrIllegalArgs)
+				return total;
+			HEL_CHECK(error);
+
+			for(size_t i = 0; i < n; i++) {
+				SampleHeader header{cpu, 0};
+				writeAll(fd, &header, sizeof(SampleHeader));
+				writeAll(fd, &samples[i], sizeof(HelProfileSample));
+			}
+			total += n;
+			if(n < samples.size())
+				break;
+		}
+	}
+}
+
+int main(int argc, const char **argv) {
+	if(argc != 5 || strcmp(argv[1], "record")) {
+		std::cout << "Usage: kprof record <interval-us> <seconds> <output>" << std::endl;
+		return 1;
+	}
+
+	uint64_t interval = strtoull(argv[2], nullptr, 10) * 1000;
+	unsigned int seconds = strtoul(argv[3], nullptr, 10);
+
+	auto fd = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		throw std::runtime_error("Could not open output file");
+
+	if(auto error = helStartProfiling(interval); error == kHelErrIllegalArgs) {
+		std::cout << "kprof: Invalid interval or not allowed to profile" << std::endl;
+		return 1;
+	}else{
+		HEL_CHECK(error);
+	}
+
+	// Drain regularly so that the per-CPU rings do not overflow.
+	size_t total = 0;
+	for(unsigned int i = 0; i < seconds * 10; i++) {
+		usleep(100'000);
+		total += drainSamples(fd);
+	}
+
+	HEL_CHECK(helStopProfiling());
+	total += drainSamples(fd);
+
+	close(fd);
+	std::cout << "kprof: Recorded " << total << " samples to " << argv[4] << std::endl;
+	return 0;
+}
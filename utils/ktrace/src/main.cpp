@@ -0,0 +1,151 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+#include <async/jump.hpp>
+#include <helix/memory.hpp>
+#include <protocols/mbus/client.hpp>
+#include <kerncfg.pb.h>
+
+// ----------------------------------------------------------------------------
+// kerncfg handling.
+// ----------------------------------------------------------------------------
+
+helix::UniqueLane kerncfgLane;
+async::jump foundKerncfg;
+
+async::result<void> enumerateKerncfg() {
+	auto root = co_await mbus::Instance::global().getRoot();
+
+	auto filter = mbus::Conjunction({
+		mbus::EqualsFilter("class", "kerncfg")
+	});
+
+	auto handler = mbus::ObserverHandler{}
+	.withAttach([] (mbus::Entity entity, mbus::Properties properties) -> async::detached {
+		kerncfgLane = helix::UniqueLane(co_await entity.bind());
+		foundKerncfg.trigger();
+	});
+
+	co_await root.linkObserver(std::move(filter), std::move(handler));
+	co_await foundKerncfg.async_wait();
+}
+
+async::result<void> setTracing(bool enable) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+
+	managarm::kerncfg::CntRequest req;
+	req.set_req_type(managarm::kerncfg::CntReqType::SET_TRACING);
+	req.set_enable(enable);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::kerncfg::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+}
+
+// Appends a snapshot of the trace buffer of the given CPU to fd.
+// Returns the total number of CPUs.
+async::result<size_t> dumpTraceBuffer(int fd, size_t cpu) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+	helix::PullDescriptor pull_memory;
+
+	// Only called for valid CPU numbers, hence the kernel always pushes the memory.
+	managarm::kerncfg::CntRequest req;
+	req.set_req_type(managarm::kerncfg::CntReqType::GET_TRACE_BUFFER);
+	req.set_cpu(cpu);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp, kHelItemChain),
+			helix::action(&pull_memory));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(pull_memory.error());
+
+	managarm::kerncfg::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+
+	// Copy the buffer first so that the file contains a consistent-enough snapshot.
+	// The decoder discards records that were overwritten while we copied.
+	helix::Mapping mapping{pull_memory.descriptor(), 0, resp.size(), kHelMapProtRead};
+	std::vector<char> snapshot(resp.size());
+	memcpy(snapshot.data(), mapping.get(), resp.size());
+
+	size_t progress = 0;
+	while(progress < snapshot.size()) {
+		auto chunk = write(fd, snapshot.data() + progress, snapshot.size() - progress);
+		if(chunk < 0)
+			throw std::runtime_error("Error while writing trace file");
+		progress += chunk;
+	}
+
+	co_return resp.num_cpus();
+}
+
+// ----------------------------------------------------------------
+// Freestanding mbus functions.
+// ----------------------------------------------------------------
+
+async::detached asyncMain(const char **args) {
+	co_await enumerateKerncfg();
+
+	if(!args[1])
+		throw std::runtime_error("Expected a command");
+
+	if(!strcmp(args[1], "enable")) {
+		co_await setTracing(true);
+		exit(0);
+	}else if(!strcmp(args[1], "disable")) {
+		co_await setTracing(false);
+		exit(0);
+	}else if(!strcmp(args[1], "dump")) {
+		if(!args[2])
+			throw std::runtime_error("Expected at least one argument");
+
+		auto fd = open(args[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0)
+			throw std::runtime_error("Could not open trace file");
+
+		size_t num_cpus = 1;
+		for(size_t cpu = 0; cpu < num_cpus; cpu++)
+			num_cpus = co_await dumpTraceBuffer(fd, cpu);
+
+		close(fd);
+		std::cout << "ktrace: Dumped trace buffers of " << num_cpus
+				<< " CPUs to " << args[2] << std::endl;
+		exit(0);
+	}else{
+		throw std::runtime_error("Unexpected command for ktrace utility");
+	}
+}
+
+int main(int argc, const char **argv) {
+	{
+		async::queue_scope scope{helix::globalQueue()};
+		asyncMain(argv);
+	}
+
+	helix::globalQueue()->run();
+
+	return 0;
+}